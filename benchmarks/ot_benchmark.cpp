@@ -0,0 +1,546 @@
+/*
+ *  Copyright (c) 2000-2022 Inria
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *  this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *  * Neither the name of the ALICE Project-Team nor the names of its
+ *  contributors may be used to endorse or promote products derived from this
+ *  software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  Contact: Bruno Levy
+ *
+ *     https://www.inria.fr/fr/bruno-levy
+ *
+ *     Inria,
+ *     Domaine de Voluceau,
+ *     78150 Le Chesnay - Rocquencourt
+ *     FRANCE
+ *
+ */
+
+/*
+ * Benchmark of the integration kernels of semi-discrete optimal transport
+ * in 3d. The restricted Laguerre diagram of a point sampling of a
+ * tetrahedral mesh is traversed with each specialization of the kernel
+ * of OptimalTransportMap3d, and with an empty callback (the cost of the
+ * traversal itself). The volumes and areas of the cells are also
+ * computed by walking the dual ConvexCell (as done before
+ * ConvexCellBatch), and by ConvexCellBatch with its scalar and SIMD
+ * kernels.
+ *
+ * Usage: exploragram_benchmark mesh.meshb [nb_pts=...] [nb_runs=...]
+ */
+
+#include <exploragram/optimal_transport/optimal_transport_3d.h>
+#include <exploragram/optimal_transport/telemetry.h>
+#include <exploragram/optimal_transport/convex_cell_batch.h>
+#include <exploragram/optimal_transport/sampling.h>
+#include <geogram/mesh/mesh.h>
+#include <geogram/mesh/mesh_io.h>
+#include <geogram/voronoi/CVT.h>
+#include <geogram/voronoi/RVD.h>
+#include <geogram/voronoi/RVD_callback.h>
+#include <geogram/voronoi/generic_RVD_cell.h>
+#include <geogram/basic/geometry.h>
+#include <geogram/basic/geometry_nd.h>
+#include <geogram/basic/command_line.h>
+#include <geogram/basic/command_line_args.h>
+#include <geogram/basic/process.h>
+#include <geogram/basic/logger.h>
+
+#include <iomanip>
+#include <cmath>
+#include <sstream>
+
+namespace {
+    using namespace GEO;
+
+    /**
+     * \brief A callback that does nothing, used to measure the cost of
+     *  the traversal of the restricted Laguerre diagram.
+     */
+    class EmptyPolyhedronCallback : public RVDPolyhedronCallback {
+    public:
+        /**
+         * \copydoc RVDPolyhedronCallback::operator()
+         */
+        void operator() (
+            index_t v, index_t t, const GEOGen::ConvexCell& C
+        ) const override {
+            geo_argused(v);
+            geo_argused(t);
+            geo_argused(C);
+        }
+    };
+
+    /**
+     * \brief A callback that counts the polyhedra.
+     * \details Not thread-safe, used in sequential mode.
+     */
+    class CountPolyhedronCallback : public RVDPolyhedronCallback {
+    public:
+        /**
+         * \brief CountPolyhedronCallback constructor.
+         */
+        CountPolyhedronCallback() : nb_(0) {
+        }
+
+        /**
+         * \copydoc RVDPolyhedronCallback::operator()
+         */
+        void operator() (
+            index_t v, index_t t, const GEOGen::ConvexCell& C
+        ) const override {
+            geo_argused(v);
+            geo_argused(t);
+            geo_argused(C);
+            ++nb_;
+        }
+
+        /**
+         * \brief Gets the number of polyhedra.
+         * \return the number of times the callback was called
+         */
+        index_t nb() const {
+            return nb_;
+        }
+
+    private:
+        mutable index_t nb_;
+    };
+
+    /**
+     * \brief A callback that sums the volumes or the facet areas of the
+     *  polyhedra, with different implementations.
+     */
+    class MeasureCallback : public RVDPolyhedronCallback {
+    public:
+
+        /**
+         * \brief The implementations.
+         */
+        enum Mode {
+            VOLUMES_WALK, VOLUMES_SCALAR, VOLUMES_SIMD,
+            AREAS_WALK, AREAS_SCALAR, AREAS_SIMD
+        };
+
+        /**
+         * \brief MeasureCallback constructor.
+         * \param[in] mode the implementation
+         */
+        MeasureCallback(Mode mode) :
+            mode_(mode),
+            sums_(PADDING*Process::maximum_concurrent_threads()) {
+        }
+
+        /**
+         * \brief Gets the name of an implementation.
+         * \param[in] mode the implementation
+         * \return a string with the name of \p mode
+         */
+        static std::string name(Mode mode) {
+            switch(mode) {
+            case VOLUMES_WALK:
+                return "volumes, walk";
+            case VOLUMES_SCALAR:
+                return "volumes, batch, scalar";
+            case VOLUMES_SIMD:
+                return std::string("volumes, batch, ") +
+                    ConvexCellBatch::SIMD_instruction_set();
+            case AREAS_WALK:
+                return "areas, walk";
+            case AREAS_SCALAR:
+                return "areas, batch, scalar";
+            case AREAS_SIMD:
+                return std::string("areas, batch, ") +
+                    ConvexCellBatch::SIMD_instruction_set();
+            }
+            return "";
+        }
+
+        /**
+         * \brief Gets the sum of the measures.
+         * \return the sum of the measures computed by all the threads,
+         *  in all the traversals
+         */
+        double sum() const {
+            double result = 0.0;
+            for(index_t i=0; i<sums_.size(); i+=PADDING) {
+                result += sums_[i];
+            }
+            return result;
+        }
+
+        /**
+         * \copydoc RVDPolyhedronCallback::operator()
+         */
+        void operator() (
+            index_t v, index_t t, const GEOGen::ConvexCell& C
+        ) const override {
+            geo_argused(v);
+            geo_argused(t);
+            double m = 0.0;
+            const GEOGen::Vertex* V0 = nullptr;
+            if(mode_ <= VOLUMES_SIMD) {
+                V0 = ConvexCellBatch::first_vertex(C);
+                if(V0 == nullptr) {
+                    return;
+                }
+            }
+            if(mode_ == VOLUMES_WALK || mode_ == AREAS_WALK) {
+                m = walk(C, V0);
+            } else {
+                ConvexCellBatch& batch = ConvexCellBatch::get();
+                batch.gather(C, V0);
+                switch(mode_) {
+                case VOLUMES_SCALAR:
+                    batch.compute_volumes_scalar(V0->point());
+                    break;
+                case VOLUMES_SIMD:
+                    batch.compute_volumes(V0->point());
+                    break;
+                case AREAS_SCALAR:
+                    batch.compute_areas_scalar(false);
+                    break;
+                default:
+                    batch.compute_areas(false);
+                    break;
+                }
+                const double* measures = batch.measures();
+                for(index_t i=0; i<batch.nb_triangles(); ++i) {
+                    m += measures[i];
+                }
+            }
+            Thread* thread = Thread::current();
+            index_t thread_id = (thread == nullptr) ? 0 : thread->id();
+            const_cast<MeasureCallback*>(this)->
+                sums_[PADDING*thread_id] += m;
+        }
+
+    protected:
+        /**
+         * \brief Computes the volume or the facet areas of a polyhedron
+         *  while walking the dual ConvexCell.
+         * \param[in] C the polyhedron
+         * \param[in] V0 the apex of the tetrahedra if volumes are
+         *  computed, nullptr if areas are computed
+         * \return the volume or the sum of the areas of the facets
+         */
+        double walk(
+            const GEOGen::ConvexCell& C, const GEOGen::Vertex* V0
+        ) const {
+            double result = 0.0;
+            for(index_t cv = 0; cv < C.max_v(); ++cv) {
+                signed_index_t ct = C.vertex_triangle(cv);
+                if(ct == -1) {
+                    continue;
+                }
+                GEOGen::ConvexCell::Corner first(
+                    index_t(ct), C.find_triangle_vertex(index_t(ct), cv)
+                );
+                const GEOGen::Vertex* V1 = &C.triangle_dual(first.t);
+                const GEOGen::Vertex* V2 = nullptr;
+                const GEOGen::Vertex* V3 = nullptr;
+                GEOGen::ConvexCell::Corner c = first;
+                do {
+                    V2 = V3;
+                    V3 = &C.triangle_dual(c.t);
+                    if(
+                        V2 != nullptr && V3 != V1 &&
+                        V1 != V0 && V2 != V0 && V3 != V0
+                    ) {
+                        if(V0 != nullptr) {
+                            result += GEO::Geom::tetra_volume<3>(
+                                V0->point(),
+                                V1->point(), V2->point(), V3->point()
+                            );
+                        } else {
+                            result += GEO::Geom::triangle_area_3d(
+                                V1->point(), V2->point(), V3->point()
+                            );
+                        }
+                    }
+                    C.move_to_next_around_vertex(c);
+                } while(c != first);
+            }
+            return result;
+        }
+
+    private:
+        /** \brief One sum per cache line, to avoid false sharing */
+        static const index_t PADDING = 8;
+        Mode mode_;
+        vector<double> sums_;
+    };
+
+    /**
+     * \brief An OptimalTransportMap3d that gives access to the
+     *  traversal of its restricted Laguerre diagram.
+     */
+    class OTMBenchmark3d : public OptimalTransportMap3d {
+    public:
+        /**
+         * \brief OTMBenchmark3d constructor.
+         * \param[in] mesh the source distribution, a tetrahedral mesh
+         *  with 4d vertices
+         */
+        OTMBenchmark3d(Mesh* mesh) : OptimalTransportMap3d(mesh) {
+        }
+
+        /**
+         * \brief Computes the regular triangulation of the current
+         *  weights.
+         * \details Needs to be called once before time_callback()
+         *  and time_traversal().
+         */
+        void begin_benchmark() {
+            compute_power_diagram(nb_points(), weights_.data());
+        }
+
+        /**
+         * \brief Times the traversal of the restricted Laguerre diagram
+         *  with the integration callback.
+         * \param[in] centroids , Newton , eval_F the flags that select
+         *  the specialization of the kernel
+         * \param[in] nb_runs number of traversals
+         * \return the smallest time of a traversal, in seconds
+         */
+        double time_callback(
+            bool centroids, bool Newton, bool eval_F, index_t nb_runs
+        ) {
+            index_t n = nb_points();
+            vector<double> g(n);
+            vector<double> mg(3*n);
+            vector<double> x(n);
+            callback_->set_w(weights_.data(), n);
+            callback_->set_g(g.data());
+            callback_->set_nb_threads(Process::maximum_concurrent_threads());
+            callback_->set_Laguerre_centroids(
+                centroids ? mg.data() : nullptr
+            );
+            callback_->set_Newton_step(Newton);
+            callback_->set_eval_F(eval_F);
+            double result = Numeric::max_float64();
+            for(index_t k=0; k<nb_runs; ++k) {
+                if(Newton) {
+                    new_linear_system(n, x.data());
+                    update_sparsity_pattern();
+                }
+                Memory::clear(g.data(), n*sizeof(double));
+                Memory::clear(mg.data(), 3*n*sizeof(double));
+                double start = OTTelemetry::now();
+                call_callback_on_RVD();
+                result = std::min(result, OTTelemetry::now() - start);
+            }
+            callback_->set_Laguerre_centroids(nullptr);
+            callback_->set_Newton_step(false);
+            callback_->set_eval_F(false);
+            return result;
+        }
+
+        /**
+         * \brief Times the traversal of the restricted Laguerre diagram
+         *  with another callback.
+         * \param[in] callback the callback
+         * \param[in] nb_runs number of traversals
+         * \return the smallest time of a traversal, in seconds
+         */
+        double time_traversal(
+            RVDPolyhedronCallback& callback, index_t nb_runs
+        ) {
+            double result = Numeric::max_float64();
+            for(index_t k=0; k<nb_runs; ++k) {
+                double start = OTTelemetry::now();
+                // Same parameters as call_callback_on_RVD()
+                RVD()->for_each_polyhedron(callback, false, false, true);
+                result = std::min(result, OTTelemetry::now() - start);
+            }
+            return result;
+        }
+
+        /**
+         * \brief Counts the polyhedra of the restricted Laguerre diagram.
+         * \return the number of calls of the callback per traversal
+         */
+        index_t nb_polyhedra() {
+            CountPolyhedronCallback callback;
+            RVD()->for_each_polyhedron(callback, false, false, false);
+            return callback.nb();
+        }
+    };
+
+    /**
+     * \brief Displays a timing.
+     * \param[in] name the name of the measured operation
+     * \param[in] t the time, in seconds
+     * \param[in] t_empty the time of the empty traversal, in seconds
+     * \param[in] nb the number of polyhedra
+     */
+    void show_time(
+        const std::string& name, double t, double t_empty, index_t nb
+    ) {
+        std::ostringstream out;
+        out << std::setw(36) << std::left << name
+            << std::setw(10) << std::right << std::fixed
+            << std::setprecision(2) << t * 1e3 << " ms"
+            << std::setw(10) << (t * 1e9 / double(nb)) << " ns/poly"
+            << std::setw(10) << ((t - t_empty) * 1e9 / double(nb))
+            << " ns/poly (integration)";
+        Logger::out("Bench") << out.str() << std::endl;
+    }
+
+    /**
+     * \brief Times all the specializations of the kernel of an
+     *  OptimalTransportMap3d.
+     * \param[in] M the tetrahedral mesh, with 4d vertices
+     * \param[in] points the points, 3 coordinates per point
+     * \param[in] nb_iter number of Newton iterations computed before
+     *  the benchmark
+     * \param[in] nb_runs number of traversals per timing
+     */
+    void benchmark_kernels(
+        Mesh& M, const vector<double>& points,
+        index_t nb_iter, index_t nb_runs
+    ) {
+        bool weighted = M.vertices.attributes().is_defined("weight");
+        Logger::out("Bench") << (weighted ? "Weighted" : "Uniform")
+                             << " density" << std::endl;
+
+        OTMBenchmark3d OTM(&M);
+        OTM.set_Newton(true);
+        OTM.set_points(points.size()/3, points.data());
+        OTM.optimize(nb_iter);
+        OTM.begin_benchmark();
+
+        index_t nb = OTM.nb_polyhedra();
+        Logger::out("Bench") << nb << " polyhedra" << std::endl;
+
+        EmptyPolyhedronCallback empty;
+        double t_empty = OTM.time_traversal(empty, nb_runs);
+        show_time("empty callback", t_empty, t_empty, nb);
+
+        for(index_t flags=0; flags<8; ++flags) {
+            bool centroids = ((flags & 1) != 0);
+            bool Newton = ((flags & 2) != 0);
+            bool eval_F = ((flags & 4) != 0);
+            std::string name = std::string("kernel<") +
+                (weighted ? "W" : "-") +
+                (centroids ? "C" : "-") +
+                (Newton ? "N" : "-") +
+                (eval_F ? "F" : "-") + ">";
+            double t = OTM.time_callback(centroids, Newton, eval_F, nb_runs);
+            show_time(name, t, t_empty, nb);
+        }
+
+        if(weighted) {
+            return;
+        }
+
+        // The walk and the two kernels of ConvexCellBatch should give
+        // the same volume and area, up to roundoff.
+        double reference = 0.0;
+        for(index_t m=MeasureCallback::VOLUMES_WALK;
+            m<=MeasureCallback::AREAS_SIMD; ++m
+        ) {
+            MeasureCallback::Mode mode = MeasureCallback::Mode(m);
+            MeasureCallback callback(mode);
+            double t = OTM.time_traversal(callback, nb_runs);
+            show_time(MeasureCallback::name(mode), t, t_empty, nb);
+            // Each traversal adds to the sums.
+            double sum = callback.sum() / double(nb_runs);
+            if(
+                mode == MeasureCallback::VOLUMES_WALK ||
+                mode == MeasureCallback::AREAS_WALK
+            ) {
+                reference = sum;
+            } else if(::fabs(sum - reference) > 1e-6 * ::fabs(reference)) {
+                Logger::warn("Bench") << MeasureCallback::name(mode)
+                                      << ": sum=" << sum
+                                      << " expected " << reference
+                                      << std::endl;
+            }
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    using namespace GEO;
+
+    GEO::initialize();
+
+    try {
+        CmdLine::import_arg_group("standard");
+        CmdLine::declare_arg("nb_pts", 100000, "number of points");
+        CmdLine::declare_arg(
+            "nb_iter", 3, "Newton iterations before the benchmark"
+        );
+        CmdLine::declare_arg("nb_runs", 5, "traversals per timing");
+
+        std::vector<std::string> filenames;
+        if(!CmdLine::parse(argc, argv, filenames, "mesh")) {
+            return 1;
+        }
+
+        Mesh M;
+        if(!mesh_load(filenames[0], M)) {
+            return 1;
+        }
+        if(M.cells.nb() == 0) {
+            Logger::err("Bench") << filenames[0] << ": no tetrahedra"
+                                 << std::endl;
+            return 1;
+        }
+
+        index_t nb_pts = CmdLine::get_arg_uint("nb_pts");
+        index_t nb_iter = CmdLine::get_arg_uint("nb_iter");
+        index_t nb_runs = CmdLine::get_arg_uint("nb_runs");
+
+        vector<double> points(3*nb_pts);
+        {
+            CentroidalVoronoiTesselation CVT(&M);
+            CVT.set_volumetric(true);
+            sample(CVT, nb_pts, false, false, false);
+            Memory::copy(
+                points.data(), CVT.embedding(0), 3*nb_pts*sizeof(double)
+            );
+        }
+
+        Mesh M_weighted;
+        M_weighted.copy(M);
+        set_density(M_weighted, 1.0, 10.0, "X");
+
+        // The OptimalTransportMap3d needs a fourth coordinate.
+        M.vertices.set_dimension(4);
+        M_weighted.vertices.set_dimension(4);
+
+        Logger::out("Bench") << Process::maximum_concurrent_threads()
+                             << " threads" << std::endl;
+
+        benchmark_kernels(M, points, nb_iter, nb_runs);
+        benchmark_kernels(M_weighted, points, nb_iter, nb_runs);
+    } catch(const std::exception& e) {
+        std::cerr << "Received an exception: " << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,618 @@
+/*
+ *  Copyright (c) 2000-2022 Inria
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *  this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *  * Neither the name of the ALICE Project-Team nor the names of its
+ *  contributors may be used to endorse or promote products derived from this
+ *  software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  Contact: Bruno Levy
+ *
+ *     https://www.inria.fr/fr/bruno-levy
+ *
+ *     Inria,
+ *     Domaine de Voluceau,
+ *     78150 Le Chesnay - Rocquencourt
+ *     FRANCE
+ *
+ */
+
+#include <exploragram/optimal_transport/amg.h>
+#include <exploragram/optimal_transport/hessian.h>
+#include <geogram/basic/process.h>
+
+#include <algorithm>
+
+namespace {
+    using namespace GEO;
+
+    typedef OTAMGPreconditioner::CSRMatrix CSRMatrix;
+    typedef OTAMGPreconditioner::CSRView CSRView;
+
+    /**
+     * \brief Computes a sparse matrix-vector product.
+     * \param[in] A the matrix
+     * \param[in] x a pointer to A.n doubles
+     * \param[out] y a pointer to A.m doubles, \f$ y \leftarrow A x \f$
+     */
+    void mult_CSR(const CSRView& A, const double* x, double* y) {
+        parallel_for_slice(
+            0, A.m,
+            [&](index_t from, index_t to) {
+                for(index_t i=from; i<to; ++i) {
+                    double sum = 0.0;
+                    for(index_t jj=A.rowptr[i]; jj<A.rowptr[i+1]; ++jj) {
+                        sum += A.val[jj] * x[A.colind[jj]];
+                    }
+                    y[i] = sum;
+                }
+            }
+        );
+    }
+
+    /**
+     * \brief Computes the transpose of a sparse matrix.
+     * \param[in] A the matrix
+     * \param[out] AT the transpose of \p A
+     */
+    void transpose_CSR(const CSRMatrix& A, CSRMatrix& AT) {
+        AT.m = A.n;
+        AT.n = A.m;
+        AT.rowptr.assign(AT.m+1, 0);
+        for(index_t jj=0; jj<A.colind.size(); ++jj) {
+            ++AT.rowptr[A.colind[jj]+1];
+        }
+        for(index_t i=0; i<AT.m; ++i) {
+            AT.rowptr[i+1] += AT.rowptr[i];
+        }
+        AT.colind.resize(A.colind.size());
+        AT.val.resize(A.val.size());
+        vector<index_t> pos(AT.m);
+        for(index_t i=0; i<AT.m; ++i) {
+            pos[i] = AT.rowptr[i];
+        }
+        // Rows of A are traversed in order, thus rows of AT are sorted.
+        for(index_t i=0; i<A.m; ++i) {
+            for(index_t jj=A.rowptr[i]; jj<A.rowptr[i+1]; ++jj) {
+                index_t k = pos[A.colind[jj]];
+                ++pos[A.colind[jj]];
+                AT.colind[k] = i;
+                AT.val[k] = A.val[jj];
+            }
+        }
+    }
+
+    /**
+     * \brief Computes a row of the product of two sparse matrices.
+     * \param[in] A , B the two matrices
+     * \param[in] i the row
+     * \param[out] row the sorted (column,value) pairs of row \p i
+     *  of \f$ AB \f$
+     */
+    void product_row(
+        const CSRView& A, const CSRView& B, index_t i,
+        vector<std::pair<index_t, double> >& row
+    ) {
+        row.clear();
+        for(index_t jj=A.rowptr[i]; jj<A.rowptr[i+1]; ++jj) {
+            index_t j = A.colind[jj];
+            double a = A.val[jj];
+            for(index_t kk=B.rowptr[j]; kk<B.rowptr[j+1]; ++kk) {
+                row.push_back(std::make_pair(B.colind[kk], a * B.val[kk]));
+            }
+        }
+        std::sort(
+            row.begin(), row.end(),
+            [](
+                const std::pair<index_t, double>& p1,
+                const std::pair<index_t, double>& p2
+            ) {
+                return p1.first < p2.first;
+            }
+        );
+        index_t nb = 0;
+        for(index_t k=0; k<row.size(); ++k) {
+            if(nb != 0 && row[nb-1].first == row[k].first) {
+                row[nb-1].second += row[k].second;
+            } else {
+                row[nb] = row[k];
+                ++nb;
+            }
+        }
+        row.resize(nb);
+    }
+
+    /**
+     * \brief Computes the product of two sparse matrices.
+     * \details Rows are computed in parallel, twice (once to
+     *  determine the sizes and once to store them), so that no
+     *  memory proportional to the number of columns is needed.
+     * \param[in] A , B the two matrices
+     * \param[out] C the product \f$ AB \f$
+     */
+    void multiply_CSR(const CSRView& A, const CSRView& B, CSRMatrix& C) {
+        geo_assert(A.n == B.m);
+        C.m = A.m;
+        C.n = B.n;
+        C.rowptr.assign(C.m+1, 0);
+        parallel_for_slice(
+            0, A.m,
+            [&](index_t from, index_t to) {
+                vector<std::pair<index_t, double> > row;
+                for(index_t i=from; i<to; ++i) {
+                    product_row(A, B, i, row);
+                    C.rowptr[i+1] = row.size();
+                }
+            }
+        );
+        for(index_t i=0; i<C.m; ++i) {
+            C.rowptr[i+1] += C.rowptr[i];
+        }
+        C.colind.resize(C.rowptr[C.m]);
+        C.val.resize(C.rowptr[C.m]);
+        parallel_for_slice(
+            0, A.m,
+            [&](index_t from, index_t to) {
+                vector<std::pair<index_t, double> > row;
+                for(index_t i=from; i<to; ++i) {
+                    product_row(A, B, i, row);
+                    index_t k = C.rowptr[i];
+                    for(const std::pair<index_t, double>& c: row) {
+                        C.colind[k] = c.first;
+                        C.val[k] = c.second;
+                        ++k;
+                    }
+                }
+            }
+        );
+    }
+
+    /**
+     * \brief Gets the diagonal coefficient of a row.
+     * \param[in] A the matrix
+     * \param[in] i the row
+     * \return the coefficient \f$ a_{ii} \f$
+     */
+    double diagonal(const CSRView& A, index_t i) {
+        for(index_t jj=A.rowptr[i]; jj<A.rowptr[i+1]; ++jj) {
+            if(A.colind[jj] == i) {
+                return A.val[jj];
+            }
+        }
+        return 0.0;
+    }
+
+    /**
+     * \brief Computes the aggregates of a matrix.
+     * \param[in] A the matrix
+     * \param[in] theta the threshold for strong connections
+     * \param[out] agg the aggregate of each row
+     * \return the number of aggregates
+     */
+    index_t compute_aggregates(
+        const CSRView& A, double theta, vector<index_t>& agg
+    ) {
+        index_t n = A.m;
+        vector<double> diag(n);
+        for(index_t i=0; i<n; ++i) {
+            diag[i] = ::fabs(diagonal(A,i));
+        }
+
+        double theta2 = theta*theta;
+        auto strong = [&](index_t i, index_t jj) -> bool {
+            index_t j = A.colind[jj];
+            return (j != i) &&
+                A.val[jj]*A.val[jj] >= theta2 * diag[i] * diag[j];
+        };
+
+        const index_t NO_AGGREGATE = index_t(-1);
+        agg.assign(n, NO_AGGREGATE);
+        index_t nb_aggregates = 0;
+
+        // Phase 1: rows with no aggregated strong neighbor form a new
+        // aggregate with their strong neighbors.
+        for(index_t i=0; i<n; ++i) {
+            if(agg[i] != NO_AGGREGATE) {
+                continue;
+            }
+            bool free_neighborhood = true;
+            for(index_t jj=A.rowptr[i]; jj<A.rowptr[i+1]; ++jj) {
+                if(strong(i,jj) && agg[A.colind[jj]] != NO_AGGREGATE) {
+                    free_neighborhood = false;
+                    break;
+                }
+            }
+            if(!free_neighborhood) {
+                continue;
+            }
+            agg[i] = nb_aggregates;
+            for(index_t jj=A.rowptr[i]; jj<A.rowptr[i+1]; ++jj) {
+                if(strong(i,jj)) {
+                    agg[A.colind[jj]] = nb_aggregates;
+                }
+            }
+            ++nb_aggregates;
+        }
+
+        // Phase 2: remaining rows join the aggregate of a strong neighbor.
+        vector<index_t> agg1 = agg;
+        for(index_t i=0; i<n; ++i) {
+            if(agg[i] != NO_AGGREGATE) {
+                continue;
+            }
+            for(index_t jj=A.rowptr[i]; jj<A.rowptr[i+1]; ++jj) {
+                if(strong(i,jj) && agg1[A.colind[jj]] != NO_AGGREGATE) {
+                    agg[i] = agg1[A.colind[jj]];
+                    break;
+                }
+            }
+            // Phase 3 (cannot happen in theory): new singleton aggregate.
+            if(agg[i] == NO_AGGREGATE) {
+                agg[i] = nb_aggregates;
+                ++nb_aggregates;
+            }
+        }
+
+        return nb_aggregates;
+    }
+
+    /**
+     * \brief Computes an upper bound of the spectral radius of
+     *  \f$ D^{-1} A \f$.
+     * \details Uses Gershgorin's theorem.
+     * \param[in] A the matrix
+     * \param[in] inv_diag the inverse of the diagonal of \p A
+     * \return the upper bound
+     */
+    double spectral_radius_bound(
+        const CSRView& A, const vector<double>& inv_diag
+    ) {
+        double result = 0.0;
+        for(index_t i=0; i<A.m; ++i) {
+            double sum = 0.0;
+            for(index_t jj=A.rowptr[i]; jj<A.rowptr[i+1]; ++jj) {
+                sum += ::fabs(A.val[jj]);
+            }
+            result = std::max(result, ::fabs(inv_diag[i]) * sum);
+        }
+        return result;
+    }
+}
+
+namespace GEO {
+
+    OTAMGPreconditioner::OTAMGPreconditioner() :
+        max_coarse_size_(1000),
+        max_levels_(20),
+        theta_(0.08),
+        nb_smoothing_steps_(2) {
+    }
+
+    void OTAMGPreconditioner::clear() {
+        levels_.clear();
+        coarse_L_.clear();
+        coarse_zero_pivot_.clear();
+    }
+
+    index_t OTAMGPreconditioner::level_size(index_t l) const {
+        geo_debug_assert(l < nb_levels());
+        return levels_[l].A.m;
+    }
+
+    bool OTAMGPreconditioner::setup(const OTHessian& H) {
+        bool reuse =
+            levels_.size() != 0 &&
+            levels_[0].A.m == H.n() &&
+            !H.pattern_changed();
+
+        if(!reuse) {
+            clear();
+            levels_.resize(1);
+        }
+
+        CSRView& A = levels_[0].A;
+        A.m = H.n();
+        A.n = H.n();
+        A.rowptr = H.rowptr();
+        A.colind = H.colind();
+        if(H.single_precision()) {
+            // The hierarchy works in double precision, the finest level
+            // keeps a copy of the coefficients.
+            vector<double>& val = levels_[0].A_storage.val;
+            val.resize(H.nnz());
+            const float* H_val = H.val_single_precision();
+            for(index_t jj=0; jj<H.nnz(); ++jj) {
+                val[jj] = double(H_val[jj]);
+            }
+            A.val = val.data();
+        } else {
+            levels_[0].A_storage.val.clear();
+            A.val = H.val();
+        }
+
+        if(reuse) {
+            compute_coarse_operators();
+        } else {
+            build_hierarchy();
+        }
+        for(Level& L: levels_) {
+            compute_smoother(L);
+        }
+        factorize_coarsest();
+        return reuse;
+    }
+
+    void OTAMGPreconditioner::compute_smoother(Level& L) {
+        index_t n = L.A.m;
+        L.inv_diag.resize(n);
+        for(index_t i=0; i<n; ++i) {
+            double d = diagonal(L.A, i);
+            L.inv_diag[i] = (d == 0.0) ? 0.0 : 1.0 / d;
+        }
+        double rho = spectral_radius_bound(L.A, L.inv_diag);
+        L.omega = (rho == 0.0) ? 0.0 : 4.0 / (3.0 * rho);
+        L.x.resize(n);
+        L.b.resize(n);
+        L.r.resize(n);
+    }
+
+    void OTAMGPreconditioner::build_hierarchy() {
+        for(index_t l=0; l+1<max_levels_; ++l) {
+            Level& L = levels_[l];
+            index_t n = L.A.m;
+            if(n <= max_coarse_size_) {
+                break;
+            }
+
+            compute_smoother(L);
+
+            vector<index_t> agg;
+            index_t nc = compute_aggregates(L.A, theta_, agg);
+            if(nc == 0 || double(nc) > 0.9 * double(n)) {
+                // Coarsening stalled.
+                break;
+            }
+
+            // Tentative prolongator: the restriction of the constant
+            // vector to each aggregate, normalized.
+            vector<index_t> agg_size(nc, 0);
+            for(index_t i=0; i<n; ++i) {
+                ++agg_size[agg[i]];
+            }
+            CSRMatrix T;
+            T.m = n;
+            T.n = nc;
+            T.rowptr.resize(n+1);
+            T.colind.resize(n);
+            T.val.resize(n);
+            for(index_t i=0; i<n; ++i) {
+                T.rowptr[i] = i;
+                T.colind[i] = agg[i];
+                T.val[i] = 1.0 / ::sqrt(double(agg_size[agg[i]]));
+            }
+            T.rowptr[n] = n;
+
+            // Smoothed prolongator: P = (I - omega D^-1 A) T
+            // (T has a single coefficient per row).
+            CSRMatrix AT;
+            multiply_CSR(L.A, CSRView(T), AT);
+            CSRMatrix& P = L.P;
+            P.m = n;
+            P.n = nc;
+            P.rowptr.swap(AT.rowptr);
+            P.colind.swap(AT.colind);
+            P.val.swap(AT.val);
+            parallel_for_slice(
+                0, n,
+                [&](index_t from, index_t to) {
+                    for(index_t i=from; i<to; ++i) {
+                        double s = -L.omega * L.inv_diag[i];
+                        for(index_t jj=P.rowptr[i]; jj<P.rowptr[i+1]; ++jj) {
+                            P.val[jj] *= s;
+                            // The diagonal of A is in its pattern, thus
+                            // the coefficient of T is in the pattern of AT.
+                            if(P.colind[jj] == T.colind[i]) {
+                                P.val[jj] += T.val[i];
+                            }
+                        }
+                    }
+                }
+            );
+            transpose_CSR(P, L.R);
+
+            // Galerkin coarse matrix R A P
+            CSRMatrix AP;
+            CSRMatrix Ac;
+            multiply_CSR(L.A, CSRView(L.P), AP);
+            multiply_CSR(CSRView(L.R), CSRView(AP), Ac);
+
+            // Note: L is invalidated by push_back()
+            levels_.push_back(Level());
+            Level& Lc = levels_.back();
+            Lc.A_storage.m = Ac.m;
+            Lc.A_storage.n = Ac.n;
+            Lc.A_storage.rowptr.swap(Ac.rowptr);
+            Lc.A_storage.colind.swap(Ac.colind);
+            Lc.A_storage.val.swap(Ac.val);
+            Lc.A = CSRView(Lc.A_storage);
+        }
+    }
+
+    void OTAMGPreconditioner::compute_coarse_operators() {
+        for(index_t l=0; l+1<levels_.size(); ++l) {
+            Level& L = levels_[l];
+            Level& Lc = levels_[l+1];
+            CSRMatrix AP;
+            multiply_CSR(L.A, CSRView(L.P), AP);
+            multiply_CSR(CSRView(L.R), CSRView(AP), Lc.A_storage);
+            Lc.A = CSRView(Lc.A_storage);
+        }
+    }
+
+    void OTAMGPreconditioner::factorize_coarsest() {
+        const CSRView& A = levels_.back().A;
+        index_t n = A.m;
+        if(n > 2*max_coarse_size_) {
+            // Coarsening stalled before reaching a small size, the
+            // coarsest level is only smoothed.
+            coarse_L_.clear();
+            coarse_zero_pivot_.clear();
+            return;
+        }
+        coarse_L_.assign(n*n, 0.0);
+        coarse_zero_pivot_.assign(n, false);
+        double max_diag = 0.0;
+        for(index_t i=0; i<n; ++i) {
+            for(index_t jj=A.rowptr[i]; jj<A.rowptr[i+1]; ++jj) {
+                index_t j = A.colind[jj];
+                if(j <= i) {
+                    coarse_L_[i*n+j] += A.val[jj];
+                }
+                if(j == i) {
+                    max_diag = std::max(max_diag, ::fabs(A.val[jj]));
+                }
+            }
+        }
+
+        // Cholesky factorization (in place, lower triangle).
+        // The Hessian is only positive semi-definite (the constant
+        // vector is in its kernel when there is no regularization),
+        // thus small pivots are replaced with zero (pseudo-inverse).
+        double tol = 1e-12 * max_diag;
+        for(index_t k=0; k<n; ++k) {
+            double* Lk = &coarse_L_[k*n];
+            double d = Lk[k];
+            for(index_t p=0; p<k; ++p) {
+                d -= Lk[p]*Lk[p];
+            }
+            if(d <= tol) {
+                coarse_zero_pivot_[k] = true;
+                for(index_t i=k; i<n; ++i) {
+                    coarse_L_[i*n+k] = 0.0;
+                }
+                continue;
+            }
+            d = ::sqrt(d);
+            Lk[k] = d;
+            parallel_for(
+                k+1, n,
+                [&](index_t i) {
+                    double* Li = &coarse_L_[i*n];
+                    double s = Li[k];
+                    for(index_t p=0; p<k; ++p) {
+                        s -= Li[p]*Lk[p];
+                    }
+                    Li[k] = s / d;
+                }
+            );
+        }
+    }
+
+    void OTAMGPreconditioner::solve_coarsest(
+        const double* b, double* x
+    ) const {
+        index_t n = levels_.back().A.m;
+        // Forward substitution L y = b
+        for(index_t i=0; i<n; ++i) {
+            if(coarse_zero_pivot_[i]) {
+                x[i] = 0.0;
+                continue;
+            }
+            const double* Li = &coarse_L_[i*n];
+            double s = b[i];
+            for(index_t p=0; p<i; ++p) {
+                s -= Li[p]*x[p];
+            }
+            x[i] = s / Li[i];
+        }
+        // Backward substitution L^T x = y
+        for(index_t ii=0; ii<n; ++ii) {
+            index_t i = n-1-ii;
+            if(coarse_zero_pivot_[i]) {
+                x[i] = 0.0;
+                continue;
+            }
+            double s = x[i];
+            for(index_t p=i+1; p<n; ++p) {
+                s -= coarse_L_[p*n+i]*x[p];
+            }
+            x[i] = s / coarse_L_[i*n+i];
+        }
+    }
+
+    void OTAMGPreconditioner::smooth(
+        const Level& L, const double* b, double* x
+    ) const {
+        index_t n = L.A.m;
+        double* r = L.r.data();
+        for(index_t k=0; k<nb_smoothing_steps_; ++k) {
+            mult_CSR(L.A, x, r);
+            for(index_t i=0; i<n; ++i) {
+                x[i] += L.omega * L.inv_diag[i] * (b[i] - r[i]);
+            }
+        }
+    }
+
+    void OTAMGPreconditioner::cycle(
+        index_t l, const double* b, double* x
+    ) const {
+        const Level& L = levels_[l];
+        index_t n = L.A.m;
+        bool coarsest = (l+1 == levels_.size());
+
+        if(coarsest && coarse_L_.size() != 0) {
+            solve_coarsest(b,x);
+            return;
+        }
+
+        Memory::clear(x, n*sizeof(double));
+        smooth(L,b,x);
+        if(coarsest) {
+            // Coarsening stalled, there is no factorization.
+            return;
+        }
+
+        // Coarse grid correction.
+        double* r = L.r.data();
+        mult_CSR(L.A, x, r);
+        for(index_t i=0; i<n; ++i) {
+            r[i] = b[i] - r[i];
+        }
+        const Level& Lc = levels_[l+1];
+        mult_CSR(CSRView(L.R), r, Lc.b.data());
+        cycle(l+1, Lc.b.data(), Lc.x.data());
+        mult_CSR(CSRView(L.P), Lc.x.data(), r);
+        for(index_t i=0; i<n; ++i) {
+            x[i] += r[i];
+        }
+
+        // Same smoother as pre-smoothing, so that the preconditioner
+        // is symmetric.
+        smooth(L,b,x);
+    }
+
+    void OTAMGPreconditioner::apply(const double* r, double* z) const {
+        geo_assert(levels_.size() != 0);
+        cycle(0, r, z);
+    }
+}
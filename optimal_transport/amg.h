@@ -0,0 +1,248 @@
+/*
+ *  Copyright (c) 2000-2022 Inria
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *  this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *  * Neither the name of the ALICE Project-Team nor the names of its
+ *  contributors may be used to endorse or promote products derived from this
+ *  software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  Contact: Bruno Levy
+ *
+ *     https://www.inria.fr/fr/bruno-levy
+ *
+ *     Inria,
+ *     Domaine de Voluceau,
+ *     78150 Le Chesnay - Rocquencourt
+ *     FRANCE
+ *
+ */
+
+#ifndef H_EXPLORAGRAM_OPTIMAL_TRANSPORT_AMG_H
+#define H_EXPLORAGRAM_OPTIMAL_TRANSPORT_AMG_H
+
+#include <exploragram/basic/common.h>
+
+/**
+ * \file exploragram/optimal_transport/amg.h
+ * \brief Algebraic multigrid preconditioner for the Newton solver
+ *  of semi-discrete optimal transport.
+ */
+
+namespace GEO {
+    class OTHessian;
+
+    /**
+     * \brief Smoothed-aggregation algebraic multigrid preconditioner.
+     * \details The Hessian of semi-discrete optimal transport is a
+     *  weighted graph Laplacian of the Laguerre diagram, for which the
+     *  constant vector is a near-nullspace. Aggregates are formed from
+     *  the strongly connected neighbors, the piecewise constant
+     *  tentative prolongator is smoothed by one damped Jacobi step,
+     *  and coarse matrices are computed with the Galerkin product
+     *  \f$ P^T A P \f$. The preconditioner is one V-cycle with damped
+     *  Jacobi smoothing and a dense (semi-definite) Cholesky factorization
+     *  on the coarsest level.
+     *
+     *  When the sparsity pattern of the Hessian did not change, the
+     *  prolongators of the previous Newton step are kept, and only
+     *  the coarse matrices are recomputed.
+     */
+    class EXPLORAGRAM_API OTAMGPreconditioner {
+    public:
+        /**
+         * \brief OTAMGPreconditioner constructor.
+         */
+        OTAMGPreconditioner();
+
+        /**
+         * \brief Sets the maximum size of the coarsest level.
+         * \param[in] n the maximum number of unknowns of the coarsest
+         *  level, that is solved with a dense factorization.
+         */
+        void set_max_coarse_size(index_t n) {
+            max_coarse_size_ = n;
+        }
+
+        /**
+         * \brief Sets the threshold for strong connections.
+         * \param[in] theta coefficient \f$ a_{ij} \f$ is a strong connection
+         *  if \f$ a_{ij}^2 \geq \theta^2 |a_{ii} a_{jj}| \f$
+         */
+        void set_strength_threshold(double theta) {
+            theta_ = theta;
+        }
+
+        /**
+         * \brief Clears the hierarchy.
+         */
+        void clear();
+
+        /**
+         * \brief Computes or updates the hierarchy for a matrix.
+         * \details The hierarchy keeps pointers to the coefficients of
+         *  \p H, that should not be modified before calling apply().
+         * \param[in] H the matrix
+         * \retval true if the prolongators were reused
+         * \retval false if a new hierarchy was created
+         */
+        bool setup(const OTHessian& H);
+
+        /**
+         * \brief Applies the preconditioner.
+         * \details Computes one V-cycle, starting from zero.
+         * \param[in] r a pointer to the n() components of the residual
+         * \param[out] z a pointer to the n() components of the
+         *  preconditioned residual
+         */
+        void apply(const double* r, double* z) const;
+
+        /**
+         * \brief Gets the number of levels.
+         * \return the number of levels of the hierarchy, including
+         *  the finest one.
+         */
+        index_t nb_levels() const {
+            return levels_.size();
+        }
+
+        /**
+         * \brief Gets the size of a level.
+         * \param[in] l the level, in 0 .. nb_levels()-1
+         * \return the number of unknowns at level \p l
+         */
+        index_t level_size(index_t l) const;
+
+        /**
+         * \brief A sparse matrix in compressed row storage.
+         */
+        struct CSRMatrix {
+            CSRMatrix() : m(0), n(0) {
+            }
+            index_t m;
+            index_t n;
+            vector<index_t> rowptr;
+            vector<index_t> colind;
+            vector<double> val;
+        };
+
+        /**
+         * \brief A read-only view on a sparse matrix in compressed
+         *  row storage.
+         */
+        struct CSRView {
+            CSRView() :
+                m(0), n(0),
+                rowptr(nullptr), colind(nullptr), val(nullptr) {
+            }
+            CSRView(const CSRMatrix& M) :
+                m(M.m), n(M.n),
+                rowptr(M.rowptr.data()),
+                colind(M.colind.data()),
+                val(M.val.data()) {
+            }
+            index_t m;
+            index_t n;
+            const index_t* rowptr;
+            const index_t* colind;
+            const double* val;
+        };
+
+    protected:
+        /**
+         * \brief A level of the hierarchy.
+         * \details The matrix of the finest level is a view on the
+         *  Hessian (its coefficients are copied in A_storage if the
+         *  Hessian is stored in single precision), the matrices of the
+         *  other levels are stored in A_storage.
+         */
+        struct Level {
+            CSRView A;
+            CSRMatrix A_storage;
+            CSRMatrix P;
+            CSRMatrix R;
+            vector<double> inv_diag;
+            double omega;
+            mutable vector<double> x;
+            mutable vector<double> b;
+            mutable vector<double> r;
+        };
+
+        /**
+         * \brief Computes the aggregates, prolongators and coarse
+         *  matrices of all levels.
+         */
+        void build_hierarchy();
+
+        /**
+         * \brief Recomputes the coarse matrices with the
+         *  prolongators of the previous setup.
+         */
+        void compute_coarse_operators();
+
+        /**
+         * \brief Computes the inverse diagonal and Jacobi damping
+         *  of a level.
+         * \param[in] L the level
+         */
+        static void compute_smoother(Level& L);
+
+        /**
+         * \brief Computes the dense factorization of the coarsest level.
+         */
+        void factorize_coarsest();
+
+        /**
+         * \brief Solves with the dense factorization of the coarsest level.
+         * \param[in] b the right-hand side
+         * \param[out] x the solution
+         */
+        void solve_coarsest(const double* b, double* x) const;
+
+        /**
+         * \brief Applies damped Jacobi smoothing steps.
+         * \param[in] L the level
+         * \param[in] b the right-hand side
+         * \param[in,out] x the approximate solution
+         */
+        void smooth(const Level& L, const double* b, double* x) const;
+
+        /**
+         * \brief Computes a V-cycle.
+         * \param[in] l the level
+         * \param[in] b the right-hand side
+         * \param[out] x the approximate solution
+         */
+        void cycle(index_t l, const double* b, double* x) const;
+
+    private:
+        index_t max_coarse_size_;
+        index_t max_levels_;
+        double theta_;
+        index_t nb_smoothing_steps_;
+        vector<Level> levels_;
+        vector<double> coarse_L_;
+        vector<bool> coarse_zero_pivot_;
+    };
+}
+
+#endif
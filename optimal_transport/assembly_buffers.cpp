@@ -0,0 +1,117 @@
+/*
+ *  Copyright (c) 2000-2022 Inria
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *  this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *  * Neither the name of the ALICE Project-Team nor the names of its
+ *  contributors may be used to endorse or promote products derived from this
+ *  software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  Contact: Bruno Levy
+ *
+ *     https://www.inria.fr/fr/bruno-levy
+ *
+ *     Inria,
+ *     Domaine de Voluceau,
+ *     78150 Le Chesnay - Rocquencourt
+ *     FRANCE
+ *
+ */
+
+#include <exploragram/optimal_transport/assembly_buffers.h>
+#include <exploragram/optimal_transport/hessian.h>
+#include <geogram/basic/process.h>
+
+namespace GEO {
+
+    OTAssemblyBuffers::OTAssemblyBuffers() :
+        nb_threads_(0),
+        nb_blocks_(0),
+        block_size_(1),
+        n_(0),
+        dim_(0) {
+    }
+
+    void OTAssemblyBuffers::begin(index_t nb_threads, index_t n, index_t dim) {
+        geo_assert(nb_threads != 0);
+        // More blocks than threads, for load balancing in end().
+        index_t nb_blocks = std::max(index_t(1), std::min(4*nb_threads, n));
+        if(nb_threads != nb_threads_ || nb_blocks != nb_blocks_) {
+            nb_threads_ = nb_threads;
+            nb_blocks_ = nb_blocks;
+            blocks_.clear();
+            blocks_.resize(nb_threads_ * nb_blocks_);
+        }
+        n_ = n;
+        dim_ = dim;
+        block_size_ = std::max(index_t(1), (n + nb_blocks_ - 1) / nb_blocks_);
+        for(Block& B: blocks_) {
+            B.mass_v.clear();
+            B.mass.clear();
+            B.triplets.clear();
+        }
+    }
+
+    void OTAssemblyBuffers::end(
+        double* g, double* mg, double* rhs, OTHessian* H
+    ) {
+        index_t stride = dim_ + 1;
+        parallel_for(
+            0, nb_blocks_,
+            [&](index_t b) {
+                for(index_t t=0; t<nb_threads_; ++t) {
+                    const Block& B = blocks_[t * nb_blocks_ + b];
+                    for(index_t k=0; k<B.mass_v.size(); ++k) {
+                        index_t v = B.mass_v[k];
+                        const double* m = &B.mass[k*stride];
+                        if(g != nullptr) {
+                            g[v] += m[0];
+                        }
+                        if(rhs != nullptr) {
+                            rhs[v] -= m[0];
+                        }
+                        if(mg != nullptr) {
+                            for(index_t c=0; c<dim_; ++c) {
+                                mg[dim_*v+c] += m[c+1];
+                            }
+                        }
+                    }
+                }
+                //   The coefficients of the block of rows are added at
+                // once, so that in single precision mode they are
+                // accumulated in double precision only for this block.
+                if(H != nullptr) {
+                    index_t row_begin = std::min(b * block_size_, n_);
+                    index_t row_end = std::min(row_begin + block_size_, n_);
+                    OTHessian::RowBlock rows(*H, row_begin, row_end);
+                    for(index_t t=0; t<nb_threads_; ++t) {
+                        const Block& B = blocks_[t * nb_blocks_ + b];
+                        for(const Triplet& T: B.triplets) {
+                            rows.add(T.i, T.j, T.a);
+                        }
+                    }
+                    rows.end();
+                }
+            }
+        );
+    }
+}
@@ -0,0 +1,165 @@
+/*
+ *  Copyright (c) 2000-2022 Inria
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *  this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *  * Neither the name of the ALICE Project-Team nor the names of its
+ *  contributors may be used to endorse or promote products derived from this
+ *  software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  Contact: Bruno Levy
+ *
+ *     https://www.inria.fr/fr/bruno-levy
+ *
+ *     Inria,
+ *     Domaine de Voluceau,
+ *     78150 Le Chesnay - Rocquencourt
+ *     FRANCE
+ *
+ */
+
+#ifndef H_EXPLORAGRAM_OPTIMAL_TRANSPORT_ASSEMBLY_BUFFERS_H
+#define H_EXPLORAGRAM_OPTIMAL_TRANSPORT_ASSEMBLY_BUFFERS_H
+
+#include <exploragram/basic/common.h>
+
+/**
+ * \file exploragram/optimal_transport/assembly_buffers.h
+ * \brief Lock-free assembly of the masses and Hessian of
+ *  semi-discrete optimal transport.
+ */
+
+namespace GEO {
+    class OTHessian;
+
+    /**
+     * \brief Per-thread buffers used to assemble the masses, centroids
+     *  and Hessian of semi-discrete optimal transport without any lock.
+     * \details During the traversal of the restricted Laguerre diagram,
+     *  each thread appends its contributions to its own buffers. The rows
+     *  are partitioned into blocks, and each thread has one buffer per
+     *  block. Then end() merges all the buffers in parallel, one block
+     *  of rows per task, so that each row is written by a single thread.
+     *  Buffers keep their capacity from one assembly to the next one.
+     */
+    class EXPLORAGRAM_API OTAssemblyBuffers {
+    public:
+        /**
+         * \brief OTAssemblyBuffers constructor.
+         */
+        OTAssemblyBuffers();
+
+        /**
+         * \brief Starts a new assembly.
+         * \param[in] nb_threads the maximum number of threads that
+         *  will call add_mass() and add_coefficient()
+         * \param[in] n the number of rows
+         * \param[in] dim the dimension of the centroids, or 0 if
+         *  centroids are not computed
+         */
+        void begin(index_t nb_threads, index_t n, index_t dim);
+
+        /**
+         * \brief Adds a contribution to the mass of a cell.
+         * \param[in] thread the id of the current thread
+         * \param[in] v the index of the seed
+         * \param[in] m the mass to be added
+         * \param[in] mg a pointer to the \p dim coordinates of the mass
+         *  times the centroid to be added. Ignored if dim is zero.
+         */
+        void add_mass(index_t thread, index_t v, double m, const double* mg) {
+            Block& B = block(thread, v);
+            B.mass_v.push_back(v);
+            B.mass.push_back(m);
+            for(index_t c=0; c<dim_; ++c) {
+                B.mass.push_back(mg[c]);
+            }
+        }
+
+        /**
+         * \brief Adds a value to a coefficient of the Hessian.
+         * \param[in] thread the id of the current thread
+         * \param[in] i , j the indices of the coefficient
+         * \param[in] a the value to be added to the coefficient
+         */
+        void add_coefficient(index_t thread, index_t i, index_t j, double a) {
+            Triplet T;
+            T.i = i;
+            T.j = j;
+            T.a = a;
+            block(thread, i).triplets.push_back(T);
+        }
+
+        /**
+         * \brief Merges the contributions of all threads.
+         * \param[in,out] g if non-null, the masses are added to it
+         * \param[in,out] mg if non-null, the masses times centroids
+         *  are added to it
+         * \param[in,out] rhs if non-null, the masses are subtracted
+         *  from it
+         * \param[in,out] H if non-null, the coefficients are added
+         *  to it. Its assembly needs to be started.
+         */
+        void end(double* g, double* mg, double* rhs, OTHessian* H);
+
+    protected:
+        /**
+         * \brief A coefficient of the Hessian.
+         */
+        struct Triplet {
+            index_t i;
+            index_t j;
+            double a;
+        };
+
+        /**
+         * \brief The contributions of a thread to a block of rows.
+         */
+        struct Block {
+            vector<index_t> mass_v;
+            vector<double> mass;
+            vector<Triplet> triplets;
+        };
+
+        /**
+         * \brief Gets the buffer of a thread for a row.
+         * \param[in] thread the id of the thread
+         * \param[in] i the row
+         * \return a reference to the Block
+         */
+        Block& block(index_t thread, index_t i) {
+            geo_debug_assert(thread < nb_threads_);
+            geo_debug_assert(i < n_);
+            return blocks_[thread * nb_blocks_ + i / block_size_];
+        }
+
+    private:
+        index_t nb_threads_;
+        index_t nb_blocks_;
+        index_t block_size_;
+        index_t n_;
+        index_t dim_;
+        vector<Block> blocks_;
+    };
+}
+
+#endif
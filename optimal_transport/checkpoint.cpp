@@ -0,0 +1,226 @@
+/*
+ *  Copyright (c) 2000-2022 Inria
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *  this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *  * Neither the name of the ALICE Project-Team nor the names of its
+ *  contributors may be used to endorse or promote products derived from this
+ *  software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  Contact: Bruno Levy
+ *
+ *     https://www.inria.fr/fr/bruno-levy
+ *
+ *     Inria,
+ *     Domaine de Voluceau,
+ *     78150 Le Chesnay - Rocquencourt
+ *     FRANCE
+ *
+ */
+
+#include <exploragram/optimal_transport/checkpoint.h>
+#include <geogram/basic/logger.h>
+#include <fstream>
+#include <cstring>
+#include <cstdio>
+
+namespace {
+    using namespace GEO;
+
+    /**
+     * \brief The first bytes of a file written by OTCheckpoint::save().
+     */
+    const char checkpoint_magic[8] = {
+        'O', 'T', 'C', 'K', 'P', 'T', '0', '1'
+    };
+
+    /**
+     * \brief Number of integers in the header of a checkpoint file.
+     */
+    const index_t nb_header_ints = 8;
+
+    /**
+     * \brief Number of doubles in the header of a checkpoint file.
+     */
+    const index_t nb_header_doubles = 4;
+
+    /**
+     * \brief Size of the header of a checkpoint file, in bytes.
+     * \details It is a multiple of 8, so that the arrays that follow
+     *  are aligned when the file is memory-mapped.
+     */
+    const size_t header_size =
+        sizeof(checkpoint_magic) +
+        nb_header_ints * sizeof(index_t) +
+        nb_header_doubles * sizeof(double);
+}
+
+namespace GEO {
+
+    OTCheckpoint::OTCheckpoint() {
+        clear();
+    }
+
+    void OTCheckpoint::clear() {
+        dimension = 0;
+        level = 0;
+        iteration = 0;
+        current_iter = 0;
+        nb_linsolve_iter = 0;
+        first_inner_iter = 0;
+        epsilon0 = 0.0;
+        forcing_term = 0.0;
+        prev_g_norm = 0.0;
+        g_norm = 0.0;
+        weights.clear();
+        direction.clear();
+    }
+
+    bool OTCheckpoint::save(const std::string& filename) const {
+        std::string tmp_filename = filename + ".tmp";
+        {
+            std::ofstream out(tmp_filename.c_str(), std::ios::binary);
+            if(!out) {
+                Logger::err("OTM") << "Could not create file "
+                                   << tmp_filename << std::endl;
+                return false;
+            }
+            index_t header_ints[nb_header_ints] = {
+                dimension, weights.size(), direction.size(), level,
+                iteration, current_iter, nb_linsolve_iter, first_inner_iter
+            };
+            double header_doubles[nb_header_doubles] = {
+                epsilon0, forcing_term, prev_g_norm, g_norm
+            };
+            out.write(checkpoint_magic, sizeof(checkpoint_magic));
+            out.write(
+                reinterpret_cast<const char*>(header_ints),
+                sizeof(header_ints)
+            );
+            out.write(
+                reinterpret_cast<const char*>(header_doubles),
+                sizeof(header_doubles)
+            );
+            out.write(
+                reinterpret_cast<const char*>(weights.data()),
+                std::streamsize(weights.size() * sizeof(double))
+            );
+            out.write(
+                reinterpret_cast<const char*>(direction.data()),
+                std::streamsize(direction.size() * sizeof(double))
+            );
+            out.flush();
+            if(!out) {
+                Logger::err("OTM") << "Error while writing "
+                                   << tmp_filename << std::endl;
+                return false;
+            }
+        }
+        if(std::rename(tmp_filename.c_str(), filename.c_str()) != 0) {
+            Logger::err("OTM") << "Could not rename " << tmp_filename
+                               << " to " << filename << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    bool OTCheckpoint::load(const std::string& filename) {
+        clear();
+        std::ifstream in(
+            filename.c_str(), std::ios::binary | std::ios::ate
+        );
+        if(!in) {
+            Logger::err("OTM") << "Could not open file " << filename
+                               << std::endl;
+            return false;
+        }
+        // The file is read at once, load_from_memory() does the rest.
+        size_t size = size_t(in.tellg());
+        vector<char> data(size);
+        in.seekg(0);
+        in.read(data.data(), std::streamsize(size));
+        if(!in) {
+            Logger::err("OTM") << "Error while reading " << filename
+                               << std::endl;
+            return false;
+        }
+        if(!load_from_memory(data.data(), size)) {
+            Logger::err("OTM") << filename << ": invalid checkpoint file"
+                               << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    bool OTCheckpoint::load_from_memory(const void* data, size_t size) {
+        clear();
+        const char* bytes = static_cast<const char*>(data);
+        if(
+            size < header_size ||
+            std::memcmp(bytes, checkpoint_magic, sizeof(checkpoint_magic))
+            != 0
+        ) {
+            return false;
+        }
+        index_t header_ints[nb_header_ints];
+        double header_doubles[nb_header_doubles];
+        bytes += sizeof(checkpoint_magic);
+        std::memcpy(header_ints, bytes, sizeof(header_ints));
+        bytes += sizeof(header_ints);
+        std::memcpy(header_doubles, bytes, sizeof(header_doubles));
+        bytes += sizeof(header_doubles);
+
+        index_t nb_weights = header_ints[1];
+        index_t nb_direction = header_ints[2];
+        if(
+            size != header_size +
+            (size_t(nb_weights) + size_t(nb_direction)) * sizeof(double)
+        ) {
+            return false;
+        }
+
+        dimension = header_ints[0];
+        level = header_ints[3];
+        iteration = header_ints[4];
+        current_iter = header_ints[5];
+        nb_linsolve_iter = header_ints[6];
+        first_inner_iter = header_ints[7];
+        epsilon0 = header_doubles[0];
+        forcing_term = header_doubles[1];
+        prev_g_norm = header_doubles[2];
+        g_norm = header_doubles[3];
+
+        // Copied with memcpy(), since data may not be aligned.
+        weights.resize(nb_weights);
+        direction.resize(nb_direction);
+        if(nb_weights != 0) {
+            std::memcpy(weights.data(), bytes, nb_weights * sizeof(double));
+            bytes += nb_weights * sizeof(double);
+        }
+        if(nb_direction != 0) {
+            std::memcpy(
+                direction.data(), bytes, nb_direction * sizeof(double)
+            );
+        }
+        return true;
+    }
+}
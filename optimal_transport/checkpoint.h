@@ -0,0 +1,152 @@
+/*
+ *  Copyright (c) 2000-2022 Inria
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *  this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *  * Neither the name of the ALICE Project-Team nor the names of its
+ *  contributors may be used to endorse or promote products derived from this
+ *  software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  Contact: Bruno Levy
+ *
+ *     https://www.inria.fr/fr/bruno-levy
+ *
+ *     Inria,
+ *     Domaine de Voluceau,
+ *     78150 Le Chesnay - Rocquencourt
+ *     FRANCE
+ *
+ */
+
+#ifndef H_EXPLORAGRAM_OPTIMAL_TRANSPORT_CHECKPOINT_H
+#define H_EXPLORAGRAM_OPTIMAL_TRANSPORT_CHECKPOINT_H
+
+#include <exploragram/basic/common.h>
+#include <string>
+
+/**
+ * \file exploragram/optimal_transport/checkpoint.h
+ * \brief State of the Newton solver of semi-discrete optimal transport,
+ *  saved to restart an interrupted solve.
+ */
+
+namespace GEO {
+
+    /**
+     * \brief The state of the Newton solver of an OptimalTransportMap
+     *  between two iterations.
+     * \details Restarting from an OTCheckpoint reproduces the iterations
+     *  of the interrupted solve. Per-point data are in the internal order
+     *  of the OptimalTransportMap, thus the points and the options need
+     *  to be the same as in the interrupted solve.
+     *
+     *  The file is a 72 bytes header (8 magic bytes, 8 32-bits integers
+     *  and 4 doubles, in the byte order of the machine) followed by the
+     *  arrays of doubles, that are aligned on 8 bytes. It can be read
+     *  with a single read() or memory-mapped and read with
+     *  load_from_memory(), there is nothing to parse.
+     */
+    struct EXPLORAGRAM_API OTCheckpoint {
+
+        /**
+         * \brief OTCheckpoint constructor.
+         */
+        OTCheckpoint();
+
+        /**
+         * \brief Resets all the fields.
+         */
+        void clear();
+
+        /**
+         * \brief Saves this OTCheckpoint to a binary file.
+         * \details The file is first written under a temporary name, then
+         *  renamed, so that a failure while writing does not destroy the
+         *  previous checkpoint.
+         * \param[in] filename the name of the file
+         * \retval true on success
+         * \retval false otherwise
+         */
+        bool save(const std::string& filename) const;
+
+        /**
+         * \brief Loads this OTCheckpoint from a binary file.
+         * \param[in] filename the name of a file written by save()
+         * \retval true on success
+         * \retval false otherwise. Then this OTCheckpoint is cleared.
+         */
+        bool load(const std::string& filename);
+
+        /**
+         * \brief Loads this OTCheckpoint from the contents of a file
+         *  written by save().
+         * \param[in] data a pointer to the contents of the file, for
+         *  instance memory-mapped
+         * \param[in] size the size of the file in bytes
+         * \retval true on success
+         * \retval false otherwise. Then this OTCheckpoint is cleared.
+         */
+        bool load_from_memory(const void* data, size_t size);
+
+        /** \brief The dimension of the transport map. */
+        index_t dimension;
+
+        /** \brief The level in optimize_levels(), or 0. */
+        index_t level;
+
+        /** \brief The next Newton iteration in the current level. */
+        index_t iteration;
+
+        /** \brief The global iteration counter, used to name files. */
+        index_t current_iter;
+
+        /** \brief Total number of iterations of the linear solver. */
+        index_t nb_linsolve_iter;
+
+        /** \brief First iteration of the next line search. */
+        index_t first_inner_iter;
+
+        /** \brief Minimum measure of a cell accepted by the line search. */
+        double epsilon0;
+
+        /** \brief Tolerance of the linear solve in inexact Newton mode. */
+        double forcing_term;
+
+        /** \brief Norm of the gradient at the previous iteration. */
+        double prev_g_norm;
+
+        /** \brief Norm of the gradient at the last accepted iterate. */
+        double g_norm;
+
+        /** \brief The weights of all the points. */
+        vector<double> weights;
+
+        /**
+         * \brief The latest Newton direction, used as the initial guess
+         *  of the next linear solve. It has one entry per point of the
+         *  current level.
+         */
+        vector<double> direction;
+    };
+}
+
+#endif
@@ -0,0 +1,439 @@
+/*
+ *  Copyright (c) 2000-2022 Inria
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *  this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *  * Neither the name of the ALICE Project-Team nor the names of its
+ *  contributors may be used to endorse or promote products derived from this
+ *  software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  Contact: Bruno Levy
+ *
+ *     https://www.inria.fr/fr/bruno-levy
+ *
+ *     Inria,
+ *     Domaine de Voluceau,
+ *     78150 Le Chesnay - Rocquencourt
+ *     FRANCE
+ *
+ */
+
+#include <exploragram/optimal_transport/convex_cell_batch.h>
+#include <geogram/voronoi/generic_RVD_vertex.h>
+
+#include <cmath>
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace {
+    using namespace GEO;
+
+    // The kernels of ConvexCellBatch are written once, as templates
+    // over a "pack" of doubles, and instantiated with one double
+    // (ScalarPack), 4 doubles (AVX2Pack) or 8 doubles (AVX512Pack).
+    // A pack has a size, load(), store(), broadcast() and the
+    // arithmetic operators, sqrt() and abs().
+
+    /**
+     * \brief A pack of one double.
+     */
+    struct ScalarPack {
+        static const index_t size = 1;
+
+        explicit ScalarPack(double x) : x_(x) {
+        }
+
+        static ScalarPack load(const double* p) {
+            return ScalarPack(*p);
+        }
+
+        static ScalarPack broadcast(double x) {
+            return ScalarPack(x);
+        }
+
+        void store(double* p) const {
+            *p = x_;
+        }
+
+        double x_;
+    };
+
+    inline ScalarPack operator+(ScalarPack a, ScalarPack b) {
+        return ScalarPack(a.x_ + b.x_);
+    }
+
+    inline ScalarPack operator-(ScalarPack a, ScalarPack b) {
+        return ScalarPack(a.x_ - b.x_);
+    }
+
+    inline ScalarPack operator*(ScalarPack a, ScalarPack b) {
+        return ScalarPack(a.x_ * b.x_);
+    }
+
+    inline ScalarPack operator/(ScalarPack a, ScalarPack b) {
+        return ScalarPack(a.x_ / b.x_);
+    }
+
+    inline ScalarPack sqrt(ScalarPack a) {
+        return ScalarPack(::sqrt(a.x_));
+    }
+
+    inline ScalarPack abs(ScalarPack a) {
+        return ScalarPack(::fabs(a.x_));
+    }
+
+#if defined(__AVX512F__)
+
+    /**
+     * \brief A pack of 8 doubles in an AVX-512 register.
+     */
+    struct AVX512Pack {
+        static const index_t size = 8;
+
+        explicit AVX512Pack(__m512d x) : x_(x) {
+        }
+
+        static AVX512Pack load(const double* p) {
+            return AVX512Pack(_mm512_loadu_pd(p));
+        }
+
+        static AVX512Pack broadcast(double x) {
+            return AVX512Pack(_mm512_set1_pd(x));
+        }
+
+        void store(double* p) const {
+            _mm512_storeu_pd(p, x_);
+        }
+
+        __m512d x_;
+    };
+
+    inline AVX512Pack operator+(AVX512Pack a, AVX512Pack b) {
+        return AVX512Pack(_mm512_add_pd(a.x_, b.x_));
+    }
+
+    inline AVX512Pack operator-(AVX512Pack a, AVX512Pack b) {
+        return AVX512Pack(_mm512_sub_pd(a.x_, b.x_));
+    }
+
+    inline AVX512Pack operator*(AVX512Pack a, AVX512Pack b) {
+        return AVX512Pack(_mm512_mul_pd(a.x_, b.x_));
+    }
+
+    inline AVX512Pack operator/(AVX512Pack a, AVX512Pack b) {
+        return AVX512Pack(_mm512_div_pd(a.x_, b.x_));
+    }
+
+    inline AVX512Pack sqrt(AVX512Pack a) {
+        return AVX512Pack(_mm512_sqrt_pd(a.x_));
+    }
+
+    inline AVX512Pack abs(AVX512Pack a) {
+        return AVX512Pack(_mm512_abs_pd(a.x_));
+    }
+
+    typedef AVX512Pack SIMDPack;
+    const char* SIMD_name = "AVX-512";
+
+#elif defined(__AVX2__)
+
+    /**
+     * \brief A pack of 4 doubles in an AVX2 register.
+     */
+    struct AVX2Pack {
+        static const index_t size = 4;
+
+        explicit AVX2Pack(__m256d x) : x_(x) {
+        }
+
+        static AVX2Pack load(const double* p) {
+            return AVX2Pack(_mm256_loadu_pd(p));
+        }
+
+        static AVX2Pack broadcast(double x) {
+            return AVX2Pack(_mm256_set1_pd(x));
+        }
+
+        void store(double* p) const {
+            _mm256_storeu_pd(p, x_);
+        }
+
+        __m256d x_;
+    };
+
+    inline AVX2Pack operator+(AVX2Pack a, AVX2Pack b) {
+        return AVX2Pack(_mm256_add_pd(a.x_, b.x_));
+    }
+
+    inline AVX2Pack operator-(AVX2Pack a, AVX2Pack b) {
+        return AVX2Pack(_mm256_sub_pd(a.x_, b.x_));
+    }
+
+    inline AVX2Pack operator*(AVX2Pack a, AVX2Pack b) {
+        return AVX2Pack(_mm256_mul_pd(a.x_, b.x_));
+    }
+
+    inline AVX2Pack operator/(AVX2Pack a, AVX2Pack b) {
+        return AVX2Pack(_mm256_div_pd(a.x_, b.x_));
+    }
+
+    inline AVX2Pack sqrt(AVX2Pack a) {
+        return AVX2Pack(_mm256_sqrt_pd(a.x_));
+    }
+
+    inline AVX2Pack abs(AVX2Pack a) {
+        // Clears the sign bit.
+        return AVX2Pack(_mm256_andnot_pd(_mm256_set1_pd(-0.0), a.x_));
+    }
+
+    typedef AVX2Pack SIMDPack;
+    const char* SIMD_name = "AVX2";
+
+#else
+
+    typedef ScalarPack SIMDPack;
+    const char* SIMD_name = "scalar";
+
+#endif
+
+    /**
+     * \brief Computes the volumes of the tetrahedra formed by a point
+     *  and the triangles of a ConvexCellBatch, by packs.
+     * \tparam PACK the type of the packs
+     * \param[in] batch the ConvexCellBatch
+     * \param[in] p0 the apex of all the tetrahedra
+     * \param[in] is_signed if set, signed volumes are computed,
+     *  else absolute values
+     * \param[out] vol the nb_triangles() volumes
+     * \param[in] begin the first triangle
+     * \return one past the last triangle processed. The remaining
+     *  triangles are fewer than PACK::size.
+     */
+    template <class PACK> index_t compute_volumes_by_packs(
+        const ConvexCellBatch& batch, const double* p0, bool is_signed,
+        double* vol, index_t begin
+    ) {
+        index_t nb = batch.nb_triangles();
+        const double* x1 = batch.coord(0,0);
+        const double* y1 = batch.coord(0,1);
+        const double* z1 = batch.coord(0,2);
+        const double* x2 = batch.coord(1,0);
+        const double* y2 = batch.coord(1,1);
+        const double* z2 = batch.coord(1,2);
+        const double* x3 = batch.coord(2,0);
+        const double* y3 = batch.coord(2,1);
+        const double* z3 = batch.coord(2,2);
+        PACK x0 = PACK::broadcast(p0[0]);
+        PACK y0 = PACK::broadcast(p0[1]);
+        PACK z0 = PACK::broadcast(p0[2]);
+        PACK six = PACK::broadcast(6.0);
+        index_t i = begin;
+        for(; i + PACK::size <= nb; i += PACK::size) {
+            PACK ux = PACK::load(x1+i) - x0;
+            PACK uy = PACK::load(y1+i) - y0;
+            PACK uz = PACK::load(z1+i) - z0;
+            PACK vx = PACK::load(x2+i) - x0;
+            PACK vy = PACK::load(y2+i) - y0;
+            PACK vz = PACK::load(z2+i) - z0;
+            PACK wx = PACK::load(x3+i) - x0;
+            PACK wy = PACK::load(y3+i) - y0;
+            PACK wz = PACK::load(z3+i) - z0;
+            PACK V = (
+                ux*(vy*wz-vz*wy) - uy*(vx*wz-vz*wx) + uz*(vx*wy-vy*wx)
+            ) / six;
+            if(!is_signed) {
+                V = abs(V);
+            }
+            V.store(vol+i);
+        }
+        return i;
+    }
+
+    /**
+     * \brief Computes the areas of the triangles of a ConvexCellBatch,
+     *  by packs.
+     * \tparam PACK the type of the packs
+     * \param[in] batch the ConvexCellBatch
+     * \param[in] weighted if set, each area is multiplied by the
+     *  average weight of the vertices of the triangle
+     * \param[out] area the nb_triangles() areas
+     * \param[in] begin the first triangle
+     * \return one past the last triangle processed. The remaining
+     *  triangles are fewer than PACK::size.
+     */
+    template <class PACK> index_t compute_areas_by_packs(
+        const ConvexCellBatch& batch, bool weighted,
+        double* area, index_t begin
+    ) {
+        index_t nb = batch.nb_triangles();
+        const double* x1 = batch.coord(0,0);
+        const double* y1 = batch.coord(0,1);
+        const double* z1 = batch.coord(0,2);
+        const double* x2 = batch.coord(1,0);
+        const double* y2 = batch.coord(1,1);
+        const double* z2 = batch.coord(1,2);
+        const double* x3 = batch.coord(2,0);
+        const double* y3 = batch.coord(2,1);
+        const double* z3 = batch.coord(2,2);
+        const double* w1 = batch.weight(0);
+        const double* w2 = batch.weight(1);
+        const double* w3 = batch.weight(2);
+        PACK half = PACK::broadcast(0.5);
+        PACK three = PACK::broadcast(3.0);
+        index_t i = begin;
+        for(; i + PACK::size <= nb; i += PACK::size) {
+            PACK X1 = PACK::load(x1+i);
+            PACK Y1 = PACK::load(y1+i);
+            PACK Z1 = PACK::load(z1+i);
+            PACK ux = PACK::load(x2+i) - X1;
+            PACK uy = PACK::load(y2+i) - Y1;
+            PACK uz = PACK::load(z2+i) - Z1;
+            PACK vx = PACK::load(x3+i) - X1;
+            PACK vy = PACK::load(y3+i) - Y1;
+            PACK vz = PACK::load(z3+i) - Z1;
+            PACK nx = uy*vz-uz*vy;
+            PACK ny = uz*vx-ux*vz;
+            PACK nz = ux*vy-uy*vx;
+            PACK A = half*sqrt(nx*nx+ny*ny+nz*nz);
+            if(weighted) {
+                A = A * (
+                    (PACK::load(w1+i) + PACK::load(w2+i) + PACK::load(w3+i))
+                    / three
+                );
+            }
+            A.store(area+i);
+        }
+        return i;
+    }
+}
+
+namespace GEO {
+
+    ConvexCellBatch& ConvexCellBatch::get() {
+        static thread_local ConvexCellBatch batch;
+        return batch;
+    }
+
+    const char* ConvexCellBatch::SIMD_instruction_set() {
+        return SIMD_name;
+    }
+
+    const GEOGen::Vertex* ConvexCellBatch::first_vertex(
+        const GEOGen::ConvexCell& C
+    ) {
+        for(index_t ct=0; ct < C.max_t(); ++ct) {
+            if(C.triangle_is_used(ct)) {
+                return &C.triangle_dual(ct);
+            }
+        }
+        return nullptr;
+    }
+
+    void ConvexCellBatch::clear() {
+        for(index_t i=0; i<9; ++i) {
+            coords_[i].resize(0);
+        }
+        for(index_t i=0; i<3; ++i) {
+            weights_[i].resize(0);
+        }
+        measures_.resize(0);
+        facet_id_.resize(0);
+        facet_begin_.resize(0);
+    }
+
+    void ConvexCellBatch::gather(
+        const GEOGen::ConvexCell& C, const GEOGen::Vertex* V0
+    ) {
+        clear();
+
+        // Iterate on all the vertices of the convex cell.
+        // The vertices associated to no triangle are skipped.
+        // Note: the convex cell is in dual form, thus a
+        // vertex of the ConvexCell corresponds to a polygonal
+        // facet.
+        for(index_t cv = 0; cv < C.max_v(); ++cv) {
+            signed_index_t ct = C.vertex_triangle(cv);
+            if(ct == -1) {
+                continue;
+            }
+            geo_debug_assert(C.triangle_is_used(index_t(ct)));
+
+            // Iterate around the facet vertices (that correspond
+            // to the current vertex in dual form). The polygonal
+            // facet is triangulated.
+            GEOGen::ConvexCell::Corner first(
+                index_t(ct), C.find_triangle_vertex(index_t(ct), cv)
+            );
+            const GEOGen::Vertex* V1 = &C.triangle_dual(first.t);
+            const GEOGen::Vertex* V2 = nullptr;
+            const GEOGen::Vertex* V3 = nullptr;
+            GEOGen::ConvexCell::Corner c = first;
+            do {
+                V2 = V3;
+                V3 = &C.triangle_dual(c.t);
+                if(
+                    V2 != nullptr && V3 != V1 &&
+                    V1 != V0 && V2 != V0 && V3 != V0
+                ) {
+                    add_triangle(V1,V2,V3);
+                }
+                C.move_to_next_around_vertex(c);
+            } while(c != first);
+        }
+    }
+
+    void ConvexCellBatch::compute_volumes(const double* p0, bool is_signed) {
+        measures_.resize(nb_triangles());
+        double* vol = measures_.data();
+        index_t i = compute_volumes_by_packs<SIMDPack>(
+            *this, p0, is_signed, vol, 0
+        );
+        compute_volumes_by_packs<ScalarPack>(*this, p0, is_signed, vol, i);
+    }
+
+    void ConvexCellBatch::compute_areas(bool weighted) {
+        measures_.resize(nb_triangles());
+        double* area = measures_.data();
+        index_t i = compute_areas_by_packs<SIMDPack>(
+            *this, weighted, area, 0
+        );
+        compute_areas_by_packs<ScalarPack>(*this, weighted, area, i);
+    }
+
+    void ConvexCellBatch::compute_volumes_scalar(
+        const double* p0, bool is_signed
+    ) {
+        measures_.resize(nb_triangles());
+        compute_volumes_by_packs<ScalarPack>(
+            *this, p0, is_signed, measures_.data(), 0
+        );
+    }
+
+    void ConvexCellBatch::compute_areas_scalar(bool weighted) {
+        measures_.resize(nb_triangles());
+        compute_areas_by_packs<ScalarPack>(
+            *this, weighted, measures_.data(), 0
+        );
+    }
+}
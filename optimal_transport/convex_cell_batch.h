@@ -0,0 +1,260 @@
+/*
+ *  Copyright (c) 2000-2022 Inria
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *  this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *  * Neither the name of the ALICE Project-Team nor the names of its
+ *  contributors may be used to endorse or promote products derived from this
+ *  software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  Contact: Bruno Levy
+ *
+ *     https://www.inria.fr/fr/bruno-levy
+ *
+ *     Inria,
+ *     Domaine de Voluceau,
+ *     78150 Le Chesnay - Rocquencourt
+ *     FRANCE
+ *
+ */
+
+#ifndef H_EXPLORAGRAM_OPTIMAL_TRANSPORT_CONVEX_CELL_BATCH_H
+#define H_EXPLORAGRAM_OPTIMAL_TRANSPORT_CONVEX_CELL_BATCH_H
+
+#include <exploragram/basic/common.h>
+#include <geogram/voronoi/generic_RVD_cell.h>
+#include <geogram/basic/memory.h>
+
+/**
+ * \file exploragram/optimal_transport/convex_cell_batch.h
+ * \brief Triangles of a ConvexCell in structure-of-arrays form, used by
+ *  the integration kernels of 3d semi-discrete optimal transport.
+ */
+
+namespace GEO {
+
+    /**
+     * \brief The triangles of a ConvexCell, gathered in
+     *  structure-of-arrays form.
+     * \details Walking the dual ConvexCell is full of branches and
+     *  indirections. The callbacks first gather the fan triangles of
+     *  the cell in this buffer, then the volumes and areas are computed
+     *  by branch-free loops over contiguous arrays. These loops use
+     *  AVX-512 or AVX2 intrinsics when the compiler targets these
+     *  instruction sets (e.g. -march=native, -mavx2 or -mavx512f), else
+     *  plain loops that the compiler can vectorize. The scalar versions
+     *  are always available, as a reference. Triangles are grouped by
+     *  facet. There is one instance per thread, obtained with get().
+     */
+    class EXPLORAGRAM_API ConvexCellBatch {
+    public:
+
+        /**
+         * \brief Gets the ConvexCellBatch of the current thread.
+         * \return a reference to the ConvexCellBatch of the current thread
+         */
+        static ConvexCellBatch& get();
+
+        /**
+         * \brief Gets the instruction set used by compute_volumes()
+         *  and compute_areas().
+         * \return one of "AVX-512", "AVX2" or "scalar"
+         */
+        static const char* SIMD_instruction_set();
+
+        /**
+         * \brief Finds a vertex of a ConvexCell.
+         * \param[in] C the ConvexCell
+         * \return a pointer to a vertex of \p C, or nullptr if \p C
+         *  is empty
+         */
+        static const GEOGen::Vertex* first_vertex(
+            const GEOGen::ConvexCell& C
+        );
+
+        /**
+         * \brief Removes all the facets and triangles.
+         * \details Allocated memory is kept for the next cell.
+         */
+        void clear();
+
+        /**
+         * \brief Replaces the contents with the triangles of a ConvexCell.
+         * \details Each polygonal facet of \p C is triangulated as a fan.
+         *  No facet is started, facet_id() and facet_begin() are not
+         *  available afterwards.
+         * \param[in] C the ConvexCell
+         * \param[in] V0 if non-null, the triangles incident to \p V0
+         *  are skipped (the tetrahedra they form with \p V0 have a
+         *  zero volume)
+         */
+        void gather(
+            const GEOGen::ConvexCell& C,
+            const GEOGen::Vertex* V0 = nullptr
+        );
+
+        /**
+         * \brief Starts a new facet.
+         * \details The triangles added afterwards belong to this facet.
+         * \param[in] id an identifier attached to the facet
+         */
+        void begin_facet(index_t id) {
+            facet_id_.push_back(id);
+            facet_begin_.push_back(nb_triangles());
+        }
+
+        /**
+         * \brief Adds a triangle.
+         * \param[in] V1 , V2 , V3 the three vertices of the triangle
+         */
+        void add_triangle(
+            const GEOGen::Vertex* V1,
+            const GEOGen::Vertex* V2,
+            const GEOGen::Vertex* V3
+        ) {
+            const GEOGen::Vertex* V[3] = { V1, V2, V3 };
+            for(index_t lv=0; lv<3; ++lv) {
+                const double* p = V[lv]->point();
+                coords_[3*lv].push_back(p[0]);
+                coords_[3*lv+1].push_back(p[1]);
+                coords_[3*lv+2].push_back(p[2]);
+                weights_[lv].push_back(V[lv]->weight());
+            }
+        }
+
+        /**
+         * \brief Gets the number of triangles.
+         * \return the number of triangles
+         */
+        index_t nb_triangles() const {
+            return coords_[0].size();
+        }
+
+        /**
+         * \brief Gets the number of facets.
+         * \return the number of facets
+         */
+        index_t nb_facets() const {
+            return facet_id_.size();
+        }
+
+        /**
+         * \brief Gets the identifier of a facet.
+         * \param[in] f the facet, in 0..nb_facets()-1
+         * \return the identifier passed to begin_facet()
+         */
+        index_t facet_id(index_t f) const {
+            return facet_id_[f];
+        }
+
+        /**
+         * \brief Gets the first triangle of a facet.
+         * \param[in] f the facet, in 0..nb_facets()-1
+         * \return the index of the first triangle of \p f
+         */
+        index_t facet_begin(index_t f) const {
+            return facet_begin_[f];
+        }
+
+        /**
+         * \brief Gets one past the last triangle of a facet.
+         * \param[in] f the facet, in 0..nb_facets()-1
+         * \return one past the index of the last triangle of \p f
+         */
+        index_t facet_end(index_t f) const {
+            return (f+1 == nb_facets()) ? nb_triangles() : facet_begin_[f+1];
+        }
+
+        /**
+         * \brief Gets a coordinate of a vertex for all the triangles.
+         * \param[in] lv local index of the vertex in the triangle, in 0..2
+         * \param[in] c the coordinate, in 0..2
+         * \return a pointer to nb_triangles() contiguous doubles
+         */
+        const double* coord(index_t lv, coord_index_t c) const {
+            return coords_[3*lv+c].data();
+        }
+
+        /**
+         * \brief Gets the weight of a vertex for all the triangles.
+         * \param[in] lv local index of the vertex in the triangle, in 0..2
+         * \return a pointer to nb_triangles() contiguous doubles
+         */
+        const double* weight(index_t lv) const {
+            return weights_[lv].data();
+        }
+
+        /**
+         * \brief Gets the measures computed by compute_volumes()
+         *  or compute_areas().
+         * \return a pointer to nb_triangles() contiguous doubles
+         */
+        const double* measures() const {
+            return measures_.data();
+        }
+
+        /**
+         * \brief Computes the volumes of the tetrahedra formed by a
+         *  point and each triangle.
+         * \param[in] p0 the apex of all the tetrahedra
+         * \param[in] is_signed if set, signed volumes are computed,
+         *  else absolute values
+         */
+        void compute_volumes(const double* p0, bool is_signed = false);
+
+        /**
+         * \brief Computes the areas of the triangles.
+         * \param[in] weighted if set, each area is multiplied by the
+         *  average weight of the vertices of the triangle
+         */
+        void compute_areas(bool weighted);
+
+        /**
+         * \brief Scalar version of compute_volumes().
+         * \details Does the same operations as compute_volumes() in
+         *  the same order, one triangle at a time. Results may only
+         *  differ if the compiler contracts products and sums into
+         *  fused multiply-adds. Used to check and benchmark the SIMD
+         *  version.
+         * \param[in] p0 the apex of all the tetrahedra
+         * \param[in] is_signed if set, signed volumes are computed,
+         *  else absolute values
+         */
+        void compute_volumes_scalar(const double* p0, bool is_signed = false);
+
+        /**
+         * \brief Scalar version of compute_areas().
+         * \param[in] weighted if set, each area is multiplied by the
+         *  average weight of the vertices of the triangle
+         */
+        void compute_areas_scalar(bool weighted);
+
+    private:
+        vector<double> coords_[9];
+        vector<double> weights_[3];
+        vector<double> measures_;
+        vector<index_t> facet_id_;
+        vector<index_t> facet_begin_;
+    };
+}
+
+#endif
@@ -0,0 +1,464 @@
+/*
+ *  Copyright (c) 2000-2022 Inria
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *  this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *  * Neither the name of the ALICE Project-Team nor the names of its
+ *  contributors may be used to endorse or promote products derived from this
+ *  software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  Contact: Bruno Levy
+ *
+ *     https://www.inria.fr/fr/bruno-levy
+ *
+ *     Inria,
+ *     Domaine de Voluceau,
+ *     78150 Le Chesnay - Rocquencourt
+ *     FRANCE
+ *
+ */
+
+#include <exploragram/optimal_transport/hessian.h>
+#include <geogram/delaunay/delaunay.h>
+#include <geogram/NL/nl.h>
+#include <geogram/NL/nl_matrix.h>
+#include <geogram/basic/process.h>
+
+#include <algorithm>
+
+namespace {
+    using namespace GEO;
+
+    /**
+     * \brief Computes a sparse matrix-vector product.
+     * \tparam T the type of the coefficients, float or double. Products
+     *  are accumulated in double precision.
+     * \param[in] n the number of rows
+     * \param[in] rowptr , colind , val the matrix, in compressed row
+     *  storage
+     * \param[in] x a pointer to n doubles
+     * \param[out] y a pointer to n doubles
+     */
+    template <class T> void mult_CSR_rows(
+        index_t n,
+        const index_t* rowptr, const index_t* colind, const T* val,
+        const double* x, double* y
+    ) {
+        parallel_for_slice(
+            0, n,
+            [=](index_t from, index_t to) {
+                for(index_t i=from; i<to; ++i) {
+                    double sum = 0.0;
+                    for(index_t jj=rowptr[i]; jj<rowptr[i+1]; ++jj) {
+                        sum += double(val[jj]) * x[colind[jj]];
+                    }
+                    y[i] = sum;
+                }
+            }
+        );
+    }
+}
+
+namespace GEO {
+
+    OTHessian::OTHessian() :
+        n_(0),
+        single_precision_(false),
+        assembling_(false),
+        by_rows_(false),
+        pattern_changed_(false) {
+        rowptr_.assign(1,0);
+    }
+
+    void OTHessian::clear() {
+        n_ = 0;
+        rowptr_.assign(1,0);
+        colind_.clear();
+        vector<double>().swap(val_);
+        vector<float>().swap(val_single_);
+        outside_pattern_.clear();
+        assembling_ = false;
+        by_rows_ = false;
+        pattern_changed_ = true;
+    }
+
+    void OTHessian::set_single_precision(bool x) {
+        if(x == single_precision_) {
+            return;
+        }
+        // During an assembly with add(), the values stay in double
+        // precision until end_assembly().
+        single_precision_ = x;
+        convert_values();
+    }
+
+    void OTHessian::convert_values() {
+        // Note: clear() keeps the capacity of a vector, swapping with
+        // an empty vector releases its memory.
+        if(values_in_double()) {
+            if(val_single_.size() != 0) {
+                val_.resize(val_single_.size());
+                for(index_t jj=0; jj<val_single_.size(); ++jj) {
+                    val_[jj] = double(val_single_[jj]);
+                }
+                vector<float>().swap(val_single_);
+            }
+        } else {
+            if(val_.size() != 0) {
+                val_single_.resize(val_.size());
+                for(index_t jj=0; jj<val_.size(); ++jj) {
+                    val_single_[jj] = float(val_[jj]);
+                }
+                vector<double>().swap(val_);
+            }
+        }
+    }
+
+    void OTHessian::clear_values() {
+        if(values_in_double()) {
+            val_.assign(colind_.size(), 0.0);
+            vector<float>().swap(val_single_);
+        } else {
+            val_single_.assign(colind_.size(), 0.0f);
+            vector<double>().swap(val_);
+        }
+    }
+
+    void OTHessian::begin_assembly(index_t n, bool by_rows) {
+        if(n != n_) {
+            clear();
+            n_ = n;
+            rowptr_.assign(n_+1, 0);
+        } else {
+            pattern_changed_ = false;
+        }
+        assembling_ = true;
+        by_rows_ = by_rows;
+        clear_values();
+        outside_pattern_.clear();
+    }
+
+    void OTHessian::set_pattern_from_Delaunay(
+        const Delaunay* delaunay,
+        index_t copies_begin,
+        const index_t* copies_ptr,
+        const index_t* copies_original
+    ) {
+        geo_assert(delaunay->nb_vertices() >= n_);
+
+        // Gets the neighbors j < n_ of vertex i, and in periodic mode
+        // the neighbors of all the copies of i, as original vertices.
+        auto get_row = [&](
+            index_t i, vector<index_t>& neighbors, vector<index_t>& row
+        ) {
+            row.resize(0);
+            index_t nb_copies =
+                (copies_ptr == nullptr) ? 0 : copies_ptr[i+1]-copies_ptr[i];
+            for(index_t k=0; k<=nb_copies; ++k) {
+                index_t v = (k == 0) ? i : copies_begin+copies_ptr[i]+k-1;
+                delaunay->get_neighbors(v, neighbors);
+                for(index_t j: neighbors) {
+                    if(copies_ptr != nullptr && j >= copies_begin) {
+                        j = copies_original[j - copies_begin];
+                    }
+                    if(j < n_ && j != i) {
+                        row.push_back(j);
+                    }
+                }
+            }
+            if(nb_copies != 0) {
+                std::sort(row.begin(), row.end());
+                row.erase(std::unique(row.begin(), row.end()), row.end());
+            }
+        };
+
+        // Row i = diagonal + all neighbors j < n_ of vertex i, sorted.
+        vector<index_t> new_rowptr(n_+1);
+        new_rowptr[0] = 0;
+        parallel_for_slice(
+            0, n_,
+            [&](index_t from, index_t to) {
+                vector<index_t> neighbors;
+                vector<index_t> row;
+                for(index_t i=from; i<to; ++i) {
+                    get_row(i, neighbors, row);
+                    new_rowptr[i+1] = row.size() + 1;
+                }
+            }
+        );
+        for(index_t i=0; i<n_; ++i) {
+            new_rowptr[i+1] += new_rowptr[i];
+        }
+
+        vector<index_t> new_colind(new_rowptr[n_]);
+        parallel_for_slice(
+            0, n_,
+            [&](index_t from, index_t to) {
+                vector<index_t> neighbors;
+                vector<index_t> row;
+                for(index_t i=from; i<to; ++i) {
+                    get_row(i, neighbors, row);
+                    index_t* dst = new_colind.data() + new_rowptr[i];
+                    index_t nb = 0;
+                    dst[nb] = i;
+                    ++nb;
+                    for(index_t j: row) {
+                        dst[nb] = j;
+                        ++nb;
+                    }
+                    std::sort(dst, dst+nb);
+                }
+            }
+        );
+
+        if(new_rowptr == rowptr_ && new_colind == colind_) {
+            return;
+        }
+
+        rowptr_.swap(new_rowptr);
+        colind_.swap(new_colind);
+        clear_values();
+        pattern_changed_ = true;
+    }
+
+    void OTHessian::add_outside_pattern(index_t i, index_t j, double a) {
+        std::lock_guard<std::mutex> lock(outside_pattern_lock_);
+        Coeff c;
+        c.i = i;
+        c.j = j;
+        c.a = a;
+        outside_pattern_.push_back(c);
+    }
+
+    void OTHessian::end_assembly() {
+        merge_outside_pattern();
+        assembling_ = false;
+        by_rows_ = false;
+        // In single precision mode, if the coefficients were accumulated
+        // in double precision by add(), they are rounded only once here.
+        convert_values();
+    }
+
+    void OTHessian::merge_outside_pattern() {
+        if(outside_pattern_.size() == 0) {
+            return;
+        }
+
+        std::sort(
+            outside_pattern_.begin(), outside_pattern_.end(),
+            [](const Coeff& c1, const Coeff& c2) {
+                return (c1.i < c2.i) || (c1.i == c2.i && c1.j < c2.j);
+            }
+        );
+
+        // Merge the (sorted) rows of the pattern with the (sorted)
+        // coefficients that were outside of it.
+        //   With add_rows() in single precision mode, the coefficients
+        // in the pattern are already rounded, and the ones outside of
+        // it are accumulated in double precision and rounded once.
+        bool in_double = values_in_double();
+        vector<index_t> new_rowptr(n_+1);
+        vector<index_t> new_colind;
+        vector<double> new_val;
+        vector<float> new_val_single;
+        index_t new_nnz = colind_.size() + outside_pattern_.size();
+        new_colind.reserve(new_nnz);
+        if(in_double) {
+            new_val.reserve(new_nnz);
+        } else {
+            new_val_single.reserve(new_nnz);
+        }
+
+        index_t k = 0;
+        new_rowptr[0] = 0;
+        for(index_t i=0; i<n_; ++i) {
+            index_t jj = rowptr_[i];
+            while(
+                jj < rowptr_[i+1] ||
+                (k < outside_pattern_.size() && outside_pattern_[k].i == i)
+            ) {
+                bool from_pattern =
+                    (jj < rowptr_[i+1]) && (
+                        k == outside_pattern_.size() ||
+                        outside_pattern_[k].i != i ||
+                        colind_[jj] <= outside_pattern_[k].j
+                    );
+                index_t j = from_pattern ? colind_[jj] : outside_pattern_[k].j;
+                double a = 0.0;
+                if(from_pattern) {
+                    a = val(jj);
+                    ++jj;
+                }
+                while(
+                    k < outside_pattern_.size() &&
+                    outside_pattern_[k].i == i &&
+                    outside_pattern_[k].j == j
+                ) {
+                    a += outside_pattern_[k].a;
+                    ++k;
+                }
+                new_colind.push_back(j);
+                if(in_double) {
+                    new_val.push_back(a);
+                } else {
+                    new_val_single.push_back(float(a));
+                }
+            }
+            new_rowptr[i+1] = new_colind.size();
+        }
+
+        rowptr_.swap(new_rowptr);
+        colind_.swap(new_colind);
+        if(in_double) {
+            val_.swap(new_val);
+        } else {
+            val_single_.swap(new_val_single);
+        }
+        outside_pattern_.clear();
+        pattern_changed_ = true;
+    }
+
+    void OTHessian::mult(const double* x, double* y) const {
+        if(!values_in_double()) {
+            mult_CSR_rows(
+                n_, rowptr_.data(), colind_.data(), val_single_.data(), x, y
+            );
+        } else {
+            mult_CSR_rows(
+                n_, rowptr_.data(), colind_.data(), val_.data(), x, y
+            );
+        }
+    }
+
+    void OTHessian::get_diagonal(double* diag) const {
+        for(index_t i=0; i<n_; ++i) {
+            diag[i] = 0.0;
+            for(index_t jj=rowptr_[i]; jj<rowptr_[i+1]; ++jj) {
+                if(colind_[jj] == i) {
+                    diag[i] = val(jj);
+                    break;
+                }
+            }
+        }
+    }
+
+    NLMatrix OTHessian::create_NL_matrix() const {
+        NLMatrix result = nlSparseMatrixNew(
+            NLuint(n_), NLuint(n_), NL_MATRIX_STORE_ROWS
+        );
+        NLSparseMatrix* M = reinterpret_cast<NLSparseMatrix*>(result);
+        for(index_t i=0; i<n_; ++i) {
+            for(index_t jj=rowptr_[i]; jj<rowptr_[i+1]; ++jj) {
+                nlSparseMatrixAdd(M, NLuint(i), NLuint(colind_[jj]), val(jj));
+            }
+        }
+        nlMatrixCompress(&result);
+        return result;
+    }
+
+    index_t OTHessian::solve_Jacobi_PCG(
+        const double* b, double* x,
+        double eps, index_t max_iter, double& error
+    ) const {
+        vector<double> inv_diag(n_);
+        get_diagonal(inv_diag.data());
+        for(index_t i=0; i<n_; ++i) {
+            inv_diag[i] = (inv_diag[i] == 0.0) ? 1.0 : 1.0 / inv_diag[i];
+        }
+        return solve_PCG(
+            [&](const double* r, double* z) {
+                for(index_t i=0; i<n_; ++i) {
+                    z[i] = inv_diag[i] * r[i];
+                }
+            },
+            b, x, eps, max_iter, error
+        );
+    }
+
+    index_t OTHessian::solve_PCG(
+        const Preconditioner& M,
+        const double* b, double* x,
+        double eps, index_t max_iter, double& error
+    ) const {
+        index_t n = n_;
+
+        vector<double> r(n);
+        vector<double> z(n);
+        vector<double> p(n);
+        vector<double> Hp(n);
+
+        mult(x, Hp.data());
+        double b_norm2 = 0.0;
+        double r_norm2 = 0.0;
+        for(index_t i=0; i<n; ++i) {
+            r[i] = b[i] - Hp[i];
+            b_norm2 += b[i]*b[i];
+            r_norm2 += r[i]*r[i];
+        }
+
+        if(b_norm2 == 0.0) {
+            Memory::clear(x, n*sizeof(double));
+            error = 0.0;
+            return 0;
+        }
+
+        M(r.data(), z.data());
+        double rz = 0.0;
+        for(index_t i=0; i<n; ++i) {
+            p[i] = z[i];
+            rz += r[i]*z[i];
+        }
+
+        double threshold2 = eps*eps*b_norm2;
+        index_t iter = 0;
+        while(r_norm2 > threshold2 && iter < max_iter) {
+            mult(p.data(), Hp.data());
+            double pHp = 0.0;
+            for(index_t i=0; i<n; ++i) {
+                pHp += p[i]*Hp[i];
+            }
+            if(pHp == 0.0) {
+                break;
+            }
+            double alpha = rz / pHp;
+            r_norm2 = 0.0;
+            for(index_t i=0; i<n; ++i) {
+                x[i] += alpha * p[i];
+                r[i] -= alpha * Hp[i];
+                r_norm2 += r[i]*r[i];
+            }
+            M(r.data(), z.data());
+            double rz_new = 0.0;
+            for(index_t i=0; i<n; ++i) {
+                rz_new += r[i]*z[i];
+            }
+            double beta = rz_new / rz;
+            rz = rz_new;
+            for(index_t i=0; i<n; ++i) {
+                p[i] = z[i] + beta * p[i];
+            }
+            ++iter;
+        }
+        error = ::sqrt(r_norm2 / b_norm2);
+        return iter;
+    }
+}
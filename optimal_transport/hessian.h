@@ -0,0 +1,456 @@
+/*
+ *  Copyright (c) 2000-2022 Inria
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *  this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *  * Neither the name of the ALICE Project-Team nor the names of its
+ *  contributors may be used to endorse or promote products derived from this
+ *  software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  Contact: Bruno Levy
+ *
+ *     https://www.inria.fr/fr/bruno-levy
+ *
+ *     Inria,
+ *     Domaine de Voluceau,
+ *     78150 Le Chesnay - Rocquencourt
+ *     FRANCE
+ *
+ */
+
+#ifndef H_EXPLORAGRAM_OPTIMAL_TRANSPORT_HESSIAN_H
+#define H_EXPLORAGRAM_OPTIMAL_TRANSPORT_HESSIAN_H
+
+#include <exploragram/basic/common.h>
+
+struct NLMatrixStruct;
+typedef NLMatrixStruct* NLMatrix;
+
+#include <mutex>
+#include <functional>
+
+/**
+ * \file exploragram/optimal_transport/hessian.h
+ * \brief Sparse Hessian used by the Newton solver for semi-discrete
+ *  optimal transport.
+ */
+
+namespace GEO {
+    class Delaunay;
+
+    /**
+     * \brief The Hessian of the objective function of semi-discrete
+     *  optimal transport, in compressed row storage.
+     * \details The sparsity pattern is the adjacency graph of the
+     *  Laguerre cells. It is kept from one Newton iteration to the next
+     *  one, and only the coefficients are rewritten when the adjacency
+     *  graph did not change. Coefficients that fall outside the current
+     *  sparsity pattern are gathered during assembly and merged into it
+     *  by end_assembly(). In single precision mode, coefficients are
+     *  accumulated in double precision and rounded once, they are stored
+     *  as floats during the solve, and products are accumulated in
+     *  double precision. When the coefficients are assembled with add(),
+     *  a temporary double precision array is used during assembly, and
+     *  the peak memory used by the values is 12 bytes per coefficient
+     *  in end_assembly() (8 bytes in double precision mode). When they
+     *  are assembled by RowBlock objects, each block of rows is
+     *  accumulated in a temporary double precision array of the size
+     *  of the block, and the values use 4 bytes per coefficient. Note
+     *  that the AMG preconditioner and the direct solvers make their
+     *  own double precision copy of the coefficients.
+     */
+    class EXPLORAGRAM_API OTHessian {
+    public:
+        /**
+         * \brief OTHessian constructor.
+         */
+        OTHessian();
+
+        /**
+         * \brief Gets the dimension.
+         * \return the number of rows (and columns) of the matrix.
+         */
+        index_t n() const {
+            return n_;
+        }
+
+        /**
+         * \brief Gets the number of stored coefficients.
+         * \return the number of entries in the sparsity pattern.
+         */
+        index_t nnz() const {
+            return colind_.size();
+        }
+
+        /**
+         * \brief Gets the row pointers.
+         * \return a pointer to the n()+1 indices of the first
+         *  coefficient of each row in colind() and val()
+         */
+        const index_t* rowptr() const {
+            return rowptr_.data();
+        }
+
+        /**
+         * \brief Gets the column indices.
+         * \return a pointer to the nnz() column indices, sorted
+         *  in each row
+         */
+        const index_t* colind() const {
+            return colind_.data();
+        }
+
+        /**
+         * \brief Gets the coefficients.
+         * \pre !single_precision()
+         * \return a pointer to the nnz() coefficients
+         */
+        const double* val() const {
+            geo_debug_assert(!single_precision_);
+            return val_.data();
+        }
+
+        /**
+         * \brief Gets the coefficients in single precision mode.
+         * \pre single_precision()
+         * \return a pointer to the nnz() coefficients
+         */
+        const float* val_single_precision() const {
+            geo_debug_assert(single_precision_);
+            return val_single_.data();
+        }
+
+        /**
+         * \brief Gets a coefficient.
+         * \param[in] jj the index of the coefficient, in 0 .. nnz()-1
+         * \return the value of the coefficient, in double precision
+         */
+        double val(index_t jj) const {
+            geo_debug_assert(jj < nnz());
+            return values_in_double() ? val_[jj] : double(val_single_[jj]);
+        }
+
+        /**
+         * \brief Specifies whether coefficients are stored in single
+         *  precision.
+         * \details Existing coefficients are converted. During assembly,
+         *  coefficients are always accumulated in double precision,
+         *  see begin_assembly().
+         * \param[in] x true if coefficients are stored as floats, false
+         *  if they are stored as doubles (default)
+         */
+        void set_single_precision(bool x);
+
+        /**
+         * \brief Tests whether coefficients are stored in single
+         *  precision.
+         * \retval true if coefficients are stored as floats
+         * \retval false if they are stored as doubles
+         */
+        bool single_precision() const {
+            return single_precision_;
+        }
+
+        /**
+         * \brief Tests whether the sparsity pattern changed during the
+         *  last assembly.
+         * \retval true if the sparsity pattern was created or modified
+         *  since the previous call of begin_assembly()
+         * \retval false otherwise.
+         */
+        bool pattern_changed() const {
+            return pattern_changed_;
+        }
+
+        /**
+         * \brief Clears the matrix, including its sparsity pattern.
+         */
+        void clear();
+
+        /**
+         * \brief Starts assembling the matrix.
+         * \details All the coefficients are reset to zero. The sparsity
+         *  pattern is kept if the dimension did not change.
+         * \param[in] n the dimension of the matrix
+         * \param[in] by_rows if set, the coefficients are only assembled
+         *  by RowBlock objects, and in single precision mode they are
+         *  stored as floats during assembly. Else they are assembled
+         *  with add(), and stored in double precision until
+         *  end_assembly().
+         */
+        void begin_assembly(index_t n, bool by_rows = false);
+
+        /**
+         * \brief Sets the sparsity pattern from the neighborhoods
+         *  of a Delaunay triangulation.
+         * \details Row i has the diagonal coefficient and one
+         *  coefficient per neighbor j < n() of vertex i. The pattern
+         *  is kept as is if it did not change. It needs to be called
+         *  between begin_assembly() and the first call to add().
+         *  If the triangulation has periodic copies of the vertices,
+         *  row i also has the coefficients of the neighbors of the
+         *  copies of i, and neighbors that are copies are replaced
+         *  with their original vertex.
+         * \param[in] delaunay the (regular) triangulation, that needs
+         *  to store its neighbors.
+         * \param[in] copies_begin index of the first periodic copy in
+         *  the triangulation
+         * \param[in] copies_ptr if non-null, the periodic copies of
+         *  vertex i are copies_begin + copies_ptr[i] ...
+         *  copies_begin + copies_ptr[i+1] - 1
+         * \param[in] copies_original if non-null, the original vertex
+         *  of each periodic copy
+         */
+        void set_pattern_from_Delaunay(
+            const Delaunay* delaunay,
+            index_t copies_begin = 0,
+            const index_t* copies_ptr = nullptr,
+            const index_t* copies_original = nullptr
+        );
+
+        /**
+         * \brief Adds a value to a coefficient.
+         * \details Calls from different threads need to lock row \p i.
+         * \param[in] i , j the indices of the coefficient
+         * \param[in] a the value to be added to the coefficient
+         */
+        void add(index_t i, index_t j, double a) {
+            geo_debug_assert(i < n_ && j < n_);
+            geo_debug_assert(assembling_ && values_in_double());
+            for(index_t jj=rowptr_[i]; jj<rowptr_[i+1]; ++jj) {
+                if(colind_[jj] == j) {
+                    val_[jj] += a;
+                    return;
+                }
+            }
+            add_outside_pattern(i,j,a);
+        }
+
+        /**
+         * \brief Accumulates all the contributions to a block of rows.
+         * \details The contributions are accumulated in double precision
+         *  in a temporary array of the size of the block, then added to
+         *  the coefficients by end(). Different threads need to use
+         *  disjoint blocks, and each block needs to be added only once
+         *  per assembly (in single precision mode, the coefficients are
+         *  rounded by end()). Requires begin_assembly() with by_rows
+         *  set in single precision mode.
+         */
+        class RowBlock {
+        public:
+            /**
+             * \brief RowBlock constructor.
+             * \param[in] H the matrix, being assembled
+             * \param[in] row_begin , row_end the block of rows
+             */
+            RowBlock(OTHessian& H, index_t row_begin, index_t row_end) :
+                H_(H),
+                row_begin_(row_begin),
+                row_end_(row_end),
+                base_(H.rowptr_[row_begin]) {
+                geo_debug_assert(H.assembling_);
+                geo_debug_assert(row_begin <= row_end && row_end <= H.n_);
+                if(!H_.values_in_double()) {
+                    work_.assign(H.rowptr_[row_end] - base_, 0.0);
+                }
+            }
+
+            /**
+             * \brief Adds a value to a coefficient.
+             * \param[in] i , j the indices of the coefficient, with
+             *  row_begin <= \p i < row_end
+             * \param[in] a the value to be added to the coefficient
+             */
+            void add(index_t i, index_t j, double a) {
+                geo_debug_assert(i >= row_begin_ && i < row_end_);
+                if(H_.values_in_double()) {
+                    H_.add(i,j,a);
+                    return;
+                }
+                geo_debug_assert(j < H_.n_);
+                for(index_t jj=H_.rowptr_[i]; jj<H_.rowptr_[i+1]; ++jj) {
+                    if(H_.colind_[jj] == j) {
+                        work_[jj - base_] += a;
+                        return;
+                    }
+                }
+                H_.add_outside_pattern(i,j,a);
+            }
+
+            /**
+             * \brief Adds the accumulated values to the coefficients.
+             */
+            void end() {
+                for(index_t k=0; k<work_.size(); ++k) {
+                    H_.val_single_[base_+k] += float(work_[k]);
+                }
+                work_.clear();
+            }
+
+        private:
+            OTHessian& H_;
+            index_t row_begin_;
+            index_t row_end_;
+            index_t base_;
+            vector<double> work_;
+        };
+
+        /**
+         * \brief Terminates the assembly.
+         * \details Merges the coefficients that were outside the
+         *  sparsity pattern, and converts the coefficients to floats in
+         *  single precision mode.
+         */
+        void end_assembly();
+
+        /**
+         * \brief Computes a matrix-vector product.
+         * \param[in] x a pointer to n() doubles
+         * \param[out] y a pointer to n() doubles, \f$ y \leftarrow H x \f$
+         */
+        void mult(const double* x, double* y) const;
+
+        /**
+         * \brief Gets the diagonal.
+         * \param[out] diag a pointer to n() doubles
+         */
+        void get_diagonal(double* diag) const;
+
+        /**
+         * \brief Creates an OpenNL matrix with the same coefficients.
+         * \details Used to call OpenNL direct solvers.
+         * \return a newly allocated matrix in CRS form, to be deleted
+         *  with nlDeleteMatrix()
+         */
+        NLMatrix create_NL_matrix() const;
+
+        /**
+         * \brief A preconditioner.
+         * \details Computes \f$ z \leftarrow M^{-1} r \f$, where
+         *  M is symmetric positive definite.
+         */
+        typedef std::function<void(const double* r, double* z)>
+        Preconditioner;
+
+        /**
+         * \brief Solves a linear system with the preconditioned
+         *  conjugate gradient.
+         * \param[in] M the preconditioner
+         * \param[in] b the right-hand side
+         * \param[in,out] x the initial guess on entry, the solution on exit
+         * \param[in] eps the maximum value of
+         *  \f$ \| Hx - b \| / \| b \| \f$
+         * \param[in] max_iter the maximum number of iterations
+         * \param[out] error the value of \f$ \| Hx - b \| / \| b \| \f$
+         * \return the number of used iterations
+         */
+        index_t solve_PCG(
+            const Preconditioner& M,
+            const double* b, double* x,
+            double eps, index_t max_iter, double& error
+        ) const;
+
+        /**
+         * \brief Solves a linear system with the Jacobi-preconditioned
+         *  conjugate gradient.
+         * \param[in] b the right-hand side
+         * \param[in,out] x the initial guess on entry, the solution on exit
+         * \param[in] eps the maximum value of
+         *  \f$ \| Hx - b \| / \| b \| \f$
+         * \param[in] max_iter the maximum number of iterations
+         * \param[out] error the value of \f$ \| Hx - b \| / \| b \| \f$
+         * \return the number of used iterations
+         */
+        index_t solve_Jacobi_PCG(
+            const double* b, double* x,
+            double eps, index_t max_iter, double& error
+        ) const;
+
+    protected:
+        /**
+         * \brief Adds a value to a coefficient that is outside of
+         *  the current sparsity pattern.
+         * \param[in] i , j the indices of the coefficient
+         * \param[in] a the value to be added to the coefficient
+         */
+        void add_outside_pattern(index_t i, index_t j, double a);
+
+        /**
+         * \brief Merges the coefficients that were outside the sparsity
+         *  pattern into it.
+         */
+        void merge_outside_pattern();
+
+        /**
+         * \brief Resets all the coefficients to zero.
+         * \details Only the array used by values_in_double() is
+         *  allocated, the memory of the other one is released.
+         */
+        void clear_values();
+
+        /**
+         * \brief Tests where the coefficients are currently stored.
+         * \retval true if they are in val_ (double precision mode, or
+         *  single precision mode during an assembly with add())
+         * \retval false if they are in val_single_
+         */
+        bool values_in_double() const {
+            return !single_precision_ || (assembling_ && !by_rows_);
+        }
+
+        /**
+         * \brief Moves the coefficients to the array used by
+         *  values_in_double(), and releases the memory of the other one.
+         */
+        void convert_values();
+
+        /**
+         * \brief A coefficient outside of the sparsity pattern.
+         */
+        struct Coeff {
+            index_t i;
+            index_t j;
+            double a;
+        };
+
+    private:
+        index_t n_;
+        vector<index_t> rowptr_;
+        vector<index_t> colind_;
+        vector<double> val_;
+        vector<float> val_single_;
+        bool single_precision_;
+        bool assembling_;
+        bool by_rows_;
+        bool pattern_changed_;
+        vector<Coeff> outside_pattern_;
+        std::mutex outside_pattern_lock_;
+
+        /** \brief Forbids copy. */
+        OTHessian(const OTHessian& rhs);
+
+        /** \brief Forbids copy. */
+        OTHessian& operator=(const OTHessian& rhs);
+    };
+}
+
+#endif
@@ -54,6 +54,7 @@
 #include <geogram/points/nn_search.h>
 #include <geogram/numerics/optimizer.h>
 #include <geogram/numerics/lbfgs_optimizers.h>
+#include <geogram/numerics/predicates.h>
 
 #include <geogram/basic/stopwatch.h>
 #include <geogram/basic/file_system.h>
@@ -67,21 +68,99 @@
 #include <geogram/bibliography/bibliography.h>
 
 
-namespace GEO {
+namespace {
+    using namespace GEO;
+
+    /**
+     * \brief The OptimalTransportMap that runs an optimizer in the
+     *  current thread.
+     * \details The optimizer callbacks are plain functions, without
+     *  any user data. Using a thread-local variable makes it possible
+     *  to run several OptimalTransportMap objects in different threads.
+     */
+    thread_local OptimalTransportMap* current_OTM = nullptr;
+
+    /**
+     * \brief Makes an OptimalTransportMap current in the calling thread
+     *  for the lifetime of this object.
+     */
+    class CurrentOTMScope {
+    public:
+        /**
+         * \brief CurrentOTMScope constructor.
+         * \param[in] OTM the OptimalTransportMap that will receive the
+         *  calls of the optimizer.
+         */
+        CurrentOTMScope(OptimalTransportMap* OTM) : previous_(current_OTM) {
+            current_OTM = OTM;
+        }
+
+        /**
+         * \brief CurrentOTMScope destructor.
+         * \details Restores the previously current OptimalTransportMap.
+         */
+        ~CurrentOTMScope() {
+            current_OTM = previous_;
+        }
+
+    private:
+        OptimalTransportMap* previous_;
+    };
 
-    OptimalTransportMap* OptimalTransportMap::instance_ = nullptr;
+    /**
+     * \brief Declares the references of the algorithm.
+     * \details Called only once, the bibliography is not thread-safe.
+     * \retval true
+     */
+    bool cite_OTM_references() {
+        geo_cite("DBLP:conf/compgeom/AurenhammerHA92");
+        geo_cite("DBLP:journals/cgf/Merigot11");
+        geo_cite("journals/M2AN/LevyNAL15");
+        return true;
+    }
+
+    /**
+     * \brief Tests whether the OpenNL extension used by a linear solver
+     *  could be initialized.
+     * \details Extensions are initialized once (function-local statics
+     *  are initialized in a thread-safe manner).
+     * \param[in] solver one of OT_PRECG, OT_SUPERLU, OT_CHOLMOD, OT_AMG
+     * \retval true if the solver can be used
+     * \retval false otherwise
+     */
+    bool linear_solver_is_available(OTLinearSolver solver) {
+        switch(solver) {
+        case OT_PRECG:
+        case OT_AMG:
+            return true;
+        case OT_SUPERLU: {
+            static bool has_superlu = (nlInitExtension("SUPERLU") == NL_TRUE);
+            return has_superlu;
+        }
+        case OT_CHOLMOD: {
+            static bool has_cholmod = (nlInitExtension("CHOLMOD") == NL_TRUE);
+            return has_cholmod;
+        }
+        }
+        return false;
+    }
+}
+
+namespace GEO {
 
     OptimalTransportMap::Callback::~Callback() {
     }
 
+    void OptimalTransportMap::Callback::update_kernel() {
+    }
+
     OptimalTransportMap::OptimalTransportMap(
         index_t dimension,
         Mesh* mesh, const std::string& delaunay, bool BRIO
     ) : mesh_(mesh) {
 
-        geo_cite("DBLP:conf/compgeom/AurenhammerHA92");
-        geo_cite("DBLP:journals/cgf/Merigot11");
-        geo_cite("journals/M2AN/LevyNAL15");
+        static bool cited = cite_OTM_references();
+        geo_argused(cited);
 
         dimension_ = dimension;
         dimp1_ = dimension_+1;
@@ -94,6 +173,8 @@ namespace GEO {
 
         // Note: we represent power diagrams as d+1 Voronoi diagrams
         delaunay_ = Delaunay::create(coord_index_t(dimp1_), delaunay);
+        // Neighborhoods give the sparsity pattern of the Hessian.
+        delaunay_->set_stores_neighbors(true);
 
         RVD_ = RestrictedVoronoiDiagram::create(delaunay_, mesh_);
         RVD_->set_volumetric(true);
@@ -109,7 +190,6 @@ namespace GEO {
         newton_ = false;
         verbose_ = true;
 
-        instance_ = nullptr;
         constant_nu_ = 0.0;
         total_mass_ = 0.0;
         current_call_iter_ = 0;
@@ -125,15 +205,35 @@ namespace GEO {
 
         w_did_not_change_ = false;
         measure_of_smallest_cell_ = 0.0;
+        nb_RVD_avoided_ = 0;
+        reuse_power_diagram_ = true;
+        points_changed_ = true;
         callback_ = nullptr;
         Laguerre_centroids_ = nullptr;
+        lifted_points_ = nullptr;
+        nb_lifted_points_ = 0;
+        reorder_points_ = false;
 
         linsolve_epsilon_ = 0.001;
         linsolve_maxiter_ = 1000;
+        prolongation_degree_ = 2;
+        prolongation_nb_neighbors_ = 0;
+
+        time_budget_ = 0.0;
+        deadline_ = 0.0;
+        solve_depth_ = 0;
+        cancel_requested_ = false;
+        interrupted_ = false;
+        inexact_Newton_ = false;
+        forcing_term_ = linsolve_epsilon_;
+        nb_linsolve_iter_ = 0;
 
         linesearch_maxiter_ = 100;
         linesearch_init_iter_ = 0;
 
+        checkpoint_every_ = 0;
+        restart_pending_ = false;
+
         linear_solver_ = OT_PRECG;
 
         nb_air_particles_ = 0;
@@ -142,9 +242,33 @@ namespace GEO {
         air_fraction_ = 0.0;
 
         clip_by_balls_ = false;
+        thread_local_assembly_ = false;
+
+        periodic_ = false;
+        periodic_margin_ = 0.0;
+        for(index_t c=0; c<3; ++c) {
+            period_origin_[c] = 0.0;
+            period_[c] = 0.0;
+        }
+        ghost_begin_ = index_t(-1);
 
         user_H_g_ = false;
         user_H_ = nullptr;
+
+        last_f_ = 0.0;
+        last_funcgrad_evaluated_ = false;
+
+        solution_ = nullptr;
+    }
+
+    OptimalTransportMap::OptimalTransportMap(
+        index_t dimension,
+        OptimalTransportTarget* target,
+        const std::string& delaunay, bool BRIO
+    ) : OptimalTransportMap(dimension, target->mesh(), delaunay, BRIO) {
+        geo_assert(target->dimension() == dimension);
+        target_ = target;
+        total_mass_ = target->total_mass();
     }
 
     OptimalTransportMap::~OptimalTransportMap() {
@@ -162,13 +286,44 @@ namespace GEO {
 
         index_t nb_total = nb_points + nb_air_particles_;
 
+        // Periodic copies are neither compatible with air particles nor
+        // with the continuous air mode (that clips the cells by balls).
+        geo_assert(!periodic_ || air_fraction_ == 0.0);
+
+        // The periodic copies of the previous points are discarded first,
+        // since external_index() maps them to their original point.
+        ghost_begin_ = index_t(-1);
+        ghost_ptr_.clear();
+        ghost_original_.clear();
+        ghost_translation_.clear();
+
+        // Internal order of the points (air particles are not reordered).
+        seed_order_.clear();
+        seed_rank_.clear();
+        if(reorder_points_ && nb_points > 1) {
+            seed_order_.resize(nb_points);
+            for(index_t i = 0; i < nb_points; ++i) {
+                seed_order_[i] = i;
+            }
+            compute_Hilbert_order(
+                nb_points, points, seed_order_, 0, nb_points,
+                dimension_, stride
+            );
+            seed_rank_.resize(nb_points);
+            for(index_t v = 0; v < nb_points; ++v) {
+                seed_rank_[seed_order_[v]] = v;
+            }
+        }
+
         // Note: we represent power diagrams as (d+1)-dim Voronoi diagrams.
         // The target points are lifted to (d+1)-dim.
         points_dimp1_.resize(nb_total * dimp1_);
+        points_changed_ = true;
         for(index_t i = 0; i < nb_points; ++i) {
             double* p = &points_dimp1_[i*dimp1_];
+            const double* q = &points[external_index(i)*stride];
             for(index_t c=0; c<dimension_; ++c) {
-                p[c] = points[i*stride+c];
+                p[c] = q[c];
             }
             p[dimension()] = 0.0; // Yes, dimension() and not dimension()-1
             // (for instance, in 2d, x->0, y->1, W->2)
@@ -181,13 +336,202 @@ namespace GEO {
             p[dimension()] = 0.0; // Yes, dimension() and not dimension()-1
             // (for instance, in 2d, x->0, y->1, W->2)
         }
-        weights_.assign(nb_points, 0);
+        if(periodic_) {
+            create_periodic_copies(nb_points);
+            nb_total += nb_periodic_copies();
+        }
+        lifted_points_ = points_dimp1_.data();
+        nb_lifted_points_ = nb_total;
+        reset_weights(nb_points);
+    }
+
+    void OptimalTransportMap::set_periodic(bool x, double margin) {
+        geo_assert(margin >= 0.0);
+        periodic_ = x;
+        periodic_margin_ = margin;
+        if(!periodic_) {
+            return;
+        }
+        vector<double> xyz_min(mesh_->vertices.dimension());
+        vector<double> xyz_max(mesh_->vertices.dimension());
+        get_bbox(*mesh_, xyz_min.data(), xyz_max.data());
+        for(index_t c=0; c<dimension_; ++c) {
+            period_origin_[c] = xyz_min[c];
+            period_[c] = xyz_max[c] - xyz_min[c];
+            geo_assert(period_[c] > 0.0);
+        }
+    }
+
+    void OptimalTransportMap::wrap_to_fundamental_domain(
+        double* points, index_t nb_points, index_t stride
+    ) const {
+        if(!periodic_) {
+            return;
+        }
+        if(stride == 0) {
+            stride = dimension_;
+        }
+        parallel_for_slice(
+            0, nb_points,
+            [this, points, stride](index_t from, index_t to) {
+                for(index_t i = from; i < to; ++i) {
+                    double* p = points + i*stride;
+                    for(index_t c = 0; c < dimension_; ++c) {
+                        double L = period_[c];
+                        double x = p[c] - period_origin_[c];
+                        x -= L * ::floor(x / L);
+                        // floor() may leave x = L because of roundoff.
+                        if(x >= L) {
+                            x -= L;
+                        }
+                        p[c] = period_origin_[c] + x;
+                    }
+                }
+            }
+        );
+    }
+
+    void OptimalTransportMap::create_periodic_copies(index_t nb_points) {
+        double margin = periodic_margin_;
+        if(margin == 0.0) {
+            double V = 1.0;
+            for(index_t c=0; c<dimension_; ++c) {
+                V *= period_[c];
+            }
+            margin = 2.5 * ::pow(
+                V / double(std::max(nb_points, index_t(1))),
+                1.0 / double(dimension_)
+            );
+        }
+        // Only the copies translated by -1, 0 or +1 period along each
+        // axis are generated.
+        for(index_t c=0; c<dimension_; ++c) {
+            margin = std::min(margin, period_[c]);
+        }
+
+        wrap_to_fundamental_domain(points_dimp1_.data(), nb_points, dimp1_);
+
+        index_t nb_translations = (dimension_ == 2) ? 9 : 27;
+        vector<double> copies;
+        ghost_ptr_.assign(nb_points+1, 0);
+        for(index_t v = 0; v < nb_points; ++v) {
+            const double* p = &points_dimp1_[v*dimp1_];
+            for(index_t t = 0; t < nb_translations; ++t) {
+                double T[3];
+                bool identity = true;
+                bool in_band = true;
+                index_t code = t;
+                for(index_t c=0; c<dimension_; ++c) {
+                    T[c] = (double(code % 3) - 1.0) * period_[c];
+                    code /= 3;
+                    identity = identity && (T[c] == 0.0);
+                    double x = p[c] + T[c];
+                    in_band = in_band &&
+                        x >= period_origin_[c] - margin &&
+                        x <= period_origin_[c] + period_[c] + margin;
+                }
+                if(identity || !in_band) {
+                    continue;
+                }
+                ghost_original_.push_back(v);
+                for(index_t c=0; c<dimension_; ++c) {
+                    ghost_translation_.push_back(T[c]);
+                    copies.push_back(p[c] + T[c]);
+                }
+            }
+            ghost_ptr_[v+1] = ghost_original_.size();
+        }
+
+        ghost_begin_ = nb_points + nb_air_particles_;
+        points_dimp1_.resize((ghost_begin_ + nb_periodic_copies()) * dimp1_);
+        for(index_t k = 0; k < nb_periodic_copies(); ++k) {
+            double* p = &points_dimp1_[(ghost_begin_ + k)*dimp1_];
+            for(index_t c=0; c<dimension_; ++c) {
+                p[c] = copies[k*dimension_+c];
+            }
+            p[dimension_] = 0.0;
+        }
+        if(verbose_) {
+            Logger::out("OTM") << "Periodic domain: "
+                               << nb_periodic_copies()
+                               << " copies of the points" << std::endl;
+        }
+    }
+
+    void OptimalTransportMap::set_points_view(
+        index_t nb_points, double* points
+    ) {
+        // Air particles and periodic copies would need to be appended
+        // to the points.
+        geo_assert(nb_air_particles_ == 0);
+        geo_assert(!periodic_);
+
+        points_dimp1_.clear();
+        points_dimp1_.shrink_to_fit();
+        seed_order_.clear();
+        seed_rank_.clear();
+        ghost_begin_ = index_t(-1);
+        ghost_ptr_.clear();
+        ghost_original_.clear();
+        ghost_translation_.clear();
+        lifted_points_ = points;
+        nb_lifted_points_ = nb_points;
+        points_changed_ = true;
+        for(index_t i = 0; i < nb_points; ++i) {
+            points[i*dimp1_ + dimension_] = 0.0;
+        }
+        reset_weights(nb_points);
+    }
+
+    void OptimalTransportMap::reset_weights(index_t nb_points) {
+        weights_.resize(nb_points);
+        restart_pending_ = false;
         constant_nu_ = (1.0 - air_fraction_) * total_mass_ / double(nb_points);
+        set_default_weights(nb_points);
+    }
+
+    bool OptimalTransportMap::set_default_weights(index_t n) {
+        double w0 = 0.0;
         if(air_fraction_ != 0.0 && nb_air_particles_ == 0) {
             // constant_nu_ = pi*R^2 -> R^2 = constant_nu_ / pi
             // TODO: volumetric case.
-            weights_.assign(nb_points, constant_nu_ / M_PI);
+            w0 = constant_nu_ / M_PI;
+        }
+        bool changed = false;
+        for(index_t i=0; i<n; ++i) {
+            changed = changed || (weights_[i] != w0);
+            weights_[i] = w0;
+        }
+        return changed;
+    }
+
+    index_t OptimalTransportMap::count_empty_cells(const double* w) {
+        index_t n = nb_points();
+        // funcgrad() works in the internal order of the points.
+        vector<double> wcopy(n);
+        for(index_t i=0; i<n; ++i) {
+            wcopy[internal_index(i)] = w[i];
+        }
+        vector<double> g(n);
+        double f = 0.0;
+        bool Newton_step = callback_->is_Newton_step();
+        callback_->set_Newton_step(false);
+        w_did_not_change_ = false;
+        funcgrad(n, wcopy.data(), f, g.data());
+        callback_->set_Newton_step(Newton_step);
+        return nbZ_;
+    }
+
+    bool OptimalTransportMap::has_hidden_points(const double* w) {
+        index_t n = nb_points();
+        // compute_power_diagram() works in the internal order of the points.
+        vector<double> wcopy(n);
+        for(index_t i=0; i<n; ++i) {
+            wcopy[internal_index(i)] = w[i];
         }
+        w_did_not_change_ = false;
+        compute_power_diagram(n, wcopy.data());
+        return has_hidden_seeds(n);
     }
 
     void OptimalTransportMap::set_nu(index_t i, double nu) {
@@ -195,14 +539,38 @@ namespace GEO {
         if(nu_.size() != weights_.size()) {
             nu_.assign(weights_.size(), 0.0);
         }
-        nu_[i] = nu;
+        nu_[internal_index(i)] = nu;
+    }
+
+    void OptimalTransportMap::to_external_order(
+        double* data, index_t dim
+    ) const {
+        if(seed_order_.size() == 0) {
+            return;
+        }
+        index_t n = seed_order_.size();
+        vector<double> internal(n*dim);
+        Memory::copy(internal.data(), data, n*dim*sizeof(double));
+        parallel_for_slice(
+            0, n,
+            [this, data, dim, &internal](index_t from, index_t to) {
+                for(index_t v = from; v < to; ++v) {
+                    index_t i = seed_order_[v];
+                    for(index_t c = 0; c < dim; ++c) {
+                        data[i*dim+c] = internal[v*dim+c];
+                    }
+                }
+            }
+        );
     }
 
     void OptimalTransportMap::optimize_full_Newton(
         index_t max_iterations, index_t n
     ) {
+        InterruptionScope interruption_scope(this);
+
         if(n == 0) {
-            n = index_t(points_dimp1_.size() / dimp1_) - nb_air_particles_;
+            n = nb_points();
         }
 
         vector<double> pk(n);
@@ -213,6 +581,15 @@ namespace GEO {
 
         double epsilon0 = 0.0;
         w_did_not_change_ = false;
+        nb_RVD_avoided_ = 0;
+        nb_linsolve_iter_ = 0;
+        telemetry_.begin_solve();
+
+        // Inexact Newton: the tolerance of the linear solve (forcing term)
+        // depends on the decrease of the norm of the gradient.
+        const double forcing_term_max = 0.5;
+        forcing_term_ = forcing_term_max;
+        double prev_g_norm = 0.0;
 
         if(max_iterations == 0) {
             if(Laguerre_centroids_ != nullptr) {
@@ -229,15 +606,53 @@ namespace GEO {
         index_t inner_iter = first_inner_iter;
         bool use_inner_iter_prediction = (first_inner_iter != 0);
 
-        for(index_t k=0; k<max_iterations; ++k) {
+        // Continue an interrupted solve (the weights were restored by
+        // restart_from_checkpoint()).
+        index_t first_k = 0;
+        if(restart_pending_) {
+            restart_pending_ = false;
+            if(restart_.direction.size() == n) {
+                first_k = restart_.iteration;
+                pk = restart_.direction;
+                epsilon0 = restart_.epsilon0;
+                forcing_term_ = restart_.forcing_term;
+                prev_g_norm = restart_.prev_g_norm;
+                first_inner_iter = restart_.first_inner_iter;
+                nb_linsolve_iter_ = restart_.nb_linsolve_iter;
+            } else {
+                Logger::warn("OTM")
+                    << "Checkpoint does not match the current level, "
+                    << "starting from the restored weights" << std::endl;
+            }
+        }
+
+        for(index_t k=first_k; k<max_iterations; ++k) {
+            if(must_stop()) {
+                break;
+            }
             if(verbose_) {
                 std::cerr << "======= k = " << k << std::endl;
             }
+            telemetry_.begin_iteration(k);
             xk=weights_;
 
             new_linear_system(n,pk.data());
             eval_func_grad_Hessian(n,xk.data(),fk,gk.data());
 
+            //   The initial weights (for instance from a warm start) can
+            // have empty cells, even if no seed is hidden. Then Newton
+            // cannot start from them, and starts from the default
+            // weights instead.
+            if(nbZ_ != 0 && k == first_k && set_default_weights(n)) {
+                Logger::warn("OTM")
+                    << nbZ_ << " empty cell(s) with the initial weights, "
+                    << "starting from the default weights" << std::endl;
+                xk = weights_;
+                w_did_not_change_ = false;
+                new_linear_system(n,pk.data());
+                eval_func_grad_Hessian(n,xk.data(),fk,gk.data());
+            }
+
             if(k == 0) {
                 newiteration();
             }
@@ -260,8 +675,35 @@ namespace GEO {
             if(nbZ_ != 0) {
                 std::cerr << "There were empty cells !!!!!!" << std::endl;
                 std::cerr << "FATAL error, exiting Newton" << std::endl;
+                telemetry_.end_iteration();
                 return;
             }
+
+            if(must_stop()) {
+                telemetry_.end_iteration();
+                break;
+            }
+
+            if(inexact_Newton_) {
+                // Eisenstat-Walker, choice 2 (gamma = 0.9, alpha = 2),
+                // with the safeguard that prevents the forcing term from
+                // decreasing too fast.
+                if(prev_g_norm != 0.0) {
+                    double prev_forcing_term = forcing_term_;
+                    forcing_term_ = 0.9 * geo_sqr(g_norm_ / prev_g_norm);
+                    double safeguard = 0.9 * geo_sqr(prev_forcing_term);
+                    if(safeguard > 0.1) {
+                        forcing_term_ = std::max(forcing_term_, safeguard);
+                    }
+                }
+                forcing_term_ = std::min(forcing_term_, forcing_term_max);
+                forcing_term_ = std::max(forcing_term_, linsolve_epsilon_);
+                prev_g_norm = g_norm_;
+                if(verbose_) {
+                    Logger::out("OTM") << "   Linear solve tolerance: "
+                                       << forcing_term_ << std::endl;
+                }
+            }
             solve_linear_system();
 
             if(verbose_) {
@@ -277,9 +719,25 @@ namespace GEO {
                 alphak /= pow(2.0, double(first_inner_iter));
             }
 
+            double line_search_start = OTTelemetry::now();
+
+            // Whether g_norm_ and measure_of_smallest_cell_ correspond
+            // to the current weights (steps rejected because of hidden
+            // seeds are not evaluated).
+            bool weights_evaluated = true;
+
             for(inner_iter=first_inner_iter;
                 inner_iter < linesearch_maxiter_; ++inner_iter
                ) {
+                if(must_stop()) {
+                    // Go back to the last accepted iterate.
+                    weights_ = xk;
+                    g_norm_ = gknorm;
+                    w_did_not_change_ = false;
+                    compute_power_diagram(n, weights_.data());
+                    break;
+                }
+
                 if(verbose_) {
                     std::cerr << "      inner iter = "
                               << inner_iter << std::endl;
@@ -289,6 +747,24 @@ namespace GEO {
                 for(index_t i=0; i<n; ++i) {
                     weights_[i] = xk[i] + alphak * pk[i];
                 }
+                weights_evaluated = false;
+
+                // A hidden seed has an empty cell: the step can be
+                // rejected from the regular triangulation, without
+                // computing the restricted power diagram.
+                compute_power_diagram(n, weights_.data());
+                if(has_hidden_seeds(n)) {
+                    if(verbose_) {
+                        std::cerr << "hidden seed, rejected step"
+                                  << std::endl;
+                    }
+                    ++nb_RVD_avoided_;
+                    ++telemetry_.current().nb_RVD_avoided;
+                    ++telemetry_.current().nb_rejected_steps;
+                    alphak /= 2.0;
+                    continue;
+                }
+                w_did_not_change_ = true;
 
                 // Compute cell measures and nbZ.
                 if(Laguerre_centroids_ != nullptr) {
@@ -300,6 +776,8 @@ namespace GEO {
                 if(Laguerre_centroids_ != nullptr) {
                     callback_->set_Laguerre_centroids(nullptr);
                 }
+                w_did_not_change_ = false;
+                weights_evaluated = true;
 
                 if(verbose_) {
                     std::cerr << "cell measure :"
@@ -324,9 +802,48 @@ namespace GEO {
                     break;
                 }
                 // Else we halve the step.
+                ++telemetry_.current().nb_rejected_steps;
                 alphak /= 2.0;
             }
 
+            if(interrupted_) {
+                telemetry_.end_iteration();
+                break;
+            }
+
+            //   If the line search was exhausted by steps rejected
+            // because of hidden seeds, the last step is kept as before,
+            // but it is evaluated so that the gradient norm and the
+            // measure of the smallest cell are not the ones of a
+            // previous step.
+            if(!weights_evaluated) {
+                if(verbose_) {
+                    std::cerr << "line search exhausted, evaluating last step"
+                              << std::endl;
+                }
+                // The power diagram was computed for these weights.
+                w_did_not_change_ = true;
+                if(Laguerre_centroids_ != nullptr) {
+                    callback_->set_Laguerre_centroids(Laguerre_centroids_);
+                }
+                funcgrad(n,weights_.data(),fk,gk.data());
+                if(Laguerre_centroids_ != nullptr) {
+                    callback_->set_Laguerre_centroids(nullptr);
+                }
+                w_did_not_change_ = false;
+            }
+
+            {
+                OTIterationStats& stats = telemetry_.current();
+                stats.line_search_time =
+                    OTTelemetry::now() - line_search_start;
+                stats.nb_line_search_steps =
+                    std::min(inner_iter+1, linesearch_maxiter_) -
+                    first_inner_iter;
+                stats.smallest_cell_measure = measure_of_smallest_cell_;
+                stats.gradient_norm = g_norm_;
+            }
+
             if(use_inner_iter_prediction) {
                 if(inner_iter <= 2) {
                     first_inner_iter = 0;
@@ -338,22 +855,36 @@ namespace GEO {
             }
 
             newiteration();
+            telemetry_.end_iteration();
             if(converged) {
                 break;
             }
+            save_checkpoint(
+                k+1, pk, epsilon0, prev_g_norm, first_inner_iter
+            );
             // No need to update the power diagram at next iteration,
             // since we will evaluate the Hessian for the same weight
             // vector.
             w_did_not_change_ = true;
         }
+        if(verbose_) {
+            Logger::out("OTM") << "Total linear solver iterations: "
+                               << nb_linsolve_iter_ << std::endl;
+        }
+        if(verbose_ && nb_RVD_avoided_ != 0) {
+            Logger::out("OTM") << "Avoided " << nb_RVD_avoided_
+                               << " RVD evaluations in line search"
+                               << std::endl;
+        }
         if(save_RVD_last_iter_) {
             save_RVD(current_iter_);
         }
     }
 
     void OptimalTransportMap::optimize(index_t max_iterations) {
+        InterruptionScope interruption_scope(this);
 
-        index_t n = index_t(points_dimp1_.size() / dimp1_) - nb_air_particles_;
+        index_t n = nb_points();
 
         // Sanity check
         if(nu_.size() != 0) {
@@ -374,7 +905,7 @@ namespace GEO {
                     << std::endl;
             }
             FOR(i,n) {
-                set_nu(i, nu(i) * total_mass_ / total_nu);
+                nu_[i] = nu(i) * total_mass_ / total_nu;
             }
 
             total_nu = 0.0;
@@ -394,6 +925,8 @@ namespace GEO {
             return;
         }
 
+        // L-BFGS only restarts from the restored weights.
+        restart_pending_ = false;
         level_ = 0;
         index_t m = 7;
         Optimizer_var optimizer = Optimizer::create("HLBFGS");
@@ -408,15 +941,24 @@ namespace GEO {
         optimizer->set_N(n);
         optimizer->set_M(m);
         optimizer->set_max_iter(max_iterations);
-        instance_ = this;
         current_call_iter_ = 0;
         current_iter_ = 0;
 
-        callback_->set_eval_F(true);
-        optimizer->optimize(weights_.data());
-        callback_->set_eval_F(false);
+        last_iterate_.assign(weights_.data(), weights_.data() + n);
+        last_f_ = 0.0;
+        last_funcgrad_evaluated_ = false;
+        {
+            CurrentOTMScope scope(this);
+            callback_->set_eval_F(true);
+            optimizer->optimize(weights_.data());
+            callback_->set_eval_F(false);
+        }
+        if(interrupted_) {
+            Memory::copy(
+                weights_.data(), last_iterate_.data(), n*sizeof(double)
+            );
+        }
 
-        instance_ = nullptr;
         // To make sure everything is reset properly
         double dummy = 0;
         funcgrad(n, weights_.data(), dummy, nullptr);
@@ -433,10 +975,11 @@ namespace GEO {
     void OptimalTransportMap::optimize_level(
         index_t b, index_t e, index_t max_iterations
     ) {
+        InterruptionScope interruption_scope(this);
 
         // If this is not the first level, propagate the weights from
-        // the lower levels.
-        if(b != 0) {
+        // the lower levels (unless they were restored from a checkpoint).
+        if(b != 0 && !restart_pending_) {
 
             //   Create a nearest neighbor search data structure
             // and insert the [0..b) samples into it (they were
@@ -444,41 +987,67 @@ namespace GEO {
             NearestNeighborSearch_var NN =
                 NearestNeighborSearch::create(coord_index_t(dimension()));
 
-            NN->set_points(b, points_dimp1_.data(), dimp1_);
-            index_t degree = 2; // CmdLine::get_arg_uint("fitting_degree");
+            NN->set_points(b, lifted_points_, dimp1_);
+            index_t degree = prolongation_degree_;
+
+            // The new points [b,e) only read the weights of [0,b), they
+            // are processed in parallel. Each slice has its own
+            // LinearLeastSquares and neighbors buffers. The queries
+            // are issued one point at a time, since NearestNeighborSearch
+            // has no batched query (the search is const and thread-safe,
+            // and the slices are the unit of parallelism).
 
             // If degree \notin {1,2}, use weight of nearest sample
             if(degree < 1 || degree > 2) {
-                for(index_t i = b; i < e; ++i) {
-                    weights_[i] =
-                        weights_[
-                            NN->get_nearest_neighbor(&points_dimp1_[dimp1_ * i])
-                        ];
-                }
+                parallel_for_slice(
+                    b, e,
+                    [this, &NN](index_t from, index_t to) {
+                        for(index_t i = from; i < to; ++i) {
+                            weights_[i] = weights_[
+                                NN->get_nearest_neighbor(
+                                    &lifted_points_[dimp1_ * i]
+                                )
+                            ];
+                        }
+                    }
+                );
             } else {
 
                 //   If degree \in {1,2} use linear least squares to
                 // compute an estimate of the weight function.
-                LinearLeastSquares LLS(degree);
-                for(index_t i = b; i < e; ++i) {
-                    const index_t nb = 10 * degree;
-                    index_t neighbor[100];
-                    double dist[100];
-                    NN->get_nearest_neighbors(
-                        nb, &points_dimp1_[dimp1_ * i], neighbor, dist
-                    );
-                    LLS.begin();
-                    for(index_t jj = 0; jj < nb; ++jj) {
-                        if(dist[jj] != 0.0) {
-                            index_t j = neighbor[jj];
-                            LLS.add_point(
-                                &points_dimp1_[dimp1_ * j], weights_[j]
+                index_t nb = prolongation_nb_neighbors_;
+                if(nb == 0) {
+                    nb = 10 * degree;
+                }
+                nb = std::min(nb, b);
+                parallel_for_slice(
+                    b, e,
+                    [this, &NN, degree, nb](index_t from, index_t to) {
+                        LinearLeastSquares LLS(degree);
+                        vector<index_t> neighbor(nb);
+                        vector<double> dist(nb);
+                        for(index_t i = from; i < to; ++i) {
+                            NN->get_nearest_neighbors(
+                                nb, &lifted_points_[dimp1_ * i],
+                                neighbor.data(), dist.data()
+                            );
+                            LLS.begin();
+                            for(index_t jj = 0; jj < nb; ++jj) {
+                                if(dist[jj] != 0.0) {
+                                    index_t j = neighbor[jj];
+                                    LLS.add_point(
+                                        &lifted_points_[dimp1_ * j],
+                                        weights_[j]
+                                    );
+                                }
+                            }
+                            LLS.end();
+                            weights_[i] = LLS.eval(
+                                &lifted_points_[dimp1_ * i]
                             );
                         }
                     }
-                    LLS.end();
-                    weights_[i] = LLS.eval(&points_dimp1_[dimp1_ * i]);
-                }
+                );
             }
         }
 
@@ -495,6 +1064,8 @@ namespace GEO {
             return;
         }
 
+        // L-BFGS only restarts from the restored weights.
+        restart_pending_ = false;
         index_t m = 7;
         Optimizer_var optimizer = Optimizer::create("HLBFGS");
 
@@ -507,12 +1078,21 @@ namespace GEO {
         optimizer->set_N(n);
         optimizer->set_M(m);
         optimizer->set_max_iter(max_iterations);
-        instance_ = this;
         current_call_iter_ = 0;
-        callback_->set_eval_F(true);
-        optimizer->optimize(weights_.data());
-        callback_->set_eval_F(false);
-        instance_ = nullptr;
+        last_iterate_.assign(weights_.data(), weights_.data() + n);
+        last_f_ = 0.0;
+        last_funcgrad_evaluated_ = false;
+        {
+            CurrentOTMScope scope(this);
+            callback_->set_eval_F(true);
+            optimizer->optimize(weights_.data());
+            callback_->set_eval_F(false);
+        }
+        if(interrupted_) {
+            Memory::copy(
+                weights_.data(), last_iterate_.data(), n*sizeof(double)
+            );
+        }
 
         // To make sure everything is reset properly
         double dummy = 0;
@@ -522,6 +1102,14 @@ namespace GEO {
     void OptimalTransportMap::optimize_levels(
         const vector<index_t>& levels, index_t max_iterations
     ) {
+        InterruptionScope interruption_scope(this);
+        if(seed_order_.size() != 0 || periodic_) {
+            Logger::warn("OTM")
+                << "Reordered or periodic points do not have levels, "
+                << "optimizing all points at once" << std::endl;
+            optimize(max_iterations);
+            return;
+        }
         if(verbose_) {
             if(levels.size() > 2) {
                 Logger::out("OTM") << "Using " << levels.size()-1
@@ -530,7 +1118,12 @@ namespace GEO {
                 Logger::out("OTM") << "Using 1 level" << std::endl;
             }
         }
-        for(index_t l = 0; l + 1 < levels.size(); ++l) {
+        // Skip the levels that were optimized before the checkpoint.
+        index_t first_level = 0;
+        if(restart_pending_ && restart_.level != 0) {
+            first_level = restart_.level - 1;
+        }
+        for(index_t l = first_level; l + 1 < levels.size(); ++l) {
             level_ = l+1;
             index_t b = levels[l];
             index_t e = levels[l + 1];
@@ -540,6 +1133,9 @@ namespace GEO {
             }
             RVD_->delaunay()->set_BRIO_levels(brio_levels);
             optimize_level(b, e, max_iterations);
+            if(interrupted_) {
+                break;
+            }
         }
         if(save_RVD_last_iter_) {
             save_RVD(current_iter_);
@@ -549,18 +1145,72 @@ namespace GEO {
     void OptimalTransportMap::funcgrad_CB(
         index_t n, double* x, double& f, double* g
     ) {
-        instance_->funcgrad(n, x, f, g);
+        geo_assert(current_OTM != nullptr);
+        // A null gradient makes the optimizer stop. The point x is not
+        // evaluated: the optimizer sees the last evaluated value of f,
+        // and newiteration_CB() does not keep x.
+        if(current_OTM->must_stop()) {
+            current_OTM->last_funcgrad_evaluated_ = false;
+            f = current_OTM->last_f_;
+            Memory::clear(g, n*sizeof(double));
+            return;
+        }
+        current_OTM->funcgrad(n, x, f, g);
+        current_OTM->last_funcgrad_evaluated_ = true;
+        current_OTM->last_f_ = f;
     }
 
     void OptimalTransportMap::newiteration_CB(
         index_t n, const double* x, double f, const double* g, double gnorm
     ) {
-        geo_argused(n);
-        geo_argused(x);
         geo_argused(f);
         geo_argused(g);
-        geo_argused(gnorm);
-        instance_->newiteration();
+        geo_assert(current_OTM != nullptr);
+        // The optimizer was stopped by funcgrad_CB(), x was not evaluated.
+        if(!current_OTM->last_funcgrad_evaluated_) {
+            return;
+        }
+        // Keep the accepted iterate, restored if the optimizer
+        // is interrupted.
+        current_OTM->last_iterate_.assign(x, x+n);
+        current_OTM->g_norm_ = gnorm;
+        current_OTM->newiteration();
+    }
+
+    OptimalTransportMap::InterruptionScope::InterruptionScope(
+        OptimalTransportMap* OTM
+    ) : OTM_(OTM) {
+        if(OTM_->solve_depth_ == 0) {
+            OTM_->interrupted_ = false;
+            OTM_->deadline_ = (OTM_->time_budget_ == 0.0) ? 0.0 :
+                OTTelemetry::now() + OTM_->time_budget_;
+        }
+        ++OTM_->solve_depth_;
+    }
+
+    OptimalTransportMap::InterruptionScope::~InterruptionScope() {
+        --OTM_->solve_depth_;
+        if(OTM_->solve_depth_ == 0 && OTM_->interrupted_) {
+            OTM_->cancel_requested_ = false;
+        }
+    }
+
+    bool OptimalTransportMap::must_stop() {
+        if(interrupted_) {
+            return true;
+        }
+        if(cancel_requested_) {
+            interrupted_ = true;
+            if(verbose_) {
+                Logger::out("OTM") << "Solve cancelled" << std::endl;
+            }
+        } else if(deadline_ != 0.0 && OTTelemetry::now() > deadline_) {
+            interrupted_ = true;
+            if(verbose_) {
+                Logger::out("OTM") << "Time budget exhausted" << std::endl;
+            }
+        }
+        return interrupted_;
     }
 
     void OptimalTransportMap::newiteration() {
@@ -574,6 +1224,63 @@ namespace GEO {
         ++current_iter_;
     }
 
+    bool OptimalTransportMap::restart_from_checkpoint(
+        const std::string& filename
+    ) {
+        restart_pending_ = false;
+        if(!restart_.load(filename)) {
+            return false;
+        }
+        if(
+            restart_.dimension != dimension_ ||
+            restart_.weights.size() != nb_points()
+        ) {
+            Logger::err("OTM") << filename
+                               << ": checkpoint does not match the points"
+                               << std::endl;
+            restart_.clear();
+            return false;
+        }
+        weights_.swap(restart_.weights);
+        restart_.weights.clear();
+        current_iter_ = restart_.current_iter;
+        g_norm_ = restart_.g_norm;
+        restart_pending_ = true;
+        if(verbose_) {
+            Logger::out("OTM") << "Restarting from " << filename
+                               << " (level " << restart_.level
+                               << ", iteration " << restart_.iteration
+                               << ")" << std::endl;
+        }
+        return true;
+    }
+
+    void OptimalTransportMap::save_checkpoint(
+        index_t iteration, const vector<double>& direction,
+        double epsilon0, double prev_g_norm, index_t first_inner_iter
+    ) {
+        if(checkpoint_every_ == 0 || iteration % checkpoint_every_ != 0) {
+            return;
+        }
+        OTCheckpoint checkpoint;
+        checkpoint.dimension = dimension_;
+        checkpoint.level = level_;
+        checkpoint.iteration = iteration;
+        checkpoint.current_iter = current_iter_;
+        checkpoint.nb_linsolve_iter = nb_linsolve_iter_;
+        checkpoint.first_inner_iter = first_inner_iter;
+        checkpoint.epsilon0 = epsilon0;
+        checkpoint.forcing_term = forcing_term_;
+        checkpoint.prev_g_norm = prev_g_norm;
+        checkpoint.g_norm = g_norm_;
+        checkpoint.weights = weights_;
+        checkpoint.direction = direction;
+        if(checkpoint.save(checkpoint_filename_) && verbose_) {
+            Logger::out("OTM") << "Saved checkpoint " << checkpoint_filename_
+                               << std::endl;
+        }
+    }
+
     void OptimalTransportMap::save_RVD(index_t id) {
         Mesh RVD_mesh;
         get_RVD(RVD_mesh);
@@ -587,6 +1294,159 @@ namespace GEO {
         );
     }
 
+    void OptimalTransportMap::compute_power_diagram(
+        index_t n, const double* w
+    ) {
+        // Step 1: determine the (dim+1)d embedding from the weights
+        double W = 0.0;
+        for(index_t p = 0; p < n; ++p) {
+            W = std::max(W, w[p]);
+        }
+        for(index_t p = 0; p < n; ++p) {
+            // Yes, dimension_ and not dimension_ -1,
+            // for instance in 2d, x->0, y->1, W->2
+            lifted_points_[dimp1_ * p + dimension_] = ::sqrt(W - w[p]);
+        }
+        if(nb_air_particles_ != 0) {
+            for(index_t p = 0; p < nb_air_particles_; ++p) {
+                lifted_points_[dimp1_ * (n + p) + dimension_] =
+                    ::sqrt(W - 0.0);
+            }
+        }
+        // The periodic copies of a point share its weight.
+        geo_assert(nb_periodic_copies() == 0 || n == nb_points());
+        for(index_t k = 0; k < nb_periodic_copies(); ++k) {
+            lifted_points_[dimp1_ * (ghost_begin_ + k) + dimension_] =
+                ::sqrt(W - w[ghost_original_[k]]);
+        }
+
+        // Step 2: compute the regular triangulation
+        Stopwatch* SW = nullptr;
+        if(newton_) {
+            if(verbose_) {
+                SW = new Stopwatch("Power diagram");
+                Logger::out("OTM") << "In power diagram..."
+                                   << std::endl;
+            }
+        }
+        double start = OTTelemetry::now();
+        index_t nb_vertices = n + nb_air_particles_ + nb_periodic_copies();
+        if(
+            reuse_power_diagram_ && !points_changed_ &&
+            power_diagram_is_regular(nb_vertices)
+        ) {
+            // The vertices of the triangulation point to lifted_points_,
+            // that was updated in place.
+            ++telemetry_.current().nb_power_diagrams_reused;
+        } else {
+            delaunay_->set_vertices(nb_vertices, lifted_points_);
+            points_changed_ = false;
+        }
+        ++telemetry_.current().nb_power_diagrams;
+        telemetry_.current().power_diagram_time += OTTelemetry::now() - start;
+        if(verbose_ && newton_) {
+            delete SW;
+        }
+    }
+
+    bool OptimalTransportMap::power_diagram_is_regular(
+        index_t nb_vertices
+    ) const {
+        if(
+            delaunay_->nb_vertices() != nb_vertices ||
+            delaunay_->vertex_ptr(0) != lifted_points_ ||
+            delaunay_->nb_cells() == 0 ||
+            delaunay_->cell_size() != dimp1_
+        ) {
+            return false;
+        }
+
+        // A hidden vertex may reappear, this requires a new triangulation.
+        for(index_t i=0; i<nb_vertices; ++i) {
+            if(delaunay_->nb_neighbors(i) == 0) {
+                return false;
+            }
+        }
+
+        std::atomic<bool> regular(true);
+        parallel_for_slice(
+            0, delaunay_->nb_cells(),
+            [this, &regular](index_t from, index_t to) {
+                const double* p[5];
+                double h[5];
+                for(index_t c=from; c<to && regular; ++c) {
+                    for(index_t lf=0; lf<dimp1_; ++lf) {
+                        signed_index_t c2 = delaunay_->cell_adjacent(c,lf);
+                        // Each facet is tested once, borders have no
+                        // neighbor.
+                        if(c2 < 0 || index_t(c2) < c) {
+                            continue;
+                        }
+                        index_t opposite = index_t(-1);
+                        for(index_t lf2=0; lf2<dimp1_; ++lf2) {
+                            if(
+                                delaunay_->cell_adjacent(index_t(c2),lf2) ==
+                                signed_index_t(c)
+                            ) {
+                                opposite = index_t(
+                                    delaunay_->cell_vertex(index_t(c2),lf2)
+                                );
+                                break;
+                            }
+                        }
+                        geo_assert(opposite != index_t(-1));
+                        for(index_t lv=0; lv<dimp1_; ++lv) {
+                            index_t v = index_t(delaunay_->cell_vertex(c,lv));
+                            p[lv] = delaunay_->vertex_ptr(v);
+                        }
+                        p[dimp1_] = delaunay_->vertex_ptr(opposite);
+                        // Lifted coordinate of the regular triangulation:
+                        // |p|^2 + t^2, where t = sqrt(W - w) is the last
+                        // coordinate of the point (in lifted_points_,
+                        // the triangulation points to it). It is computed
+                        // here rather than read from the triangulation,
+                        // whose cached heights are stale.
+                        for(index_t lv=0; lv<=dimp1_; ++lv) {
+                            h[lv] = 0.0;
+                            for(index_t coord=0; coord<dimp1_; ++coord) {
+                                h[lv] += geo_sqr(p[lv][coord]);
+                            }
+                        }
+                        Sign s = (dimension_ == 2) ?
+                            PCK::orient_2dlifted_SOS(
+                                p[0],p[1],p[2],p[3],h[0],h[1],h[2],h[3]
+                            ) :
+                            PCK::orient_3dlifted_SOS(
+                                p[0],p[1],p[2],p[3],p[4],
+                                h[0],h[1],h[2],h[3],h[4]
+                            ) ;
+                        // Positive means that the opposite vertex is in
+                        // conflict with the cell.
+                        if(s > 0) {
+                            regular = false;
+                            break;
+                        }
+                    }
+                }
+            }
+        );
+        return regular;
+    }
+
+    bool OptimalTransportMap::has_hidden_seeds(index_t n) const {
+        // A triangulation without any cell is degenerate (less than
+        // dimension+1 points), nothing can be deduced from it.
+        if(delaunay_->nb_cells() == 0) {
+            return false;
+        }
+        for(index_t i=0; i<n; ++i) {
+            if(delaunay_->nb_neighbors(i) == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
     void OptimalTransportMap::funcgrad(
         index_t n, double* w, double& f, double* g
     ) {
@@ -601,44 +1461,14 @@ namespace GEO {
         // then it is at the same point as the latest function and gradient
         // evaluation (see Yang Liu's CVT-Newton code).
         if(update_fg && !w_did_not_change_) {
-            // Step 1: determine the (dim+1)d embedding from the weights
-            double W = 0.0;
-            for(index_t p = 0; p < n; ++p) {
-                W = std::max(W, w[p]);
-            }
-            for(index_t p = 0; p < n; ++p) {
-                // Yes, dimension_ and not dimension_ -1,
-                // for instance in 2d, x->0, y->1, W->2
-                points_dimp1_[dimp1_ * p + dimension_] = ::sqrt(W - w[p]);
-            }
-            if(nb_air_particles_ != 0) {
-                for(index_t p = 0; p < nb_air_particles_; ++p) {
-                    points_dimp1_[dimp1_ * (n + p) + dimension_] =
-                        ::sqrt(W - 0.0);
-                }
-            }
-
-            // Step 2: compute function and gradient
-            {
-                Stopwatch* SW = nullptr;
-                if(newton_) {
-                    if(verbose_) {
-                        SW = new Stopwatch("Power diagram");
-                        Logger::out("OTM") << "In power diagram..."
-                                           << std::endl;
-                    }
-                }
-                delaunay_->set_vertices(
-                    (n + nb_air_particles_), points_dimp1_.data()
-                );
-                if(verbose_ && newton_) {
-                    delete SW;
-                }
-            }
+            compute_power_diagram(n, w);
         }
 
         if(is_Newton_step) {
+            double start = OTTelemetry::now();
             update_sparsity_pattern();
+            telemetry_.current().Hessian_assembly_time +=
+                OTTelemetry::now() - start;
         }
 
         if(g == nullptr) {
@@ -667,13 +1497,48 @@ namespace GEO {
             );
         }
 
+        // The user-defined Hessian (compute_P1_Laplacian()) is a dynamic
+        // OpenNL matrix, and always uses spinlocks.
+        bool thread_local_assembly = thread_local_assembly_ && !user_H_g_;
+        if(thread_local_assembly) {
+            assembly_buffers_.begin(
+                Process::maximum_concurrent_threads(), n,
+                callback_->has_Laguerre_centroids() ? dimension_ : 0
+            );
+            callback_->set_assembly_buffers(&assembly_buffers_);
+        }
+
         {
             Stopwatch* W = nullptr;
             if(verbose_ && newton_) {
                 W = new Stopwatch("RVD");
                 Logger::out("OTM") << "In RVD (funcgrad)..." << std::endl;
             }
+            double start = OTTelemetry::now();
             call_callback_on_RVD();
+            double RVD_end = OTTelemetry::now();
+            telemetry_.current().RVD_time += RVD_end - start;
+            if(thread_local_assembly) {
+                //   The Hessian is assembled by blocks of rows, the
+                // regularization is added to the buffers so that its
+                // coefficients are rounded once in single precision.
+                if(is_Newton_step && epsilon_regularization_ != 0.0) {
+                    for(index_t p = 0; p < n; ++p) {
+                        assembly_buffers_.add_coefficient(
+                            0, p, p, epsilon_regularization_*nu(p)
+                        );
+                    }
+                }
+                assembly_buffers_.end(
+                    g,
+                    callback_->Laguerre_centroids(),
+                    is_Newton_step ? rhs_.data() : nullptr,
+                    is_Newton_step ? &H_ : nullptr
+                );
+                callback_->set_assembly_buffers(nullptr);
+                telemetry_.current().Hessian_assembly_time +=
+                    OTTelemetry::now() - RVD_end;
+            }
             if(verbose_ && newton_) {
                 delete W;
             }
@@ -686,6 +1551,10 @@ namespace GEO {
                     callback_->Laguerre_centroids()[dimension_*v+c] /= g[v];
                 }
             }
+            wrap_to_fundamental_domain(
+                callback_->Laguerre_centroids(), nb_points()
+            );
+            to_external_order(callback_->Laguerre_centroids(), dimension_);
         }
 
         index_t nb_empty_cells = 0;
@@ -755,9 +1624,11 @@ namespace GEO {
             }
             if(is_Newton_step) {
                 for(index_t p = 0; p < n; ++p) {
-                    add_ij_coefficient(
-                        p,p,epsilon_regularization_*nu(p)
-                    );
+                    if(!thread_local_assembly) {
+                        add_ij_coefficient(
+                            p,p,epsilon_regularization_*nu(p)
+                        );
+                    }
                     add_i_right_hand_side(
                         p,-epsilon_regularization_*nu(p)*w[p]
                     );
@@ -819,6 +1690,118 @@ namespace GEO {
         ++current_call_iter_;
     }
 
+    void OptimalTransportMap::finalize(const FinalOutputs& outputs) {
+        index_t n = nb_points();
+        index_t nb_threads = Process::maximum_concurrent_threads();
+
+        vector<double> masses;
+        double* m = outputs.masses;
+        if(m == nullptr) {
+            masses.assign(n, 0.0);
+            m = masses.data();
+        } else {
+            Memory::clear(m, n*sizeof(double));
+        }
+
+        // The first moments of the transport plan are computed by the
+        // kernels that compute the centroids.
+        vector<double> centroids;
+        double* mg = outputs.centroids;
+        if(
+            mg == nullptr &&
+            outputs.transport_plan != nullptr &&
+            outputs.transport_plan_moments
+        ) {
+            centroids.assign(n*dimension_, 0.0);
+            mg = centroids.data();
+        }
+        if(mg != nullptr) {
+            Memory::clear(mg, n*sizeof(double)*dimension_);
+        }
+
+        // The callback is shared with the solver, its state is
+        // restored at the end.
+        double* callback_mg = callback_->Laguerre_centroids();
+        bool is_Newton_step = callback_->is_Newton_step();
+        bool eval_F = callback_->eval_F();
+
+        callback_->set_w(weights_.data(), n);
+        callback_->set_g(m);
+        callback_->set_nb_threads(nb_threads);
+        callback_->set_Laguerre_centroids(mg);
+        callback_->set_Newton_step(false);
+        callback_->set_eval_F(false);
+
+        if(thread_local_assembly_) {
+            assembly_buffers_.begin(
+                nb_threads, n, mg != nullptr ? dimension_ : 0
+            );
+            callback_->set_assembly_buffers(&assembly_buffers_);
+        }
+
+        if(outputs.transport_plan != nullptr) {
+            outputs.transport_plan->begin_assembly(
+                nb_threads, n, nb_background_elements(),
+                outputs.transport_plan_moments ? dimension_ : 0
+            );
+            callback_->set_transport_plan(outputs.transport_plan);
+        }
+
+        OTRVDMeshBuffers RVD_buffers;
+        if(outputs.RVD != nullptr) {
+            RVD_buffers.begin(nb_threads);
+            callback_->set_RVD_mesh_buffers(&RVD_buffers);
+        }
+
+        {
+            Stopwatch* W = nullptr;
+            if(verbose_) {
+                W = new Stopwatch("RVD");
+                Logger::out("OTM") << "In RVD (finalize)..." << std::endl;
+            }
+            call_callback_on_RVD();
+            if(thread_local_assembly_) {
+                assembly_buffers_.end(m, mg, nullptr, nullptr);
+            }
+            if(outputs.transport_plan != nullptr) {
+                outputs.transport_plan->end_assembly();
+            }
+            if(outputs.RVD != nullptr) {
+                RVD_buffers.end(*outputs.RVD);
+            }
+            if(verbose_) {
+                delete W;
+            }
+        }
+
+        callback_->set_assembly_buffers(nullptr);
+        callback_->set_transport_plan(nullptr);
+        callback_->set_RVD_mesh_buffers(nullptr);
+        callback_->set_Laguerre_centroids(callback_mg);
+        callback_->set_Newton_step(is_Newton_step);
+        callback_->set_eval_F(eval_F);
+
+        if(outputs.centroids != nullptr) {
+            for(index_t v=0; v<n; ++v) {
+                for(index_t c=0; c<dimension_; ++c) {
+                    outputs.centroids[dimension_*v+c] /= m[v];
+                }
+            }
+            wrap_to_fundamental_domain(outputs.centroids, n);
+            to_external_order(outputs.centroids, dimension_);
+        }
+        if(outputs.masses != nullptr) {
+            to_external_order(outputs.masses, 1);
+        }
+    }
+
+    index_t OptimalTransportMap::nb_background_elements() const {
+        if(mesh_->cells.nb() != 0) {
+            return mesh_->cells.nb();
+        }
+        return mesh_->facets.nb();
+    }
+
     void OptimalTransportMap::eval_func_grad_Hessian(
         index_t n, const double* w, double& f, double* g
     ) {
@@ -833,93 +1816,118 @@ namespace GEO {
     //  not have duplicated computations, i.e.
     //    - Power diagrams when leaving and entering iteration ?
     //    - Centroids: do we restart a RVD computation ?
-    // TODO: are we obliged to create/destroy OpenNL context for each system ?
-    // TODO: we could have an OpenNL buffer for the RHS of the Newton solve ?
-    //   Not really, because this is *minus* the gradient.
 
     void OptimalTransportMap::update_sparsity_pattern() {
-        // Does nothing for now,
-        // (we let OpenNL discover the sparsity pattern)
-        // Tryed smarter things, but was not faster...
+        if(!user_H_g_) {
+            if(nb_periodic_copies() == 0) {
+                H_.set_pattern_from_Delaunay(delaunay_);
+            } else {
+                H_.set_pattern_from_Delaunay(
+                    delaunay_, ghost_begin_,
+                    ghost_ptr_.data(), ghost_original_.data()
+                );
+            }
+        }
     }
 
     void OptimalTransportMap::new_linear_system(index_t n, double* x) {
-        nlNewContext();
+        if(!linear_solver_is_available(linear_solver_)) {
+            linear_solver_ = OT_PRECG;
+            Logger::warn("OTM") << "Could not initialize OpenNL extension"
+                                << std::endl;
+            Logger::warn("OTM") << "Falling back to conjugate gradient"
+                                << std::endl;
+        }
 
-        if(linear_solver_ != OT_PRECG) {
+        // With thread-local assembly, the Hessian is assembled by blocks
+        // of rows (see OTAssemblyBuffers::end()).
+        H_.begin_assembly(n, thread_local_assembly_ && !user_H_g_);
+        rhs_.assign(n, 0.0);
+        solution_ = x;
+    }
+
+    void OptimalTransportMap::solve_linear_system() {
+        Stopwatch W("Linear solve", false);
+        index_t used_iters = 0;
+        double error = 0.0;
+        double eps = inexact_Newton_ ? forcing_term_ : linsolve_epsilon_;
+
+        double start = OTTelemetry::now();
+        H_.end_assembly();
+        double assembly_end = OTTelemetry::now();
+        telemetry_.current().Hessian_assembly_time += assembly_end - start;
+
+        // Note: the sparsity pattern of H_ is kept from one Newton
+        // step to the next one, but OpenNL does not let us keep the
+        // symbolic factorization, so direct solvers redo it each time.
+        NLMatrix F = nullptr;
+        if(linear_solver_ == OT_SUPERLU || linear_solver_ == OT_CHOLMOD) {
+            NLMatrix M = H_.create_NL_matrix();
             if(linear_solver_ == OT_SUPERLU) {
-                if(nlInitExtension("SUPERLU") != NL_TRUE) {
-                    linear_solver_ = OT_PRECG;
-                }
-            } else if(linear_solver_ == OT_CHOLMOD) {
-                if(nlInitExtension("CHOLMOD") != NL_TRUE) {
-                    linear_solver_ = OT_PRECG;
-                }
+                F = nlMatrixFactorize(M, NL_PERM_SUPERLU_EXT);
+            } else {
+                F = nlMatrixFactorize(M, NL_CHOLMOD_EXT);
             }
-            if(linear_solver_ == OT_PRECG) {
-                Logger::warn("OTM") << "Could not initialize OpenNL extension"
-                                    << std::endl;
-                Logger::warn("OTM") << "Falling back to conjugate gradient"
+            nlDeleteMatrix(M);
+        }
+
+        if(linear_solver_ == OT_AMG) {
+            bool reused = AMG_.setup(H_);
+            if(verbose_) {
+                Logger::out("OTM") << "AMG: " << AMG_.nb_levels()
+                                   << " levels, coarsest: "
+                                   << AMG_.level_size(AMG_.nb_levels()-1)
+                                   << (reused ? " (reused hierarchy)" : "")
+                                   << std::endl;
+            }
+            used_iters = H_.solve_PCG(
+                [&](const double* r, double* z) {
+                    AMG_.apply(r,z);
+                },
+                rhs_.data(), solution_,
+                eps, linsolve_maxiter_, error
+            );
+        } else if(F != nullptr) {
+            nlMultMatrixVector(F, rhs_.data(), solution_);
+            nlDeleteMatrix(F);
+        } else {
+            if(linear_solver_ != OT_PRECG) {
+                Logger::warn("OTM") << "Factorization failed, "
+                                    << "falling back to conjugate gradient"
                                     << std::endl;
             }
+            used_iters = H_.solve_Jacobi_PCG(
+                rhs_.data(), solution_,
+                eps, linsolve_maxiter_, error
+            );
         }
 
-        if(verbose_) {
-            nlEnable(NL_VERBOSE);
+        {
+            OTIterationStats& stats = telemetry_.current();
+            stats.linear_solve_time += OTTelemetry::now() - assembly_end;
+            stats.nb_CG_iterations += used_iters;
+            stats.linear_solve_tolerance = eps;
+            stats.linear_solve_error = error;
         }
 
-        nlSolverParameteri(NL_NB_VARIABLES, NLint(n));
-        switch(linear_solver_) {
-        case OT_PRECG:
-            nlSolverParameteri(NL_SOLVER, NL_CG);
-            nlSolverParameteri(NL_PRECONDITIONER, NL_PRECOND_JACOBI);
-            nlSolverParameteri(NL_SYMMETRIC, NL_TRUE);
-            nlSolverParameterd(NL_THRESHOLD, linsolve_epsilon_);
-            nlSolverParameteri(NL_MAX_ITERATIONS, NLint(linsolve_maxiter_));
-
-            break;
-        case OT_SUPERLU:
-            nlSolverParameteri(NL_SOLVER, NL_PERM_SUPERLU_EXT);
-            break;
-        case OT_CHOLMOD:
-            nlSolverParameteri(NL_SOLVER, NL_CHOLMOD_EXT);
-            break;
-        }
-        nlEnable(NL_VARIABLES_BUFFER);
-        nlEnable(NL_NO_VARIABLES_INDIRECTION);
-        nlBegin(NL_SYSTEM);
-        nlBindBuffer(NL_VARIABLES_BUFFER, 0, x, NLuint(sizeof(double)));
-        nlBegin(NL_MATRIX);
-    }
+        nb_linsolve_iter_ += used_iters;
 
-    void OptimalTransportMap::solve_linear_system() {
-        nlEnd(NL_MATRIX);
-        nlEnd(NL_SYSTEM);
-        nlSolve();
         if(verbose_) {
-            int used_iters;
-            double elapsed_time;
-            double gflops;
-            double error;
-            nlGetIntegerv(NL_USED_ITERATIONS, &used_iters);
-            nlGetDoublev(NL_ELAPSED_TIME, &elapsed_time);
-            nlGetDoublev(NL_GFLOPS, &gflops);
-            nlGetDoublev(NL_ERROR, &error);
             std::cerr << "   "
                       << used_iters << " iters in "
-                      << elapsed_time << " seconds "
-                      << gflops << " GFlop/s"
+                      << W.elapsed_time() << " seconds "
                       << "  ||Ax-b||/||b||="
                       << error
+                      << "  nnz=" << H_.nnz()
+                      << (H_.pattern_changed() ? "" : " (same pattern)")
                       << std::endl;
         }
-        nlDeleteContext(nlGetCurrent());
     }
 
     void OptimalTransportMap::compute_P1_Laplacian(
         const double* w, NLMatrix Laplacian, double* measures
     ) {
-        index_t n = index_t(points_dimp1_.size() / dimp1_) - nb_air_particles_;
+        index_t n = nb_points();
 
         if(measures != nullptr) {
             Memory::clear(measures, n*sizeof(double));
@@ -929,25 +1937,10 @@ namespace GEO {
         user_H_ = Laplacian;
         callback_->set_Newton_step(true);
 
-        // Step 1: determine the (dim+1)d embedding from the weights
-        double W = 0.0;
-        for(index_t p = 0; p < n; ++p) {
-            W = std::max(W, w[p]);
-        }
-        for(index_t p = 0; p < n; ++p) {
-            // Yes, dimension_ and not dimension_ -1,
-            // for instance in 2d, x->0, y->1, W->2
-            points_dimp1_[dimp1_ * p + dimension_] = ::sqrt(W - w[p]);
-        }
-
-        if(nb_air_particles_ != 0) {
-            for(index_t p = 0; p < nb_air_particles_; ++p) {
-                points_dimp1_[dimp1_ * (n + p) + dimension_] = ::sqrt(W - 0.0);
-            }
-        }
+        // Step 1: compute the power diagram
+        compute_power_diagram(n, w);
 
         // Step 2: compute Laplacian and cell measures.
-        delaunay_->set_vertices((n + nb_air_particles_), points_dimp1_.data());
         callback_->set_w(w,n);
         callback_->set_g(measures);
         callback_->set_nb_threads(Process::maximum_concurrent_threads());
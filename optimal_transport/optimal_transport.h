@@ -41,6 +41,16 @@
 #define H_EXPLORAGRAM_OPTIMAL_TRANSPORT_OPTIMAL_TRANSPORT_H
 
 #include <exploragram/basic/common.h>
+#include <exploragram/optimal_transport/hessian.h>
+#include <exploragram/optimal_transport/assembly_buffers.h>
+#include <exploragram/optimal_transport/amg.h>
+#include <exploragram/optimal_transport/telemetry.h>
+#include <exploragram/optimal_transport/transport_plan.h>
+#include <exploragram/optimal_transport/rvd_mesh_buffers.h>
+#include <exploragram/optimal_transport/transport_target.h>
+#include <exploragram/optimal_transport/checkpoint.h>
+
+#include <atomic>
 
 struct NLMatrixStruct;
 typedef NLMatrixStruct* NLMatrix;
@@ -49,9 +59,12 @@ namespace GEO {
     /**
      * \brief Specifies the linear solver to be used
      *  with OptimalTransport.
+     * \details OT_PRECG is the Jacobi-preconditioned conjugate gradient,
+     *  OT_AMG the conjugate gradient preconditioned with algebraic
+     *  multigrid, OT_SUPERLU and OT_CHOLMOD are direct solvers.
      */
     enum OTLinearSolver {
-        OT_PRECG, OT_SUPERLU, OT_CHOLMOD
+        OT_PRECG, OT_SUPERLU, OT_CHOLMOD, OT_AMG
     };
 }
 
@@ -60,6 +73,7 @@ namespace GEO {
 #include <geogram/mesh/mesh.h>
 #include <geogram/voronoi/RVD.h>
 #include <geogram/delaunay/delaunay.h>
+#include <geogram/basic/process.h>
 #include <geogram/NL/nl.h>
 #include <geogram/NL/nl_matrix.h>
 #include <geogram/third_party/HLBFGS/HLBFGS.h>
@@ -87,6 +101,10 @@ namespace GEO {
      *   - Earlier article on OT and power diagrams:
      *    F. Aurenhammer, F. Hoffmann, and B. Aronov. Minkowski-type theorems
      *    and least-squares clustering. Algorithmica, 20:61-76, 1998.
+     *
+     *  The state of the solver is stored in the OptimalTransportMap
+     *  object, thus different OptimalTransportMap objects can be
+     *  optimized concurrently in different threads.
      */
     class EXPLORAGRAM_API OptimalTransportMap {
     public:
@@ -103,6 +121,27 @@ namespace GEO {
         bool BRIO = false
     );
 
+    /**
+     * \brief OptimalTransportMap constructor with a shared background mesh.
+     * \details The mass of the background mesh is taken from \p target,
+     *  that can be shared by several OptimalTransportMap objects. Each
+     *  OptimalTransportMap still has its own Delaunay triangulation and
+     *  restricted Voronoi diagram. OptimalTransportTarget is
+     *  reference-counted, and the counter is not thread-safe, thus the
+     *  maps that share a target should be created and destroyed by the
+     *  same thread (they can be optimized in different threads).
+     * \param[in] target the background mesh and its precomputed
+     *  masses. Its dimension is \p dimension.
+     * \param[in] delaunay factory name of the Delaunay triangulation.
+     * \param[in] BRIO true if vertices are already ordered using BRIO
+     */
+    OptimalTransportMap(
+        index_t dimension,
+        OptimalTransportTarget* target,
+        const std::string& delaunay = "default",
+        bool BRIO = false
+    );
+
     /**
      * \brief OptimalTransportMap destructor.
      */
@@ -124,6 +163,15 @@ namespace GEO {
         return *mesh_;
     }
 
+    /**
+     * \brief Gets the shared background mesh.
+     * \return a pointer to the OptimalTransportTarget specified to the
+     *  constructor, or nullptr if the map was constructed from a Mesh
+     */
+    OptimalTransportTarget* target() const {
+        return target_;
+    }
+
     /**
      * \brief Sets whether Newton algorithm should be used.
      * \details It is (for now) incompatible with multilevel.
@@ -149,6 +197,25 @@ namespace GEO {
         index_t nb_points, const double* points, index_t stride=0
     );
 
+    /**
+     * \brief Sets the points that define the target distribution,
+     *  without copying them.
+     * \details The regular triangulation and the restricted Laguerre
+     *  diagram directly use \p points. They need interleaved
+     *  (dimension()+1)d points, thus each point has dimension()+1
+     *  doubles: its coordinates, then a slot where the lifted coordinate
+     *  derived from the weight is stored. The caller keeps ownership of
+     *  \p points, that needs to remain valid until the next call to
+     *  set_points() or set_points_view(). The last slot of each point
+     *  is written by this OptimalTransportMap and should not be modified.
+     *  When the points move, set_points_view() needs to be called again
+     *  (this does not copy anything). Air particles are not supported
+     *  in this mode.
+     * \param[in] nb_points number of points in the target distribution
+     * \param[in,out] points an array of size nb_points * (dimension()+1)
+     */
+    void set_points_view(index_t nb_points, double* points);
+
     /**
      * \brief Sets the air particles that define the volume occupied by the
      *  free space.
@@ -190,6 +257,92 @@ namespace GEO {
         return nb_air_particles_;
     }
 
+    /**
+     * \brief Specifies whether the domain is periodic.
+     * \details In periodic mode, the domain is the torus obtained by
+     *  identifying the opposite faces of the bounding box of the mesh
+     *  (that needs to be a box in 3d or a rectangle in 2d). The points
+     *  are wrapped into the box by set_points(). Each point closer to
+     *  the border than \p margin is copied, translated by the period,
+     *  so that the regular triangulation sees the neighbors of the
+     *  Laguerre cells across the border. The copies share the weight of
+     *  their original point and the parts of their Laguerre cells are
+     *  integrated as parts of the cell of the original point. The
+     *  gradient, the Hessian, the transport plan and the restricted
+     *  Laguerre diagram refer to the original points only, and the
+     *  centroids are wrapped into the box. Not compatible with
+     *  air particles and air fraction, with set_points_view() and with
+     *  optimize_levels().
+     * \param[in] x true if the domain is periodic, false otherwise
+     *  (default). Taken into account by the next call to set_points().
+     * \param[in] margin width of the band around the box where the
+     *  points are copied. The Laguerre cells of the points need to be
+     *  smaller than the margin. If 0 (default), 2.5 times the average
+     *  spacing of the points is used.
+     */
+    void set_periodic(bool x, double margin = 0.0);
+
+    /**
+     * \brief Tests whether the domain is periodic.
+     * \return true if the domain is periodic, false otherwise
+     */
+    bool periodic() const {
+        return periodic_;
+    }
+
+    /**
+     * \brief Gets the total number of periodic copies of the points.
+     * \return the number of periodic copies, that are stored after
+     *  the points (and the air particles) in the regular triangulation
+     */
+    index_t nb_periodic_copies() const {
+        return ghost_original_.size();
+    }
+
+    /**
+     * \brief Gets the number of periodic copies of a point.
+     * \param[in] v the internal index of the point
+     * \return the number of periodic copies of \p v
+     */
+    index_t nb_periodic_copies(index_t v) const {
+        return (v+1 < ghost_ptr_.size()) ?
+            ghost_ptr_[v+1] - ghost_ptr_[v] : 0;
+    }
+
+    /**
+     * \brief Gets a periodic copy of a point.
+     * \param[in] v the internal index of the point
+     * \param[in] k the index of the copy, in 0..nb_periodic_copies(v)-1
+     * \return the index of the copy in the regular triangulation
+     */
+    index_t periodic_copy(index_t v, index_t k) const {
+        geo_debug_assert(k < nb_periodic_copies(v));
+        return ghost_begin_ + ghost_ptr_[v] + k;
+    }
+
+    /**
+     * \brief Gets the point that a vertex of the regular triangulation
+     *  is a copy of.
+     * \param[in] v the index of a vertex of the regular triangulation
+     * \return the internal index of the original point if \p v is a
+     *  periodic copy, \p v otherwise
+     */
+    index_t original_seed(index_t v) const {
+        return (v < ghost_begin_) ? v : ghost_original_[v - ghost_begin_];
+    }
+
+    /**
+     * \brief Gets the translation from a point to one of its periodic
+     *  copies.
+     * \param[in] v the index of a periodic copy in the regular
+     *  triangulation
+     * \return a pointer to the dimension() coordinates of the translation
+     */
+    const double* periodic_translation(index_t v) const {
+        geo_debug_assert(v >= ghost_begin_);
+        return &ghost_translation_[dimension_ * (v - ghost_begin_)];
+    }
+
     /**
      * \brief Sets the desired mass at one of the Diracs.
      * \details If unspecified, then default value is total mass
@@ -238,6 +391,32 @@ namespace GEO {
         linsolve_maxiter_ = maxiter;
     }
 
+    /**
+     * \brief Specifies whether the tolerance of the linear solve
+     *  adapts to the convergence of the Newton solver.
+     * \details In inexact Newton mode, the tolerance of the conjugate
+     *  gradient is a forcing term computed at each iteration from the
+     *  decrease of the norm of the gradient (Eisenstat-Walker, choice 2).
+     *  Linear systems are solved loosely far from the solution and
+     *  more and more accurately near convergence, never more accurately
+     *  than the tolerance specified by set_linsolve_epsilon(). It does
+     *  not change anything for direct solvers.
+     * \param[in] x true to use inexact Newton, false to solve all
+     *  linear systems with the same tolerance (default)
+     */
+    void set_inexact_Newton(bool x) {
+        inexact_Newton_ = x;
+    }
+
+    /**
+     * \brief Gets the number of iterations of the linear solver.
+     * \return the total number of iterations of the conjugate gradient
+     *  in the last call to optimize_full_Newton()
+     */
+    index_t nb_linsolve_iterations() const {
+        return nb_linsolve_iter_;
+    }
+
     /**
      * \brief Sets the maximum number of line search iterations.
      * \param[in] maxiter the maximum number of step length reduction
@@ -273,15 +452,55 @@ namespace GEO {
 
     /**
      * \brief Specifies whether a direct solver should be used.
-     * \param[in] solver one of OT_PRECG (default), OT_SUPERLU, OT_CHOLMOD.
+     * \param[in] solver one of OT_PRECG (default), OT_SUPERLU, OT_CHOLMOD,
+     *  OT_AMG.
      * \details The direct solvers (OT_SUPERLU, OT_CHOLMOD) are recommended only for
      *  surfacic data, since the sparse factors become not so sparse when
-     *  volumetric meshes are considered.
+     *  volumetric meshes are considered. OT_AMG is recommended for large
+     *  volumetric data.
      */
     void set_linear_solver(OTLinearSolver solver) {
         linear_solver_ = solver;
     }
 
+    /**
+     * \brief Specifies whether masses and Hessian are assembled
+     *  in thread-local buffers.
+     * \details In thread-local mode, each thread appends its contributions
+     *  to its own buffers, that are merged by a parallel reduction once
+     *  the Laguerre diagram is traversed. This avoids the spinlocks taken
+     *  for each contribution, and scales better with many threads, at the
+     *  expense of some additional memory.
+     * \param[in] x true to use thread-local assembly, false to use
+     *  spinlocks (default).
+     */
+    void set_thread_local_assembly(bool x) {
+        thread_local_assembly_ = x;
+    }
+
+    /**
+     * \brief Specifies whether the coefficients of the Hessian are
+     *  stored in single precision.
+     * \details The Hessian is stored in compressed row storage with
+     *  32-bit indices. Storing its coefficients as floats reduces its
+     *  memory footprint during the solve from 12 to 8 bytes per
+     *  coefficient. The conjugate gradient and the matrix-vector
+     *  products still compute in double precision. With spinlocks
+     *  (see set_thread_local_assembly()), the coefficients are
+     *  assembled in a double precision array, and the peak memory
+     *  is 16 bytes per coefficient, when they are rounded. With
+     *  thread-local assembly, only a block of rows at a time is
+     *  accumulated in double precision. With OT_SUPERLU, OT_CHOLMOD
+     *  and OT_AMG, a double precision copy of the coefficients is
+     *  made for the solver, and there is no memory saving: single
+     *  precision is only useful with OT_PRECG.
+     * \param[in] x true to store coefficients as floats, false to
+     *  store them as doubles (default).
+     */
+    void set_Hessian_single_precision(bool x) {
+        H_.set_single_precision(x);
+    }
+
     /**
      * \brief Computes the weights that realize the optimal
      *  transport map between the source mesh and the target
@@ -337,6 +556,104 @@ namespace GEO {
         const vector<index_t>& levels, index_t max_iterations
     );
 
+    /**
+     * \brief Sets how optimize_level() initializes the weights of
+     *  a new level.
+     * \details The weight of a new point is estimated from the weights
+     *  of the nearest points of the previous levels, by a least squares
+     *  fit of a polynomial.
+     * \param[in] degree degree of the polynomial, 1 (linear) or 2
+     *  (quadratic, default). Any other value copies the weight of the
+     *  nearest point.
+     * \param[in] nb_neighbors number of neighbors used by the least
+     *  squares fit, or 0 for 10 times the degree (default).
+     */
+    void set_prolongation(index_t degree, index_t nb_neighbors = 0) {
+        prolongation_degree_ = degree;
+        prolongation_nb_neighbors_ = nb_neighbors;
+    }
+
+    /**
+     * \brief Sets a wall clock time budget for the solves.
+     * \details When the budget of a call to optimize(), optimize_levels()
+     *  or optimize_full_Newton() is exhausted, the solver stops at the
+     *  next check (before each RVD evaluation and in the line search),
+     *  and the weights are the ones of the last accepted iterate. Nested
+     *  calls share the budget of the outermost one.
+     * \param[in] seconds the budget of each solve, in seconds, or 0 for
+     *  no limit (default)
+     * \see interrupted(), gradient_norm()
+     */
+    void set_time_budget(double seconds) {
+        time_budget_ = seconds;
+    }
+
+    /**
+     * \brief Interrupts the current solve.
+     * \details Can be called from another thread. The solver stops at the
+     *  next check, and the weights are the ones of the last accepted
+     *  iterate. If no solve is running, the next one stops immediately.
+     * \see interrupted(), gradient_norm()
+     */
+    void cancel() {
+        cancel_requested_ = true;
+    }
+
+    /**
+     * \brief Tests whether the last solve was interrupted.
+     * \retval true if the last solve was stopped by cancel() or
+     *  because its time budget was exhausted
+     * \retval false otherwise
+     */
+    bool interrupted() const {
+        return interrupted_;
+    }
+
+    /**
+     * \brief Gets the norm of the gradient.
+     * \details Can be used as a quality indicator of the weights
+     *  when a solve was interrupted.
+     * \return the norm of the gradient for the last accepted weights
+     */
+    double gradient_norm() const {
+        return g_norm_;
+    }
+
+    /**
+     * \brief Saves the state of the Newton solver periodically.
+     * \details Every \p every Newton iterations, the weights, the current
+     *  level of optimize_levels(), the iteration counters and the state
+     *  of the line search and of the inexact Newton solver are saved to
+     *  \p filename (see OTCheckpoint). The file is replaced at each
+     *  checkpoint.
+     * \param[in] filename the name of the checkpoint file
+     * \param[in] every number of Newton iterations between two
+     *  checkpoints, or 0 to disable checkpoints (default)
+     * \see restart_from_checkpoint()
+     */
+    void set_checkpoints(const std::string& filename, index_t every) {
+        checkpoint_filename_ = filename;
+        checkpoint_every_ = every;
+    }
+
+    /**
+     * \brief Restores the state of the Newton solver from a checkpoint.
+     * \details Needs to be called after set_points() (with the same
+     *  points and options as the interrupted solve) and before
+     *  optimize() or optimize_levels(). The weights are restored
+     *  immediately. The next call to optimize() or optimize_levels()
+     *  skips the levels that were already optimized and continues the
+     *  Newton iterations where they were interrupted, with the same
+     *  max_iterations. In the L-BFGS mode (set_Newton(false)), only the
+     *  weights are restored.
+     * \param[in] filename the name of a file written by a previous
+     *  solve with set_checkpoints()
+     * \retval true on success
+     * \retval false if the file could not be read or does not match
+     *  the points
+     */
+    bool restart_from_checkpoint(const std::string& filename);
+
     /**
      * \brief Gets the number of points.
      * \return The number of points, that was previously defined
@@ -346,6 +663,46 @@ namespace GEO {
         return weights_.size();
     }
 
+    /**
+     * \brief Specifies whether the points are reordered internally.
+     * \details If set, set_points() sorts the points along a Hilbert
+     *  curve. This improves memory locality in the traversal of the
+     *  restricted Laguerre diagram and in the Hessian. The reordering
+     *  is invisible from the outside: all the functions that take or
+     *  return per-point data (weight(), point_ptr(), set_nu(), the
+     *  centroids, the transport plan and the attributes of the
+     *  restricted Laguerre diagram) use the order of set_points().
+     *  It is ignored by set_points_view(), and is not compatible with
+     *  optimize_levels(), that needs the order of the levels (points
+     *  sampled by compute_hierarchical_sampling() already have a
+     *  spatial order).
+     * \param[in] x true if points should be reordered, false otherwise
+     *  (default). Taken into account by the next call to set_points().
+     */
+    void set_reorder_points(bool x) {
+        reorder_points_ = x;
+    }
+
+    /**
+     * \brief Gets the internal index of a point.
+     * \param[in] i the index of a point, in the order of set_points()
+     * \return the index of the point in the regular triangulation
+     */
+    index_t internal_index(index_t i) const {
+        return (i < seed_rank_.size()) ? seed_rank_[i] : i;
+    }
+
+    /**
+     * \brief Gets the index of a point in the order of set_points().
+     * \param[in] v the index of the point, or of one of its periodic
+     *  copies, in the regular triangulation
+     * \return the index of the point in the order of set_points()
+     */
+    index_t external_index(index_t v) const {
+        v = original_seed(v);
+        return (v < seed_order_.size()) ? seed_order_[v] : v;
+    }
+
     /**
      * \brief Gets a point.
      * \param[in] i index of the point
@@ -354,7 +711,7 @@ namespace GEO {
      */
     const double* point_ptr(index_t i) const {
         geo_debug_assert(i < (nb_points() + nb_air_particles()));
-        return &(points_dimp1_[dimp1_ * i]);
+        return &(lifted_points_[dimp1_ * internal_index(i)]);
     }
 
     /**
@@ -363,7 +720,7 @@ namespace GEO {
      * \return the weight that was computed for point \p i
      */
     double weight(index_t i) const {
-        return weights_[i];
+        return weights_[internal_index(i)];
     }
 
     /**
@@ -372,7 +729,7 @@ namespace GEO {
      * \param[in] val new value of the weight
      */
     void set_weight(index_t i, double val) {
-        weights_[i] = val;
+        weights_[internal_index(i)] = val;
     }
 
     /**
@@ -381,12 +738,14 @@ namespace GEO {
      * \return the d+1-th coordinate that was computed for point \p i
      */
     double potential(index_t i) const {
-        return points_dimp1_[dimp1_*i + dimension_];
+        return lifted_points_[dimp1_*internal_index(i) + dimension_];
     }
 
     /**
      * \brief Callback for the numerical solver.
      * \details Evaluates the objective function and its gradient.
+     *  The call is routed to the OptimalTransportMap that runs the
+     *  optimizer in the calling thread.
      * \param[in] n number of variables
      * \param[in] x current value of the variables
      * \param[out] f current value of the objective function
@@ -455,9 +814,99 @@ namespace GEO {
      */
     virtual void compute_Laguerre_centroids(double* centroids) = 0;
 
+    /**
+     * \brief The quantities that can be computed by finalize().
+     * \details Only the quantities with a non-null pointer are computed.
+     */
+    struct FinalOutputs {
+        /**
+         * \brief FinalOutputs constructor.
+         * \details Nothing is selected.
+         */
+        FinalOutputs() :
+            centroids(nullptr),
+            masses(nullptr),
+            transport_plan(nullptr),
+            transport_plan_moments(false),
+            RVD(nullptr) {
+        }
+
+        /**
+         * \brief The dimension()*nb_points() coordinates of the
+         *  centroids of the Laguerre cells.
+         */
+        double* centroids;
+
+        /**
+         * \brief The nb_points() (possibly weighted) measures of the
+         *  Laguerre cells.
+         */
+        double* masses;
+
+        /**
+         * \brief The measures of the intersections between the Laguerre
+         *  cells and the elements of the background mesh.
+         */
+        TransportPlan* transport_plan;
+
+        /**
+         * \brief If set, the first moments of the intersections are
+         *  stored in the transport plan.
+         */
+        bool transport_plan_moments;
+
+        /**
+         * \brief The restricted Laguerre diagram. See OTRVDMeshBuffers
+         *  for its format.
+         */
+        Mesh* RVD;
+    };
+
+    /**
+     * \brief Computes the selected outputs in a single parallel
+     *  traversal of the restricted Laguerre diagram.
+     * \details Computing the centroids, the transport plan and the
+     *  restricted Laguerre diagram separately costs one traversal each,
+     *  that is about as much as a Newton iteration. This function is
+     *  meant to be called once after optimize(), it uses the current
+     *  weights and power diagram.
+     * \param[in] outputs the selected outputs
+     */
+    void finalize(const FinalOutputs& outputs);
+
+    /**
+     * \brief Computes the transport plan.
+     * \details The transport plan is much more compact than the
+     *  restricted Laguerre diagram, and has all what is needed to remap
+     *  quantities between the background mesh and the seeds. It is
+     *  computed for the current weights and power diagram, typically
+     *  after optimize(). Use finalize() to compute it together with
+     *  other outputs.
+     * \param[out] plan the transport plan
+     * \param[in] moments if set, the first moments of the intersections
+     *  are computed as well
+     */
+    void compute_transport_plan(TransportPlan& plan, bool moments=false) {
+        FinalOutputs outputs;
+        outputs.transport_plan = &plan;
+        outputs.transport_plan_moments = moments;
+        finalize(outputs);
+    }
+
+    /**
+     * \brief Gets the number of elements of the background mesh.
+     * \details These are the columns of the transport plan.
+     * \return the number of tetrahedra in 3d, of triangles in 2d and
+     *  on surfaces.
+     */
+    virtual index_t nb_background_elements() const;
+
     /**
      * \brief Updates the sparsity pattern of the Hessian right after
      *  a new Laguerre diagram was computed.
+     * \details The pattern is deduced from the neighborhoods in the
+     *  regular triangulation. It is kept as is (and only the
+     *  coefficients are rewritten) when the combinatorics did not change.
      */
     void update_sparsity_pattern();
 
@@ -471,12 +920,13 @@ namespace GEO {
 
     /**
      * \brief Adds a coefficient to the matrix of the system.
+     * \details Callers running in parallel need to lock row \p i.
      * \param[in] i , j the indices of the coefficient
      * \param[in] a the value to be added to the coefficient
      */
     void add_ij_coefficient(index_t i, index_t j, double a) {
         if(!user_H_g_) {
-            nlAddIJCoefficient(i,j,a);
+            H_.add(i, j, a);
         } else {
             if(user_H_ != nullptr) {
                 geo_debug_assert(user_H_->type == NL_MATRIX_SPARSE_DYNAMIC);
@@ -487,12 +937,13 @@ namespace GEO {
 
     /**
      * \brief Adds a coefficient to the right hand side.
+     * \details Callers running in parallel need to lock row \p i.
      * \param[in] i the index of the coefficient
      * \param[in] a the value to be added to the coefficient
      */
     void add_i_right_hand_side(index_t i, double a) {
         if(!user_H_g_) {
-            nlAddIRightHandSide(i,a);
+            rhs_[i] += a;
         }
     }
 
@@ -511,7 +962,88 @@ namespace GEO {
      * \param[in] w the value of the weight.
      */
     void set_initial_weight(index_t i, double w) {
-        weights_[i] = w;
+        weights_[internal_index(i)] = w;
+    }
+
+    /**
+     * \brief Gets the number of avoided restricted Voronoi diagram
+     *  evaluations.
+     * \return the number of steps rejected by the line search of the
+     *  last Newton solve because a seed was hidden in the regular
+     *  triangulation, without computing the restricted Voronoi diagram.
+     */
+    index_t nb_avoided_RVD_evaluations() const {
+        return nb_RVD_avoided_;
+    }
+
+    /**
+     * \brief Specifies whether the regular triangulation can be kept
+     *  when the weights change.
+     * \details If set, before rebuilding the regular triangulation,
+     *  one checks whether the current one is still regular with the
+     *  new weights (this is frequent late in the Newton solve and in
+     *  the line search). It costs one predicate per facet, and is
+     *  much cheaper than rebuilding the triangulation. A reused
+     *  triangulation has stale cached heights, see
+     *  power_diagram_is_regular().
+     * \param[in] x true if the triangulation can be kept (default),
+     *  false if it is always rebuilt.
+     */
+    void set_reuse_power_diagram(bool x) {
+        reuse_power_diagram_ = x;
+    }
+
+    /**
+     * \brief Gets the statistics of the Newton iterations.
+     * \details Recording is disabled by default, and is enabled by
+     *  telemetry().set_enabled(true). The statistics can then be
+     *  queried or exported as JSON lines.
+     * \return a reference to the telemetry of this OptimalTransportMap
+     */
+    OTTelemetry& telemetry() {
+        return telemetry_;
+    }
+
+    /**
+     * \copydoc telemetry()
+     */
+    const OTTelemetry& telemetry() const {
+        return telemetry_;
+    }
+
+    /**
+     * \brief Counts the empty Laguerre cells for a given weight vector.
+     * \details This computes the Laguerre diagram and the measures
+     *  of the cells. It can be used to test whether a weight vector is
+     *  a valid starting point for the Newton solver.
+     * \param[in] w a pointer to nb_points() weights, in the order of
+     *  set_points() (like weight() and set_initial_weight())
+     * \return the number of empty cells
+     */
+    index_t count_empty_cells(const double* w);
+
+    /**
+     * \brief Tests whether some points are hidden in the regular
+     *  triangulation of a given weight vector.
+     * \details This only computes the regular triangulation, and is much
+     *  cheaper than count_empty_cells(). A hidden point has an empty
+     *  Laguerre cell, but a cell can also be empty because it does not
+     *  intersect the domain.
+     * \param[in] w a pointer to nb_points() weights, in the order of
+     *  set_points()
+     * \retval true if at least one point is hidden
+     * \retval false otherwise
+     */
+    bool has_hidden_points(const double* w);
+
+    /**
+     * \brief Gets the number of empty cells.
+     * \return the number of empty Laguerre cells found by the latest
+     *  evaluation of the objective function, for instance at the end
+     *  of optimize()
+     */
+    index_t nb_empty_cells() const {
+        return nbZ_;
     }
 
     /**
@@ -538,6 +1070,38 @@ namespace GEO {
 
     protected:
 
+    /**
+     * \brief Starts the clock of the time budget for the lifetime of
+     *  this object.
+     * \details Does nothing if a solve is already running, so that
+     *  nested calls share the budget of the outermost one.
+     */
+    class InterruptionScope {
+    public:
+        /**
+         * \brief InterruptionScope constructor.
+         * \param[in] OTM the OptimalTransportMap that starts a solve
+         */
+        InterruptionScope(OptimalTransportMap* OTM);
+
+        /**
+         * \brief InterruptionScope destructor.
+         */
+        ~InterruptionScope();
+
+    private:
+        OptimalTransportMap* OTM_;
+    };
+
+    /**
+     * \brief Tests whether the current solve should stop.
+     * \details Sets interrupted() if the solve was cancelled or if
+     *  its time budget is exhausted.
+     * \retval true if the solve should stop
+     * \retval false otherwise
+     */
+    bool must_stop();
+
     /**
      * \brief Gets the mass of the Dirac associated with point p.
      * \return the desired mass at point p.
@@ -552,6 +1116,66 @@ namespace GEO {
      */
     virtual void newiteration();
 
+    /**
+     * \brief Saves the state of the Newton solver if a checkpoint is due.
+     * \param[in] iteration the next Newton iteration
+     * \param[in] direction the latest Newton direction
+     * \param[in] epsilon0 the minimum measure of a cell accepted by
+     *  the line search
+     * \param[in] prev_g_norm the norm of the gradient at the previous
+     *  iteration
+     * \param[in] first_inner_iter first iteration of the next line search
+     */
+    void save_checkpoint(
+        index_t iteration, const vector<double>& direction,
+        double epsilon0, double prev_g_norm, index_t first_inner_iter
+    );
+
+    /**
+     * \brief Resets the weights and the Dirac masses after new points
+     *  were specified.
+     * \param[in] nb_points the number of points
+     */
+    void reset_weights(index_t nb_points);
+
+    /**
+     * \brief Sets the weights to their default initial value.
+     * \details The default weights are zero, except in air fraction
+     *  mode without air particles.
+     * \param[in] n the number of weights to be initialized
+     * \retval true if at least one weight was changed
+     * \retval false if the weights already had their default value
+     */
+    bool set_default_weights(index_t n);
+
+    /**
+     * \brief Puts per-point data computed in the internal order back
+     *  into the order of set_points().
+     * \details Does nothing if the points are not reordered.
+     * \param[in,out] data nb_points()*dim doubles
+     * \param[in] dim number of doubles per point
+     */
+    void to_external_order(double* data, index_t dim) const;
+
+    /**
+     * \brief Wraps points into the fundamental domain in periodic mode.
+     * \details Does nothing if the domain is not periodic.
+     * \param[in,out] points the coordinates of the points
+     * \param[in] nb_points number of points
+     * \param[in] stride number of doubles between two consecutive points,
+     *  or 0 if tightly packed.
+     */
+    void wrap_to_fundamental_domain(
+        double* points, index_t nb_points, index_t stride = 0
+    ) const;
+
+    /**
+     * \brief Appends the periodic copies of the points to points_dimp1_.
+     * \details Wraps the points into the fundamental domain first.
+     * \param[in] nb_points the number of points
+     */
+    void create_periodic_copies(index_t nb_points);
+
     /**
      * \brief Saves the RVD at each iteration if
      *   specified on command line (just for debugging/
@@ -561,6 +1185,52 @@ namespace GEO {
      */
     void save_RVD(index_t id);
 
+    /**
+     * \brief Computes the regular triangulation that corresponds
+     *  to a weight vector.
+     * \param[in] n number of variables
+     * \param[in] w the weights
+     */
+    void compute_power_diagram(index_t n, const double* w);
+
+    /**
+     * \brief Tests whether some seeds are hidden in the current
+     *  regular triangulation.
+     * \details A hidden seed has an empty Laguerre cell. This is
+     *  much cheaper to test than computing the measures of the cells,
+     *  but an empty cell does not always correspond to a hidden seed.
+     * \param[in] n number of seeds (air particles are not tested)
+     * \retval true if at least one seed is hidden
+     * \retval false otherwise
+     */
+    bool has_hidden_seeds(index_t n) const;
+
+    /**
+     * \brief Tests whether the current triangulation is still the
+     *  regular triangulation of the lifted points.
+     * \details Only the last coordinate of the lifted points changes
+     *  with the weights. If the triangulation has no hidden vertex and
+     *  all its facets are locally regular, then it is the regular
+     *  triangulation of the points, and it does not need to be rebuilt.
+     *  The test stops at the first facet that is not locally regular.
+     *  The lifted coordinates are computed on the fly from
+     *  lifted_points_, in the parallel loop over the cells.
+     *
+     *  When the triangulation is kept, the last coordinates of
+     *  lifted_points_ (that the vertices of the triangulation point to)
+     *  were updated in place by compute_power_diagram(). The heights
+     *  cached by the triangulation when it was built are then stale:
+     *  while it is reused, only its combinatorics and vertex_ptr() may
+     *  be used, and no query that relies on the cached heights
+     *  (insertion, nearest vertex, conflict or location queries) may
+     *  be made, until set_vertices() is called again.
+     * \param[in] nb_vertices number of points (seeds, air particles and
+     *  periodic copies)
+     * \retval true if the current triangulation can be kept
+     * \retval false otherwise
+     */
+    bool power_diagram_is_regular(index_t nb_vertices) const;
+
     /**
      * \brief Computes the objective function and its gradient.
      * \param[in] n number of variables
@@ -623,7 +1293,10 @@ namespace GEO {
             n_(0),
             w_(nullptr),
             g_(nullptr),
-            mg_(nullptr) {
+            mg_(nullptr),
+            buffers_(nullptr),
+            plan_(nullptr),
+            RVD_buffers_(nullptr) {
             weighted_ =
                 OTM->mesh().vertices.attributes().is_defined("weight");
         }
@@ -642,6 +1315,7 @@ namespace GEO {
          */
         void set_Laguerre_centroids(double* mg) {
             mg_ = mg;
+            update_kernel();
         }
 
         /**
@@ -682,6 +1356,7 @@ namespace GEO {
          */
         void set_Newton_step(bool Newton) {
             Newton_step_ = Newton;
+            update_kernel();
         }
 
         /**
@@ -710,6 +1385,34 @@ namespace GEO {
             g_ = g;
         }
 
+        /**
+         * \brief Specifies the buffers for thread-local assembly.
+         * \param[in] buffers a pointer to the OTAssemblyBuffers, or
+         *  nullptr to directly accumulate into the gradient and Hessian
+         *  using spinlocks.
+         */
+        void set_assembly_buffers(OTAssemblyBuffers* buffers) {
+            buffers_ = buffers;
+        }
+
+        /**
+         * \brief Specifies where the transport plan should be assembled.
+         * \param[in] plan a pointer to a TransportPlan with a started
+         *  assembly, or nullptr
+         */
+        void set_transport_plan(TransportPlan* plan) {
+            plan_ = plan;
+        }
+
+        /**
+         * \brief Specifies where the restricted Laguerre diagram should
+         *  be extracted.
+         * \param[in] RVD a pointer to started OTRVDMeshBuffers, or nullptr
+         */
+        void set_RVD_mesh_buffers(OTRVDMeshBuffers* RVD) {
+            RVD_buffers_ = RVD;
+        }
+
         /**
          * \brief Specifies whether the objective function should
          *  be evaluated.
@@ -720,6 +1423,16 @@ namespace GEO {
          */
         void set_eval_F(bool x) {
             eval_F_ = x;
+            update_kernel();
+        }
+
+        /**
+         * \brief Tests whether the objective function is evaluated.
+         * \retval true if the objective function is evaluated.
+         * \retval false otherwise.
+         */
+        bool eval_F() const {
+            return eval_F_;
         }
 
         /**
@@ -736,6 +1449,133 @@ namespace GEO {
         }
 
     protected:
+        /**
+         * \brief Gets a seed from its internal index.
+         * \details The callbacks receive the internal indices of the
+         *  seeds, in the order of the regular triangulation.
+         * \param[in] v the internal index of the seed
+         * \return a const pointer to the (dimension()+1)d coordinates
+         *  of the seed
+         */
+        const double* seed_point(index_t v) const {
+            return &(OTM_->lifted_points_[OTM_->dimp1_ * v]);
+        }
+
+        /**
+         * \brief Gets the weight of a seed from its internal index.
+         * \param[in] v the internal index of the seed
+         * \return the weight of the seed
+         */
+        double seed_weight(index_t v) const {
+            return OTM_->weights_[v];
+        }
+
+        /**
+         * \brief Gets the index of a seed in the order of set_points().
+         * \param[in] v the internal index of the seed
+         * \return the index of the seed as seen by the caller
+         */
+        index_t external_seed(index_t v) const {
+            return OTM_->external_index(v);
+        }
+
+        /**
+         * \brief Gets the seed that a vertex of the regular triangulation
+         *  is a copy of.
+         * \param[in] v the index of the vertex
+         * \return the internal index of the original seed if \p v is a
+         *  periodic copy, \p v otherwise
+         */
+        index_t original_seed(index_t v) const {
+            return OTM_->original_seed(v);
+        }
+
+        /**
+         * \brief Moves mass times centroid computed in the Laguerre cell
+         *  of a periodic copy to the frame of its original seed.
+         * \param[in] v the index of the vertex, that may be a periodic
+         *  copy or not
+         * \param[in] m the mass
+         * \param[in,out] mg the mass times the centroid
+         */
+        void to_original_frame(index_t v, double m, double* mg) const {
+            if(OTM_->original_seed(v) == v) {
+                return;
+            }
+            const double* T = OTM_->periodic_translation(v);
+            for(index_t c = 0; c < OTM_->dimension(); ++c) {
+                mg[c] -= m * T[c];
+            }
+        }
+
+        /**
+         * \brief Selects the integration kernel.
+         * \details Called each time one of the flags (weighted, centroids,
+         *  Newton step, evaluation of F) changes, so that derived classes
+         *  can select an integration kernel specialized for the current
+         *  flags once, instead of testing them in the inner loops.
+         */
+        virtual void update_kernel();
+
+        /**
+         * \brief Gets a pointer to a specialized integration kernel.
+         * \tparam T the callback class. It has a template member function
+         *  kernel<WEIGHTED,CENTROIDS,NEWTON,EVAL_F>() and a type Kernel
+         *  for pointers to it.
+         * \return a pointer to the specialization of T::kernel() for
+         *  the current flags.
+         */
+        template <class T> typename T::Kernel select_kernel() const {
+            return weighted_ ?
+                select_kernel<T,true>(mg_ != nullptr) :
+                select_kernel<T,false>(mg_ != nullptr) ;
+        }
+
+        /**
+         * \copydoc select_kernel()
+         * \param[in] centroids true if centroids are computed
+         */
+        template <class T, bool W> typename T::Kernel select_kernel(
+            bool centroids
+        ) const {
+            return centroids ?
+                select_kernel<T,W,true>(Newton_step_) :
+                select_kernel<T,W,false>(Newton_step_) ;
+        }
+
+        /**
+         * \copydoc select_kernel()
+         * \param[in] Newton true if the Hessian is computed
+         */
+        template <class T, bool W, bool C> typename T::Kernel select_kernel(
+            bool Newton
+        ) const {
+            return Newton ?
+                select_kernel<T,W,C,true>(eval_F_) :
+                select_kernel<T,W,C,false>(eval_F_) ;
+        }
+
+        /**
+         * \copydoc select_kernel()
+         * \param[in] eval_F true if the objective function is computed
+         */
+        template <class T, bool W, bool C, bool N>
+        typename T::Kernel select_kernel(bool eval_F) const {
+            return eval_F ?
+                &T::template kernel<W,C,N,true> :
+                &T::template kernel<W,C,N,false> ;
+        }
+
+        /**
+         * \brief Gets the id of the current thread.
+         * \return the id of the current thread, or 0 if not
+         *  running in a thread.
+         */
+        static index_t current_thread_id() {
+            Thread* thread = Thread::current();
+            return (thread == nullptr) ? 0 : thread->id();
+        }
+
         OptimalTransportMap* OTM_;
         bool weighted_;
         bool Newton_step_;
@@ -745,16 +1585,48 @@ namespace GEO {
         const double* w_;
         double* g_;
         double* mg_;
+        OTAssemblyBuffers* buffers_;
+        TransportPlan* plan_;
+        OTRVDMeshBuffers* RVD_buffers_;
     };
 
     protected:
-    static OptimalTransportMap* instance_;
     index_t dimension_;
     index_t dimp1_; /**< \brief dimension_ + 1 */
     Mesh* mesh_;
+    OptimalTransportTarget_var target_;
     Delaunay_var delaunay_;
     RestrictedVoronoiDiagram_var RVD_;
     vector<double> points_dimp1_;
+
+    /**
+     * \brief The (dimension()+1)d points, either points_dimp1_ or the
+     *  array specified by set_points_view().
+     */
+    double* lifted_points_;
+
+    /**
+     * \brief The number of points in lifted_points_, including the air
+     *  particles.
+     */
+    index_t nb_lifted_points_;
+
+    /**
+     * \brief If set, set_points() sorts the points along a Hilbert curve.
+     */
+    bool reorder_points_;
+
+    /**
+     * \brief Index in the order of set_points() of each internal point,
+     *  or empty if the points are not reordered.
+     */
+    vector<index_t> seed_order_;
+
+    /**
+     * \brief Internal index of each point in the order of set_points(),
+     *  or empty if the points are not reordered.
+     */
+    vector<index_t> seed_rank_;
     vector<double> weights_;
     double total_mass_;
     double constant_nu_; /**< \brief Value of one of the Diracs if cte. */
@@ -793,6 +1665,30 @@ namespace GEO {
      */
     double g_norm_;
 
+    /**
+     * \brief Number of line search steps rejected without
+     *  computing the restricted Voronoi diagram, in the last call
+     *  to optimize_full_Newton().
+     */
+    index_t nb_RVD_avoided_;
+
+    /**
+     * \brief Per-iteration statistics of optimize_full_Newton().
+     */
+    OTTelemetry telemetry_;
+
+    /**
+     * \brief True if the regular triangulation is kept when it is
+     *  still regular for the new weights.
+     */
+    bool reuse_power_diagram_;
+
+    /**
+     * \brief True if the points changed since the last time the
+     *  regular triangulation was built (then it cannot be kept).
+     */
+    bool points_changed_;
+
     /**
      * \brief Measure of the smallest Laguerre cell.
      */
@@ -813,15 +1709,94 @@ namespace GEO {
     /** \brief maximum number of iterations for linear solve */
     index_t linsolve_maxiter_;
 
+    /** \brief degree of the fit used by optimize_level() */
+    index_t prolongation_degree_;
+
+    /**
+     * \brief number of neighbors used by the fit in optimize_level(),
+     *  or 0 for the default
+     */
+    index_t prolongation_nb_neighbors_;
+
+    /** \brief time budget of a solve in seconds, or 0 if unlimited */
+    double time_budget_;
+
+    /** \brief time at which the current solve should stop, or 0 */
+    double deadline_;
+
+    /** \brief number of nested solves that are running */
+    index_t solve_depth_;
+
+    /** \brief set by cancel(), possibly from another thread */
+    std::atomic<bool> cancel_requested_;
+
+    /** \brief true if the last solve was interrupted */
+    bool interrupted_;
+
+    /**
+     * \brief weights of the last accepted iterate of the L-BFGS
+     *  optimizer, restored if it is interrupted.
+     */
+    vector<double> last_iterate_;
+
+    /**
+     * \brief value of the objective function at the last point
+     *  evaluated by funcgrad_CB(), returned to the L-BFGS optimizer
+     *  when it is interrupted.
+     */
+    double last_f_;
+
+    /**
+     * \brief false if the last call to funcgrad_CB() did not evaluate
+     *  its point because the solve was interrupted.
+     */
+    bool last_funcgrad_evaluated_;
+
+    /** \brief true if the tolerance of linear solve is adaptive */
+    bool inexact_Newton_;
+
+    /**
+     * \brief tolerance of the current linear solve, in inexact
+     *  Newton mode.
+     */
+    double forcing_term_;
+
+    /**
+     * \brief total number of iterations of the linear solver in the
+     *  last call to optimize_full_Newton()
+     */
+    index_t nb_linsolve_iter_;
+
+    /** \brief name of the checkpoint file */
+    std::string checkpoint_filename_;
+
+    /** \brief Newton iterations between two checkpoints, or 0 */
+    index_t checkpoint_every_;
+
+    /** \brief the state restored by restart_from_checkpoint() */
+    OTCheckpoint restart_;
+
+    /**
+     * \brief true if the next Newton solve continues from restart_
+     *  instead of starting from scratch
+     */
+    bool restart_pending_;
+
     /** \brief maximum number of steplength divisions */
     index_t linesearch_maxiter_;
 
     /** \brief starting number of steplength divisions */
     index_t linesearch_init_iter_;
 
-    /** \brief one of OT_PRECG, OT_SUPERLU, OT_CHOLMOD. */
+    /** \brief one of OT_PRECG, OT_SUPERLU, OT_CHOLMOD, OT_AMG. */
     OTLinearSolver linear_solver_;
 
+    /**
+     * \brief The multigrid preconditioner used by OT_AMG.
+     * \details Kept from one Newton step to the next one.
+     */
+    OTAMGPreconditioner AMG_;
+
     /** \brief if set, pointer to the air particles. */
     const double* air_particles_;
 
@@ -845,6 +1820,52 @@ namespace GEO {
      */
     bool clip_by_balls_;
 
+    /** \brief True if the domain is periodic. */
+    bool periodic_;
+
+    /**
+     * \brief Width of the band where the points are copied in periodic
+     *  mode, or 0 to deduce it from the average spacing of the points.
+     */
+    double periodic_margin_;
+
+    /** \brief Lower corner of the fundamental domain. */
+    double period_origin_[3];
+
+    /** \brief Size of the fundamental domain along each axis. */
+    double period_[3];
+
+    /**
+     * \brief Index of the first periodic copy in lifted_points_, or
+     *  index_t(-1) if there is no periodic copy.
+     */
+    index_t ghost_begin_;
+
+    /**
+     * \brief The periodic copies of point v are
+     *  ghost_begin_ + ghost_ptr_[v] ... ghost_begin_ + ghost_ptr_[v+1] - 1.
+     */
+    vector<index_t> ghost_ptr_;
+
+    /** \brief The original point of each periodic copy. */
+    vector<index_t> ghost_original_;
+
+    /**
+     * \brief The translation from its original point to each
+     *  periodic copy, dimension() doubles per copy.
+     */
+    vector<double> ghost_translation_;
+
+    /**
+     * \brief True if masses and Hessian are assembled in
+     *  thread-local buffers.
+     */
+    bool thread_local_assembly_;
+
+    /**
+     * \brief The buffers used by thread-local assembly.
+     */
+    OTAssemblyBuffers assembly_buffers_;
 
     /**
      * \brief True if class is just used by user to compute
@@ -856,6 +1877,26 @@ namespace GEO {
      * \brief User-defined Hessian matrix.
      */
     NLMatrix user_H_;
+
+    /**
+     * \brief The matrix of the current Newton step.
+     * \details It is owned by this OptimalTransportMap (and not by
+     *  an OpenNL context, that is global), so that several
+     *  OptimalTransportMap objects can be solved concurrently. Its
+     *  sparsity pattern is kept from one Newton step to the next one.
+     */
+    OTHessian H_;
+
+    /**
+     * \brief The right-hand side of the current Newton step.
+     */
+    vector<double> rhs_;
+
+    /**
+     * \brief Where to store the solution of the current Newton
+     *  step, as specified to new_linear_system().
+     */
+    double* solution_;
     };
 
 }
@@ -153,21 +153,32 @@ namespace {
      * \param[out] clipped the result
      * \param[in] n first index to be used for intersections (number of
      *  vertices in Delaunay).
-     * \param[in] alloc the PointAllocator used to create the
-     *  new vertices
-     * \param[out] work a temporary work zone
+     * \param[in,out] W the workspace of the current thread. Its
+     *  vertices are recycled, the result is stored in W.clipped.
      */
     void clip_polygon_by_ball(
         const GEOGen::Polygon& P,
         vec2 center, double radius,
-        GEOGen::Polygon& clipped,
         index_t n,
-        GEOGen::PointAllocator* alloc,
-        GEOGen::Polygon& work
+        OptimalTransportMap2d::ClippingWorkspace& W
     ) {
         const index_t N = 16;
         const double dalpha = M_PI * 2.0 / double(N);
         index_t first_new_index = n;
+        //   The previous clipped polygon is no longer used, but the
+        // allocator is only cleared once it has grown past a bound,
+        // so that its chunks are shared by thousands of cells instead
+        // of being allocated and freed for each cell. Each half-plane
+        // creates at most two vertices.
+        const index_t max_allocated = 65536;
+        if(W.nb_allocated > max_allocated) {
+            W.allocator.clear();
+            W.nb_allocated = 0;
+        }
+        W.nb_allocated += 2*N;
+        GEOGen::Polygon& clipped = W.clipped;
+        GEOGen::Polygon& work = W.work;
+        GEOGen::PointAllocator* alloc = &W.allocator;
         clipped.copy(P);
         FOR(i,N) {
             double s = ::sin(dalpha*i);
@@ -203,6 +214,7 @@ namespace {
          */
         OTMPolygonCallback(OptimalTransportMap2d* OTM) :
             OptimalTransportMap::Callback(OTM) {
+            update_kernel();
         }
 
         /**
@@ -218,31 +230,51 @@ namespace {
                 if(v < OTM_->nb_points()) {
                     OptimalTransportMap2d* OTM =
                         static_cast<OptimalTransportMap2d*>(OTM_);
-                    double R = OTM_->weight(v);
+                    double R = seed_weight(v);
                     geo_assert(R > 0.0);
                     R = ::sqrt(R);
-                    vec2 center(OTM_->point_ptr(v));
-                    clip_polygon_by_ball(
-                        P, center, R, OTM->clipped_,
-                        OTM_->nb_points(),
-                        OTM_->RVD()->point_allocator(),
-                        OTM->work_
-                    );
-                    do_it(v,t,OTM->clipped_);
+                    vec2 center(seed_point(v));
+                    OptimalTransportMap2d::ClippingWorkspace& W =
+                        OTM->clipping_workspace(current_thread_id());
+                    clip_polygon_by_ball(P, center, R, OTM_->nb_points(), W);
+                    (this->*kernel_)(v,t,W.clipped);
                 }
             } else {
-                do_it(v,t,P);
+                (this->*kernel_)(v,t,P);
             }
         }
 
-        void do_it(
+        /**
+         * \brief A pointer to a specialization of kernel().
+         */
+        typedef void (OTMPolygonCallback::*Kernel)(
+            index_t v, index_t t, const GEOGen::Polygon& P
+        ) const;
+
+        /**
+         * \brief Computes the contribution of a polygon.
+         * \details The flags are template arguments, so that the
+         *  tests are resolved at compile time.
+         * \tparam WEIGHTED true if the mesh has varying density
+         * \tparam CENTROIDS true if mass times centroids are computed
+         * \tparam NEWTON true if the Hessian is computed
+         * \tparam EVAL_F true if the objective function is computed
+         * \param[in] v the seed
+         * \param[in] t the mesh facet
+         * \param[in] P the intersection between the Laguerre cell of \p v
+         *  and the facet \p t
+         */
+        template <bool WEIGHTED, bool CENTROIDS, bool NEWTON, bool EVAL_F>
+        void kernel(
             index_t v,
             index_t t,
             const GEOGen::Polygon& P
         ) const {
 
-            // v can be an air particle.
-            if(v >= n_) {
+            // v can be an air particle or a periodic copy of a seed,
+            // the contributions of a copy go to the original seed o.
+            index_t o = original_seed(v);
+            if(o >= n_) {
                 return;
             }
 
@@ -250,60 +282,92 @@ namespace {
                 return;
             }
 
-            geo_argused(t);
             double m, mgx, mgy;
-            compute_m_and_mg(P, m, mgx, mgy);
-
-            if(spinlocks_ != nullptr) {
-                spinlocks_->acquire_spinlock(v);
+            compute_m_and_mg<WEIGHTED, CENTROIDS>(P, m, mgx, mgy);
+
+            // The transport plan keeps the actual position of the
+            // mass, the centroid of the seed is in the frame of o.
+            double plan_mg[2] = { mgx, mgy };
+            if(CENTROIDS && o != v) {
+                double mg[2] = { mgx, mgy };
+                to_original_frame(v, m, mg);
+                mgx = mg[0];
+                mgy = mg[1];
             }
 
-            // +m because we maximize F <=> minimize -F
-            g_[v] += m;
+            if(buffers_ != nullptr) {
+                double mg[2] = { mgx, mgy };
+                buffers_->add_mass(current_thread_id(), o, m, mg);
+            } else {
+                if(spinlocks_ != nullptr) {
+                    spinlocks_->acquire_spinlock(o);
+                }
+
+                // +m because we maximize F <=> minimize -F
+                g_[o] += m;
+
+                if(NEWTON) {
+                    // ... but here -m because Newton step =
+                    //  solve H p = -g    (minus g in the RHS).
+                    OTM_->add_i_right_hand_side(o,-m);
+                }
 
-            if(Newton_step_) {
-                // ... but here -m because Newton step =
-                //  solve H p = -g    (minus g in the RHS).
-                OTM_->add_i_right_hand_side(v,-m);
+                if(CENTROIDS) {
+                    mg_[2*o] += mgx;
+                    mg_[2*o+1] += mgy;
+                }
+
+                if(spinlocks_ != nullptr) {
+                    spinlocks_->release_spinlock(o);
+                }
             }
 
-            if(mg_ != nullptr) {
-                mg_[2*v] += mgx;
-                mg_[2*v+1] += mgy;
+            if(plan_ != nullptr) {
+                plan_->add(
+                    current_thread_id(), external_seed(v), t, m, plan_mg
+                );
             }
 
-            if(spinlocks_ != nullptr) {
-                spinlocks_->release_spinlock(v);
+            if(RVD_buffers_ != nullptr) {
+                RVD_buffers_->add_polygon(
+                    current_thread_id(), external_seed(v), P,
+                    coord_index_t(OTM_->dimension())
+                );
             }
 
-            if(Newton_step_) {
+            if(NEWTON) {
                 // Spinlocks are managed internally by update_Hessian().
-                update_Hessian(P, v);
+                update_Hessian<WEIGHTED>(P, v);
             }
 
 
-            if(eval_F_) {
-                Thread* thread = Thread::current();
-                index_t current_thread_id =
-                    (thread == nullptr) ? 0 : thread->id();
-                double F = weighted_ ? eval_F_weighted(P, v) : eval_F(P, v);
+            if(EVAL_F) {
+                double F = WEIGHTED ? eval_F_weighted(P, v) : eval_F(P, v);
                 const_cast<OTMPolygonCallback*>(this)->
-                    funcval_[current_thread_id] += F;
+                    funcval_[current_thread_id()] += F;
             }
         }
 
     protected:
+        /**
+         * \copydoc OptimalTransportMap::Callback::update_kernel()
+         */
+        void update_kernel() override {
+            kernel_ = select_kernel<OTMPolygonCallback>();
+        }
 
         /**
          * \brief Computes the mass and mass times centroid of the
          *  current intersection polygon.
          * \details Weights are taken into account if present.
+         * \tparam WEIGHTED true if the mesh has varying density
+         * \tparam CENTROIDS true if mass times centroids are computed
          * \param[in] P a const reference to the current intersection polygon.
          * \param[out] m , mgx , mgy the mass and the mass times the
          *  centroid of the ConvexCell. mgx and mgy are not computed
-         *  if mg_ is nullptr.
+         *  if CENTROIDS is false.
          */
-        void compute_m_and_mg(
+        template <bool WEIGHTED, bool CENTROIDS> void compute_m_and_mg(
             const GEOGen::Polygon& P,
             double& m, double& mgx, double& mgy
         ) const {
@@ -317,10 +381,10 @@ namespace {
                 const double* p1 = V1.point();
                 const GEOGen::Vertex& V2 = P.vertex(i+1);
                 const double* p2 = V2.point();
-                double cur_m = triangle_mass(V0,V1,V2);
+                double cur_m = triangle_mass<WEIGHTED>(V0,V1,V2);
                 m += cur_m;
-                if(mg_ != nullptr) {
-                    if(weighted_) {
+                if(CENTROIDS) {
+                    if(WEIGHTED) {
                         double w0 = V0.weight();
                         double w1 = V1.weight();
                         double w2 = V2.weight();
@@ -338,10 +402,11 @@ namespace {
         /**
          * \brief Updates the Hessian according to the current intersection
          *  polygon.
+         * \tparam WEIGHTED true if the mesh has varying density
          * \param[in] P a const reference to the current intersection polygon.
          * \param[in] i the current seed
          */
-        void update_Hessian(
+        template <bool WEIGHTED> void update_Hessian(
             const GEOGen::Polygon& P, index_t i
         ) const {
 
@@ -349,7 +414,10 @@ namespace {
             // adjacent cells Lag(i),Lag(j) is :
             // - mass(Lag(i) /\ Lag(j)) / (2*distance(pi,pj))
 
-            const double* pi = OTM_->point_ptr(i);
+            // Distances are measured between the actual copies, the
+            // coefficients go to the original seeds.
+            const double* pi = seed_point(i);
+            index_t o = original_seed(i);
 
             for(index_t k1=0; k1<P.nb_vertices(); ++k1) {
                 index_t k2 = k1+1;
@@ -361,38 +429,49 @@ namespace {
                 // not P.vertex(k1).adjacent_seed() !!!
                 index_t j = index_t(P.vertex(k2).adjacent_seed());
                 if(j != index_t(-1)) {
+                    index_t o_adj = original_seed(j);
                     double hij = 0.0;
-                    if(j < n_) {
-                        const double* pj = OTM_->point_ptr(j);
+                    if(o_adj < n_) {
+                        const double* pj = seed_point(j);
                         hij =
-                            edge_mass(P.vertex(k1), P.vertex(k2)) /
+                            edge_mass<WEIGHTED>(P.vertex(k1), P.vertex(k2)) /
                             (2.0 * GEO::Geom::distance(pi,pj,2)) ;
                     } else if(OTM_->nb_air_particles() != 0) {
-			const double* pj = OTM_->point_ptr(j); // points and air
+			const double* pj = seed_point(j); // points and air
                         hij =
-                            edge_mass(P.vertex(k1), P.vertex(k2)) /
+                            edge_mass<WEIGHTED>(P.vertex(k1), P.vertex(k2)) /
                             (2.0 * GEO::Geom::distance(pi,pj,2)) ;
 		    } else {
-                        double R = OTM_->weight(i);
+                        double R = seed_weight(i);
                         geo_assert(R >= 0.0);
                         R = ::sqrt(R);
-                        hij = edge_mass(P.vertex(k1), P.vertex(k2)) / (2.0 * R);
+                        hij = edge_mass<WEIGHTED>(P.vertex(k1), P.vertex(k2)) / (2.0 * R);
                     }
 
                     // -hij because we maximize F <=> minimize -F
                     if(hij != 0.0) {
-                        if(spinlocks_ != nullptr) {
-                            spinlocks_->acquire_spinlock(i);
-                        }
-                        // Diagonal is positive, extra-diagonal
-                        // coefficients are negative,
-                        // this is a convex function.
-                        if(j < n_) {
-                            OTM_->add_ij_coefficient(i, j, -hij);
-                        }
-                        OTM_->add_ij_coefficient(i, i,  hij);
-                        if(spinlocks_ != nullptr) {
-                            spinlocks_->release_spinlock(i);
+                        if(buffers_ != nullptr) {
+                            index_t thread = current_thread_id();
+                            if(o_adj < n_) {
+                                buffers_->add_coefficient(
+                                    thread, o, o_adj, -hij
+                                );
+                            }
+                            buffers_->add_coefficient(thread, o, o, hij);
+                        } else {
+                            if(spinlocks_ != nullptr) {
+                                spinlocks_->acquire_spinlock(o);
+                            }
+                            // Diagonal is positive, extra-diagonal
+                            // coefficients are negative,
+                            // this is a convex function.
+                            if(o_adj < n_) {
+                                OTM_->add_ij_coefficient(o, o_adj, -hij);
+                            }
+                            OTM_->add_ij_coefficient(o, o,  hij);
+                            if(spinlocks_ != nullptr) {
+                                spinlocks_->release_spinlock(o);
+                            }
                         }
                     }
                 }
@@ -429,20 +508,21 @@ namespace {
 
         /**
          * \brief Computes the mass of a triangle.
-         * \details Weights are taken into account in weighted_ mode.
+         * \details Weights are taken into account in WEIGHTED mode.
+         * \tparam WEIGHTED true if the mesh has varying density
          * \param[in] V0 , V1 , V2 the three vertices of the triangle,
          *  given as RVD vertices.
          * \return the area of the triangle in 3D times the average value of the
          *  three weights.
          */
-        double triangle_mass(
+        template <bool WEIGHTED> double triangle_mass(
             const GEOGen::Vertex& V0,
             const GEOGen::Vertex& V1,
             const GEOGen::Vertex& V2
         ) const {
             double m =
                 Geom::triangle_area_2d(V0.point(), V1.point(), V2.point());
-            if(weighted_) {
+            if(WEIGHTED) {
                 m *= ((V0.weight() + V1.weight() + V2.weight())/3.0);
             }
             return m;
@@ -450,22 +530,26 @@ namespace {
 
         /**
          * \brief Computes the mass of an edge.
-         * \details Weights are taken into account in weighted_ mode.
+         * \details Weights are taken into account in WEIGHTED mode.
+         * \tparam WEIGHTED true if the mesh has varying density
          * \param[in] V0 , V1 the two vertices of the edge,
          *  given as RVD vertices.
          * \return the length of the edge in 3D times the average value of the
          *  two weights.
          */
-        double edge_mass(
+        template <bool WEIGHTED> double edge_mass(
             const GEOGen::Vertex& V0,
             const GEOGen::Vertex& V1
         ) const {
             double m = Geom::distance(V0.point(), V1.point(), 2);
-            if(weighted_) {
+            if(WEIGHTED) {
                 m *= ((V0.weight() + V1.weight())/2.0);
             }
             return m;
         }
+
+    private:
+        Kernel kernel_;
     };
 
     /********************************************************************/
@@ -497,19 +581,19 @@ namespace {
                 if(v < OTM_->nb_points()) {
                     OptimalTransportMap2d* OTM =
                         static_cast<OptimalTransportMap2d*>(OTM_);
-                    double R = OTM_->weight(v);
+                    double R = OTM_->weight(OTM_->external_index(v));
                     if(R < 0.0) {
                         std::cerr << '-' << std::flush;
                     }
                     R = R > 0.0 ? ::sqrt(R) : 0.0;
-                    vec2 center(OTM_->point_ptr(v));
-                    clip_polygon_by_ball(
-                        P, center, R, OTM->clipped_,
-                        OTM_->nb_points(),
-                        OTM_->RVD()->point_allocator(),
-                        OTM->work_
+                    vec2 center(
+                        OTM_->point_ptr(OTM_->external_index(v))
                     );
-                    do_it(v,t,OTM->clipped_);
+                    // get_RVD() traverses the polygons sequentially.
+                    OptimalTransportMap2d::ClippingWorkspace& W =
+                        OTM->clipping_workspace(0);
+                    clip_polygon_by_ball(P, center, R, OTM_->nb_points(), W);
+                    do_it(v,t,W.clipped);
                 }
             } else {
                 do_it(v,t,P);
@@ -545,7 +629,8 @@ namespace {
             FOR(i,P.nb_vertices()) {
                 target_->facets.set_vertex(f,i,voffset+i);
             }
-            const_cast<Attribute<index_t>&>(chart_)[f] = v;
+            const_cast<Attribute<index_t>&>(chart_)[f] =
+                OTM_->external_index(v);
         }
 
     private:
@@ -572,12 +657,41 @@ namespace GEO {
         total_mass_ = total_mesh_mass();
     }
 
+    OptimalTransportMap2d::OptimalTransportMap2d(
+        OptimalTransportTarget* target, const std::string& delaunay, bool BRIO
+    ) :
+        OptimalTransportMap(
+            2,
+            target,
+            (delaunay == "default") ? "BPOW2d" : delaunay,
+            BRIO
+        ) {
+        geo_assert(!target->volumetric());
+        callback_ = new OTMPolygonCallback(this);
+    }
+
     OptimalTransportMap2d::~OptimalTransportMap2d() {
+        for(index_t i=0; i<clipping_workspaces_.size(); ++i) {
+            delete clipping_workspaces_[i];
+        }
+    }
+
+    void OptimalTransportMap2d::reserve_clipping_workspaces(
+        index_t nb_threads
+    ) {
+        while(clipping_workspaces_.size() < nb_threads) {
+            clipping_workspaces_.push_back(
+                new ClippingWorkspace(coord_index_t(dimp1_))
+            );
+        }
     }
 
     void OptimalTransportMap2d::get_RVD(Mesh& RVD_mesh) {
+        if(clip_by_balls_) {
+            reserve_clipping_workspaces(1);
+        }
         ComputeRVDPolygonCallback callback(this, &RVD_mesh);
-        RVD()->for_each_polygon(callback, false, false, false);
+        for_each_polygon(callback, false);
         /*
         // NOTE: Does not work, TODO: determine why
         Attribute<index_t> tet_region(RVD_mesh.cells.attributes(),"region");
@@ -602,9 +716,8 @@ namespace GEO {
                 W = new Stopwatch("RVD");
                 Logger::out("OTM") << "In RVD (centroids)..." << std::endl;
             }
-            RVD_->for_each_polygon(
-                *dynamic_cast<RVDPolygonCallback*>(callback_),
-                false, false, true
+            for_each_polygon(
+                *dynamic_cast<RVDPolygonCallback*>(callback_), true
             );
             if(newton_ && verbose_) {
                 delete W;
@@ -617,9 +730,15 @@ namespace GEO {
             centroids[2*v  ] /= g[v];
             centroids[2*v+1] /= g[v];
         }
+        wrap_to_fundamental_domain(centroids, nb_points());
+        to_external_order(centroids, 2);
     }
 
     double OptimalTransportMap2d::total_mesh_mass() const {
+        if(!target_.is_null()) {
+            return target_->total_mass();
+        }
+
         double result = 0.0;
 
         //   This is terribly confusing, the parameters for
@@ -654,84 +773,118 @@ namespace GEO {
     }
 
     void OptimalTransportMap2d::call_callback_on_RVD() {
+        // Clipping by balls does not use the PointAllocator of the RVD
+        // (that is shared by all threads), but per-thread workspaces.
+        if(clip_by_balls_) {
+            reserve_clipping_workspaces(
+                Process::maximum_concurrent_threads()
+            );
+        }
+        for_each_polygon(*dynamic_cast<RVDPolygonCallback*>(callback_), true);
+    }
+
+    void OptimalTransportMap2d::for_each_polygon(
+        RVDPolygonCallback& callback, bool parallel
+    ) {
         RVD_->for_each_polygon(
-            *dynamic_cast<RVDPolygonCallback*>(callback_),
-            false,          // symbolic
-            false,          // connected components priority
-            !clip_by_balls_ // parallel
+            callback,
+            false,   // symbolic
+            false,   // connected components priority
+            parallel
         );
-        // clip_by_balls deactivates parallel mode, because it needs to access
-        // the PointAllocator of the current thread, and we do not have any
-        // access (for now).
     }
 
     /**********************************************************************/
 
-    void compute_Laguerre_centroids_2d(
-        Mesh* omega,
-        index_t nb_points,
-        const double* points,
-        double* centroids,
-        Mesh* RVD,
-        bool verbose,
-        index_t nb_air_particles,
-        const double* air_particles,
-        index_t air_particles_stride,
-        double air_fraction,
-        const double* weights_in,
-        double* weights_out,
-        index_t nb_iter
-    ) {
+    LaguerreCentroidsSolver2d::LaguerreCentroidsSolver2d(
+        Mesh* omega, bool verbose
+    ) : omega_(omega) {
         // Omega can be either 2d or 3d with third coordinate set to
         // zero.
-        index_t omega_dim_backup = omega->vertices.dimension();
-        omega->vertices.set_dimension(3);
+        omega_dim_backup_ = omega_->vertices.dimension();
+        omega_->vertices.set_dimension(3);
 
         // false = no BRIO
         // (OTM does not use multilevel and lets Delaunay
         //  reorder the vertices)
-        OptimalTransportMap2d OTM(
-            omega,
+        OTM_ = new OptimalTransportMap2d(
+            omega_,
             std::string("BPOW2d"),
             false
         );
 
-        static bool initialized = false;
-        static bool has_cholmod = false;
-        if(!initialized) {
-            initialized = true;
-            has_cholmod = (nlInitExtension("CHOLMOD") == NL_TRUE);
-        }
+        // Initialized once, in a thread-safe manner.
+        static bool has_cholmod = (nlInitExtension("CHOLMOD") == NL_TRUE);
 
         if(has_cholmod) {
-            OTM.set_regularization(1e-3);
-            OTM.set_linear_solver(OT_CHOLMOD);
+            OTM_->set_regularization(1e-3);
+            OTM_->set_linear_solver(OT_CHOLMOD);
         }
 
-        OTM.set_Newton(true);
-        OTM.set_air_particles(
+        OTM_->set_Newton(true);
+        OTM_->set_epsilon(0.01);
+        OTM_->set_verbose(verbose);
+    }
+
+    LaguerreCentroidsSolver2d::~LaguerreCentroidsSolver2d() {
+        delete OTM_;
+        OTM_ = nullptr;
+        omega_->vertices.set_dimension(omega_dim_backup_);
+    }
+
+    void LaguerreCentroidsSolver2d::compute(
+        index_t nb_points,
+        const double* points,
+        double* centroids,
+        Mesh* RVD,
+        index_t nb_air_particles,
+        const double* air_particles,
+        index_t air_particles_stride,
+        double air_fraction,
+        index_t nb_iter
+    ) {
+        OTM_->set_air_particles(
             nb_air_particles, air_particles, air_particles_stride, air_fraction
         );
-        OTM.set_points(nb_points, points);
-        if(weights_in != nullptr) {
-            FOR(i, nb_points) {
-                OTM.set_initial_weight(i, weights_in[i]);
-            }
-        }
-        OTM.set_epsilon(0.01);
-        OTM.set_Laguerre_centroids(centroids);
-        OTM.set_verbose(verbose);
-        OTM.optimize(nb_iter);
+        OTM_->set_points(nb_points, points);
+        warm_start_.begin(*OTM_);
+        OTM_->set_Laguerre_centroids(centroids);
+        OTM_->optimize(nb_iter);
+        warm_start_.end(*OTM_);
 
         if(RVD != nullptr) {
-            OTM.get_RVD(*RVD);
+            OTM_->get_RVD(*RVD);
         }
+    }
 
-        omega->vertices.set_dimension(omega_dim_backup);
-
+    void compute_Laguerre_centroids_2d(
+        Mesh* omega,
+        index_t nb_points,
+        const double* points,
+        double* centroids,
+        Mesh* RVD,
+        bool verbose,
+        index_t nb_air_particles,
+        const double* air_particles,
+        index_t air_particles_stride,
+        double air_fraction,
+        const double* weights_in,
+        double* weights_out,
+        index_t nb_iter
+    ) {
+        LaguerreCentroidsSolver2d solver(omega, verbose);
+        if(weights_in != nullptr) {
+            // Explicit initial weights are used as is.
+            solver.warm_start().set_weights(nb_points, weights_in, false);
+        }
+        solver.compute(
+            nb_points, points, centroids, RVD,
+            nb_air_particles, air_particles, air_particles_stride,
+            air_fraction, nb_iter
+        );
         if(weights_out != nullptr) {
-            FOR(v, OTM.nb_points()) {
-                weights_out[v] = OTM.weight(v);
+            FOR(v, nb_points) {
+                weights_out[v] = solver.OTM().weight(v);
             }
         }
     }
@@ -42,6 +42,7 @@
 
 #include <exploragram/basic/common.h>
 #include <exploragram/optimal_transport/optimal_transport.h>
+#include <exploragram/optimal_transport/warm_start.h>
 #include <geogram/voronoi/generic_RVD_polygon.h>
 
 /**
@@ -122,6 +123,21 @@ namespace GEO {
             bool BRIO=false
         );
 
+        /**
+         * \brief OptimalTransportMap2d constructor with a shared
+         *  background mesh.
+         * \details See OptimalTransportTarget.
+         * \param[in] target the source distribution, a triangulated
+         *  OptimalTransportTarget of dimension 2
+         * \param[in] delaunay factory name of the Delaunay triangulation.
+         * \param[in] BRIO true if vertices are already ordered using BRIO
+         */
+        OptimalTransportMap2d(
+            OptimalTransportTarget* target,
+            const std::string& delaunay = "BPOW2d",
+            bool BRIO=false
+        );
+
         /**
          * \brief OptimalTransportMap destructor.
          */
@@ -150,15 +166,180 @@ namespace GEO {
          */
         void call_callback_on_RVD() override;
 
+        /**
+         * \brief Calls a callback for each intersection between a
+         *  Laguerre cell and the domain.
+         * \details The default implementation traverses the restricted
+         *  Voronoi diagram. Derived classes that represent the domain
+         *  differently overload this function.
+         * \param[in] callback the callback
+         * \param[in] parallel if true, the callback may be called
+         *  concurrently by several threads
+         */
+        virtual void for_each_polygon(
+            RVDPolygonCallback& callback, bool parallel
+        );
+
+    public:
+        /**
+         * \brief The temporary polygons and vertices used by clipping
+         *  operations.
+         * \details There is one of them per thread, so that the
+         *  air fraction mode (clipping by balls) can run in parallel.
+         */
+        struct ClippingWorkspace {
+            /**
+             * \brief ClippingWorkspace constructor.
+             * \param[in] dim the dimension of the created vertices
+             */
+            ClippingWorkspace(coord_index_t dim) :
+                allocator(dim),
+                nb_allocated(0) {
+            }
+
+            /**
+             * \brief Allocates the vertices created by clipping operations.
+             */
+            GEOGen::PointAllocator allocator;
+
+            /**
+             * \brief An upper bound of the number of vertices created
+             *  in allocator since it was last cleared.
+             */
+            index_t nb_allocated;
+
+            /**
+             * \brief Used by clipping operations.
+             */
+            GEOGen::Polygon work;
+
+            /**
+             * \brief Used by clipping operations.
+             */
+            GEOGen::Polygon clipped;
+        };
+
+        /**
+         * \brief Gets the clipping workspace of a thread.
+         * \param[in] thread the id of the thread
+         * \return a reference to the workspace
+         * \pre reserve_clipping_workspaces() was called with a number
+         *  of threads larger than \p thread
+         */
+        ClippingWorkspace& clipping_workspace(index_t thread) {
+            geo_debug_assert(thread < clipping_workspaces_.size());
+            return *clipping_workspaces_[thread];
+        }
+
+    protected:
+        /**
+         * \brief Makes sure there is a clipping workspace for each thread.
+         * \param[in] nb_threads the number of threads
+         */
+        void reserve_clipping_workspaces(index_t nb_threads);
+
+        vector<ClippingWorkspace*> clipping_workspaces_;
+    };
+
+    /*********************************************************************/
+
+    /**
+     * \brief Computes the centroids of the Laguerre cells that correspond
+     *  to optimal transport in 2D, for a sequence of point sets.
+     * \details Same as compute_Laguerre_centroids_2d(), but keeps the
+     *  Delaunay triangulation, the restricted Voronoi diagram and the
+     *  weights from one call to the next one. When the points move a
+     *  little bit between two calls (for instance, time steps of a
+     *  fluid simulation), the weights of the previous call are a good
+     *  starting point and Newton converges in a few iterations.
+     *  The domain \p omega is embedded in 3d during the lifetime of this
+     *  object, and it should not be modified.
+     */
+    class EXPLORAGRAM_API LaguerreCentroidsSolver2d {
     public:
         /**
-         * \brief Used by clipping operations.
+         * \brief LaguerreCentroidsSolver2d constructor.
+         * \param[in] omega a pointer to the mesh that represents the domain
+         * \param[in] verbose if true, display messages and statistics
+         */
+        LaguerreCentroidsSolver2d(Mesh* omega, bool verbose=false);
+
+        /**
+         * \brief LaguerreCentroidsSolver2d destructor.
+         * \details Restores the dimension of the domain.
+         */
+        ~LaguerreCentroidsSolver2d();
+
+        /**
+         * \brief Specifies whether weights should be extrapolated
+         *  from the two previous calls.
+         * \param[in] x true to extrapolate, false to restart from the
+         *  weights of the previous call (default)
          */
-        GEOGen::Polygon work_;
+        void set_extrapolate(bool x) {
+            warm_start_.set_extrapolate(x);
+        }
+
         /**
-         * \brief Used by clipping operations.
+         * \brief Computes the centroids of the Laguerre cells.
+         * \param[in] nb_points number of points
+         * \param[in] points a pointer to the coordinates of the points
+         * \param[out] centroids a pointer to the computed centroids
+         * \param[out] RVD if non-nullptr, a mesh with the
+         *  restricted Voronoi diagram.
+         * \param[in] nb_air_particles number of air particles.
+         * \param[in] air_particles a pointer to the array of doubles with
+         *  the coordinates of the air particles.
+         * \param[in] air_particles_stride number of doubles between two
+         *  consecutive air particles in the array, or 0 if tightly packed.
+         * \param[in] air_fraction the fraction of the total mass occupied
+         *  by air.
+         * \param[in] nb_iter maximum number of Newton iterations.
          */
-        GEOGen::Polygon clipped_;
+        void compute(
+            index_t nb_points,
+            const double* points,
+            double* centroids,
+            Mesh* RVD=nullptr,
+            index_t nb_air_particles = 0,
+            const double* air_particles = nullptr,
+            index_t air_particles_stride = 0,
+            double air_fraction = 0.0,
+            index_t nb_iter = 1000
+        );
+
+        /**
+         * \brief Gets the OptimalTransportMap2d.
+         * \return a reference to the OptimalTransportMap2d, that can be
+         *  used to change the parameters of the solver.
+         */
+        OptimalTransportMap2d& OTM() {
+            return *OTM_;
+        }
+
+        /**
+         * \brief Gets the warm-start weights.
+         * \return a reference to the OTWarmStart, that has the weights
+         *  of the latest call, and that can be used to specify the
+         *  initial weights of the next call.
+         */
+        OTWarmStart& warm_start() {
+            return warm_start_;
+        }
+
+    private:
+        Mesh* omega_;
+        index_t omega_dim_backup_;
+        OptimalTransportMap2d* OTM_;
+        OTWarmStart warm_start_;
+
+        /** \brief Forbids copy. */
+        LaguerreCentroidsSolver2d(const LaguerreCentroidsSolver2d& rhs);
+
+        /** \brief Forbids copy. */
+        LaguerreCentroidsSolver2d& operator=(
+            const LaguerreCentroidsSolver2d& rhs
+        );
     };
 
     /*********************************************************************/
@@ -39,6 +39,7 @@
 
 #include <exploragram/optimal_transport/optimal_transport_3d.h>
 #include <exploragram/optimal_transport/linear_least_squares.h>
+#include <exploragram/optimal_transport/convex_cell_batch.h>
 
 #include <geogram/mesh/mesh_io.h>
 #include <geogram/mesh/mesh_reorder.h>
@@ -155,6 +156,7 @@ namespace {
          */
         OTMPolyhedronCallback(OptimalTransportMap3d* OTM) :
             OptimalTransportMap::Callback(OTM) {
+            update_kernel();
         }
 
         /**
@@ -165,66 +167,128 @@ namespace {
             index_t t,
             const GEOGen::ConvexCell& C
         ) const override {
-            // v can be an air particle.
-            if(v >= n_) {
+            (this->*kernel_)(v,t,C);
+        }
+
+        /**
+         * \brief A pointer to a specialization of kernel().
+         */
+        typedef void (OTMPolyhedronCallback::*Kernel)(
+            index_t v, index_t t, const GEOGen::ConvexCell& C
+        ) const;
+
+        /**
+         * \brief Computes the contribution of a polyhedron.
+         * \details The flags are template arguments, so that the
+         *  tests are resolved at compile time.
+         * \tparam WEIGHTED true if the mesh has varying density
+         * \tparam CENTROIDS true if mass times centroids are computed
+         * \tparam NEWTON true if the Hessian is computed
+         * \tparam EVAL_F true if the objective function is computed
+         * \param[in] v the seed
+         * \param[in] t the tetrahedron
+         * \param[in] C the intersection between the Laguerre cell of \p v
+         *  and the tetrahedron \p t
+         */
+        template <bool WEIGHTED, bool CENTROIDS, bool NEWTON, bool EVAL_F>
+        void kernel(
+            index_t v,
+            index_t t,
+            const GEOGen::ConvexCell& C
+        ) const {
+            // v can be an air particle or a periodic copy of a seed,
+            // the contributions of a copy go to the original seed o.
+            index_t o = original_seed(v);
+            if(o >= n_) {
                 return;
             }
 
-            geo_argused(t);
-
             double m, mgx, mgy, mgz;
-            compute_m_and_mg(C, m, mgx, mgy, mgz);
-
-            if(spinlocks_ != nullptr) {
-                spinlocks_->acquire_spinlock(v);
+            compute_m_and_mg<WEIGHTED, CENTROIDS>(C, m, mgx, mgy, mgz);
+
+            // The transport plan keeps the actual position of the
+            // mass, the centroid of the seed is in the frame of o.
+            double plan_mg[3] = { mgx, mgy, mgz };
+            if(CENTROIDS && o != v) {
+                double mg[3] = { mgx, mgy, mgz };
+                to_original_frame(v, m, mg);
+                mgx = mg[0];
+                mgy = mg[1];
+                mgz = mg[2];
             }
 
-            // +m because we maximize F <=> minimize -F
-            g_[v] += m;
+            if(buffers_ != nullptr) {
+                double mg[3] = { mgx, mgy, mgz };
+                buffers_->add_mass(current_thread_id(), o, m, mg);
+            } else {
+                if(spinlocks_ != nullptr) {
+                    spinlocks_->acquire_spinlock(o);
+                }
+
+                // +m because we maximize F <=> minimize -F
+                g_[o] += m;
+
+                if(NEWTON) {
+                    // ... but here -m because Newton step =
+                    //  solve H p = -g    (minus g in the RHS).
+                    OTM_->add_i_right_hand_side(o,-m);
+                }
+
+                if(CENTROIDS) {
+                    mg_[3*o] += mgx;
+                    mg_[3*o+1] += mgy;
+                    mg_[3*o+2] += mgz;
+                }
 
-            if(Newton_step_) {
-                // ... but here -m because Newton step =
-                //  solve H p = -g    (minus g in the RHS).
-                OTM_->add_i_right_hand_side(v,-m);
+                if(spinlocks_ != nullptr) {
+                    spinlocks_->release_spinlock(o);
+                }
             }
 
-            if(mg_ != nullptr) {
-                mg_[3*v] += mgx;
-                mg_[3*v+1] += mgy;
-                mg_[3*v+2] += mgz;
+            if(plan_ != nullptr) {
+                plan_->add(
+                    current_thread_id(), external_seed(v), t, m, plan_mg
+                );
             }
 
-            if(spinlocks_ != nullptr) {
-                spinlocks_->release_spinlock(v);
+            if(RVD_buffers_ != nullptr) {
+                RVD_buffers_->add_polyhedron(
+                    current_thread_id(), external_seed(v), C
+                );
             }
 
-            if(Newton_step_) {
+            if(NEWTON) {
                 // Spinlocks are managed internally by update_Hessian().
-                update_Hessian(C, v);
+                update_Hessian<WEIGHTED>(C, v);
             }
 
-            if(eval_F_) {
-                Thread* thread = Thread::current();
-                index_t current_thread_id =
-                    (thread == nullptr) ? 0 : thread->id();
-                double F = weighted_ ? eval_F_weighted(C, v) : eval_F(C, v);
+            if(EVAL_F) {
+                double F = WEIGHTED ? eval_F_weighted(C, v) : eval_F(C, v);
                 const_cast<OTMPolyhedronCallback*>(this)->
-                    funcval_[current_thread_id] += F;
+                    funcval_[current_thread_id()] += F;
             }
         }
 
     protected:
+        /**
+         * \copydoc OptimalTransportMap::Callback::update_kernel()
+         */
+        void update_kernel() override {
+            kernel_ = select_kernel<OTMPolyhedronCallback>();
+        }
 
         /**
          * \brief Computes the mass and mass times centroid of the
          *  current ConvexCell.
          * \details Weights are taken into account if present.
+         * \tparam WEIGHTED true if the mesh has varying density
+         * \tparam CENTROIDS true if mass times centroids are computed
          * \param[in] C a const reference to the current ConvexCell
          * \param[out] m , mgx , mgy , mgz the mass and the mass times the
          *  centroid of the ConvexCell. mgx, mgy and mgz are not computed
-         *  if mg_ is nullptr.
+         *  if CENTROIDS is false.
          */
-        void compute_m_and_mg(
+        template <bool WEIGHTED, bool CENTROIDS> void compute_m_and_mg(
             const GEOGen::ConvexCell& C,
             double& m, double& mgx, double& mgy, double& mgz
         ) const {
@@ -237,100 +301,89 @@ namespace {
 
             // Find one vertex V0 of the Convex Cell. It will be then decomposed
             // into tetrahedra radiating from V0.
-            const GEOGen::Vertex* V0 = nullptr;
-            for(index_t ct=0; ct < C.max_t(); ++ct) {
-                if(C.triangle_is_used(ct)) {
-                    V0 = &C.triangle_dual(ct);
-                    break;
-                }
-            }
+            const GEOGen::Vertex* V0 = ConvexCellBatch::first_vertex(C);
             if(V0 == nullptr) {
                 return;
             }
 
+            // Gather the triangles of the facets that do not contain V0.
+            ConvexCellBatch& batch = ConvexCellBatch::get();
+            batch.gather(C, V0);
 
-            // Iterate on all the vertices of the convex cell.
-            // The vertices associated to no triangle are skipped.
-            // Note: the convex cell is in dual form, thus a
-            // vertex of the ConvexCell corresponds to a polygonal
-            // facet.
-            for(index_t cv = 0; cv < C.max_v(); ++cv) {
-                signed_index_t ct = C.vertex_triangle(cv);
-                if(ct == -1) {
-                    continue;
-                }
-                geo_debug_assert(C.triangle_is_used(index_t(ct)));
-
+            // Integrate over the tetrahedra radiating from V0.
+            const double* p0 = V0->point();
+            batch.compute_volumes(p0);
+            index_t nb = batch.nb_triangles();
+            const double* vol = batch.measures();
 
-                // Iterate around the facet vertices (that correspond
-                // to the current vertex in dual form). The polygonal
-                // facet is triangulated. The triangles that contain
-                // the vertex V0 are skipped (their volume is zero).
-                GEOGen::ConvexCell::Corner first(
-                    index_t(ct), C.find_triangle_vertex(index_t(ct), cv)
-                );
-                const GEOGen::Vertex* V1 = &C.triangle_dual(first.t);
-                const GEOGen::Vertex* V2 = nullptr;
-                const GEOGen::Vertex* V3 = nullptr;
-                const double* p0 = V0->point();
-                GEOGen::ConvexCell::Corner c = first;
-                do {
-                    V2 = V3;
-                    V3 = &C.triangle_dual(c.t);
-                    if(
-                        V2 != nullptr && V3 != V1 &&
-                        V1 != V0 && V2 != V0 && V3 != V0
-                    ) {
-                        const double* p1 = V1->point();
-                        const double* p2 = V2->point();
-                        const double* p3 = V3->point();
-                        double cur_m = GEO::Geom::tetra_volume<3>(p0,p1,p2,p3);
-                        if(weighted_) {
-                            double w0 = V0->weight();
-                            double w1 = V1->weight();
-                            double w2 = V2->weight();
-                            double w3 = V3->weight();
-                            double S =  w0+w1+w2+w3;
-                            if(mg_ != nullptr) {
-                                mgx += 0.25*cur_m*(
-                                    w0*p0[0]+w1*p1[0]+w2*p2[0]+w3*p3[0]
-                                );
-                                mgy += 0.25*cur_m*(
-                                    w0*p0[1]+w1*p1[1]+w2*p2[1]+w3*p3[1]
-                                );
-                                mgz += 0.25*cur_m*(
-                                    w0*p0[2]+w1*p1[2]+w2*p2[2]+w3*p3[2]
-                                );
-                            }
-                            cur_m *= (S/4.0);
-                        } else {
-                            if(mg_ != nullptr) {
-                                mgx += 0.25*cur_m*(p0[0]+p1[0]+p2[0]+p3[0]);
-                                mgy += 0.25*cur_m*(p0[1]+p1[1]+p2[1]+p3[1]);
-                                mgz += 0.25*cur_m*(p0[2]+p1[2]+p2[2]+p3[2]);
-                            }
+            if(!WEIGHTED) {
+                for(index_t i=0; i<nb; ++i) {
+                    m += vol[i];
+                }
+                if(CENTROIDS) {
+                    double* mg[3] = { &mgx, &mgy, &mgz };
+                    for(coord_index_t coord=0; coord<3; ++coord) {
+                        const double* x1 = batch.coord(0,coord);
+                        const double* x2 = batch.coord(1,coord);
+                        const double* x3 = batch.coord(2,coord);
+                        double x0 = p0[coord];
+                        double result = 0.0;
+                        for(index_t i=0; i<nb; ++i) {
+                            result += 0.25*vol[i]*(x0+x1[i]+x2[i]+x3[i]);
                         }
-                        m += cur_m;
+                        *mg[coord] = result;
                     }
-                    C.move_to_next_around_vertex(c);
-                } while(c != first);
+                }
+                return;
             }
 
+            double w0 = V0->weight();
+            const double* w1 = batch.weight(0);
+            const double* w2 = batch.weight(1);
+            const double* w3 = batch.weight(2);
+            for(index_t i=0; i<nb; ++i) {
+                m += vol[i]*(w0+w1[i]+w2[i]+w3[i])/4.0;
+            }
+            if(CENTROIDS) {
+                double* mg[3] = { &mgx, &mgy, &mgz };
+                for(coord_index_t coord=0; coord<3; ++coord) {
+                    const double* x1 = batch.coord(0,coord);
+                    const double* x2 = batch.coord(1,coord);
+                    const double* x3 = batch.coord(2,coord);
+                    double w0x0 = w0*p0[coord];
+                    double result = 0.0;
+                    for(index_t i=0; i<nb; ++i) {
+                        result += 0.25*vol[i]*(
+                            w0x0+w1[i]*x1[i]+w2[i]*x2[i]+w3[i]*x3[i]
+                        );
+                    }
+                    *mg[coord] = result;
+                }
+            }
         }
 
         /**
          * \brief Updates the Hessian according to the current ConvexCell.
+         * \tparam WEIGHTED true if the mesh has varying density
          * \param[in] C a const reference to the current ConvexCell
          * \param[in] v the current seed
          */
-        void update_Hessian(
+        template <bool WEIGHTED> void update_Hessian(
             const GEOGen::ConvexCell& C, index_t v
         ) const {
             // The coefficient of the Hessian associated to a pair of
             // adjacent cells Lag(i),Lag(j) is :
             // - mass(Lag(i) /\ Lag(j)) / (2*distance(pi,pj))
 
-            const double* p0 = OTM_->point_ptr(v);
+            // Distances are measured between the actual copies, the
+            // coefficients go to the original seeds.
+            const double* p0 = seed_point(v);
+            index_t o = original_seed(v);
+
+            // Gather the triangles of the facets shared with another
+            // Laguerre cell, one facet per adjacent seed.
+            ConvexCellBatch& batch = ConvexCellBatch::get();
+            batch.clear();
 
             // Iterate on all the vertices of the convex cell.
             // The vertices associated to no triangle are skipped.
@@ -346,18 +399,13 @@ namespace {
                 geo_debug_assert(C.triangle_is_used(index_t(ct)));
 
                 // Get index of adjacent seed if any.
-                index_t v_adj = index_t(-1);
                 signed_index_t adjacent = C.vertex_id(cv);
-                if(adjacent > 0) {
-                    // Positive adjacent indices correspond to
-                    // Voronoi seed - Voronoi seed link
-                    v_adj = index_t(adjacent - 1);
-                }
-                if(v_adj == index_t(-1)) {
+                if(adjacent <= 0) {
                     continue;
                 }
-
-                double hij = 0;
+                // Positive adjacent indices correspond to
+                // Voronoi seed - Voronoi seed link
+                batch.begin_facet(index_t(adjacent - 1));
 
                 // Iterate around the facet vertices (that correspond
                 // to the current vertex in dual form). The polygonal
@@ -374,41 +422,54 @@ namespace {
                     V2 = V3;
                     V3 = &C.triangle_dual(c.t);
                     if(V2 != nullptr && V3 != V1) {
-                        double cur_m = GEO::Geom::triangle_area_3d(
-                            V1->point(),V2->point(),V3->point()
-                        );
-                        if(weighted_) {
-                            cur_m *= (
-                                V1->weight()+V2->weight()+V3->weight()
-                            )/3.0;
-                        }
-                        hij += cur_m;
+                        batch.add_triangle(V1,V2,V3);
                     }
                     C.move_to_next_around_vertex(c);
                 } while(c != first);
+            }
+
+            batch.compute_areas(WEIGHTED);
+            const double* area = batch.measures();
 
-                const double* p1 = OTM_->point_ptr(v_adj);
+            for(index_t f=0; f<batch.nb_facets(); ++f) {
+                index_t v_adj = batch.facet_id(f);
+                double hij = 0.0;
+                for(index_t i=batch.facet_begin(f); i<batch.facet_end(f); ++i) {
+                    hij += area[i];
+                }
+
+                const double* p1 = seed_point(v_adj);
                 hij /= (2.0 * GEO::Geom::distance(p0,p1,3));
+                index_t o_adj = original_seed(v_adj);
+
+                if(buffers_ != nullptr) {
+                    index_t thread = current_thread_id();
+                    if(o_adj < n_) {
+                        buffers_->add_coefficient(thread, o, o_adj, -hij);
+                    }
+                    buffers_->add_coefficient(thread, o, o, hij);
+                    continue;
+                }
 
                 if(spinlocks_ != nullptr) {
-                    spinlocks_->acquire_spinlock(v);
+                    spinlocks_->acquire_spinlock(o);
                 }
 
                 // Diagonal is positive, extra-diagonal
                 // coefficients are negative,
                 // this is a convex function.
 
-                if(v_adj < n_) {
+                if(o_adj < n_) {
                     OTM_->add_ij_coefficient(
-                        v, v_adj, -hij
+                        o, o_adj, -hij
                     );
                 }
                 OTM_->add_ij_coefficient(
-                    v, v, hij
+                    o, o, hij
                 );
 
                 if(spinlocks_ != nullptr) {
-                    spinlocks_->release_spinlock(v);
+                    spinlocks_->release_spinlock(o);
                 }
             }
         }
@@ -431,60 +492,34 @@ namespace {
 
             geo_debug_assert(!weighted_);
 
-            double F = 0.0;
+            ConvexCellBatch& batch = ConvexCellBatch::get();
+            batch.gather(C);
 
-            // Iterate on all the vertices of the convex cell.
-            // The vertices associated to no triangle are skipped.
-            // Note: the convex cell is in dual form, thus a
-            // vertex of the ConvexCell corresponds to a polygonal
-            // facet.
+            const double* p0 = seed_point(v);
+            batch.compute_volumes(p0, true);
+            index_t nb = batch.nb_triangles();
+            const double* m = batch.measures();
 
-            for(index_t cv = 0; cv < C.max_v(); ++cv) {
-                signed_index_t ct = C.vertex_triangle(cv);
-                if(ct == -1) {
-                    continue;
+            // fT accumulates, for each tetrahedron, the sum of the
+            // squared lengths and dot products of its edge vectors.
+            // A periodic copy has the weight of its original seed.
+            double wv = w_[original_seed(v)];
+            double F = 0.0;
+            for(index_t i=0; i<nb; ++i) {
+                double fT = 0.0;
+                for(coord_index_t cc = 0; cc < 3; ++cc) {
+                    double Uc = batch.coord(0,cc)[i] - p0[cc];
+                    double Vc = batch.coord(1,cc)[i] - p0[cc];
+                    double Wc = batch.coord(2,cc)[i] - p0[cc];
+                    fT +=
+                        Uc * Uc +
+                        Vc * Vc +
+                        Wc * Wc +
+                        Uc * Vc +
+                        Vc * Wc +
+                        Wc * Uc;
                 }
-                geo_debug_assert(C.triangle_is_used(index_t(ct)));
-
-
-                // Iterate around the facet vertices (that correspond
-                // to the current vertex in dual form). The polygonal
-                // facet is triangulated.
-
-                GEOGen::ConvexCell::Corner first(
-                    index_t(ct), C.find_triangle_vertex(index_t(ct), cv)
-                );
-                const GEOGen::Vertex* V1 = &C.triangle_dual(first.t);
-                const GEOGen::Vertex* V2 = nullptr;
-                const GEOGen::Vertex* V3 = nullptr;
-                GEOGen::ConvexCell::Corner c = first;
-                do {
-                    V2 = V3;
-                    V3 = &C.triangle_dual(c.t);
-                    if(V2 != nullptr && V3 != V1) {
-                        const double* p0 = OTM_->point_ptr(v);
-                        const double* p1 = V1->point();
-                        const double* p2 = V2->point();
-                        const double* p3 = V3->point();
-                        double m = Geom::tetra_signed_volume(p0, p1, p2, p3);
-                        double fT = 0.0;
-                        for(coord_index_t cc = 0; cc < 3; ++cc) {
-                            double Uc = p1[cc] - p0[cc];
-                            double Vc = p2[cc] - p0[cc];
-                            double Wc = p3[cc] - p0[cc];
-                            fT +=
-                                Uc * Uc +
-                                Vc * Vc +
-                                Wc * Wc +
-                                Uc * Vc +
-                                Vc * Wc +
-                                Wc * Uc;
-                        }
-                        fT = m * (fT / 10.0 - w_[v]);
-                        F += fT;
-                    }
-                    C.move_to_next_around_vertex(c);
-                } while(c != first);
+                F += m[i] * (fT / 10.0 - wv);
             }
             // -F because we maximize F <=> minimize -F
             return -F;
@@ -500,131 +535,90 @@ namespace {
         double eval_F_weighted(const GEOGen::ConvexCell& C, index_t v) const {
             double F = 0.0;
 
-
             // Find one vertex V0 of the Convex Cell. It will be then decomposed
             // into tetrahedra radiating from V0.
-            const GEOGen::Vertex* V0 = nullptr;
-            for(index_t ct=0; ct < C.max_t(); ++ct) {
-                if(C.triangle_is_used(ct)) {
-                    V0 = &C.triangle_dual(ct);
-                    break;
-                }
-            }
+            const GEOGen::Vertex* V0 = ConvexCellBatch::first_vertex(C);
             if(V0 == nullptr) {
                 return F;
             }
 
-            // Iterate on all the vertices of the convex cell.
-            // The vertices associated to no triangle are skipped.
-            // Note: the convex cell is in dual form, thus a
-            // vertex of the ConvexCell corresponds to a polygonal
-            // facet.
-            for(index_t cv = 0; cv < C.max_v(); ++cv) {
-                signed_index_t ct = C.vertex_triangle(cv);
-                if(ct == -1) {
-                    continue;
-                }
-                geo_debug_assert(C.triangle_is_used(index_t(ct)));
-
-
-                // Iterate around the facet vertices (that correspond
-                // to the current vertex in dual form). The polygonal
-                // facet is triangulated. The triangles that contain
-                // the vertex V0 are skipped (their volume is zero).
-                GEOGen::ConvexCell::Corner first(
-                    index_t(ct), C.find_triangle_vertex(index_t(ct), cv)
-                );
-                const GEOGen::Vertex* V1 = &C.triangle_dual(first.t);
-                const GEOGen::Vertex* V2 = nullptr;
-                const GEOGen::Vertex* V3 = nullptr;
-                GEOGen::ConvexCell::Corner c = first;
-                do {
-                    V2 = V3;
-                    V3 = &C.triangle_dual(c.t);
-                    if(
-                        V2 != nullptr && V3 != V1 &&
-                        V1 != V0 && V2 != V0 && V3 != V0
-                    ) {
+            // Gather the triangles of the facets that do not contain V0.
+            ConvexCellBatch& batch = ConvexCellBatch::get();
+            batch.gather(C, V0);
+
+            const double* p0 = V0->point();
+            batch.compute_volumes(p0);
+            index_t nb = batch.nb_triangles();
+            const double* vol = batch.measures();
+
+            const double* q = seed_point(v);
+            double wv = w_[original_seed(v)];
+
+            // The terms that only depend on V0 are the same for all the
+            // tetrahedra.
+            double rho0 = V0->weight();
+            double dotprod_00 = 0.0;
+            for(coord_index_t cc = 0; cc < 3; ++cc) {
+                double sp0 = q[cc] - p0[cc];
+                dotprod_00 += sp0 * sp0;
+            }
 
-                        const double* p0 = V0->point();
-                        const double* p1 = V1->point();
-                        const double* p2 = V2->point();
-                        const double* p3 = V3->point();
-
-                        double p0_mass = V0->weight();
-                        double p1_mass = V1->weight();
-                        double p2_mass = V2->weight();
-                        double p3_mass = V3->weight();
-
-                        const double* q = OTM_->point_ptr(v);
-
-                        double Tvol = GEO::Geom::tetra_volume<3>(p0,p1,p2,p3);
-                        double Sp = p0_mass + p1_mass + p2_mass + p3_mass;
-
-                        double m = (Tvol * Sp) / 4.0;
-                        double rho[4], alpha[4];
-
-                        rho[0] = p0_mass;
-                        rho[1] = p1_mass;
-                        rho[2] = p2_mass;
-                        rho[3] = p3_mass;
-
-                        alpha[0] = Sp + rho[0];
-                        alpha[1] = Sp + rho[1];
-                        alpha[2] = Sp + rho[2];
-                        alpha[3] = Sp + rho[3];
-
-                        double dotprod_00 = 0.0;
-                        double dotprod_10 = 0.0;
-                        double dotprod_11 = 0.0;
-                        double dotprod_20 = 0.0;
-                        double dotprod_21 = 0.0;
-                        double dotprod_22 = 0.0;
-                        double dotprod_30 = 0.0;
-                        double dotprod_31 = 0.0;
-                        double dotprod_32 = 0.0;
-                        double dotprod_33 = 0.0;
-
-                        for(coord_index_t cc = 0; cc < 3; ++cc) {
-                            double sp0 = q[cc] - p0[cc];
-                            double sp1 = q[cc] - p1[cc];
-                            double sp2 = q[cc] - p2[cc];
-                            double sp3 = q[cc] - p3[cc];
-                            dotprod_00 += sp0 * sp0;
-                            dotprod_10 += sp1 * sp0;
-                            dotprod_11 += sp1 * sp1;
-                            dotprod_20 += sp2 * sp0;
-                            dotprod_21 += sp2 * sp1;
-                            dotprod_22 += sp2 * sp2;
-                            dotprod_30 += sp3 * sp0;
-                            dotprod_31 += sp3 * sp1;
-                            dotprod_32 += sp3 * sp2;
-                            dotprod_33 += sp3 * sp3;
-                        }
+            const double* rho1 = batch.weight(0);
+            const double* rho2 = batch.weight(1);
+            const double* rho3 = batch.weight(2);
+
+            for(index_t i=0; i<nb; ++i) {
+                double Sp = rho0 + rho1[i] + rho2[i] + rho3[i];
+                double m = (vol[i] * Sp) / 4.0;
+
+                double dotprod_10 = 0.0;
+                double dotprod_11 = 0.0;
+                double dotprod_20 = 0.0;
+                double dotprod_21 = 0.0;
+                double dotprod_22 = 0.0;
+                double dotprod_30 = 0.0;
+                double dotprod_31 = 0.0;
+                double dotprod_32 = 0.0;
+                double dotprod_33 = 0.0;
+
+                for(coord_index_t cc = 0; cc < 3; ++cc) {
+                    double sp0 = q[cc] - p0[cc];
+                    double sp1 = q[cc] - batch.coord(0,cc)[i];
+                    double sp2 = q[cc] - batch.coord(1,cc)[i];
+                    double sp3 = q[cc] - batch.coord(2,cc)[i];
+                    dotprod_10 += sp1 * sp0;
+                    dotprod_11 += sp1 * sp1;
+                    dotprod_20 += sp2 * sp0;
+                    dotprod_21 += sp2 * sp1;
+                    dotprod_22 += sp2 * sp2;
+                    dotprod_30 += sp3 * sp0;
+                    dotprod_31 += sp3 * sp1;
+                    dotprod_32 += sp3 * sp2;
+                    dotprod_33 += sp3 * sp3;
+                }
 
-                        double fT = 0.0;
-                        fT += (alpha[0] + rho[0]) * dotprod_00;
-                        fT += (alpha[1] + rho[0]) * dotprod_10;
-                        fT += (alpha[1] + rho[1]) * dotprod_11;
-                        fT += (alpha[2] + rho[0]) * dotprod_20;
-                        fT += (alpha[2] + rho[1]) * dotprod_21;
-                        fT += (alpha[2] + rho[2]) * dotprod_22;
-                        fT += (alpha[3] + rho[0]) * dotprod_30;
-                        fT += (alpha[3] + rho[1]) * dotprod_31;
-                        fT += (alpha[3] + rho[2]) * dotprod_32;
-                        fT += (alpha[3] + rho[3]) * dotprod_33;
-
-                        fT = Tvol * fT / 60.0 - m * w_[v];
-
-                        F += fT;
-                    }
-                    C.move_to_next_around_vertex(c);
-                } while(c != first);
+                // The coefficient of dotprod_kj is alpha[k] + rho[j],
+                // with alpha[k] = Sp + rho[k].
+                double fT = 0.0;
+                fT += (Sp + 2.0 * rho0) * dotprod_00;
+                fT += (Sp + rho1[i] + rho0) * dotprod_10;
+                fT += (Sp + 2.0 * rho1[i]) * dotprod_11;
+                fT += (Sp + rho2[i] + rho0) * dotprod_20;
+                fT += (Sp + rho2[i] + rho1[i]) * dotprod_21;
+                fT += (Sp + 2.0 * rho2[i]) * dotprod_22;
+                fT += (Sp + rho3[i] + rho0) * dotprod_30;
+                fT += (Sp + rho3[i] + rho1[i]) * dotprod_31;
+                fT += (Sp + rho3[i] + rho2[i]) * dotprod_32;
+                fT += (Sp + 2.0 * rho3[i]) * dotprod_33;
+
+                F += vol[i] * fT / 60.0 - m * wv;
             }
             // -F because we maximize F <=> minimize -F
             return -F;
         }
 
+    private:
+        Kernel kernel_;
     };
 
 /**********************************************************************/
@@ -719,6 +713,10 @@ namespace GEO {
     }
 
     double OptimalTransportMap3d::total_mesh_mass() const {
+        if(!target_.is_null()) {
+            return target_->total_mass();
+        }
+
         double result = 0.0;
         //   This is terribly confusing, the parameters for
         // a power diagram are called "weights", and the
@@ -753,6 +751,19 @@ namespace GEO {
         return result;
     }
 
+    OptimalTransportMap3d::OptimalTransportMap3d(
+        OptimalTransportTarget* target, const std::string& delaunay, bool BRIO
+    ) :
+        OptimalTransportMap(
+            3,
+            target,
+            default_delaunay(delaunay),
+            BRIO
+        ) {
+        geo_assert(target->volumetric());
+        callback_ = new OTMPolyhedronCallback(this);
+    }
+
     OptimalTransportMap3d::~OptimalTransportMap3d() {
     }
 
@@ -765,6 +776,11 @@ namespace GEO {
             false,         // borders_only
             show_RVD_seed_ // integration_simplices
         );
+        if(seed_order_.size() != 0 || nb_periodic_copies() != 0) {
+            for(index_t c: RVD_mesh.cells) {
+                tet_region[c] = external_index(tet_region[c]);
+            }
+        }
         if(!show_RVD_seed_) {
             cell_shrink_to_animation(RVD_mesh);
         }
@@ -797,55 +813,78 @@ namespace GEO {
             centroids[3*v+1] /= g[v];
             centroids[3*v+2] /= g[v];
         }
+        wrap_to_fundamental_domain(centroids, nb_points());
+        to_external_order(centroids, 3);
     }
 
     void OptimalTransportMap3d::call_callback_on_RVD() {
+        // Air fraction is not taken into account by this callback (no
+        // clipping by balls), so there is no reason not to run in parallel.
         RVD_->for_each_polyhedron(
             *dynamic_cast<RVDPolyhedronCallback*>(callback_),
             false, // symbolic
             false, // connected components priority
-            !clip_by_balls_ // parallel
+            true   // parallel
         );
-        // clip_by_balls deactivates parallel mode, because it needs to access
-        // the PointAllocator of the current thread, and we do not have any
-        // access (for now).
     }
 
     /**********************************************************************/
 
-    void compute_Laguerre_centroids_3d(
-        Mesh* omega,
-        index_t nb_points,
-        const double* points,
-        double* centroids,
-        RVDPolyhedronCallback* cb,
-        bool verbose,
-        index_t nb_iter
-    ) {
-        omega->vertices.set_dimension(4);
+    LaguerreCentroidsSolver3d::LaguerreCentroidsSolver3d(
+        Mesh* omega, bool verbose
+    ) : omega_(omega) {
+        omega_->vertices.set_dimension(4);
 
         // false = no BRIO
         // (OTM does not use multilevel and lets Delaunay
         //  reorder the vertices)
-        OptimalTransportMap3d OTM(
-            omega,
+        OTM_ = new OptimalTransportMap3d(
+            omega_,
             "PDEL",
             false
         );
 
-        OTM.set_regularization(1e-3);
-        OTM.set_Newton(true);
-        OTM.set_points(nb_points, points);
-        OTM.set_epsilon(0.01);
-        OTM.set_Laguerre_centroids(centroids);
-        OTM.set_verbose(verbose);
-        OTM.optimize(nb_iter);
+        OTM_->set_regularization(1e-3);
+        OTM_->set_Newton(true);
+        OTM_->set_epsilon(0.01);
+        OTM_->set_verbose(verbose);
+    }
+
+    LaguerreCentroidsSolver3d::~LaguerreCentroidsSolver3d() {
+        delete OTM_;
+        OTM_ = nullptr;
+        omega_->vertices.set_dimension(3);
+    }
+
+    void LaguerreCentroidsSolver3d::compute(
+        index_t nb_points,
+        const double* points,
+        double* centroids,
+        RVDPolyhedronCallback* cb,
+        index_t nb_iter
+    ) {
+        OTM_->set_points(nb_points, points);
+        warm_start_.begin(*OTM_);
+        OTM_->set_Laguerre_centroids(centroids);
+        OTM_->optimize(nb_iter);
+        warm_start_.end(*OTM_);
 
         if(cb != nullptr) {
-            OTM.RVD()->for_each_polyhedron(*cb,false,false,false);
+            OTM_->RVD()->for_each_polyhedron(*cb,false,false,false);
         }
+    }
 
-        omega->vertices.set_dimension(3);
+    void compute_Laguerre_centroids_3d(
+        Mesh* omega,
+        index_t nb_points,
+        const double* points,
+        double* centroids,
+        RVDPolyhedronCallback* cb,
+        bool verbose,
+        index_t nb_iter
+    ) {
+        LaguerreCentroidsSolver3d solver(omega, verbose);
+        solver.compute(nb_points, points, centroids, cb, nb_iter);
     }
 }
 
@@ -945,6 +984,9 @@ namespace {
             );
             RVD.vertices.set_dimension(3);
             RVD.cells.connect();
+            for(index_t t = 0; t < RVD.cells.nb(); ++t) {
+                tet_region[t] = OTM.external_index(tet_region[t]);
+            }
 
             /*
               if(CmdLine::get_arg_bool("RVD")) {
@@ -1101,7 +1143,17 @@ namespace GEO {
         // Step 4: Filter-out the tets that are not contained by
         // the initial mesh M1.
         if(filter_tets) {
-            MeshCellsAABB AABB(*OTM.RVD()->mesh());
+            //   The bounding volume hierarchy of the shared target is
+            // used if there is one, else a temporary one is created.
+            const MeshCellsAABB* AABB = nullptr;
+            MeshCellsAABB* own_AABB = nullptr;
+            if(OTM.target() != nullptr) {
+                AABB = OTM.target()->cells_AABB();
+            }
+            if(AABB == nullptr) {
+                own_AABB = new MeshCellsAABB(*OTM.RVD()->mesh());
+                AABB = own_AABB;
+            }
             try {
                 ProgressTask progress("Classifying", 100);
                 for(index_t t=0; t<nb_tets; ++t) {
@@ -1114,13 +1166,18 @@ namespace GEO {
                                 p[lv][c] = morph_vertices[v*6+3+c];
                             }
                         }
-                        if(!mesh_contains_tet(AABB, p[0], p[1], p[2], p[3])) {
+                        if(
+                            !mesh_contains_tet(
+                                *AABB, p[0], p[1], p[2], p[3]
+                            )
+                        ) {
                             tet_to_remove[t] = true;
                         }
                     }
                 }
             } catch(...) {
             }
+            delete own_AABB;
         }
 
         // Step 5: create the output mesh.
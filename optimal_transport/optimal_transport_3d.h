@@ -42,6 +42,7 @@
 
 #include <exploragram/basic/common.h>
 #include <exploragram/optimal_transport/optimal_transport.h>
+#include <exploragram/optimal_transport/warm_start.h>
 
 /**
  * \file exploragram/optimal_transport/optimal_transport_3d.h
@@ -106,6 +107,21 @@ namespace GEO {
             bool BRIO = false
         );
 
+        /**
+         * \brief OptimalTransportMap3d constructor with a shared
+         *  background mesh.
+         * \details See OptimalTransportTarget.
+         * \param[in] target the source distribution, a volumetric
+         *  OptimalTransportTarget of dimension 3
+         * \param[in] delaunay factory name of the Delaunay triangulation.
+         * \param[in] BRIO true if vertices are already ordered using BRIO
+         */
+        OptimalTransportMap3d(
+            OptimalTransportTarget* target,
+            const std::string& delaunay = "PDEL",
+            bool BRIO = false
+        );
+
         /**
          * \brief OptimalTransportMap destructor.
          */
@@ -137,6 +153,94 @@ namespace GEO {
 
     /**********************************************************************/
 
+    /**
+     * \brief Computes the centroids of the Laguerre cells that correspond
+     *  to optimal transport, for a sequence of point sets.
+     * \details Same as compute_Laguerre_centroids_3d(), but keeps the
+     *  Delaunay triangulation, the restricted Voronoi diagram and the
+     *  weights from one call to the next one. When the points move a
+     *  little bit between two calls (for instance, time steps of a
+     *  fluid simulation), the weights of the previous call are a good
+     *  starting point and Newton converges in a few iterations.
+     *  The domain \p omega is embedded in 4d during the lifetime of this
+     *  object, and it should not be modified.
+     */
+    class EXPLORAGRAM_API LaguerreCentroidsSolver3d {
+    public:
+        /**
+         * \brief LaguerreCentroidsSolver3d constructor.
+         * \param[in] omega a pointer to the mesh that represents the domain
+         * \param[in] verbose if true, display messages and statistics
+         */
+        LaguerreCentroidsSolver3d(Mesh* omega, bool verbose=false);
+
+        /**
+         * \brief LaguerreCentroidsSolver3d destructor.
+         * \details Restores the dimension of the domain.
+         */
+        ~LaguerreCentroidsSolver3d();
+
+        /**
+         * \brief Specifies whether weights should be extrapolated
+         *  from the two previous calls.
+         * \param[in] x true to extrapolate, false to restart from the
+         *  weights of the previous call (default)
+         */
+        void set_extrapolate(bool x) {
+            warm_start_.set_extrapolate(x);
+        }
+
+        /**
+         * \brief Computes the centroids of the Laguerre cells.
+         * \param[in] nb_points number of points
+         * \param[in] points a pointer to the coordinates of the points
+         * \param[out] centroids a pointer to the computed centroids
+         * \param[in] cb an optional RVD polyhedron callback to be called
+         *  on the restricted power diagram once it is computed.
+         * \param[in] nb_iter maximum number of Newton iterations
+         */
+        void compute(
+            index_t nb_points,
+            const double* points,
+            double* centroids,
+            RVDPolyhedronCallback* cb=nullptr,
+            index_t nb_iter=2000
+        );
+
+        /**
+         * \brief Gets the OptimalTransportMap3d.
+         * \return a reference to the OptimalTransportMap3d, that can be
+         *  used to change the parameters of the solver.
+         */
+        OptimalTransportMap3d& OTM() {
+            return *OTM_;
+        }
+
+        /**
+         * \brief Gets the warm-start weights.
+         * \return a reference to the OTWarmStart, that has the weights
+         *  of the latest call.
+         */
+        OTWarmStart& warm_start() {
+            return warm_start_;
+        }
+
+    private:
+        Mesh* omega_;
+        OptimalTransportMap3d* OTM_;
+        OTWarmStart warm_start_;
+
+        /** \brief Forbids copy. */
+        LaguerreCentroidsSolver3d(const LaguerreCentroidsSolver3d& rhs);
+
+        /** \brief Forbids copy. */
+        LaguerreCentroidsSolver3d& operator=(
+            const LaguerreCentroidsSolver3d& rhs
+        );
+    };
+
+    /**********************************************************************/
+
     /**
      * \brief Computes a shape that interpolates the two input tet
      *  meshes.
@@ -0,0 +1,348 @@
+/*
+ *  Copyright (c) 2000-2022 Inria
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *  this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *  * Neither the name of the ALICE Project-Team nor the names of its
+ *  contributors may be used to endorse or promote products derived from this
+ *  software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  Contact: Bruno Levy
+ *
+ *     https://www.inria.fr/fr/bruno-levy
+ *
+ *     Inria,
+ *     Domaine de Voluceau,
+ *     78150 Le Chesnay - Rocquencourt
+ *     FRANCE
+ *
+ */
+
+#include <exploragram/optimal_transport/optimal_transport_on_convex_domain.h>
+#include <geogram/voronoi/generic_RVD_vertex.h>
+#include <geogram/voronoi/generic_RVD_polygon.h>
+#include <geogram/voronoi/RVD_callback.h>
+#include <geogram/mesh/mesh.h>
+#include <geogram/basic/process.h>
+#include <geogram/basic/geometry.h>
+
+namespace {
+    using namespace GEO;
+
+    /**
+     * \brief Gets the id of the current thread.
+     * \return the id of the current thread, or 0 if not
+     *  running in a thread.
+     */
+    index_t current_thread_id() {
+        Thread* thread = Thread::current();
+        return (thread == nullptr) ? 0 : thread->id();
+    }
+}
+
+namespace GEO {
+
+    OptimalTransportMapOnConvexDomain::OptimalTransportMapOnConvexDomain(
+        index_t nb_vertices, const double* vertices,
+        const std::string& delaunay
+    ) :
+        OptimalTransportMap2d(
+            new_domain_mesh(nb_vertices, vertices, false),
+            (delaunay == "default") ? "BPOW2d" : delaunay,
+            false
+        ) {
+        domain_ = mesh_;
+        set_domain_vertices(nb_vertices, vertices);
+    }
+
+    OptimalTransportMapOnConvexDomain::OptimalTransportMapOnConvexDomain(
+        index_t nb_vertices, const double* vertices,
+        const std::string& delaunay, bool weighted
+    ) :
+        OptimalTransportMap2d(
+            new_domain_mesh(nb_vertices, vertices, weighted),
+            (delaunay == "default") ? "BPOW2d" : delaunay,
+            false
+        ) {
+        domain_ = mesh_;
+        set_domain_vertices(nb_vertices, vertices);
+    }
+
+    OptimalTransportMapOnConvexDomain::~OptimalTransportMapOnConvexDomain() {
+        for(index_t i=0; i<cell_workspaces_.size(); ++i) {
+            delete cell_workspaces_[i];
+        }
+        delete domain_;
+        domain_ = nullptr;
+    }
+
+    void OptimalTransportMapOnConvexDomain::set_domain_vertices(
+        index_t nb_vertices, const double* vertices
+    ) {
+        domain_vertices_.assign(vertices, vertices + 2*nb_vertices);
+
+        double area = 0.0;
+        for(index_t i=0; i<nb_vertices; ++i) {
+            index_t j = (i+1) % nb_vertices;
+            area +=
+                vertices[2*i] * vertices[2*j+1] -
+                vertices[2*j] * vertices[2*i+1];
+        }
+        geo_assert(area != 0.0);
+        if(area < 0.0) {
+            for(index_t i=0; i<nb_vertices; ++i) {
+                index_t j = nb_vertices-1-i;
+                domain_vertices_[2*i]   = vertices[2*j];
+                domain_vertices_[2*i+1] = vertices[2*j+1];
+            }
+        }
+
+        // The polygon is convex if all its corners turn left.
+        for(index_t i=0; i<nb_vertices; ++i) {
+            const double* p1 = domain_vertex(i);
+            const double* p2 = domain_vertex((i+1) % nb_vertices);
+            const double* p3 = domain_vertex((i+2) % nb_vertices);
+            double det =
+                (p2[0] - p1[0]) * (p3[1] - p1[1]) -
+                (p2[1] - p1[1]) * (p3[0] - p1[0]);
+            geo_assert(det >= 0.0);
+        }
+    }
+
+    Mesh* OptimalTransportMapOnConvexDomain::new_domain_mesh(
+        index_t nb_vertices, const double* vertices, bool weighted
+    ) {
+        geo_assert(nb_vertices >= 3);
+        Mesh* result = new Mesh(3);
+        for(index_t i=0; i<nb_vertices; ++i) {
+            result->vertices.create_vertex(
+                vec3(vertices[2*i], vertices[2*i+1], 0.0).data()
+            );
+        }
+        for(index_t i=1; i+1<nb_vertices; ++i) {
+            result->facets.create_triangle(0, i, i+1);
+        }
+
+        if(weighted) {
+            // The "weight" attribute activates the weighted mode of the
+            // callbacks. The actual weights are copied into the vertices
+            // of the polygons by the derived classes.
+            Attribute<double> vertex_mass(
+                result->vertices.attributes(), "weight"
+            );
+            for(index_t v: result->vertices) {
+                vertex_mass[v] = 1.0;
+            }
+        }
+        return result;
+    }
+
+    index_t OptimalTransportMapOnConvexDomain::nb_background_elements(
+    ) const {
+        return 1;
+    }
+
+    void OptimalTransportMapOnConvexDomain::for_each_polygon(
+        RVDPolygonCallback& callback, bool parallel
+    ) {
+        index_t nb_threads =
+            parallel ? Process::maximum_concurrent_threads() : 1;
+        while(cell_workspaces_.size() < nb_threads) {
+            cell_workspaces_.push_back(
+                new CellWorkspace(coord_index_t(dimp1_))
+            );
+        }
+
+        // Each Laguerre cell is processed by a single thread, with the
+        // periodic copies of its seed. Note that the air particles have
+        // a Laguerre cell (ignored by the callback of the transport map,
+        // but used by get_RVD()).
+        index_t nb = delaunay_->nb_vertices() - nb_periodic_copies();
+        auto process_with_copies = [this,&callback](
+            index_t v, CellWorkspace& W
+        ) {
+            if(clip_Laguerre_cell(v, W)) {
+                process_Laguerre_cell(v, callback, W);
+            }
+            for(index_t k=0; k<nb_periodic_copies(v); ++k) {
+                index_t copy = periodic_copy(v,k);
+                if(clip_Laguerre_cell(copy, W)) {
+                    process_Laguerre_cell(copy, callback, W);
+                }
+            }
+        };
+        if(parallel) {
+            parallel_for(
+                0, nb,
+                [this,&process_with_copies](index_t v) {
+                    process_with_copies(
+                        v, *cell_workspaces_[current_thread_id()]
+                    );
+                }
+            );
+        } else {
+            for(index_t v=0; v<nb; ++v) {
+                process_with_copies(v, *cell_workspaces_[0]);
+            }
+        }
+    }
+
+    bool OptimalTransportMapOnConvexDomain::clip_Laguerre_cell(
+        index_t v, CellWorkspace& W
+    ) {
+        //   The vertices of the previous cells are no longer used, but
+        // the allocator is only cleared once max_points points were
+        // created, so that its chunks are shared by many cells instead
+        // of being allocated and freed for each cell. The points created
+        // by derived classes when processing the cell (e.g. one piece
+        // per pixel) are counted as well.
+        const index_t max_points = 65536;
+        if(W.nb_points >= max_points) {
+            W.allocator.clear();
+            W.nb_points = 0;
+        }
+
+        delaunay_->get_neighbors(v, W.neighbors);
+        if(W.neighbors.size() == 0 && delaunay_->nb_vertices() > 1) {
+            // Hidden seed, empty Laguerre cell.
+            return false;
+        }
+
+        // Start from the domain polygon.
+        W.cell.clear();
+        for(index_t i=0; i<nb_domain_vertices(); ++i) {
+            double* p = W.new_point();
+            p[0] = domain_vertex(i)[0];
+            p[1] = domain_vertex(i)[1];
+            p[2] = 0.0;
+            GEOGen::Vertex V;
+            V.set_point(p);
+            V.set_weight(1.0);
+            V.set_adjacent_seed(-1);
+            W.cell.add_vertex(V);
+        }
+
+        // Clip it by the bisectors of the power diagram. Points are lifted
+        // (last coordinate is sqrt(W-w)), hence the bisector of pi,pj is
+        // 2 x.(pi - pj) + |pj|^2 - |pi|^2 >= 0, with norms in dimension 3.
+        const double* pi = delaunay_->vertex_ptr(v);
+        for(index_t jj=0; jj<W.neighbors.size(); ++jj) {
+            index_t j = W.neighbors[jj];
+            const double* pj = delaunay_->vertex_ptr(j);
+            double a = 2.0 * (pi[0] - pj[0]);
+            double b = 2.0 * (pi[1] - pj[1]);
+            double c = 0.0;
+            for(index_t coord=0; coord<dimp1_; ++coord) {
+                c += pj[coord]*pj[coord] - pi[coord]*pi[coord];
+            }
+            clip_polygon_by_line(
+                W.cell, a, b, c, signed_index_t(j), W.work, W
+            );
+            W.cell.swap(W.work);
+            if(W.cell.nb_vertices() == 0) {
+                return false;
+            }
+        }
+        return (W.cell.nb_vertices() >= 3);
+    }
+
+    void OptimalTransportMapOnConvexDomain::process_Laguerre_cell(
+        index_t v, RVDPolygonCallback& callback, CellWorkspace& W
+    ) {
+        callback(v, 0, W.cell);
+    }
+
+    void OptimalTransportMapOnConvexDomain::clip_polygon_by_line(
+        const GEOGen::Polygon& P,
+        double a, double b, double c,
+        signed_index_t adjacent,
+        GEOGen::Polygon& target,
+        CellWorkspace& W
+    ) {
+        target.clear();
+        if(P.nb_vertices() == 0) {
+            return;
+        }
+
+        // The predecessor of the first vertex is the last vertex
+        const GEOGen::Vertex* prev_vk = &(P.vertex(P.nb_vertices() - 1));
+        const double* prev_pk = prev_vk->point();
+        double prev_d = a*prev_pk[0] + b*prev_pk[1] + c;
+
+        for(index_t k = 0; k < P.nb_vertices(); k++) {
+            const GEOGen::Vertex* vk = &(P.vertex(k));
+            const double* pk = vk->point();
+            double d = a*pk[0] + b*pk[1] + c;
+
+            // Note: the adjacent seed of a vertex corresponds to the
+            // edge that arrives at that vertex.
+            if(d >= 0.0) {
+                if(prev_d < 0.0) {
+                    if(d == 0.0) {
+                        // Entering exactly at vk: the edge that arrives
+                        // at vk is on the line.
+                        GEOGen::Vertex V = *vk;
+                        V.set_adjacent_seed(adjacent);
+                        target.add_vertex(V);
+                        prev_vk = vk;
+                        prev_pk = pk;
+                        prev_d = d;
+                        continue;
+                    }
+                    double lambda2 = prev_d / (prev_d - d);
+                    double lambda1 = 1.0 - lambda2;
+                    GEOGen::Vertex I;
+                    double* Ipoint = W.new_point();
+                    Ipoint[0] = lambda1 * prev_pk[0] + lambda2 * pk[0];
+                    Ipoint[1] = lambda1 * prev_pk[1] + lambda2 * pk[1];
+                    Ipoint[2] = 0.0;
+                    I.set_point(Ipoint);
+                    I.set_weight(
+                        lambda1 * prev_vk->weight() + lambda2 * vk->weight()
+                    );
+                    I.set_adjacent_seed(adjacent);
+                    target.add_vertex(I);
+                }
+                target.add_vertex(*vk);
+            } else if(prev_d > 0.0) {
+                // Leaving (if prev_d is zero, the previous vertex is
+                // already the exit point).
+                double lambda2 = prev_d / (prev_d - d);
+                double lambda1 = 1.0 - lambda2;
+                GEOGen::Vertex I;
+                double* Ipoint = W.new_point();
+                Ipoint[0] = lambda1 * prev_pk[0] + lambda2 * pk[0];
+                Ipoint[1] = lambda1 * prev_pk[1] + lambda2 * pk[1];
+                Ipoint[2] = 0.0;
+                I.set_point(Ipoint);
+                I.set_weight(
+                    lambda1 * prev_vk->weight() + lambda2 * vk->weight()
+                );
+                I.set_adjacent_seed(vk->adjacent_seed());
+                target.add_vertex(I);
+            }
+            prev_vk = vk;
+            prev_pk = pk;
+            prev_d = d;
+        }
+    }
+}
@@ -0,0 +1,258 @@
+/*
+ *  Copyright (c) 2000-2022 Inria
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *  this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *  * Neither the name of the ALICE Project-Team nor the names of its
+ *  contributors may be used to endorse or promote products derived from this
+ *  software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  Contact: Bruno Levy
+ *
+ *     https://www.inria.fr/fr/bruno-levy
+ *
+ *     Inria,
+ *     Domaine de Voluceau,
+ *     78150 Le Chesnay - Rocquencourt
+ *     FRANCE
+ *
+ */
+
+#ifndef H_EXPLORAGRAM_OPTIMAL_TRANSPORT_OPTIMAL_TRANSPORT_ON_CONVEX_DOMAIN_H
+#define H_EXPLORAGRAM_OPTIMAL_TRANSPORT_OPTIMAL_TRANSPORT_ON_CONVEX_DOMAIN_H
+
+#include <exploragram/basic/common.h>
+#include <exploragram/optimal_transport/optimal_transport_2d.h>
+
+/**
+ * \file exploragram/optimal_transport/optimal_transport_on_convex_domain.h
+ * \brief Solver for semi-discrete optimal transport between a pointset
+ *  and the uniform measure on a convex polygon.
+ */
+
+namespace GEO {
+
+    /**
+     * \brief Computes semi-discrete optimal transport maps between the
+     *  uniform measure on a convex polygon and a sum of Diracs in 2D.
+     * \details Instead of traversing a restricted Voronoi diagram of a
+     *  triangulation of the domain, each Laguerre cell is computed
+     *  directly, by clipping the domain polygon by the bisectors of the
+     *  neighbors of the seed in the power diagram. The Laguerre cells are
+     *  processed in parallel, and the work for a cell is proportional to
+     *  its number of neighbors, whatever the number of triangles of the
+     *  domain. The cells are sent to the same callbacks as in
+     *  OptimalTransportMap2d, hence the gradient, Hessian and centroids
+     *  are computed exactly as with a triangulated domain. Derived
+     *  classes can further cut the cells, see process_Laguerre_cell().
+     */
+    class EXPLORAGRAM_API OptimalTransportMapOnConvexDomain :
+        public OptimalTransportMap2d {
+    public:
+        /**
+         * \brief OptimalTransportMapOnConvexDomain constructor.
+         * \param[in] nb_vertices the number of vertices of the domain
+         * \param[in] vertices a pointer to the 2*nb_vertices coordinates
+         *  of the vertices of the domain, a convex polygon. They are
+         *  copied. They can be in clockwise or anticlockwise order.
+         * \param[in] delaunay factory name of the Delaunay triangulation.
+         */
+        OptimalTransportMapOnConvexDomain(
+            index_t nb_vertices, const double* vertices,
+            const std::string& delaunay = "BPOW2d"
+        );
+
+        /**
+         * \brief OptimalTransportMapOnConvexDomain destructor.
+         */
+        ~OptimalTransportMapOnConvexDomain() override;
+
+        /**
+         * \brief Gets the number of vertices of the domain.
+         * \return the number of vertices of the convex polygon
+         */
+        index_t nb_domain_vertices() const {
+            return domain_vertices_.size() / 2;
+        }
+
+        /**
+         * \brief Gets a vertex of the domain.
+         * \param[in] i the vertex, in 0..nb_domain_vertices()-1. The
+         *  vertices are in anticlockwise order.
+         * \return a const pointer to the 2 coordinates of the vertex
+         */
+        const double* domain_vertex(index_t i) const {
+            geo_debug_assert(i < nb_domain_vertices());
+            return &domain_vertices_[2*i];
+        }
+
+        /**
+         * \copydoc OptimalTransportMap::nb_background_elements()
+         * \details There is a single background element, the domain.
+         */
+        index_t nb_background_elements() const override;
+
+    protected:
+        /**
+         * \brief The polygons and vertices used by the clipping
+         *  of a thread.
+         */
+        struct CellWorkspace {
+            /**
+             * \brief CellWorkspace constructor.
+             * \param[in] dim the dimension of the created vertices
+             */
+            CellWorkspace(coord_index_t dim) :
+                allocator(dim),
+                nb_points(0) {
+            }
+
+            /**
+             * \brief Creates a point in allocator.
+             * \details All the points are created by this function, so
+             *  that nb_points counts them.
+             * \return a pointer to the coordinates of the new point
+             */
+            double* new_point() {
+                ++nb_points;
+                return allocator.new_item();
+            }
+
+            GEOGen::PointAllocator allocator;
+            /**
+             * \brief Number of points created by new_point() since
+             *  allocator was last cleared.
+             */
+            index_t nb_points;
+            GEOGen::Polygon cell;
+            GEOGen::Polygon work;
+            GEOGen::Polygon row;
+            GEOGen::Polygon piece;
+            vector<index_t> neighbors;
+        };
+
+        /**
+         * \brief Constructor used by derived classes with a polygonal
+         *  domain with a varying density.
+         * \param[in] nb_vertices the number of vertices of the domain
+         * \param[in] vertices a pointer to the 2*nb_vertices coordinates
+         *  of the vertices of the domain, a convex polygon
+         * \param[in] delaunay factory name of the Delaunay triangulation.
+         * \param[in] weighted if set, the domain mesh has a "weight"
+         *  attribute, so that the callbacks take into account the
+         *  weights of the vertices of the polygons sent to them.
+         */
+        OptimalTransportMapOnConvexDomain(
+            index_t nb_vertices, const double* vertices,
+            const std::string& delaunay, bool weighted
+        );
+
+        /**
+         * \copydoc OptimalTransportMap2d::for_each_polygon()
+         * \details Each Laguerre cell is computed by clip_Laguerre_cell(),
+         *  then sent to process_Laguerre_cell().
+         */
+        void for_each_polygon(
+            RVDPolygonCallback& callback, bool parallel
+        ) override;
+
+        /**
+         * \brief Computes the intersection between a Laguerre cell and
+         *  the domain.
+         * \param[in] v the seed
+         * \param[in,out] W the workspace of the current thread. On exit,
+         *  W.cell contains the Laguerre cell.
+         * \retval true if the Laguerre cell is not empty
+         * \retval false otherwise
+         */
+        bool clip_Laguerre_cell(index_t v, CellWorkspace& W);
+
+        /**
+         * \brief Sends a Laguerre cell to a callback.
+         * \details The default implementation sends the whole cell, with
+         *  0 as the facet index. Derived classes can cut the cell into
+         *  pieces with different densities.
+         * \param[in] v the seed
+         * \param[in] callback the callback
+         * \param[in,out] W the workspace of the current thread. W.cell
+         *  contains the Laguerre cell. The other polygons can be used.
+         */
+        virtual void process_Laguerre_cell(
+            index_t v, RVDPolygonCallback& callback, CellWorkspace& W
+        );
+
+        /**
+         * \brief Clips a polygon by a line.
+         * \details Keeps the part of \p P where a*x + b*y + c >= 0.
+         *  Vertices on the line are kept and are not duplicated.
+         * \param[in] P the polygon to be clipped
+         * \param[in] a , b , c the equation of the line
+         * \param[in] adjacent the seed on the other side of the line, or
+         *  -1 if the line is a border of the domain or of a piece.
+         * \param[out] target the clipped polygon
+         * \param[in,out] W the workspace of the current thread, used to
+         *  create the new vertices
+         */
+        static void clip_polygon_by_line(
+            const GEOGen::Polygon& P,
+            double a, double b, double c,
+            signed_index_t adjacent,
+            GEOGen::Polygon& target,
+            CellWorkspace& W
+        );
+
+        /**
+         * \brief Creates the mesh that represents the domain.
+         * \details The mesh is used by the base class. It is a fan
+         *  triangulation of the polygon.
+         * \param[in] nb_vertices the number of vertices of the domain
+         * \param[in] vertices a pointer to the 2*nb_vertices coordinates
+         *  of the vertices of the domain
+         * \param[in] weighted if set, a "weight" attribute is created,
+         *  with 1 for all the vertices
+         * \return a pointer to the new mesh. Ownership is transferred
+         *  to the caller.
+         */
+        static Mesh* new_domain_mesh(
+            index_t nb_vertices, const double* vertices, bool weighted
+        );
+
+    protected:
+        vector<double> domain_vertices_;
+        Mesh* domain_;
+        vector<CellWorkspace*> cell_workspaces_;
+
+    private:
+        /**
+         * \brief Copies the vertices of the domain in anticlockwise order
+         *  and checks that it is convex.
+         * \param[in] nb_vertices the number of vertices of the domain
+         * \param[in] vertices a pointer to the 2*nb_vertices coordinates
+         *  of the vertices of the domain
+         */
+        void set_domain_vertices(index_t nb_vertices, const double* vertices);
+    };
+
+    /*********************************************************************/
+}
+
+#endif
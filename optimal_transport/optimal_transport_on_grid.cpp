@@ -0,0 +1,702 @@
+/*
+ *  Copyright (c) 2000-2022 Inria
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *  this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *  * Neither the name of the ALICE Project-Team nor the names of its
+ *  contributors may be used to endorse or promote products derived from this
+ *  software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  Contact: Bruno Levy
+ *
+ *     https://www.inria.fr/fr/bruno-levy
+ *
+ *     Inria,
+ *     Domaine de Voluceau,
+ *     78150 Le Chesnay - Rocquencourt
+ *     FRANCE
+ *
+ */
+
+#include <exploragram/optimal_transport/optimal_transport_on_grid.h>
+#include <geogram/voronoi/convex_cell.h>
+#include <geogram/mesh/mesh.h>
+#include <geogram/basic/process.h>
+#include <geogram/basic/geometry.h>
+#include <geogram/basic/stopwatch.h>
+#include <algorithm>
+
+namespace {
+    using namespace GEO;
+
+    /**
+     * \brief Gets the id of the current thread.
+     * \return the id of the current thread, or 0 if not
+     *  running in a thread.
+     */
+    index_t current_thread_id() {
+        Thread* thread = Thread::current();
+        return (thread == nullptr) ? 0 : thread->id();
+    }
+
+    /**
+     * \brief Computes the contribution of the intersection between a
+     *  Laguerre cell and a voxel to the objective function minimized by
+     *  a semi-discrete optimal transport map.
+     * \details Works in Newton and BFGS mode. The density is constant on
+     *  the intersection. The intersection is decomposed into tetrahedra
+     *  radiating from one of its vertices, and its facets into
+     *  triangles, on which all the integrals are evaluated in closed
+     *  form.
+     */
+    class OTMGridCallback : public OptimalTransportMap::Callback {
+    public:
+        /**
+         * \brief OTMGridCallback constructor.
+         * \param[in] OTM a pointer to the OptimalTransportMapOnGrid
+         */
+        OTMGridCallback(OptimalTransportMapOnGrid* OTM) :
+            OptimalTransportMap::Callback(OTM) {
+            update_kernel();
+        }
+
+        /**
+         * \brief Computes the contribution of an intersection.
+         * \param[in] v the seed
+         * \param[in] e the voxel
+         * \param[in] C the intersection between the Laguerre cell of
+         *  \p v and the voxel \p e, with its geometry computed
+         * \param[in] rho the density of the voxel
+         */
+        void operator()(
+            index_t v, index_t e, VBW::ConvexCell& C, double rho
+        ) const {
+            (this->*kernel_)(v,e,C,rho);
+        }
+
+        /**
+         * \brief A pointer to a specialization of kernel().
+         */
+        typedef void (OTMGridCallback::*Kernel)(
+            index_t v, index_t e, VBW::ConvexCell& C, double rho
+        ) const;
+
+        /**
+         * \brief Computes the contribution of an intersection.
+         * \details The flags are template arguments, so that the
+         *  tests are resolved at compile time.
+         * \tparam WEIGHTED unused, the density is given by \p rho
+         * \tparam CENTROIDS true if mass times centroids are computed
+         * \tparam NEWTON true if the Hessian is computed
+         * \tparam EVAL_F true if the objective function is computed
+         * \param[in] v the seed
+         * \param[in] e the voxel
+         * \param[in] C the intersection between the Laguerre cell of
+         *  \p v and the voxel \p e, with its geometry computed
+         * \param[in] rho the density of the voxel
+         */
+        template <bool WEIGHTED, bool CENTROIDS, bool NEWTON, bool EVAL_F>
+        void kernel(
+            index_t v, index_t e, VBW::ConvexCell& C, double rho
+        ) const {
+            // v can be an air particle or a periodic copy of a seed,
+            // the contributions of a copy go to the original seed o.
+            index_t o = original_seed(v);
+            if(o >= n_) {
+                return;
+            }
+
+            index_t thread = current_thread_id();
+            const double* y = seed_point(v);
+            index_t nb_seeds = OTM_->RVD()->delaunay()->nb_vertices();
+
+            // Volume, first moment and second moment about the seed
+            // (integral of |x-y|^2) of the intersection.
+            double m = 0.0;
+            double mg[3] = { 0.0, 0.0, 0.0 };
+            double I2 = 0.0;
+
+            vector<index_t>& facet = facet_loop_[thread];
+            index_t t0 = index_t(-1);
+            vec3 q0;
+            for(index_t lv=0; lv<C.nb_v(); ++lv) {
+                facet.resize(0);
+                C.for_each_Voronoi_vertex(
+                    lv, [&facet](index_t t) { facet.push_back(t); }
+                );
+                if(facet.size() < 3) {
+                    continue;
+                }
+                if(t0 == index_t(-1)) {
+                    t0 = facet[0];
+                    q0 = point(C, t0);
+                }
+
+                // The tetrahedra radiating from t0 and the facets incident
+                // to t0 are flat.
+                bool has_t0 =
+                    (std::find(facet.begin(), facet.end(), t0) != facet.end());
+                if(has_t0 && !NEWTON) {
+                    continue;
+                }
+
+                double area = 0.0;
+                vec3 p1 = point(C, facet[0]);
+                for(index_t k=1; k+1<facet.size(); ++k) {
+                    vec3 p2 = point(C, facet[k]);
+                    vec3 p3 = point(C, facet[k+1]);
+                    if(NEWTON) {
+                        area += Geom::triangle_area(p1,p2,p3);
+                    }
+                    if(has_t0) {
+                        continue;
+                    }
+                    double V = Geom::tetra_volume(q0,p1,p2,p3);
+                    vec3 c = 0.25*(q0+p1+p2+p3);
+                    m += V;
+                    if(CENTROIDS) {
+                        mg[0] += V*c.x;
+                        mg[1] += V*c.y;
+                        mg[2] += V*c.z;
+                    }
+                    if(EVAL_F) {
+                        // Integral of |x-y|^2 over the tetrahedron: the
+                        // covariance matrix of a tetrahedron is
+                        // 1/20 sum_i (pi-c)(pi-c)^T.
+                        vec3 cy(c.x-y[0], c.y-y[1], c.z-y[2]);
+                        I2 += V*(
+                            length2(cy) + (
+                                length2(q0-c) + length2(p1-c) +
+                                length2(p2-c) + length2(p3-c)
+                            ) / 20.0
+                        );
+                    }
+                }
+
+                if(NEWTON) {
+                    index_t v_adj = C.v_global_index(lv);
+                    if(v_adj < nb_seeds && v_adj != v) {
+                        add_Hessian_coefficient(
+                            thread, v, v_adj, rho * area
+                        );
+                    }
+                }
+            }
+
+            m *= rho;
+            mg[0] *= rho;
+            mg[1] *= rho;
+            mg[2] *= rho;
+
+            // The transport plan keeps the actual position of the
+            // mass, the centroid of the seed is in the frame of o.
+            if(plan_ != nullptr) {
+                plan_->add(thread, external_seed(v), e, m, mg);
+            }
+            if(CENTROIDS) {
+                to_original_frame(v, m, mg);
+            }
+
+            // Each Laguerre cell is processed by a single thread, with
+            // the periodic copies of its seed, hence no spinlock is
+            // needed to accumulate into row o.
+            if(buffers_ != nullptr) {
+                buffers_->add_mass(thread, o, m, mg);
+            } else {
+                // +m because we maximize F <=> minimize -F
+                g_[o] += m;
+
+                if(NEWTON) {
+                    // ... but here -m because Newton step =
+                    //  solve H p = -g    (minus g in the RHS).
+                    OTM_->add_i_right_hand_side(o,-m);
+                }
+
+                if(CENTROIDS) {
+                    mg_[3*o] += mg[0];
+                    mg_[3*o+1] += mg[1];
+                    mg_[3*o+2] += mg[2];
+                }
+            }
+
+            if(RVD_buffers_ != nullptr) {
+                RVD_buffers_->add_polyhedron(thread, external_seed(v), C);
+            }
+
+            if(EVAL_F) {
+                // -F because we maximize F <=> minimize -F
+                double F = rho * I2 - w_[o] * m;
+                const_cast<OTMGridCallback*>(this)->
+                    funcval_[thread] -= F;
+            }
+        }
+
+        /**
+         * \brief Allocates the per-thread workspaces.
+         * \param[in] nb the number of threads.
+         */
+        void reserve_threads(index_t nb) {
+            if(facet_loop_.size() < nb) {
+                facet_loop_.resize(nb);
+            }
+        }
+
+    protected:
+        /**
+         * \copydoc OptimalTransportMap::Callback::update_kernel()
+         */
+        void update_kernel() override {
+            kernel_ = select_kernel<OTMGridCallback>();
+        }
+
+        /**
+         * \brief Gets a vertex of a ConvexCell.
+         * \param[in] C the ConvexCell
+         * \param[in] t a triangle of \p C (a vertex in dual form)
+         * \return the coordinates of the vertex
+         */
+        static vec3 point(const VBW::ConvexCell& C, index_t t) {
+            VBW::vec3 p = C.triangle_point(t);
+            return vec3(p.x, p.y, p.z);
+        }
+
+        /**
+         * \brief Adds the contribution of a facet to the Hessian.
+         * \details The coefficient associated to a pair of adjacent
+         *  cells Lag(i),Lag(j) is mass(Lag(i) /\ Lag(j)) / (2*d(pi,pj)).
+         *  Distances are measured between the actual periodic copies,
+         *  the coefficient goes to the original seeds.
+         * \param[in] thread the id of the current thread
+         * \param[in] v the current seed
+         * \param[in] v_adj the seed on the other side of the facet
+         * \param[in] mass the mass of the facet
+         */
+        void add_Hessian_coefficient(
+            index_t thread, index_t v, index_t v_adj, double mass
+        ) const {
+            const double* p0 = seed_point(v);
+            const double* p1 = seed_point(v_adj);
+            double hij = mass / (2.0 * Geom::distance(p0,p1,3));
+            index_t o = original_seed(v);
+            index_t o_adj = original_seed(v_adj);
+
+            if(buffers_ != nullptr) {
+                if(o_adj < n_) {
+                    buffers_->add_coefficient(thread, o, o_adj, -hij);
+                }
+                buffers_->add_coefficient(thread, o, o, hij);
+                return;
+            }
+
+            // Diagonal is positive, extra-diagonal
+            // coefficients are negative,
+            // this is a convex function.
+            if(o_adj < n_) {
+                OTM_->add_ij_coefficient(o, o_adj, -hij);
+            }
+            OTM_->add_ij_coefficient(o, o, hij);
+        }
+
+        Kernel kernel_;
+        mutable vector< vector<index_t> > facet_loop_;
+    };
+}
+
+/****************************************************************************/
+
+namespace GEO {
+
+    struct OptimalTransportMapOnGrid::GridWorkspace {
+        /**
+         * \brief GridWorkspace constructor.
+         */
+        GridWorkspace() :
+            cell(VBW::WithVGlobal),
+            voxel(VBW::WithVGlobal) {
+        }
+        VBW::ConvexCell cell;
+        VBW::ConvexCell voxel;
+        vector<index_t> neighbors;
+        vector<index_t> facets;
+        vector<index_t> facet_loop;
+    };
+
+    OptimalTransportMapOnGrid::OptimalTransportMapOnGrid(
+        const double* xyz_min, const double* xyz_max,
+        index_t nx, index_t ny, index_t nz,
+        const double* density,
+        const std::string& delaunay
+    ) :
+        OptimalTransportMap3d(
+            new_domain_mesh(xyz_min, xyz_max),
+            delaunay,
+            false
+        ) {
+        domain_ = mesh_;
+        geo_assert(nx != 0 && ny != 0 && nz != 0);
+        grid_size_[0] = nx;
+        grid_size_[1] = ny;
+        grid_size_[2] = nz;
+        for(coord_index_t c=0; c<3; ++c) {
+            xyz_min_[c] = xyz_min[c];
+            xyz_max_[c] = xyz_max[c];
+            voxel_size_[c] =
+                (xyz_max[c] - xyz_min[c]) / double(grid_size_[c]);
+        }
+        if(density == nullptr) {
+            density_.assign(nx*ny*nz, 1.0);
+            total_mass_ = total_grid_mass();
+        } else {
+            set_density(density);
+        }
+        delete callback_;
+        callback_ = new OTMGridCallback(this);
+    }
+
+    OptimalTransportMapOnGrid::~OptimalTransportMapOnGrid() {
+        for(index_t i=0; i<grid_workspaces_.size(); ++i) {
+            delete grid_workspaces_[i];
+        }
+        // The callback references the domain mesh.
+        delete callback_;
+        callback_ = nullptr;
+        delete domain_;
+        domain_ = nullptr;
+    }
+
+    Mesh* OptimalTransportMapOnGrid::new_domain_mesh(
+        const double* xyz_min, const double* xyz_max
+    ) {
+        for(coord_index_t c=0; c<3; ++c) {
+            geo_assert(xyz_max[c] > xyz_min[c]);
+        }
+        Mesh* result = new Mesh(4);
+        // Vertex (i,j,k) of the box has index i + 2j + 4k
+        for(index_t v=0; v<8; ++v) {
+            double p[4] = {
+                (v & 1) ? xyz_max[0] : xyz_min[0],
+                (v & 2) ? xyz_max[1] : xyz_min[1],
+                (v & 4) ? xyz_max[2] : xyz_min[2],
+                0.0
+            };
+            result->vertices.create_vertex(p);
+        }
+        // Six tetrahedra around the diagonal (0,7), one for each
+        // monotonic path along the edges from vertex 0 to vertex 7.
+        result->cells.create_tet(0, 1, 3, 7);
+        result->cells.create_tet(0, 5, 1, 7);
+        result->cells.create_tet(0, 2, 6, 7);
+        result->cells.create_tet(0, 3, 2, 7);
+        result->cells.create_tet(0, 4, 5, 7);
+        result->cells.create_tet(0, 6, 4, 7);
+        result->cells.connect();
+
+        // The "weight" attribute activates the weighted mode of the
+        // callback. The actual weights are the densities of the voxels.
+        Attribute<double> vertex_mass(result->vertices.attributes(), "weight");
+        for(index_t v: result->vertices) {
+            vertex_mass[v] = 1.0;
+        }
+        return result;
+    }
+
+    void OptimalTransportMapOnGrid::set_density(const double* density) {
+        density_.assign(
+            density, density + grid_size_[0]*grid_size_[1]*grid_size_[2]
+        );
+        total_mass_ = total_grid_mass();
+    }
+
+    void OptimalTransportMapOnGrid::set_density(
+        std::function<double(const vec3&)> density
+    ) {
+        density_.resize(grid_size_[0]*grid_size_[1]*grid_size_[2]);
+        for(index_t k=0; k<grid_size_[2]; ++k) {
+            for(index_t j=0; j<grid_size_[1]; ++j) {
+                for(index_t i=0; i<grid_size_[0]; ++i) {
+                    vec3 center(
+                        xyz_min_[0] + (double(i) + 0.5) * voxel_size_[0],
+                        xyz_min_[1] + (double(j) + 0.5) * voxel_size_[1],
+                        xyz_min_[2] + (double(k) + 0.5) * voxel_size_[2]
+                    );
+                    density_[(k*grid_size_[1]+j)*grid_size_[0]+i] =
+                        density(center);
+                }
+            }
+        }
+        total_mass_ = total_grid_mass();
+    }
+
+    double OptimalTransportMapOnGrid::total_grid_mass() const {
+        double result = 0.0;
+        for(index_t i=0; i<density_.size(); ++i) {
+            result += density_[i];
+        }
+        return result * voxel_size_[0] * voxel_size_[1] * voxel_size_[2];
+    }
+
+    index_t OptimalTransportMapOnGrid::nb_background_elements() const {
+        return grid_size_[0] * grid_size_[1] * grid_size_[2];
+    }
+
+    void OptimalTransportMapOnGrid::get_RVD(Mesh& RVD_mesh) {
+        index_t nb_threads = Process::maximum_concurrent_threads();
+        OTRVDMeshBuffers buffers;
+        buffers.begin(nb_threads);
+        for_each_cell(
+            [this,&buffers](
+                index_t v, index_t e, VBW::ConvexCell& C, double rho
+            ) {
+                geo_argused(e);
+                geo_argused(rho);
+                buffers.add_polyhedron(
+                    current_thread_id(), external_index(v), C
+                );
+            },
+            false, // voxels
+            true   // parallel
+        );
+        buffers.end(RVD_mesh);
+    }
+
+    void OptimalTransportMapOnGrid::compute_Laguerre_centroids(
+        double* centroids
+    ) {
+        vector<double> g(nb_points(), 0.0);
+        Memory::clear(centroids, nb_points()*sizeof(double)*3);
+
+        callback_->set_Laguerre_centroids(centroids);
+        callback_->set_g(g.data());
+        {
+            Stopwatch* W = nullptr;
+            if(newton_) {
+                W = new Stopwatch("RVD");
+                Logger::out("OTM") << "In RVD (centroids)..." << std::endl;
+            }
+            call_callback_on_RVD();
+            if(newton_) {
+                delete W;
+            }
+        }
+        callback_->set_Laguerre_centroids(nullptr);
+
+        for(index_t v=0; v<nb_points(); ++v) {
+            centroids[3*v  ] /= g[v];
+            centroids[3*v+1] /= g[v];
+            centroids[3*v+2] /= g[v];
+        }
+        wrap_to_fundamental_domain(centroids, nb_points());
+        to_external_order(centroids, 3);
+    }
+
+    void OptimalTransportMapOnGrid::call_callback_on_RVD() {
+        OTMGridCallback* callback = static_cast<OTMGridCallback*>(callback_);
+        callback->reserve_threads(Process::maximum_concurrent_threads());
+        for_each_cell(
+            [callback](
+                index_t v, index_t e, VBW::ConvexCell& C, double rho
+            ) {
+                (*callback)(v, e, C, rho);
+            },
+            true, // voxels
+            true  // parallel
+        );
+    }
+
+    void OptimalTransportMapOnGrid::for_each_cell(
+        const CellAction& action, bool voxels, bool parallel
+    ) {
+        index_t nb_threads =
+            parallel ? Process::maximum_concurrent_threads() : 1;
+        while(grid_workspaces_.size() < nb_threads) {
+            grid_workspaces_.push_back(new GridWorkspace);
+        }
+
+        // Note that the air particles have a Laguerre cell (ignored by
+        // the callback of the transport map, but used by get_RVD()).
+        // The periodic copies of a seed are processed by the thread of
+        // the seed, so that each row has a single writer.
+        index_t nb = delaunay_->nb_vertices() - nb_periodic_copies();
+        auto clip_with_copies = [this,&action,voxels](
+            index_t v, index_t thread
+        ) {
+            clip_Laguerre_cell(v, action, voxels, thread);
+            for(index_t k=0; k<nb_periodic_copies(v); ++k) {
+                clip_Laguerre_cell(
+                    periodic_copy(v,k), action, voxels, thread
+                );
+            }
+        };
+        if(parallel) {
+            parallel_for(
+                0, nb,
+                [&clip_with_copies](index_t v) {
+                    clip_with_copies(v, current_thread_id());
+                }
+            );
+        } else {
+            for(index_t v=0; v<nb; ++v) {
+                clip_with_copies(v, 0);
+            }
+        }
+    }
+
+    void OptimalTransportMapOnGrid::clip_Laguerre_cell(
+        index_t v, const CellAction& action, bool voxels, index_t thread
+    ) {
+        GridWorkspace& W = *grid_workspaces_[thread];
+
+        delaunay_->get_neighbors(v, W.neighbors);
+        if(W.neighbors.size() == 0 && delaunay_->nb_vertices() > 1) {
+            // Hidden seed, empty Laguerre cell.
+            return;
+        }
+
+        // Bisector of pi,pj in the power diagram. Points are lifted
+        // (last coordinate is sqrt(W-w)), hence the bisector is
+        // 2 x.(pi - pj) + |pj|^2 - |pi|^2 >= 0, with norms in dimension 4.
+        const double* pi = delaunay_->vertex_ptr(v);
+        auto bisector = [this,pi](index_t j)->VBW::vec4 {
+            const double* pj = delaunay_->vertex_ptr(j);
+            double d = 0.0;
+            for(index_t coord=0; coord<dimp1_; ++coord) {
+                d += pj[coord]*pj[coord] - pi[coord]*pi[coord];
+            }
+            return VBW::make_vec4(
+                2.0 * (pi[0] - pj[0]),
+                2.0 * (pi[1] - pj[1]),
+                2.0 * (pi[2] - pj[2]),
+                d
+            );
+        };
+
+        // Start from the box, and clip it by the bisectors.
+        W.cell.init_with_box(
+            xyz_min_[0], xyz_min_[1], xyz_min_[2],
+            xyz_max_[0], xyz_max_[1], xyz_max_[2]
+        );
+        for(index_t jj=0; jj<W.neighbors.size(); ++jj) {
+            index_t j = W.neighbors[jj];
+            W.cell.clip_by_plane(bisector(j), j);
+            if(W.cell.empty()) {
+                return;
+            }
+        }
+        W.cell.compute_geometry();
+
+        if(!voxels) {
+            action(v, index_t(-1), W.cell, 1.0);
+            return;
+        }
+
+        if(density_.size() == 1) {
+            if(density_[0] != 0.0) {
+                action(v, 0, W.cell, density_[0]);
+            }
+            return;
+        }
+
+        // Bounding box of the cell, and neighbors that contribute a
+        // non-empty facet.
+        double cell_min[3] = {
+            Numeric::max_float64(),
+            Numeric::max_float64(),
+            Numeric::max_float64()
+        };
+        double cell_max[3] = {
+            -Numeric::max_float64(),
+            -Numeric::max_float64(),
+            -Numeric::max_float64()
+        };
+        index_t nb_seeds = delaunay_->nb_vertices();
+        W.facets.resize(0);
+        for(index_t lv=0; lv<W.cell.nb_v(); ++lv) {
+            W.facet_loop.resize(0);
+            W.cell.for_each_Voronoi_vertex(
+                lv, [&W](index_t t) { W.facet_loop.push_back(t); }
+            );
+            if(W.facet_loop.size() < 3) {
+                continue;
+            }
+            for(index_t t: W.facet_loop) {
+                VBW::vec3 p = W.cell.triangle_point(t);
+                cell_min[0] = std::min(cell_min[0], p.x);
+                cell_min[1] = std::min(cell_min[1], p.y);
+                cell_min[2] = std::min(cell_min[2], p.z);
+                cell_max[0] = std::max(cell_max[0], p.x);
+                cell_max[1] = std::max(cell_max[1], p.y);
+                cell_max[2] = std::max(cell_max[2], p.z);
+            }
+            index_t j = W.cell.v_global_index(lv);
+            if(j < nb_seeds) {
+                W.facets.push_back(j);
+            }
+        }
+
+        // Range of voxels covered by the bounding box of the cell.
+        index_t i0[3];
+        index_t i1[3];
+        for(coord_index_t c=0; c<3; ++c) {
+            i0[c] = index_t(std::max(
+                ::floor((cell_min[c] - xyz_min_[c]) / voxel_size_[c]), 0.0
+            ));
+            i1[c] = index_t(std::min(
+                ::ceil((cell_max[c] - xyz_min_[c]) / voxel_size_[c]),
+                double(grid_size_[c])
+            ));
+        }
+
+        // Clip each voxel by the facets of the cell.
+        for(index_t k=i0[2]; k<i1[2]; ++k) {
+            for(index_t j=i0[1]; j<i1[1]; ++j) {
+                for(index_t i=i0[0]; i<i1[0]; ++i) {
+                    index_t e = (k*grid_size_[1]+j)*grid_size_[0]+i;
+                    double rho = density_[e];
+                    if(rho == 0.0) {
+                        continue;
+                    }
+                    W.voxel.init_with_box(
+                        xyz_min_[0] + double(i)   * voxel_size_[0],
+                        xyz_min_[1] + double(j)   * voxel_size_[1],
+                        xyz_min_[2] + double(k)   * voxel_size_[2],
+                        xyz_min_[0] + double(i+1) * voxel_size_[0],
+                        xyz_min_[1] + double(j+1) * voxel_size_[1],
+                        xyz_min_[2] + double(k+1) * voxel_size_[2]
+                    );
+                    for(index_t jj=0; jj<W.facets.size(); ++jj) {
+                        W.voxel.clip_by_plane(
+                            bisector(W.facets[jj]), W.facets[jj]
+                        );
+                        if(W.voxel.empty()) {
+                            break;
+                        }
+                    }
+                    if(W.voxel.empty()) {
+                        continue;
+                    }
+                    W.voxel.compute_geometry();
+                    action(v, e, W.voxel, rho);
+                }
+            }
+        }
+    }
+}
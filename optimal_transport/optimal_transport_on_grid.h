@@ -0,0 +1,251 @@
+/*
+ *  Copyright (c) 2000-2022 Inria
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *  this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *  * Neither the name of the ALICE Project-Team nor the names of its
+ *  contributors may be used to endorse or promote products derived from this
+ *  software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  Contact: Bruno Levy
+ *
+ *     https://www.inria.fr/fr/bruno-levy
+ *
+ *     Inria,
+ *     Domaine de Voluceau,
+ *     78150 Le Chesnay - Rocquencourt
+ *     FRANCE
+ *
+ */
+
+#ifndef H_EXPLORAGRAM_OPTIMAL_TRANSPORT_OPTIMAL_TRANSPORT_ON_GRID_H
+#define H_EXPLORAGRAM_OPTIMAL_TRANSPORT_OPTIMAL_TRANSPORT_ON_GRID_H
+
+#include <exploragram/basic/common.h>
+#include <exploragram/optimal_transport/optimal_transport_3d.h>
+#include <functional>
+
+/**
+ * \file exploragram/optimal_transport/optimal_transport_on_grid.h
+ * \brief Solver for semi-discrete optimal transport between a pointset
+ *  and a density defined on a voxel grid in an axis-aligned box.
+ */
+
+namespace VBW {
+    class ConvexCell;
+}
+
+namespace GEO {
+
+    /**
+     * \brief Computes semi-discrete optimal transport maps between a
+     *  density defined on a voxel grid and a sum of Diracs in 3D.
+     * \details The domain is an axis-aligned box, subdivided into
+     *  nx*ny*nz voxels of the same size. The density is constant on
+     *  each voxel. With a single voxel, the density is uniform in the
+     *  box. Instead of traversing a restricted Voronoi diagram of a
+     *  tetrahedral mesh, each Laguerre cell is computed from its
+     *  neighbors in the power diagram by clipping the box, then it is
+     *  cut into voxels. The mass, centroid, objective function and
+     *  Hessian coefficients are integrated in closed form on each
+     *  piece, hence the Newton and BFGS solvers are used exactly as
+     *  with OptimalTransportMap3d, without the cost of tetrahedralizing
+     *  the grid. The index of a voxel (i,j,k) is (k*ny+j)*nx+i.
+     */
+    class EXPLORAGRAM_API OptimalTransportMapOnGrid :
+        public OptimalTransportMap3d {
+    public:
+        /**
+         * \brief OptimalTransportMapOnGrid constructor.
+         * \param[in] xyz_min , xyz_max the corners of the box
+         * \param[in] nx , ny , nz the number of voxels along each axis
+         * \param[in] density a pointer to the nx*ny*nz densities of the
+         *  voxels, stored as described in the class documentation. They
+         *  are copied. If nullptr, the density is 1 everywhere.
+         * \param[in] delaunay factory name of the Delaunay triangulation.
+         */
+        OptimalTransportMapOnGrid(
+            const double* xyz_min, const double* xyz_max,
+            index_t nx = 1, index_t ny = 1, index_t nz = 1,
+            const double* density = nullptr,
+            const std::string& delaunay = "PDEL"
+        );
+
+        /**
+         * \brief OptimalTransportMapOnGrid destructor.
+         */
+        ~OptimalTransportMapOnGrid() override;
+
+        /**
+         * \brief Gets the number of voxels along an axis.
+         * \param[in] coord the axis, in 0..2
+         * \return the number of voxels along axis \p coord
+         */
+        index_t grid_size(coord_index_t coord) const {
+            geo_debug_assert(coord < 3);
+            return grid_size_[coord];
+        }
+
+        /**
+         * \brief Gets the size of the voxels along an axis.
+         * \param[in] coord the axis, in 0..2
+         * \return the length of the edges of the voxels along
+         *  axis \p coord
+         */
+        double voxel_size(coord_index_t coord) const {
+            geo_debug_assert(coord < 3);
+            return voxel_size_[coord];
+        }
+
+        /**
+         * \brief Gets the density of a voxel.
+         * \param[in] i , j , k the indices of the voxel along the
+         *  three axes
+         * \return the density of the voxel
+         */
+        double density(index_t i, index_t j, index_t k) const {
+            geo_debug_assert(
+                i < grid_size_[0] && j < grid_size_[1] && k < grid_size_[2]
+            );
+            return density_[(k*grid_size_[1]+j)*grid_size_[0]+i];
+        }
+
+        /**
+         * \brief Sets the densities of the voxels.
+         * \details Needs to be called before set_points(), that
+         *  distributes the total mass among the points.
+         * \param[in] density a pointer to the densities of the voxels,
+         *  stored as described in the class documentation. They are
+         *  copied.
+         */
+        void set_density(const double* density);
+
+        /**
+         * \brief Sets the densities of the voxels from a function.
+         * \details The function is evaluated at the centers of the
+         *  voxels, and the density is constant on each voxel. Needs to
+         *  be called before set_points(), that distributes the total
+         *  mass among the points.
+         * \param[in] density the density, as a function of the position
+         */
+        void set_density(std::function<double(const vec3&)> density);
+
+        /**
+         * \brief Gets the total mass of the grid.
+         * \return the sum of the densities of the voxels times the
+         *  volume of a voxel.
+         */
+        double total_grid_mass() const;
+
+        /**
+         * \copydoc OptimalTransportMap::nb_background_elements()
+         * \details The background elements are the voxels.
+         */
+        index_t nb_background_elements() const override;
+
+        /**
+         * \copydoc OptimalTransportMap::get_RVD()
+         * \details The Laguerre cells are decomposed into tetrahedra, with
+         *  a "region" attribute that has the index of the seed.
+         */
+        void get_RVD(Mesh& M) override;
+
+        /**
+         * \copydoc OptimalTransportMap::compute_Laguerre_centroids()
+         */
+        void compute_Laguerre_centroids(double* centroids) override;
+
+        /**
+         * \brief A function called for each intersection between a Laguerre
+         *  cell and a voxel.
+         * \details The arguments are the seed, the voxel, the intersection
+         *  with its geometry computed and the density of the voxel.
+         */
+        typedef std::function<
+            void(index_t, index_t, VBW::ConvexCell&, double)
+        > CellAction;
+
+    protected:
+        /**
+         * \copydoc OptimalTransportMap::call_callback_on_RVD()
+         */
+        void call_callback_on_RVD() override;
+
+        /**
+         * \brief Calls a function for each intersection between a Laguerre
+         *  cell and a voxel.
+         * \param[in] action the function
+         * \param[in] voxels if set, the Laguerre cells are cut into
+         *  voxels, and the voxels with zero density are skipped. Else
+         *  \p action is called once for each Laguerre cell clipped by
+         *  the box, with index_t(-1) as the voxel and 1 as the density.
+         * \param[in] parallel if set, the Laguerre cells are processed
+         *  in parallel
+         */
+        void for_each_cell(
+            const CellAction& action, bool voxels, bool parallel
+        );
+
+        /**
+         * \brief Computes a Laguerre cell and sends its intersections with
+         *  the voxels to a function.
+         * \param[in] v the seed
+         * \param[in] action the function
+         * \param[in] voxels if set, the cell is cut into voxels
+         * \param[in] thread the id of the current thread
+         */
+        void clip_Laguerre_cell(
+            index_t v, const CellAction& action, bool voxels, index_t thread
+        );
+
+        /**
+         * \brief Creates the mesh that represents the box.
+         * \details The mesh is used by the base class (the Laguerre cells
+         *  are not computed from it). It has a "weight" attribute, so
+         *  that the callback is in weighted mode.
+         * \param[in] xyz_min , xyz_max the corners of the box
+         * \return a pointer to the new mesh. Ownership is transferred
+         *  to the caller.
+         */
+        static Mesh* new_domain_mesh(
+            const double* xyz_min, const double* xyz_max
+        );
+
+    protected:
+        double xyz_min_[3];
+        double xyz_max_[3];
+        index_t grid_size_[3];
+        double voxel_size_[3];
+        vector<double> density_;
+        Mesh* domain_;
+
+        /**
+         * \brief The convex cells and neighbors used by a thread.
+         */
+        struct GridWorkspace;
+        vector<GridWorkspace*> grid_workspaces_;
+    };
+
+    /*********************************************************************/
+}
+
+#endif
@@ -0,0 +1,167 @@
+/*
+ *  Copyright (c) 2000-2022 Inria
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *  this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *  * Neither the name of the ALICE Project-Team nor the names of its
+ *  contributors may be used to endorse or promote products derived from this
+ *  software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  Contact: Bruno Levy
+ *
+ *     https://www.inria.fr/fr/bruno-levy
+ *
+ *     Inria,
+ *     Domaine de Voluceau,
+ *     78150 Le Chesnay - Rocquencourt
+ *     FRANCE
+ *
+ */
+
+#include <exploragram/optimal_transport/optimal_transport_on_image.h>
+#include <geogram/voronoi/generic_RVD_vertex.h>
+#include <geogram/voronoi/generic_RVD_polygon.h>
+#include <geogram/voronoi/RVD_callback.h>
+#include <geogram/mesh/mesh.h>
+#include <geogram/basic/geometry.h>
+
+namespace {
+    using namespace GEO;
+
+    /**
+     * \brief Gets the corners of the rectangle covered by an image.
+     * \param[in] width , height the size of the image, in pixels
+     * \param[in] pixel_size the size of a pixel
+     * \return the 2*4 coordinates of the corners, in anticlockwise order
+     */
+    vector<double> image_corners(
+        index_t width, index_t height, double pixel_size
+    ) {
+        geo_assert(width != 0 && height != 0 && pixel_size > 0.0);
+        double X = double(width) * pixel_size;
+        double Y = double(height) * pixel_size;
+        vector<double> result(8);
+        result[0] = 0.0; result[1] = 0.0;
+        result[2] = X;   result[3] = 0.0;
+        result[4] = X;   result[5] = Y;
+        result[6] = 0.0; result[7] = Y;
+        return result;
+    }
+}
+
+namespace GEO {
+
+    OptimalTransportMapOnImage::OptimalTransportMapOnImage(
+        index_t width, index_t height,
+        const double* density,
+        double pixel_size,
+        const std::string& delaunay
+    ) :
+        // The "weight" attribute activates the weighted mode of the
+        // callbacks. The actual weights are the densities of the pixels,
+        // copied into the vertices of the clipped polygons.
+        OptimalTransportMapOnConvexDomain(
+            4, image_corners(width, height, pixel_size).data(),
+            delaunay, true
+        ),
+        width_(width),
+        height_(height),
+        pixel_size_(pixel_size) {
+        density_.assign(density, density + width*height);
+        total_mass_ = total_image_mass();
+    }
+
+    OptimalTransportMapOnImage::~OptimalTransportMapOnImage() {
+    }
+
+    double OptimalTransportMapOnImage::total_image_mass() const {
+        double result = 0.0;
+        for(index_t i=0; i<density_.size(); ++i) {
+            result += density_[i];
+        }
+        return result * pixel_size_ * pixel_size_;
+    }
+
+    index_t OptimalTransportMapOnImage::nb_background_elements() const {
+        return width_ * height_;
+    }
+
+    void OptimalTransportMapOnImage::process_Laguerre_cell(
+        index_t v, RVDPolygonCallback& callback, CellWorkspace& W
+    ) {
+        // Scanline clipping: cut the cell into rows, and the rows
+        // into pixels.
+        double ymin = Numeric::max_float64();
+        double ymax = -Numeric::max_float64();
+        for(index_t k=0; k<W.cell.nb_vertices(); ++k) {
+            double y = W.cell.vertex(k).point()[1];
+            ymin = std::min(ymin, y);
+            ymax = std::max(ymax, y);
+        }
+        index_t j0 = index_t(std::max(::floor(ymin / pixel_size_), 0.0));
+        index_t j1 = index_t(
+            std::min(::ceil(ymax / pixel_size_), double(height_))
+        );
+
+        for(index_t j=j0; j<j1; ++j) {
+            double y0 = double(j) * pixel_size_;
+            double y1 = double(j+1) * pixel_size_;
+            clip_polygon_by_line(W.cell, 0.0, 1.0, -y0, -1, W.work, W);
+            clip_polygon_by_line(W.work, 0.0, -1.0, y1, -1, W.row, W);
+            if(W.row.nb_vertices() < 3) {
+                continue;
+            }
+            double xmin = Numeric::max_float64();
+            double xmax = -Numeric::max_float64();
+            for(index_t k=0; k<W.row.nb_vertices(); ++k) {
+                double x = W.row.vertex(k).point()[0];
+                xmin = std::min(xmin, x);
+                xmax = std::max(xmax, x);
+            }
+            index_t i0 = index_t(std::max(::floor(xmin / pixel_size_), 0.0));
+            index_t i1 = index_t(
+                std::min(::ceil(xmax / pixel_size_), double(width_))
+            );
+            for(index_t i=i0; i<i1; ++i) {
+                double rho = density_[j*width_+i];
+                if(rho == 0.0) {
+                    continue;
+                }
+                double x0 = double(i) * pixel_size_;
+                double x1 = double(i+1) * pixel_size_;
+                clip_polygon_by_line(
+                    W.row, 1.0, 0.0, -x0, -1, W.work, W
+                );
+                clip_polygon_by_line(
+                    W.work, -1.0, 0.0, x1, -1, W.piece, W
+                );
+                if(W.piece.nb_vertices() < 3) {
+                    continue;
+                }
+                for(index_t k=0; k<W.piece.nb_vertices(); ++k) {
+                    W.piece.vertex(k).set_weight(rho);
+                }
+                callback(v, j*width_+i, W.piece);
+            }
+        }
+    }
+}
@@ -0,0 +1,159 @@
+/*
+ *  Copyright (c) 2000-2022 Inria
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *  this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *  * Neither the name of the ALICE Project-Team nor the names of its
+ *  contributors may be used to endorse or promote products derived from this
+ *  software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  Contact: Bruno Levy
+ *
+ *     https://www.inria.fr/fr/bruno-levy
+ *
+ *     Inria,
+ *     Domaine de Voluceau,
+ *     78150 Le Chesnay - Rocquencourt
+ *     FRANCE
+ *
+ */
+
+#ifndef H_EXPLORAGRAM_OPTIMAL_TRANSPORT_OPTIMAL_TRANSPORT_ON_IMAGE_H
+#define H_EXPLORAGRAM_OPTIMAL_TRANSPORT_OPTIMAL_TRANSPORT_ON_IMAGE_H
+
+#include <exploragram/basic/common.h>
+#include <exploragram/optimal_transport/optimal_transport_on_convex_domain.h>
+
+/**
+ * \file exploragram/optimal_transport/optimal_transport_on_image.h
+ * \brief Solver for semi-discrete optimal transport between a pointset
+ *  and a density defined on a pixel grid.
+ */
+
+namespace GEO {
+
+    /**
+     * \brief Computes semi-discrete optimal transport maps between a
+     *  density defined on a pixel grid and a sum of Diracs in 2D.
+     * \details The density is constant on each pixel. Pixel (i,j)
+     *  covers [i*s, (i+1)*s] x [j*s, (j+1)*s], where s is the size of
+     *  the pixels. Instead of traversing a restricted Voronoi diagram,
+     *  each Laguerre cell is computed from its neighbors in the power
+     *  diagram (see OptimalTransportMapOnConvexDomain), and is cut into
+     *  pixels by scanline clipping. The pieces
+     *  are sent to the same callbacks as in OptimalTransportMap2d, hence
+     *  the gradient, Hessian and centroids are computed exactly as if the
+     *  image was a triangulated mesh with a piecewise constant density,
+     *  without the cost of triangulating it.
+     */
+    class EXPLORAGRAM_API OptimalTransportMapOnImage :
+        public OptimalTransportMapOnConvexDomain {
+    public:
+        /**
+         * \brief OptimalTransportMapOnImage constructor.
+         * \param[in] width , height the size of the image, in pixels
+         * \param[in] density a pointer to the width*height densities
+         *  of the pixels, stored row by row. They are copied.
+         * \param[in] pixel_size the size of a pixel
+         * \param[in] delaunay factory name of the Delaunay triangulation.
+         */
+        OptimalTransportMapOnImage(
+            index_t width, index_t height,
+            const double* density,
+            double pixel_size = 1.0,
+            const std::string& delaunay = "BPOW2d"
+        );
+
+        /**
+         * \brief OptimalTransportMapOnImage destructor.
+         */
+        ~OptimalTransportMapOnImage() override;
+
+        /**
+         * \brief Gets the width of the image.
+         * \return the number of pixels in a row
+         */
+        index_t width() const {
+            return width_;
+        }
+
+        /**
+         * \brief Gets the height of the image.
+         * \return the number of rows
+         */
+        index_t height() const {
+            return height_;
+        }
+
+        /**
+         * \brief Gets the size of the pixels.
+         * \return the length of the side of a pixel
+         */
+        double pixel_size() const {
+            return pixel_size_;
+        }
+
+        /**
+         * \brief Gets the density of a pixel.
+         * \param[in] i , j the column and the row of the pixel
+         * \return the density of the pixel
+         */
+        double density(index_t i, index_t j) const {
+            geo_debug_assert(i < width_ && j < height_);
+            return density_[j*width_+i];
+        }
+
+        /**
+         * \brief Gets the total mass of the image.
+         * \return the sum of the densities of the pixels times the
+         *  area of a pixel.
+         */
+        double total_image_mass() const;
+
+        /**
+         * \copydoc OptimalTransportMap::nb_background_elements()
+         * \details The background elements are the pixels.
+         */
+        index_t nb_background_elements() const override;
+
+    protected:
+        /**
+         * \copydoc OptimalTransportMapOnConvexDomain::process_Laguerre_cell()
+         * \details Sends the pixels covered by the Laguerre cell. The
+         *  index of the pixel (j*width()+i) is passed to the callback as
+         *  the facet index.
+         */
+        void process_Laguerre_cell(
+            index_t v, RVDPolygonCallback& callback, CellWorkspace& W
+        ) override;
+
+    protected:
+        index_t width_;
+        index_t height_;
+        double pixel_size_;
+        vector<double> density_;
+    };
+
+    /*********************************************************************/
+}
+
+#endif
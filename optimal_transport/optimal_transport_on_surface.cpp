@@ -71,6 +71,7 @@ namespace {
          */
         SurfaceOTMPolygonCallback(OptimalTransportMapOnSurface* OTM) :
             OptimalTransportMap::Callback(OTM) {
+            update_kernel();
         }
 
         /**
@@ -81,6 +82,35 @@ namespace {
             index_t t,
             const GEOGen::Polygon& P
         ) const override {
+            (this->*kernel_)(v,t,P);
+        }
+
+        /**
+         * \brief A pointer to a specialization of kernel().
+         */
+        typedef void (SurfaceOTMPolygonCallback::*Kernel)(
+            index_t v, index_t t, const GEOGen::Polygon& P
+        ) const;
+
+        /**
+         * \brief Computes the contribution of a polygon.
+         * \details The flags are template arguments, so that the
+         *  tests are resolved at compile time.
+         * \tparam WEIGHTED true if the mesh has varying density
+         * \tparam CENTROIDS true if mass times centroids are computed
+         * \tparam NEWTON true if the Hessian is computed
+         * \tparam EVAL_F true if the objective function is computed
+         * \param[in] v the seed
+         * \param[in] t the mesh facet
+         * \param[in] P the intersection between the Laguerre cell of \p v
+         *  and the facet \p t
+         */
+        template <bool WEIGHTED, bool CENTROIDS, bool NEWTON, bool EVAL_F>
+        void kernel(
+            index_t v,
+            index_t t,
+            const GEOGen::Polygon& P
+        ) const {
             // v can be an air particle.
             if(v >= n_) {
                 return;
@@ -91,58 +121,81 @@ namespace {
             }
 
             double m, mgx, mgy, mgz;
-            compute_m_and_mg(P, m, mgx, mgy, mgz);
+            compute_m_and_mg<WEIGHTED, CENTROIDS>(P, m, mgx, mgy, mgz);
+
+            if(buffers_ != nullptr) {
+                double mg[3] = { mgx, mgy, mgz };
+                buffers_->add_mass(current_thread_id(), v, m, mg);
+            } else {
+                if(spinlocks_ != nullptr) {
+                    spinlocks_->acquire_spinlock(v);
+                }
 
-            if(spinlocks_ != nullptr) {
-                spinlocks_->acquire_spinlock(v);
-            }
+                // +m because we maximize F <=> minimize -F
+                g_[v] += m;
+
+                if(NEWTON) {
+                    // ... but here -m because Newton step =
+                    //  solve H p = -g    (minus g in the RHS).
+                    OTM_->add_i_right_hand_side(v,-m);
+                }
 
-            // +m because we maximize F <=> minimize -F
-            g_[v] += m;
+                if(CENTROIDS) {
+                    mg_[3*v] += mgx;
+                    mg_[3*v+1] += mgy;
+                    mg_[3*v+2] += mgz;
+                }
 
-            if(Newton_step_) {
-                // ... but here -m because Newton step =
-                //  solve H p = -g    (minus g in the RHS).
-                OTM_->add_i_right_hand_side(v,-m);
+                if(spinlocks_ != nullptr) {
+                    spinlocks_->release_spinlock(v);
+                }
             }
 
-            if(mg_ != nullptr) {
-                mg_[3*v] += mgx;
-                mg_[3*v+1] += mgy;
-                mg_[3*v+2] += mgz;
+            if(plan_ != nullptr) {
+                double mg[3] = { mgx, mgy, mgz };
+                plan_->add(current_thread_id(), external_seed(v), t, m, mg);
             }
 
-            if(spinlocks_ != nullptr) {
-                spinlocks_->release_spinlock(v);
+            if(RVD_buffers_ != nullptr) {
+                RVD_buffers_->add_polygon(
+                    current_thread_id(), external_seed(v), P,
+                    coord_index_t(OTM_->dimension())
+                );
             }
 
-            if(Newton_step_) {
+            if(NEWTON) {
                 // Spinlocks are managed internally by update_Hessian().
-                update_Hessian(P, v, t);
+                update_Hessian<WEIGHTED>(P, v, t);
             }
 
 
-            if(eval_F_) {
-                Thread* thread = Thread::current();
-                index_t current_thread_id = (thread == nullptr) ? 0 : thread->id();
-                double F = weighted_ ? eval_F_weighted(P, v) : eval_F(P, v);
+            if(EVAL_F) {
+                double F = WEIGHTED ? eval_F_weighted(P, v) : eval_F(P, v);
                 const_cast<SurfaceOTMPolygonCallback*>(this)->
-                    funcval_[current_thread_id] += F;
+                    funcval_[current_thread_id()] += F;
             }
         }
 
     protected:
+        /**
+         * \copydoc OptimalTransportMap::Callback::update_kernel()
+         */
+        void update_kernel() override {
+            kernel_ = select_kernel<SurfaceOTMPolygonCallback>();
+        }
 
         /**
          * \brief Computes the mass and mass times centroid of the
          *  current intersection polygon.
          * \details Weights are taken into account if present.
+         * \tparam WEIGHTED true if the mesh has varying density
+         * \tparam CENTROIDS true if mass times centroids are computed
          * \param[in] P a const reference to the current intersection polygon.
          * \param[out] m , mgx , mgy , mgz the mass and the mass times the
          *  centroid of the ConvexCell. mgx, mgy and mgy are not computed
-         *  if mg_ is nullptr.
+         *  if CENTROIDS is false.
          */
-        void compute_m_and_mg(
+        template <bool WEIGHTED, bool CENTROIDS> void compute_m_and_mg(
             const GEOGen::Polygon& P,
             double& m, double& mgx, double& mgy, double& mgz
         ) const {
@@ -157,10 +210,10 @@ namespace {
                 const double* p1 = V1.point();
                 const GEOGen::Vertex& V2 = P.vertex(i+1);
                 const double* p2 = V2.point();
-                double cur_m = triangle_mass(V0,V1,V2);
+                double cur_m = triangle_mass<WEIGHTED>(V0,V1,V2);
                 m += cur_m;
-                if(mg_ != nullptr) {
-                    if(weighted_) {
+                if(CENTROIDS) {
+                    if(WEIGHTED) {
                         double w0 = V0.weight();
                         double w1 = V1.weight();
                         double w2 = V2.weight();
@@ -203,11 +256,14 @@ namespace {
         /**
          * \brief Updates the Hessian according to the current intersection
          *  polygon.
+         * \tparam WEIGHTED true if the mesh has varying density
          * \param[in] P a const reference to the current intersection polygon.
          * \param[in] i the current seed
          * \param[in] t the current mesh facet
          */
-        void update_Hessian(const GEOGen::Polygon& P, index_t i, index_t t) const {
+        template <bool WEIGHTED> void update_Hessian(
+            const GEOGen::Polygon& P, index_t i, index_t t
+        ) const {
 
             vec3 N = normalize(facet_normal(t));
 
@@ -215,7 +271,7 @@ namespace {
             // adjacent cells Lag(i),Lag(j) is :
             // - mass(Lag(i) /\ Lag(j)) / (2*distance(pi,pj))
 
-            const double* pi = OTM_->point_ptr(i);
+            const double* pi = seed_point(i);
 
             for(index_t k1=0; k1<P.nb_vertices(); ++k1) {
                 index_t k2 = k1+1;
@@ -227,29 +283,37 @@ namespace {
                 // not P.vertex(k1).adjacent_seed() !!!
                 index_t j = index_t(P.vertex(k2).adjacent_seed());
                 if(j != index_t(-1)) {
-                    const double* pj = OTM_->point_ptr(j);
+                    const double* pj = seed_point(j);
 
                     vec3 pij(pj[0] - pi[0],pj[1] - pi[1],pj[2] - pi[2]);
                     // Remove from pij the part that is normal to the current polygon.
                     pij -= dot(pij,N)*N;
                     double lij = length(pij);
 
-                    double hij = edge_mass(P.vertex(k1), P.vertex(k2)) / (2.0 * lij);
+                    double hij = edge_mass<WEIGHTED>(P.vertex(k1), P.vertex(k2)) / (2.0 * lij);
 
                     // -hij because we maximize F <=> minimize -F
                     if(hij != 0.0) {
-                        if(spinlocks_ != nullptr) {
-                            spinlocks_->acquire_spinlock(i);
-                        }
-                        // Diagonal is positive, extra-diagonal
-                        // coefficients are negative,
-                        // this is a convex function.
-                        if(j < n_) {
-                            OTM_->add_ij_coefficient(i, j, -hij);
-                        }
-                        OTM_->add_ij_coefficient(i, i,  hij);
-                        if(spinlocks_ != nullptr) {
-                            spinlocks_->release_spinlock(i);
+                        if(buffers_ != nullptr) {
+                            index_t thread = current_thread_id();
+                            if(j < n_) {
+                                buffers_->add_coefficient(thread, i, j, -hij);
+                            }
+                            buffers_->add_coefficient(thread, i, i, hij);
+                        } else {
+                            if(spinlocks_ != nullptr) {
+                                spinlocks_->acquire_spinlock(i);
+                            }
+                            // Diagonal is positive, extra-diagonal
+                            // coefficients are negative,
+                            // this is a convex function.
+                            if(j < n_) {
+                                OTM_->add_ij_coefficient(i, j, -hij);
+                            }
+                            OTM_->add_ij_coefficient(i, i,  hij);
+                            if(spinlocks_ != nullptr) {
+                                spinlocks_->release_spinlock(i);
+                            }
                         }
                     }
                 }
@@ -286,19 +350,20 @@ namespace {
 
         /**
          * \brief Computes the mass of a triangle.
-         * \details Weights are taken into account in weighted_ mode.
+         * \details Weights are taken into account in WEIGHTED mode.
+         * \tparam WEIGHTED true if the mesh has varying density
          * \param[in] V0 , V1 , V2 the three vertices of the triangle,
          *  given as RVD vertices.
          * \return the area of the triangle in 3D times the average value of the
          *  three weights.
          */
-        double triangle_mass(
+        template <bool WEIGHTED> double triangle_mass(
             const GEOGen::Vertex& V0,
             const GEOGen::Vertex& V1,
             const GEOGen::Vertex& V2
         ) const {
             double m = Geom::triangle_area_3d(V0.point(), V1.point(), V2.point());
-            if(weighted_) {
+            if(WEIGHTED) {
                 m *= ((V0.weight() + V1.weight() + V2.weight())/3.0);
             }
             return m;
@@ -306,22 +371,26 @@ namespace {
 
         /**
          * \brief Computes the mass of an edge.
-         * \details Weights are taken into account in weighted_ mode.
+         * \details Weights are taken into account in WEIGHTED mode.
+         * \tparam WEIGHTED true if the mesh has varying density
          * \param[in] V0 , V1 the two vertices of the edge,
          *  given as RVD vertices.
          * \return the length of the edge in 3D times the average value of the
          *  two weights.
          */
-        double edge_mass(
+        template <bool WEIGHTED> double edge_mass(
             const GEOGen::Vertex& V0,
             const GEOGen::Vertex& V1
         ) const {
             double m = Geom::distance(V0.point(), V1.point(), 3);
-            if(weighted_) {
+            if(WEIGHTED) {
                 m *= ((V0.weight() + V1.weight())/2.0);
             }
             return m;
         }
+
+    private:
+        Kernel kernel_;
     };
 
     /**********************************************************************/
@@ -348,7 +417,6 @@ namespace {
             index_t t,
             const GEOGen::Polygon& P
         ) const override {
-            geo_argused(v);
             geo_argused(t);
 
             if(P.nb_vertices() == 0) {
@@ -372,7 +440,8 @@ namespace {
             FOR(i,P.nb_vertices()) {
                 target_->facets.set_vertex(f,i,voffset+i);
             }
-            const_cast<Attribute<index_t>&>(chart_)[f] = v;
+            const_cast<Attribute<index_t>&>(chart_)[f] =
+                OTM_->external_index(v);
         }
 
     private:
@@ -383,6 +452,16 @@ namespace {
 
 
 
+    /**
+     * \brief Declares the references of the algorithm.
+     * \details Called only once, the bibliography is not thread-safe.
+     * \retval true
+     */
+    bool cite_surface_OTM_references() {
+        geo_cite("DBLP:journals/corr/MerigotMT17");
+        return true;
+    }
+
     /**
      * \brief Gets the Delaunay implementation that best fits
      *  user desire.
@@ -420,7 +499,23 @@ namespace GEO {
         ) {
         callback_ = new SurfaceOTMPolygonCallback(this);
         total_mass_ = total_mesh_mass();
-        geo_cite("DBLP:journals/corr/MerigotMT17");
+        static bool cited = cite_surface_OTM_references();
+        geo_argused(cited);
+    }
+
+    OptimalTransportMapOnSurface::OptimalTransportMapOnSurface(
+        OptimalTransportTarget* target, const std::string& delaunay, bool BRIO
+    ) :
+        OptimalTransportMap(
+            3,
+            target,
+            default_delaunay(delaunay),
+            BRIO
+        ) {
+        geo_assert(!target->volumetric());
+        callback_ = new SurfaceOTMPolygonCallback(this);
+        static bool cited = cite_surface_OTM_references();
+        geo_argused(cited);
     }
 
     OptimalTransportMapOnSurface::~OptimalTransportMapOnSurface() {
@@ -468,9 +563,14 @@ namespace GEO {
             centroids[3*v+1] /= g[v];
             centroids[3*v+2] /= g[v];
         }
+        to_external_order(centroids, 3);
     }
 
     double OptimalTransportMapOnSurface::total_mesh_mass() const {
+        if(!target_.is_null()) {
+            return target_->total_mass();
+        }
+
         double result = 0.0;
 
         //   This is terribly confusing, the parameters for
@@ -505,15 +605,14 @@ namespace GEO {
     }
 
     void OptimalTransportMapOnSurface::call_callback_on_RVD() {
+        // Air fraction is not taken into account by this callback (no
+        // clipping by balls), so there is no reason not to run in parallel.
         RVD_->for_each_polygon(
             *dynamic_cast<RVDPolygonCallback*>(callback_),
-            false,          // symbolic
-            false,          // connected components priority
-            !clip_by_balls_ // parallel
+            false, // symbolic
+            false, // connected components priority
+            true   // parallel
         );
-        // clip_by_balls deactivates parallel mode, because it needs to access
-        // the PointAllocator of the current thread, and we do not have any
-        // access (for now).
     }
 
     /**********************************************************************/
@@ -539,12 +638,8 @@ namespace GEO {
             false
         );
 
-        static bool initialized = false;
-        static bool has_cholmod = false;
-        if(!initialized) {
-            initialized = true;
-            has_cholmod = (nlInitExtension("CHOLMOD") == NL_TRUE);
-        }
+        // Initialized once, in a thread-safe manner.
+        static bool has_cholmod = (nlInitExtension("CHOLMOD") == NL_TRUE);
         if(has_cholmod) {
             OTM.set_regularization(1e-3);
             OTM.set_linear_solver(OT_CHOLMOD);
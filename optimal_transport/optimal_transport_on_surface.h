@@ -104,6 +104,21 @@ namespace GEO {
             bool BRIO=false
         );
 
+        /**
+         * \brief OptimalTransportMapOnSurface constructor with a shared
+         *  background mesh.
+         * \details See OptimalTransportTarget.
+         * \param[in] target the source distribution, a surfacic
+         *  OptimalTransportTarget of dimension 3
+         * \param[in] delaunay factory name of the Delaunay triangulation.
+         * \param[in] BRIO true if vertices are already ordered using BRIO
+         */
+        OptimalTransportMapOnSurface(
+            OptimalTransportTarget* target,
+            const std::string& delaunay = "BPOW",
+            bool BRIO=false
+        );
+
         /**
          * \brief OptimalTransportMap destructor.
          */
@@ -0,0 +1,270 @@
+/*
+ *  Copyright (c) 2000-2022 Inria
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *  this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *  * Neither the name of the ALICE Project-Team nor the names of its
+ *  contributors may be used to endorse or promote products derived from this
+ *  software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  Contact: Bruno Levy
+ *
+ *     https://www.inria.fr/fr/bruno-levy
+ *
+ *     Inria,
+ *     Domaine de Voluceau,
+ *     78150 Le Chesnay - Rocquencourt
+ *     FRANCE
+ *
+ */
+
+#include <exploragram/optimal_transport/rvd_mesh_buffers.h>
+#include <geogram/mesh/mesh.h>
+#include <geogram/voronoi/generic_RVD_vertex.h>
+#include <geogram/voronoi/generic_RVD_polygon.h>
+#include <geogram/voronoi/generic_RVD_cell.h>
+#include <geogram/voronoi/convex_cell.h>
+#include <geogram/basic/process.h>
+#include <algorithm>
+
+namespace GEO {
+
+    OTRVDMeshBuffers::OTRVDMeshBuffers() {
+    }
+
+    void OTRVDMeshBuffers::begin(index_t nb_threads) {
+        geo_assert(nb_threads != 0);
+        buffers_.resize(nb_threads);
+        for(Buffer& B: buffers_) {
+            B.points.clear();
+            B.facet_ptr.assign(1, 0);
+            B.facet_vertices.clear();
+            B.facet_seed.clear();
+            B.tet_vertices.clear();
+            B.tet_seed.clear();
+        }
+    }
+
+    void OTRVDMeshBuffers::add_polygon(
+        index_t thread, index_t v,
+        const GEOGen::Polygon& P, coord_index_t dim
+    ) {
+        if(P.nb_vertices() == 0) {
+            return;
+        }
+        Buffer& B = buffer(thread);
+        index_t offset = B.points.size() / 3;
+        for(index_t i=0; i<P.nb_vertices(); ++i) {
+            const double* p = P.vertex(i).point();
+            B.points.push_back(p[0]);
+            B.points.push_back(p[1]);
+            B.points.push_back(dim == 3 ? p[2] : 0.0);
+            B.facet_vertices.push_back(offset + i);
+        }
+        B.facet_ptr.push_back(B.facet_vertices.size());
+        B.facet_seed.push_back(v);
+    }
+
+    void OTRVDMeshBuffers::add_polyhedron(
+        index_t thread, index_t v, const GEOGen::ConvexCell& C
+    ) {
+        Buffer& B = buffer(thread);
+
+        // Find one vertex t0 of the Convex Cell (a triangle in dual form).
+        // It will be then decomposed into tetrahedra radiating from t0.
+        index_t t0 = index_t(-1);
+        for(index_t ct=0; ct < C.max_t(); ++ct) {
+            if(C.triangle_is_used(ct)) {
+                t0 = ct;
+                break;
+            }
+        }
+        if(t0 == index_t(-1)) {
+            return;
+        }
+
+        // Vertices are created on demand, and shared by all the
+        // tetrahedra of the cell.
+        B.vertex_map.assign(C.max_t(), index_t(-1));
+        auto vertex = [&](index_t ct)->index_t {
+            if(B.vertex_map[ct] == index_t(-1)) {
+                B.vertex_map[ct] = B.points.size() / 3;
+                const double* p = C.triangle_dual(ct).point();
+                B.points.push_back(p[0]);
+                B.points.push_back(p[1]);
+                B.points.push_back(p[2]);
+            }
+            return B.vertex_map[ct];
+        };
+
+        // Same traversal as in the integration kernels: iterate on the
+        // facets (the vertices of the ConvexCell in dual form), and
+        // triangulate each facet. The triangles that contain t0 are
+        // skipped (their tetrahedron is flat).
+        for(index_t cv = 0; cv < C.max_v(); ++cv) {
+            signed_index_t ct = C.vertex_triangle(cv);
+            if(ct == -1) {
+                continue;
+            }
+            GEOGen::ConvexCell::Corner first(
+                index_t(ct), C.find_triangle_vertex(index_t(ct), cv)
+            );
+            index_t t1 = first.t;
+            index_t t2 = index_t(-1);
+            index_t t3 = index_t(-1);
+            GEOGen::ConvexCell::Corner c = first;
+            do {
+                t2 = t3;
+                t3 = c.t;
+                if(
+                    t2 != index_t(-1) && t3 != t1 &&
+                    t1 != t0 && t2 != t0 && t3 != t0
+                ) {
+                    B.tet_vertices.push_back(vertex(t0));
+                    B.tet_vertices.push_back(vertex(t1));
+                    B.tet_vertices.push_back(vertex(t2));
+                    B.tet_vertices.push_back(vertex(t3));
+                    B.tet_seed.push_back(v);
+                }
+                C.move_to_next_around_vertex(c);
+            } while(c != first);
+        }
+    }
+
+    void OTRVDMeshBuffers::add_polyhedron(
+        index_t thread, index_t v, VBW::ConvexCell& C
+    ) {
+        Buffer& B = buffer(thread);
+
+        // The vertices of the cell are the triangles in dual form.
+        // Vertices are created on demand, and shared by all the
+        // tetrahedra of the cell.
+        B.vertex_map.assign(C.nb_t(), index_t(-1));
+        auto vertex = [&](index_t t)->index_t {
+            if(B.vertex_map[t] == index_t(-1)) {
+                B.vertex_map[t] = B.points.size() / 3;
+                VBW::vec3 p = C.triangle_point(t);
+                B.points.push_back(p.x);
+                B.points.push_back(p.y);
+                B.points.push_back(p.z);
+            }
+            return B.vertex_map[t];
+        };
+
+        // Iterate on the facets (the vertices of the ConvexCell in dual
+        // form), and triangulate each facet. The tetrahedra radiate from
+        // the first vertex t0 of the cell, the facets incident to t0 are
+        // skipped (their tetrahedra are flat).
+        index_t t0 = index_t(-1);
+        vector<index_t>& facet = B.facet_loop;
+        for(index_t cv = 0; cv < C.nb_v(); ++cv) {
+            facet.resize(0);
+            C.for_each_Voronoi_vertex(
+                cv, [&facet](index_t t) { facet.push_back(t); }
+            );
+            if(facet.size() < 3) {
+                continue;
+            }
+            if(t0 == index_t(-1)) {
+                t0 = facet[0];
+                continue;
+            }
+            if(std::find(facet.begin(), facet.end(), t0) != facet.end()) {
+                continue;
+            }
+            for(index_t k=1; k+1<facet.size(); ++k) {
+                B.tet_vertices.push_back(vertex(t0));
+                B.tet_vertices.push_back(vertex(facet[0]));
+                B.tet_vertices.push_back(vertex(facet[k]));
+                B.tet_vertices.push_back(vertex(facet[k+1]));
+                B.tet_seed.push_back(v);
+            }
+        }
+    }
+
+    void OTRVDMeshBuffers::end(Mesh& M) {
+        M.clear();
+        M.vertices.set_dimension(3);
+
+        index_t nb_threads = buffers_.size();
+        vector<index_t> vertex_offset(nb_threads+1, 0);
+        vector<index_t> tet_offset(nb_threads+1, 0);
+        index_t nb_facets = 0;
+        for(index_t th=0; th<nb_threads; ++th) {
+            const Buffer& B = buffers_[th];
+            vertex_offset[th+1] = vertex_offset[th] + B.points.size() / 3;
+            tet_offset[th+1] = tet_offset[th] + B.tet_seed.size();
+            nb_facets += B.facet_seed.size();
+        }
+
+        M.vertices.create_vertices(vertex_offset[nb_threads]);
+        if(tet_offset[nb_threads] != 0) {
+            M.cells.create_tets(tet_offset[nb_threads]);
+        }
+
+        Attribute<index_t> region;
+        if(tet_offset[nb_threads] != 0) {
+            region.bind(M.cells.attributes(), "region");
+        }
+
+        parallel_for(
+            0, nb_threads,
+            [&](index_t th) {
+                const Buffer& B = buffers_[th];
+                index_t nb_v = B.points.size() / 3;
+                for(index_t lv=0; lv<nb_v; ++lv) {
+                    double* p = M.vertices.point_ptr(vertex_offset[th] + lv);
+                    p[0] = B.points[3*lv];
+                    p[1] = B.points[3*lv+1];
+                    p[2] = B.points[3*lv+2];
+                }
+                for(index_t lt=0; lt<B.tet_seed.size(); ++lt) {
+                    index_t t = tet_offset[th] + lt;
+                    for(index_t lv=0; lv<4; ++lv) {
+                        M.cells.set_vertex(
+                            t, lv, vertex_offset[th] + B.tet_vertices[4*lt+lv]
+                        );
+                    }
+                    region[t] = B.tet_seed[lt];
+                }
+            }
+        );
+
+        if(nb_facets != 0) {
+            Attribute<index_t> chart(M.facets.attributes(), "chart");
+            for(index_t th=0; th<nb_threads; ++th) {
+                const Buffer& B = buffers_[th];
+                for(index_t lf=0; lf<B.facet_seed.size(); ++lf) {
+                    index_t b = B.facet_ptr[lf];
+                    index_t e = B.facet_ptr[lf+1];
+                    index_t f = M.facets.create_polygon(e-b);
+                    for(index_t lv=0; lv<e-b; ++lv) {
+                        M.facets.set_vertex(
+                            f, lv, vertex_offset[th] + B.facet_vertices[b+lv]
+                        );
+                    }
+                    chart[f] = B.facet_seed[lf];
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,159 @@
+/*
+ *  Copyright (c) 2000-2022 Inria
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *  this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *  * Neither the name of the ALICE Project-Team nor the names of its
+ *  contributors may be used to endorse or promote products derived from this
+ *  software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  Contact: Bruno Levy
+ *
+ *     https://www.inria.fr/fr/bruno-levy
+ *
+ *     Inria,
+ *     Domaine de Voluceau,
+ *     78150 Le Chesnay - Rocquencourt
+ *     FRANCE
+ *
+ */
+
+#ifndef H_EXPLORAGRAM_OPTIMAL_TRANSPORT_RVD_MESH_BUFFERS_H
+#define H_EXPLORAGRAM_OPTIMAL_TRANSPORT_RVD_MESH_BUFFERS_H
+
+#include <exploragram/basic/common.h>
+
+/**
+ * \file exploragram/optimal_transport/rvd_mesh_buffers.h
+ * \brief Parallel extraction of a restricted Laguerre diagram as a mesh.
+ */
+
+namespace GEOGen {
+    class Polygon;
+    class ConvexCell;
+}
+
+namespace VBW {
+    class ConvexCell;
+}
+
+namespace GEO {
+    class Mesh;
+
+    /**
+     * \brief Per-thread buffers used to extract the restricted Laguerre
+     *  diagram as a mesh during a parallel traversal.
+     * \details Each thread appends the intersections it traverses to its
+     *  own buffers, then end() concatenates them into a Mesh. Polygons
+     *  (2d and surface) are stored as facets with a "chart" attribute,
+     *  and polyhedra (3d) are decomposed into tetrahedra stored as cells
+     *  with a "region" attribute. The attributes have the index of the
+     *  seed. Vertices are shared by the simplices of the same
+     *  intersection only.
+     */
+    class EXPLORAGRAM_API OTRVDMeshBuffers {
+    public:
+        /**
+         * \brief OTRVDMeshBuffers constructor.
+         */
+        OTRVDMeshBuffers();
+
+        /**
+         * \brief Starts a new extraction.
+         * \param[in] nb_threads the maximum number of threads that
+         *  will call add_polygon() and add_polyhedron()
+         */
+        void begin(index_t nb_threads);
+
+        /**
+         * \brief Adds a polygon.
+         * \param[in] thread the id of the current thread
+         * \param[in] v the seed
+         * \param[in] P the intersection between the Laguerre cell of
+         *  \p v and a background element
+         * \param[in] dim the dimension of the vertices of \p P, 2 or 3
+         */
+        void add_polygon(
+            index_t thread, index_t v,
+            const GEOGen::Polygon& P, coord_index_t dim
+        );
+
+        /**
+         * \brief Adds a polyhedron, decomposed into tetrahedra.
+         * \param[in] thread the id of the current thread
+         * \param[in] v the seed
+         * \param[in] C the intersection between the Laguerre cell of
+         *  \p v and a background element
+         */
+        void add_polyhedron(
+            index_t thread, index_t v, const GEOGen::ConvexCell& C
+        );
+
+        /**
+         * \brief Adds a polyhedron, decomposed into tetrahedra.
+         * \param[in] thread the id of the current thread
+         * \param[in] v the seed
+         * \param[in] C the intersection between the Laguerre cell of
+         *  \p v and a background element. Its geometry is computed
+         *  (compute_geometry() was called).
+         */
+        void add_polyhedron(
+            index_t thread, index_t v, VBW::ConvexCell& C
+        );
+
+        /**
+         * \brief Concatenates the buffers of all threads into a mesh.
+         * \param[out] M the mesh. Previous contents are cleared.
+         */
+        void end(Mesh& M);
+
+    protected:
+        /**
+         * \brief The elements extracted by a thread.
+         */
+        struct Buffer {
+            vector<double> points;
+            vector<index_t> facet_ptr;
+            vector<index_t> facet_vertices;
+            vector<index_t> facet_seed;
+            vector<index_t> tet_vertices;
+            vector<index_t> tet_seed;
+            vector<index_t> vertex_map;
+            vector<index_t> facet_loop;
+        };
+
+        /**
+         * \brief Gets the buffer of a thread.
+         * \param[in] thread the id of the thread
+         * \return a reference to the Buffer
+         */
+        Buffer& buffer(index_t thread) {
+            geo_debug_assert(thread < buffers_.size());
+            return buffers_[thread];
+        }
+
+    private:
+        vector<Buffer> buffers_;
+    };
+}
+
+#endif
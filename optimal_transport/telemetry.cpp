@@ -0,0 +1,175 @@
+/*
+ *  Copyright (c) 2000-2022 Inria
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *  this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *  * Neither the name of the ALICE Project-Team nor the names of its
+ *  contributors may be used to endorse or promote products derived from this
+ *  software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  Contact: Bruno Levy
+ *
+ *     https://www.inria.fr/fr/bruno-levy
+ *
+ *     Inria,
+ *     Domaine de Voluceau,
+ *     78150 Le Chesnay - Rocquencourt
+ *     FRANCE
+ *
+ */
+
+#include <exploragram/optimal_transport/telemetry.h>
+#include <geogram/basic/logger.h>
+#include <fstream>
+#include <iomanip>
+#include <cmath>
+
+namespace {
+    using namespace GEO;
+
+    /**
+     * \brief Writes a JSON number.
+     * \details Non-finite values are not allowed in JSON, and
+     *  are written as null.
+     * \param[in] out the stream where to write
+     * \param[in] x the value
+     */
+    void write_JSON_number(std::ostream& out, double x) {
+        if(std::isfinite(x)) {
+            out << x;
+        } else {
+            out << "null";
+        }
+    }
+}
+
+namespace GEO {
+
+    void OTIterationStats::clear() {
+        solve = 0;
+        iteration = 0;
+        total_time = 0.0;
+        power_diagram_time = 0.0;
+        nb_power_diagrams = 0;
+        nb_power_diagrams_reused = 0;
+        RVD_time = 0.0;
+        Hessian_assembly_time = 0.0;
+        linear_solve_time = 0.0;
+        line_search_time = 0.0;
+        nb_CG_iterations = 0;
+        linear_solve_tolerance = 0.0;
+        linear_solve_error = 0.0;
+        smallest_cell_measure = 0.0;
+        gradient_norm = 0.0;
+        nb_line_search_steps = 0;
+        nb_rejected_steps = 0;
+        nb_RVD_avoided = 0;
+    }
+
+    /*********************************************************************/
+
+    OTTelemetry::OTTelemetry() :
+        enabled_(false),
+        solve_(0),
+        iteration_start_(0.0) {
+    }
+
+    void OTTelemetry::clear() {
+        iterations_.clear();
+        current_.clear();
+        solve_ = 0;
+    }
+
+    void OTTelemetry::begin_solve() {
+        if(!iterations_.empty()) {
+            ++solve_;
+        }
+    }
+
+    void OTTelemetry::begin_iteration(index_t k) {
+        current_.clear();
+        current_.solve = solve_;
+        current_.iteration = k;
+        iteration_start_ = now();
+    }
+
+    void OTTelemetry::end_iteration() {
+        current_.total_time = now() - iteration_start_;
+        if(enabled_) {
+            iterations_.push_back(current_);
+        }
+    }
+
+    void OTTelemetry::save_JSON_lines(std::ostream& out) const {
+        std::streamsize precision = out.precision();
+        out << std::setprecision(10);
+        for(index_t i=0; i<nb_iterations(); ++i) {
+            const OTIterationStats& S = iterations_[i];
+            out << "{\"solve\":" << S.solve
+                << ",\"iteration\":" << S.iteration
+                << ",\"total_time\":";
+            write_JSON_number(out, S.total_time);
+            out << ",\"power_diagram_time\":";
+            write_JSON_number(out, S.power_diagram_time);
+            out << ",\"nb_power_diagrams\":" << S.nb_power_diagrams
+                << ",\"nb_power_diagrams_reused\":"
+                << S.nb_power_diagrams_reused
+                << ",\"RVD_time\":";
+            write_JSON_number(out, S.RVD_time);
+            out << ",\"Hessian_assembly_time\":";
+            write_JSON_number(out, S.Hessian_assembly_time);
+            out << ",\"linear_solve_time\":";
+            write_JSON_number(out, S.linear_solve_time);
+            out << ",\"line_search_time\":";
+            write_JSON_number(out, S.line_search_time);
+            out << ",\"nb_CG_iterations\":" << S.nb_CG_iterations
+                << ",\"linear_solve_tolerance\":";
+            write_JSON_number(out, S.linear_solve_tolerance);
+            out << ",\"linear_solve_error\":";
+            write_JSON_number(out, S.linear_solve_error);
+            out << ",\"smallest_cell_measure\":";
+            write_JSON_number(out, S.smallest_cell_measure);
+            out << ",\"gradient_norm\":";
+            write_JSON_number(out, S.gradient_norm);
+            out << ",\"nb_line_search_steps\":" << S.nb_line_search_steps
+                << ",\"nb_rejected_steps\":" << S.nb_rejected_steps
+                << ",\"nb_RVD_avoided\":" << S.nb_RVD_avoided
+                << "}\n";
+        }
+        out.precision(precision);
+    }
+
+    bool OTTelemetry::save_JSON_lines(
+        const std::string& filename, bool append
+    ) const {
+        std::ofstream out(
+            filename.c_str(),
+            append ? (std::ios::out | std::ios::app) : std::ios::out
+        );
+        if(!out) {
+            Logger::err("OTM") << "Could not open " << filename << std::endl;
+            return false;
+        }
+        save_JSON_lines(out);
+        return true;
+    }
+}
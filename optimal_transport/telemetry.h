@@ -0,0 +1,267 @@
+/*
+ *  Copyright (c) 2000-2022 Inria
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *  this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *  * Neither the name of the ALICE Project-Team nor the names of its
+ *  contributors may be used to endorse or promote products derived from this
+ *  software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  Contact: Bruno Levy
+ *
+ *     https://www.inria.fr/fr/bruno-levy
+ *
+ *     Inria,
+ *     Domaine de Voluceau,
+ *     78150 Le Chesnay - Rocquencourt
+ *     FRANCE
+ *
+ */
+
+#ifndef H_EXPLORAGRAM_OPTIMAL_TRANSPORT_TELEMETRY_H
+#define H_EXPLORAGRAM_OPTIMAL_TRANSPORT_TELEMETRY_H
+
+#include <exploragram/basic/common.h>
+#include <geogram/basic/stopwatch.h>
+#include <iosfwd>
+#include <string>
+
+/**
+ * \file exploragram/optimal_transport/telemetry.h
+ * \brief Per-iteration statistics of semi-discrete optimal transport
+ *  solvers.
+ */
+
+namespace GEO {
+
+    /**
+     * \brief Statistics of a Newton iteration of an OptimalTransportMap.
+     * \details All times are wall clock times, in seconds. The power
+     *  diagrams and RVD traversals done by the line search are also
+     *  counted in power_diagram_time and RVD_time, hence line_search_time
+     *  overlaps them.
+     */
+    struct EXPLORAGRAM_API OTIterationStats {
+
+        /**
+         * \brief OTIterationStats constructor.
+         */
+        OTIterationStats() {
+            clear();
+        }
+
+        /**
+         * \brief Resets all the times and counters to zero.
+         */
+        void clear();
+
+        /** \brief Index of the solve, incremented at each optimize() */
+        index_t solve;
+
+        /** \brief Index of the Newton iteration in the solve */
+        index_t iteration;
+
+        /** \brief Total time of the iteration */
+        double total_time;
+
+        /** \brief Time spent computing regular triangulations */
+        double power_diagram_time;
+
+        /** \brief Number of regular triangulations requested */
+        index_t nb_power_diagrams;
+
+        /**
+         * \brief Number of regular triangulations that were not rebuilt,
+         *  because the previous one was still regular
+         */
+        index_t nb_power_diagrams_reused;
+
+        /**
+         * \brief Time spent traversing the restricted power diagram,
+         *  including the contributions of the cells to masses and Hessian
+         */
+        double RVD_time;
+
+        /**
+         * \brief Time spent updating the sparsity pattern of the
+         *  Hessian, merging thread-local contributions and compressing
+         *  the Hessian
+         */
+        double Hessian_assembly_time;
+
+        /** \brief Time spent in the linear solver */
+        double linear_solve_time;
+
+        /** \brief Total time of the line search */
+        double line_search_time;
+
+        /** \brief Number of iterations of the conjugate gradient */
+        index_t nb_CG_iterations;
+
+        /** \brief Tolerance of the linear solve */
+        double linear_solve_tolerance;
+
+        /** \brief Relative residual of the linear solve */
+        double linear_solve_error;
+
+        /** \brief Smallest cell measure at the end of the iteration */
+        double smallest_cell_measure;
+
+        /** \brief Norm of the gradient at the end of the iteration */
+        double gradient_norm;
+
+        /** \brief Number of steps tried by the line search */
+        index_t nb_line_search_steps;
+
+        /** \brief Number of steps rejected by the line search */
+        index_t nb_rejected_steps;
+
+        /**
+         * \brief Number of rejected steps that did not need computing
+         *  the restricted power diagram (hidden seeds)
+         */
+        index_t nb_RVD_avoided;
+    };
+
+    /*********************************************************************/
+
+    /**
+     * \brief Records the statistics of the Newton iterations of an
+     *  OptimalTransportMap.
+     * \details The statistics of the current iteration are always
+     *  accumulated (this only costs reading the clock a few times per
+     *  iteration). They are kept in the history only if recording is
+     *  enabled.
+     */
+    class EXPLORAGRAM_API OTTelemetry {
+    public:
+        /**
+         * \brief OTTelemetry constructor.
+         */
+        OTTelemetry();
+
+        /**
+         * \brief Enables or disables recording.
+         * \param[in] x true if iteration statistics are kept, false
+         *  otherwise (default)
+         */
+        void set_enabled(bool x) {
+            enabled_ = x;
+        }
+
+        /**
+         * \brief Tests whether recording is enabled.
+         * \retval true if iteration statistics are kept
+         * \retval false otherwise
+         */
+        bool enabled() const {
+            return enabled_;
+        }
+
+        /**
+         * \brief Clears the recorded statistics.
+         */
+        void clear();
+
+        /**
+         * \brief Starts a new solve.
+         */
+        void begin_solve();
+
+        /**
+         * \brief Starts a new iteration.
+         * \param[in] k the index of the iteration in the current solve
+         */
+        void begin_iteration(index_t k);
+
+        /**
+         * \brief Terminates the current iteration, and records its
+         *  statistics if enabled.
+         */
+        void end_iteration();
+
+        /**
+         * \brief Gets the statistics of the current iteration.
+         * \return a modifiable reference to the statistics
+         */
+        OTIterationStats& current() {
+            return current_;
+        }
+
+        /**
+         * \brief Gets the number of recorded iterations.
+         * \return the number of recorded iterations, in all the solves
+         *  since the latest call to clear()
+         */
+        index_t nb_iterations() const {
+            return index_t(iterations_.size());
+        }
+
+        /**
+         * \brief Gets the statistics of a recorded iteration.
+         * \param[in] i the index of the iteration,
+         *  in 0 .. nb_iterations()-1
+         * \return a const reference to the statistics
+         */
+        const OTIterationStats& iteration(index_t i) const {
+            geo_debug_assert(i < nb_iterations());
+            return iterations_[i];
+        }
+
+        /**
+         * \brief Gets the current time.
+         * \return the wall clock time, in seconds
+         */
+        static double now() {
+            return SystemStopwatch::now();
+        }
+
+        /**
+         * \brief Writes the recorded statistics as JSON lines.
+         * \details Each line is a JSON object with the fields of
+         *  OTIterationStats.
+         * \param[in] out the stream where to write
+         */
+        void save_JSON_lines(std::ostream& out) const;
+
+        /**
+         * \brief Writes the recorded statistics as JSON lines to a file.
+         * \param[in] filename the name of the file
+         * \param[in] append if true, the lines are appended to the
+         *  file, else the file is overwritten
+         * \retval true on success
+         * \retval false otherwise
+         */
+        bool save_JSON_lines(
+            const std::string& filename, bool append = true
+        ) const;
+
+    private:
+        bool enabled_;
+        index_t solve_;
+        double iteration_start_;
+        OTIterationStats current_;
+        vector<OTIterationStats> iterations_;
+    };
+}
+
+#endif
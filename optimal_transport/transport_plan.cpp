@@ -0,0 +1,339 @@
+/*
+ *  Copyright (c) 2000-2022 Inria
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *  this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *  * Neither the name of the ALICE Project-Team nor the names of its
+ *  contributors may be used to endorse or promote products derived from this
+ *  software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  Contact: Bruno Levy
+ *
+ *     https://www.inria.fr/fr/bruno-levy
+ *
+ *     Inria,
+ *     Domaine de Voluceau,
+ *     78150 Le Chesnay - Rocquencourt
+ *     FRANCE
+ *
+ */
+
+#include <exploragram/optimal_transport/transport_plan.h>
+#include <geogram/basic/process.h>
+#include <geogram/basic/logger.h>
+#include <algorithm>
+#include <fstream>
+#include <cstring>
+
+namespace {
+    using namespace GEO;
+
+    /**
+     * \brief The first bytes of a file written by TransportPlan::save().
+     */
+    const char transport_plan_magic[8] = {
+        'O', 'T', 'P', 'L', 'A', 'N', '0', '1'
+    };
+
+    /**
+     * \brief Sorts the contributions of a block by seed and by
+     *  background element, and sums the duplicates.
+     * \param[in,out] C the contributions. The field k of each
+     *  contribution is the index of its first moment.
+     * \param[in,out] moments the first moments, dim per contribution
+     * \param[in] dim the dimension of the first moments, or 0
+     */
+    template <class COUPLING> void sort_and_merge(
+        vector<COUPLING>& C, vector<double>& moments, index_t dim
+    ) {
+        std::sort(
+            C.begin(), C.end(),
+            [](const COUPLING& A, const COUPLING& B) {
+                return (A.v < B.v) || (A.v == B.v && A.t < B.t);
+            }
+        );
+        index_t k = 0;
+        for(index_t i=0; i<C.size(); ++i) {
+            if(k != 0 && C[k-1].v == C[i].v && C[k-1].t == C[i].t) {
+                C[k-1].m += C[i].m;
+                for(index_t c=0; c<dim; ++c) {
+                    moments[C[k-1].k*dim+c] += moments[C[i].k*dim+c];
+                }
+            } else {
+                C[k] = C[i];
+                ++k;
+            }
+        }
+        C.resize(k);
+    }
+
+    /**
+     * \brief Writes an array to a binary stream.
+     * \param[in] out the stream
+     * \param[in] data a const reference to the array
+     */
+    template <class T> void write_array(
+        std::ostream& out, const vector<T>& data
+    ) {
+        if(data.size() != 0) {
+            out.write(
+                reinterpret_cast<const char*>(data.data()),
+                std::streamsize(data.size() * sizeof(T))
+            );
+        }
+    }
+
+    /**
+     * \brief Reads an array from a binary stream.
+     * \param[in] in the stream
+     * \param[out] data the array, already resized
+     */
+    template <class T> void read_array(
+        std::istream& in, vector<T>& data
+    ) {
+        if(data.size() != 0) {
+            in.read(
+                reinterpret_cast<char*>(data.data()),
+                std::streamsize(data.size() * sizeof(T))
+            );
+        }
+    }
+}
+
+namespace GEO {
+
+    TransportPlan::TransportPlan() :
+        nb_seeds_(0),
+        nb_elements_(0),
+        dimension_(0),
+        nb_threads_(0),
+        nb_blocks_(0),
+        block_size_(1) {
+        row_ptr_.assign(1, 0);
+    }
+
+    void TransportPlan::clear() {
+        nb_seeds_ = 0;
+        nb_elements_ = 0;
+        dimension_ = 0;
+        row_ptr_.assign(1, 0);
+        element_.clear();
+        measure_.clear();
+        moment_.clear();
+    }
+
+    void TransportPlan::begin_assembly(
+        index_t nb_threads, index_t nb_seeds, index_t nb_elements,
+        index_t dim
+    ) {
+        geo_assert(nb_threads != 0);
+        clear();
+        nb_seeds_ = nb_seeds;
+        nb_elements_ = nb_elements;
+        dimension_ = dim;
+        // More blocks than threads, for load balancing in end_assembly().
+        index_t nb_blocks = std::max(
+            index_t(1), std::min(4*nb_threads, nb_seeds)
+        );
+        if(nb_threads != nb_threads_ || nb_blocks != nb_blocks_) {
+            nb_threads_ = nb_threads;
+            nb_blocks_ = nb_blocks;
+            blocks_.clear();
+            blocks_.resize(nb_threads_ * nb_blocks_);
+            merged_.clear();
+            merged_.resize(nb_blocks_);
+        }
+        block_size_ = std::max(
+            index_t(1), (nb_seeds + nb_blocks_ - 1) / nb_blocks_
+        );
+        for(Block& B: blocks_) {
+            B.couplings.clear();
+            B.moments.clear();
+        }
+    }
+
+    void TransportPlan::end_assembly() {
+        row_ptr_.assign(nb_seeds_+1, 0);
+
+        // Gather the contributions of all threads to each block,
+        // sort them and count the couplings of each row.
+        parallel_for(
+            0, nb_blocks_,
+            [&](index_t b) {
+                Block& M = merged_[b];
+                M.couplings.clear();
+                M.moments.clear();
+                for(index_t th=0; th<nb_threads_; ++th) {
+                    const Block& B = blocks_[th * nb_blocks_ + b];
+                    for(index_t k=0; k<B.couplings.size(); ++k) {
+                        Coupling C = B.couplings[k];
+                        C.k = M.couplings.size();
+                        M.couplings.push_back(C);
+                        for(index_t c=0; c<dimension_; ++c) {
+                            M.moments.push_back(B.moments[k*dimension_+c]);
+                        }
+                    }
+                }
+                sort_and_merge(M.couplings, M.moments, dimension_);
+                for(index_t k=0; k<M.couplings.size(); ++k) {
+                    ++row_ptr_[M.couplings[k].v+1];
+                }
+            }
+        );
+
+        for(index_t v=0; v<nb_seeds_; ++v) {
+            row_ptr_[v+1] += row_ptr_[v];
+        }
+        index_t nnz = row_ptr_[nb_seeds_];
+        element_.resize(nnz);
+        measure_.resize(nnz);
+        moment_.resize(nnz * dimension_);
+
+        // Blocks are sorted, and cover consecutive rows.
+        parallel_for(
+            0, nb_blocks_,
+            [&](index_t b) {
+                const Block& M = merged_[b];
+                if(M.couplings.size() == 0) {
+                    return;
+                }
+                index_t k0 = row_ptr_[M.couplings[0].v];
+                for(index_t k=0; k<M.couplings.size(); ++k) {
+                    const Coupling& C = M.couplings[k];
+                    element_[k0+k] = C.t;
+                    measure_[k0+k] = C.m;
+                    for(index_t c=0; c<dimension_; ++c) {
+                        moment_[(k0+k)*dimension_+c] =
+                            M.moments[C.k*dimension_+c];
+                    }
+                }
+            }
+        );
+
+        for(Block& B: blocks_) {
+            B.couplings.clear();
+            B.moments.clear();
+        }
+    }
+
+    bool TransportPlan::save(const std::string& filename) const {
+        std::ofstream out(filename.c_str(), std::ios::binary);
+        if(!out) {
+            Logger::err("OTM") << "Could not create file " << filename
+                               << std::endl;
+            return false;
+        }
+        index_t header[4] = {
+            nb_seeds_, nb_elements_, nb_couplings(), dimension_
+        };
+        out.write(transport_plan_magic, sizeof(transport_plan_magic));
+        out.write(reinterpret_cast<const char*>(header), sizeof(header));
+        write_array(out, row_ptr_);
+        write_array(out, element_);
+        write_array(out, measure_);
+        write_array(out, moment_);
+        if(!out) {
+            Logger::err("OTM") << "Error while writing " << filename
+                               << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    bool TransportPlan::load(const std::string& filename) {
+        clear();
+        std::ifstream in(
+            filename.c_str(), std::ios::binary | std::ios::ate
+        );
+        if(!in) {
+            Logger::err("OTM") << "Could not open file " << filename
+                               << std::endl;
+            return false;
+        }
+        Numeric::uint64 size = Numeric::uint64(in.tellg());
+        in.seekg(0);
+        char magic[sizeof(transport_plan_magic)];
+        index_t header[4];
+        in.read(magic, sizeof(magic));
+        in.read(reinterpret_cast<char*>(header), sizeof(header));
+        if(
+            !in ||
+            std::memcmp(magic, transport_plan_magic, sizeof(magic)) != 0
+        ) {
+            Logger::err("OTM") << filename << ": not a transport plan file"
+                               << std::endl;
+            return false;
+        }
+
+        // Check the sizes in the header against the size of the file
+        // before allocating anything. The moments are tested first, so
+        // that the expected size cannot overflow.
+        Numeric::uint64 nb_seeds = header[0];
+        Numeric::uint64 nnz = header[2];
+        Numeric::uint64 dim = header[3];
+        if(dim != 0 && nnz > size / sizeof(double) / dim) {
+            Logger::err("OTM") << filename << ": truncated or corrupted"
+                               << std::endl;
+            return false;
+        }
+        Numeric::uint64 expected_size =
+            sizeof(magic) + sizeof(header) +
+            (nb_seeds + 1) * sizeof(index_t) +
+            nnz * (sizeof(index_t) + sizeof(double)) +
+            nnz * dim * sizeof(double);
+        if(size != expected_size) {
+            Logger::err("OTM") << filename << ": truncated or corrupted"
+                               << std::endl;
+            return false;
+        }
+
+        nb_seeds_ = header[0];
+        nb_elements_ = header[1];
+        dimension_ = header[3];
+        row_ptr_.resize(nb_seeds_+1);
+        element_.resize(header[2]);
+        measure_.resize(header[2]);
+        moment_.resize(header[2] * dimension_);
+        read_array(in, row_ptr_);
+        read_array(in, element_);
+        read_array(in, measure_);
+        read_array(in, moment_);
+
+        // The accessors trust the CSR structure.
+        bool ok =
+            !in.fail() &&
+            row_ptr_[0] == 0 && row_ptr_[nb_seeds_] == header[2];
+        for(index_t v=0; ok && v<nb_seeds_; ++v) {
+            ok = (row_ptr_[v] <= row_ptr_[v+1]);
+        }
+        for(index_t k=0; ok && k<element_.size(); ++k) {
+            ok = (element_[k] < nb_elements_);
+        }
+        if(!ok) {
+            Logger::err("OTM") << filename << ": truncated or corrupted"
+                               << std::endl;
+            clear();
+            return false;
+        }
+        return true;
+    }
+}
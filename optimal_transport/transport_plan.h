@@ -0,0 +1,303 @@
+/*
+ *  Copyright (c) 2000-2022 Inria
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *  this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *  * Neither the name of the ALICE Project-Team nor the names of its
+ *  contributors may be used to endorse or promote products derived from this
+ *  software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  Contact: Bruno Levy
+ *
+ *     https://www.inria.fr/fr/bruno-levy
+ *
+ *     Inria,
+ *     Domaine de Voluceau,
+ *     78150 Le Chesnay - Rocquencourt
+ *     FRANCE
+ *
+ */
+
+#ifndef H_EXPLORAGRAM_OPTIMAL_TRANSPORT_TRANSPORT_PLAN_H
+#define H_EXPLORAGRAM_OPTIMAL_TRANSPORT_TRANSPORT_PLAN_H
+
+#include <exploragram/basic/common.h>
+#include <string>
+
+/**
+ * \file exploragram/optimal_transport/transport_plan.h
+ * \brief Sparse representation of a semi-discrete transport plan.
+ */
+
+namespace GEO {
+
+    /**
+     * \brief The transport plan of a semi-discrete optimal transport
+     *  map, stored as a sparse matrix.
+     * \details Row v corresponds to seed v, and column t to element t
+     *  of the background mesh (tetrahedron, triangle or pixel). The
+     *  coefficient is the measure of the intersection between the
+     *  Laguerre cell of v and t. Rows are stored in compressed sparse
+     *  row (CSR) format, and columns are sorted in each row. Optionally,
+     *  the first moment of each intersection (its measure times its
+     *  centroid) is stored as well.
+     *
+     *  The plan is assembled during the traversal of the restricted
+     *  Laguerre diagram: each thread appends its contributions to its
+     *  own buffers (add()), and end_assembly() merges them in parallel.
+     */
+    class EXPLORAGRAM_API TransportPlan {
+    public:
+        /**
+         * \brief TransportPlan constructor.
+         */
+        TransportPlan();
+
+        /**
+         * \brief Clears this TransportPlan.
+         */
+        void clear();
+
+        /**
+         * \brief Gets the number of seeds.
+         * \return the number of rows
+         */
+        index_t nb_seeds() const {
+            return nb_seeds_;
+        }
+
+        /**
+         * \brief Gets the number of background elements.
+         * \return the number of columns
+         */
+        index_t nb_elements() const {
+            return nb_elements_;
+        }
+
+        /**
+         * \brief Gets the number of non-empty intersections between
+         *  a Laguerre cell and a background element.
+         * \return the number of non-zero coefficients
+         */
+        index_t nb_couplings() const {
+            return element_.size();
+        }
+
+        /**
+         * \brief Gets the dimension of the first moments.
+         * \return the number of coordinates of the first moments, or 0
+         *  if they are not stored
+         */
+        index_t dimension() const {
+            return dimension_;
+        }
+
+        /**
+         * \brief Tests whether the first moments are stored.
+         * \retval true if the first moments are stored
+         * \retval false otherwise
+         */
+        bool has_moments() const {
+            return (dimension_ != 0);
+        }
+
+        /**
+         * \brief Gets the first coupling of a seed.
+         * \param[in] v the seed
+         * \return the index of the first coupling of \p v
+         */
+        index_t row_begin(index_t v) const {
+            geo_debug_assert(v < nb_seeds_);
+            return row_ptr_[v];
+        }
+
+        /**
+         * \brief Gets one position past the last coupling of a seed.
+         * \param[in] v the seed
+         * \return one position past the index of the last
+         *  coupling of \p v
+         */
+        index_t row_end(index_t v) const {
+            geo_debug_assert(v < nb_seeds_);
+            return row_ptr_[v+1];
+        }
+
+        /**
+         * \brief Gets the background element of a coupling.
+         * \param[in] k the coupling, in 0..nb_couplings()-1
+         * \return the index of the background element
+         */
+        index_t element(index_t k) const {
+            geo_debug_assert(k < nb_couplings());
+            return element_[k];
+        }
+
+        /**
+         * \brief Gets the measure of a coupling.
+         * \param[in] k the coupling, in 0..nb_couplings()-1
+         * \return the (possibly weighted) measure of the intersection
+         *  between the Laguerre cell and the background element
+         */
+        double measure(index_t k) const {
+            geo_debug_assert(k < nb_couplings());
+            return measure_[k];
+        }
+
+        /**
+         * \brief Gets the first moment of a coupling.
+         * \param[in] k the coupling, in 0..nb_couplings()-1
+         * \return a pointer to the dimension() coordinates of the measure
+         *  times the centroid of the intersection
+         * \pre has_moments()
+         */
+        const double* moment(index_t k) const {
+            geo_debug_assert(has_moments());
+            geo_debug_assert(k < nb_couplings());
+            return &moment_[k * dimension_];
+        }
+
+        /**
+         * \brief Saves this TransportPlan to a binary file.
+         * \details The file stores the sizes, then the arrays of the CSR
+         *  structure, as 32 bits integers and doubles in the byte order
+         *  of the machine.
+         * \param[in] filename the name of the file
+         * \retval true on success
+         * \retval false otherwise
+         */
+        bool save(const std::string& filename) const;
+
+        /**
+         * \brief Loads this TransportPlan from a binary file.
+         * \details The sizes stored in the file are checked against its
+         *  length before anything is allocated, and the CSR structure is
+         *  checked after reading.
+         * \param[in] filename the name of a file written by save()
+         * \retval true on success
+         * \retval false otherwise. Then this TransportPlan is cleared.
+         */
+        bool load(const std::string& filename);
+
+        /**
+         * \brief Starts a new assembly.
+         * \details Previous contents are discarded.
+         * \param[in] nb_threads the maximum number of threads that
+         *  will call add()
+         * \param[in] nb_seeds the number of seeds
+         * \param[in] nb_elements the number of background elements
+         * \param[in] dim the dimension of the first moments, or 0 if
+         *  they are not stored
+         */
+        void begin_assembly(
+            index_t nb_threads, index_t nb_seeds, index_t nb_elements,
+            index_t dim = 0
+        );
+
+        /**
+         * \brief Adds a contribution to a coupling.
+         * \details Several contributions to the same coupling are summed.
+         * \param[in] thread the id of the current thread
+         * \param[in] v the seed
+         * \param[in] t the background element
+         * \param[in] m the measure to be added
+         * \param[in] mg a pointer to the dimension() coordinates of the
+         *  first moment to be added. Ignored if has_moments() is false.
+         */
+        void add(
+            index_t thread, index_t v, index_t t, double m,
+            const double* mg = nullptr
+        ) {
+            geo_debug_assert(t < nb_elements_);
+            Coupling C;
+            C.v = v;
+            C.t = t;
+            C.m = m;
+            C.k = 0;
+            Block& B = block(thread, v);
+            B.couplings.push_back(C);
+            if(dimension_ != 0) {
+                geo_debug_assert(mg != nullptr);
+                for(index_t c=0; c<dimension_; ++c) {
+                    B.moments.push_back(mg[c]);
+                }
+            }
+        }
+
+        /**
+         * \brief Merges the contributions of all threads and
+         *  builds the CSR structure.
+         */
+        void end_assembly();
+
+    protected:
+        /**
+         * \brief A contribution to a coefficient.
+         * \details k is the index of the first moment in the Block
+         *  (only used when merging).
+         */
+        struct Coupling {
+            index_t v;
+            index_t t;
+            double m;
+            index_t k;
+        };
+
+        /**
+         * \brief The contributions to a block of rows.
+         * \details The first moments are stored in the same order
+         *  as the couplings.
+         */
+        struct Block {
+            vector<Coupling> couplings;
+            vector<double> moments;
+        };
+
+        /**
+         * \brief Gets the buffer of a thread for a row.
+         * \param[in] thread the id of the thread
+         * \param[in] v the row
+         * \return a reference to the buffer
+         */
+        Block& block(index_t thread, index_t v) {
+            geo_debug_assert(thread < nb_threads_);
+            geo_debug_assert(v < nb_seeds_);
+            return blocks_[thread * nb_blocks_ + v / block_size_];
+        }
+
+    private:
+        index_t nb_seeds_;
+        index_t nb_elements_;
+        index_t dimension_;
+        vector<index_t> row_ptr_;
+        vector<index_t> element_;
+        vector<double> measure_;
+        vector<double> moment_;
+
+        index_t nb_threads_;
+        index_t nb_blocks_;
+        index_t block_size_;
+        vector<Block> blocks_;
+        vector<Block> merged_;
+    };
+}
+
+#endif
@@ -0,0 +1,154 @@
+/*
+ *  Copyright (c) 2000-2022 Inria
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *  this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *  * Neither the name of the ALICE Project-Team nor the names of its
+ *  contributors may be used to endorse or promote products derived from this
+ *  software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  Contact: Bruno Levy
+ *
+ *     https://www.inria.fr/fr/bruno-levy
+ *
+ *     Inria,
+ *     Domaine de Voluceau,
+ *     78150 Le Chesnay - Rocquencourt
+ *     FRANCE
+ *
+ */
+
+#include <exploragram/optimal_transport/transport_target.h>
+#include <geogram/mesh/mesh.h>
+#include <geogram/mesh/mesh_AABB.h>
+#include <geogram/mesh/mesh_geometry.h>
+#include <geogram/basic/geometry.h>
+#include <geogram/basic/process.h>
+#include <geogram/basic/logger.h>
+
+namespace GEO {
+
+    OptimalTransportTarget::OptimalTransportTarget(
+        Mesh* mesh, index_t dimension, bool AABB
+    ) :
+        mesh_(mesh),
+        dimension_(dimension),
+        volumetric_(mesh->cells.nb() != 0),
+        weighted_(mesh->vertices.attributes().is_defined("weight")),
+        nb_elements_(volumetric_ ? mesh->cells.nb() : mesh->facets.nb()),
+        total_mass_(0.0),
+        cells_AABB_(nullptr) {
+
+        geo_assert(dimension_ == 2 || dimension_ == 3);
+        // Mesh is supposed to be embedded in d+1 dim (with
+        // (d+1-th dimension set to zero).
+        geo_assert(mesh_->vertices.dimension() == dimension_ + 1);
+        geo_assert(!volumetric_ || dimension_ == 3);
+
+        compute_masses();
+
+        // get_bbox() works on the first three coordinates, in 2d the
+        // third one is zero.
+        GEO::get_bbox(*mesh_, xyz_min_, xyz_max_);
+
+        //   The elements are not reordered, so that their indices
+        // remain the ones seen by the OptimalTransportMap objects
+        // (transport plan, restricted Voronoi diagram).
+        if(AABB && volumetric_) {
+            cells_AABB_ = new MeshCellsAABB(*mesh_, false);
+        }
+
+        Logger::out("OTM") << "Transport target: "
+                           << nb_elements()
+                           << (volumetric_ ? " tets" : " triangles")
+                           << ", total mass=" << total_mass_
+                           << std::endl;
+    }
+
+    OptimalTransportTarget::~OptimalTransportTarget() {
+        delete cells_AABB_;
+        cells_AABB_ = nullptr;
+    }
+
+    void OptimalTransportTarget::compute_masses() {
+        //   This is terribly confusing, the parameters for
+        // a power diagram are called "weights", and the
+        // standard attribute name for vertices density is
+        // also called "weight" (and is unrelated).
+        //   In this program, what is called weight corresponds
+        // to the parameters of the power diagram (except the
+        // name of the attribute), and everything that corresponds
+        // to mass/density is called mass.
+        Attribute<double> vertex_mass;
+        vertex_mass.bind_if_is_defined(
+            mesh_->vertices.attributes(), "weight"
+        );
+
+        const Mesh& M = *mesh_;
+        vector<double> element_mass(nb_elements_);
+        if(volumetric_) {
+            parallel_for(0, M.cells.nb(), [&](index_t t) {
+                double tet_mass = GEO::Geom::tetra_volume<3>(
+                    M.vertices.point_ptr(M.cells.tet_vertex(t, 0)),
+                    M.vertices.point_ptr(M.cells.tet_vertex(t, 1)),
+                    M.vertices.point_ptr(M.cells.tet_vertex(t, 2)),
+                    M.vertices.point_ptr(M.cells.tet_vertex(t, 3))
+                );
+                if(vertex_mass.is_bound()) {
+                    tet_mass *= (
+                        vertex_mass[M.cells.tet_vertex(t, 0)] +
+                        vertex_mass[M.cells.tet_vertex(t, 1)] +
+                        vertex_mass[M.cells.tet_vertex(t, 2)] +
+                        vertex_mass[M.cells.tet_vertex(t, 3)]
+                    ) / 4.0;
+                }
+                element_mass[t] = tet_mass;
+            });
+        } else {
+            parallel_for(0, M.facets.nb(), [&](index_t f) {
+                const double* p1 = M.vertices.point_ptr(M.facets.vertex(f,0));
+                const double* p2 = M.vertices.point_ptr(M.facets.vertex(f,1));
+                const double* p3 = M.vertices.point_ptr(M.facets.vertex(f,2));
+                double tri_mass = (dimension_ == 2) ?
+                    GEO::Geom::triangle_area(vec2(p1), vec2(p2), vec2(p3)) :
+                    GEO::Geom::triangle_area(vec3(p1), vec3(p2), vec3(p3)) ;
+                if(vertex_mass.is_bound()) {
+                    tri_mass *= (
+                        vertex_mass[M.facets.vertex(f, 0)] +
+                        vertex_mass[M.facets.vertex(f, 1)] +
+                        vertex_mass[M.facets.vertex(f, 2)]
+                    ) / 3.0;
+                }
+                element_mass[f] = tri_mass;
+            });
+        }
+
+        // Summed sequentially, in the same order as the
+        // total_mesh_mass() functions of the OptimalTransportMap
+        // classes, so that the result does not depend on the number
+        // of threads.
+        total_mass_ = 0.0;
+        for(index_t e=0; e<nb_elements_; ++e) {
+            total_mass_ += element_mass[e];
+        }
+    }
+}
@@ -0,0 +1,202 @@
+/*
+ *  Copyright (c) 2000-2022 Inria
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *  this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *  * Neither the name of the ALICE Project-Team nor the names of its
+ *  contributors may be used to endorse or promote products derived from this
+ *  software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  Contact: Bruno Levy
+ *
+ *     https://www.inria.fr/fr/bruno-levy
+ *
+ *     Inria,
+ *     Domaine de Voluceau,
+ *     78150 Le Chesnay - Rocquencourt
+ *     FRANCE
+ *
+ */
+
+#ifndef H_EXPLORAGRAM_OPTIMAL_TRANSPORT_TRANSPORT_TARGET_H
+#define H_EXPLORAGRAM_OPTIMAL_TRANSPORT_TRANSPORT_TARGET_H
+
+#include <exploragram/basic/common.h>
+#include <geogram/basic/counted.h>
+#include <geogram/basic/smart_pointer.h>
+#include <geogram/basic/memory.h>
+
+/**
+ * \file exploragram/optimal_transport/transport_target.h
+ * \brief The background mesh of semi-discrete optimal transport,
+ *  shared by several OptimalTransportMap objects.
+ */
+
+namespace GEO {
+
+    class Mesh;
+    class MeshCellsAABB;
+
+    /**
+     * \brief The background mesh of semi-discrete optimal transport,
+     *  with everything that depends only on it.
+     * \details When optimal transport is computed from many point sets
+     *  to the same mesh (for instance one point set per frame, or an
+     *  ensemble of point sets), the total mass, the bounding box and
+     *  the spatial search structure are computed once in an
+     *  OptimalTransportTarget, and referenced by all the
+     *  OptimalTransportMap objects. Once constructed, an
+     *  OptimalTransportTarget is never modified, thus it can be used
+     *  by maps optimized concurrently in different threads. The mesh
+     *  should not be modified during the lifetime of this object.
+     */
+    class EXPLORAGRAM_API OptimalTransportTarget : public Counted {
+    public:
+        /**
+         * \brief OptimalTransportTarget constructor.
+         * \param[in] mesh the background mesh, embedded in
+         *  dimension+1 dimensions (with the last coordinate set to
+         *  zero). If it has cells, they are tetrahedra and the
+         *  volumetric measure is used, else the facets are triangles
+         *  and the surfacic measure is used.
+         * \param[in] dimension 2 for 2d, 3 for 3d and for surfaces
+         *  in 3d
+         * \param[in] AABB if set and if the mesh is volumetric, a
+         *  bounding volume hierarchy of the tetrahedra is created,
+         *  see cells_AABB()
+         */
+        OptimalTransportTarget(
+            Mesh* mesh, index_t dimension, bool AABB = true
+        );
+
+        /**
+         * \brief OptimalTransportTarget destructor.
+         */
+        ~OptimalTransportTarget() override;
+
+        /**
+         * \brief Gets the mesh.
+         * \return a pointer to the background mesh
+         */
+        Mesh* mesh() const {
+            return mesh_;
+        }
+
+        /**
+         * \brief Gets the dimension.
+         * \return 2 for 2d, 3 for 3d and surfaces in 3d
+         */
+        index_t dimension() const {
+            return dimension_;
+        }
+
+        /**
+         * \brief Tests whether the mesh is volumetric.
+         * \retval true if the elements are the tetrahedra of the mesh
+         * \retval false if the elements are the triangles of the mesh
+         */
+        bool volumetric() const {
+            return volumetric_;
+        }
+
+        /**
+         * \brief Tests whether the mesh has a varying density.
+         * \details The density is the vertex attribute named "weight".
+         * \retval true if the masses are weighted by the density
+         * \retval false otherwise
+         */
+        bool weighted() const {
+            return weighted_;
+        }
+
+        /**
+         * \brief Gets the number of elements.
+         * \return the number of tetrahedra if the mesh is volumetric,
+         *  else the number of triangles
+         */
+        index_t nb_elements() const {
+            return nb_elements_;
+        }
+
+        /**
+         * \brief Gets the total mass of the mesh.
+         * \details The mass of an element is its volume or its area,
+         *  multiplied by the average density of its vertices in weighted
+         *  mode.
+         * \return the sum of the masses of all the elements
+         */
+        double total_mass() const {
+            return total_mass_;
+        }
+
+        /**
+         * \brief Gets the bounding box of the mesh.
+         * \param[out] xyz_min , xyz_max pointers to dimension() doubles
+         */
+        void get_bbox(double* xyz_min, double* xyz_max) const {
+            for(index_t c=0; c<dimension_; ++c) {
+                xyz_min[c] = xyz_min_[c];
+                xyz_max[c] = xyz_max_[c];
+            }
+        }
+
+        /**
+         * \brief Gets the bounding volume hierarchy of the tetrahedra.
+         * \return a const pointer to the MeshCellsAABB, or nullptr if
+         *  the mesh is not volumetric or if it was not requested at
+         *  construction
+         */
+        const MeshCellsAABB* cells_AABB() const {
+            return cells_AABB_;
+        }
+
+    private:
+        /**
+         * \brief Computes the total mass.
+         */
+        void compute_masses();
+
+        /** \brief Forbids copy. */
+        OptimalTransportTarget(const OptimalTransportTarget& rhs);
+
+        /** \brief Forbids copy. */
+        OptimalTransportTarget& operator=(const OptimalTransportTarget& rhs);
+
+    private:
+        Mesh* mesh_;
+        index_t dimension_;
+        bool volumetric_;
+        bool weighted_;
+        index_t nb_elements_;
+        double total_mass_;
+        double xyz_min_[3];
+        double xyz_max_[3];
+        MeshCellsAABB* cells_AABB_;
+    };
+
+    /**
+     * \brief Smart pointer to an OptimalTransportTarget.
+     */
+    typedef SmartPointer<OptimalTransportTarget> OptimalTransportTarget_var;
+}
+
+#endif
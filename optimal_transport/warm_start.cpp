@@ -0,0 +1,114 @@
+/*
+ *  Copyright (c) 2000-2022 Inria
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *  this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *  * Neither the name of the ALICE Project-Team nor the names of its
+ *  contributors may be used to endorse or promote products derived from this
+ *  software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  Contact: Bruno Levy
+ *
+ *     https://www.inria.fr/fr/bruno-levy
+ *
+ *     Inria,
+ *     Domaine de Voluceau,
+ *     78150 Le Chesnay - Rocquencourt
+ *     FRANCE
+ *
+ */
+
+#include <exploragram/optimal_transport/warm_start.h>
+#include <exploragram/optimal_transport/optimal_transport.h>
+#include <geogram/basic/logger.h>
+
+namespace GEO {
+
+    OTWarmStart::OTWarmStart() : extrapolate_(false), check_(true) {
+    }
+
+    void OTWarmStart::clear() {
+        w_.clear();
+        w_prev_.clear();
+        check_ = true;
+    }
+
+    void OTWarmStart::set_weights(index_t n, const double* w, bool check) {
+        w_.assign(w, w+n);
+        w_prev_.clear();
+        check_ = check;
+    }
+
+    void OTWarmStart::begin(OptimalTransportMap& OTM) {
+        index_t n = OTM.nb_points();
+        if(w_.size() != n) {
+            clear();
+            return;
+        }
+
+        if(!check_) {
+            // Weights specified explicitly by the caller.
+            check_ = true;
+            for(index_t i=0; i<n; ++i) {
+                OTM.set_initial_weight(i, w_[i]);
+            }
+            return;
+        }
+
+        if(extrapolate_ && w_prev_.size() == n) {
+            vector<double> w(n);
+            for(index_t i=0; i<n; ++i) {
+                w[i] = 2.0 * w_[i] - w_prev_[i];
+            }
+            if(!OTM.has_hidden_points(w.data())) {
+                for(index_t i=0; i<n; ++i) {
+                    OTM.set_initial_weight(i, w[i]);
+                }
+                return;
+            }
+        }
+
+        if(!OTM.has_hidden_points(w_.data())) {
+            for(index_t i=0; i<n; ++i) {
+                OTM.set_initial_weight(i, w_[i]);
+            }
+            return;
+        }
+
+        Logger::warn("OTM") << "Previous weights have hidden points, "
+                            << "not using them" << std::endl;
+    }
+
+    void OTWarmStart::end(const OptimalTransportMap& OTM) {
+        if(OTM.nb_empty_cells() != 0) {
+            Logger::warn("OTM") << "Solve ended with empty cells, "
+                                << "not keeping the weights" << std::endl;
+            clear();
+            return;
+        }
+        w_prev_.swap(w_);
+        w_.resize(OTM.nb_points());
+        for(index_t i=0; i<OTM.nb_points(); ++i) {
+            w_[i] = OTM.weight(i);
+        }
+    }
+}
@@ -0,0 +1,145 @@
+/*
+ *  Copyright (c) 2000-2022 Inria
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *  this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *  * Neither the name of the ALICE Project-Team nor the names of its
+ *  contributors may be used to endorse or promote products derived from this
+ *  software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  Contact: Bruno Levy
+ *
+ *     https://www.inria.fr/fr/bruno-levy
+ *
+ *     Inria,
+ *     Domaine de Voluceau,
+ *     78150 Le Chesnay - Rocquencourt
+ *     FRANCE
+ *
+ */
+
+#ifndef H_EXPLORAGRAM_OPTIMAL_TRANSPORT_WARM_START_H
+#define H_EXPLORAGRAM_OPTIMAL_TRANSPORT_WARM_START_H
+
+#include <exploragram/basic/common.h>
+
+/**
+ * \file exploragram/optimal_transport/warm_start.h
+ * \brief Reuses the weights of semi-discrete optimal transport
+ *  across a sequence of similar problems.
+ */
+
+namespace GEO {
+    class OptimalTransportMap;
+
+    /**
+     * \brief Keeps the weights computed by an OptimalTransportMap
+     *  to start the next solve from them.
+     * \details Typically used by time-dependent simulations, where
+     *  points move a little bit between two consecutive time steps.
+     *  The initial weights can be optionally extrapolated linearly
+     *  from the two previous solutions. A candidate starting point is
+     *  only used if no point is hidden in its regular triangulation
+     *  (else the Newton solver cannot start), and the default initial
+     *  weights are kept otherwise. This test does not compute the
+     *  Laguerre cells. If the first evaluation of the Newton solver
+     *  finds empty cells, it starts from the default weights instead.
+     *  Weights that still have empty cells at the end of a solve are
+     *  not stored.
+     */
+    class EXPLORAGRAM_API OTWarmStart {
+    public:
+        /**
+         * \brief OTWarmStart constructor.
+         */
+        OTWarmStart();
+
+        /**
+         * \brief Specifies whether weights should be extrapolated.
+         * \param[in] x if true, the next solve starts from
+         *  \f$ 2 w_k - w_{k-1} \f$, else it starts from \f$ w_k \f$.
+         */
+        void set_extrapolate(bool x) {
+            extrapolate_ = x;
+        }
+
+        /**
+         * \brief Forgets the previous weights.
+         */
+        void clear();
+
+        /**
+         * \brief Specifies the weights to be used by the next solve.
+         * \details The weights of the solve before are forgotten.
+         * \param[in] n number of weights
+         * \param[in] w a pointer to \p n weights
+         * \param[in] check if true (default), the weights are only used
+         *  if no point is hidden, else they are used unconditionally by
+         *  the next solve
+         */
+        void set_weights(index_t n, const double* w, bool check = true);
+
+        /**
+         * \brief Gets the number of stored weights.
+         * \return the number of points of the latest solve, or 0
+         *  if there was no solve.
+         */
+        index_t nb_weights() const {
+            return w_.size();
+        }
+
+        /**
+         * \brief Gets the stored weights.
+         * \return a pointer to the nb_weights() weights of the
+         *  latest solve
+         */
+        const double* weights() const {
+            return w_.data();
+        }
+
+        /**
+         * \brief Initializes the weights of an OptimalTransportMap.
+         * \details Needs to be called after OptimalTransportMap::set_points()
+         *  and before OptimalTransportMap::optimize(). Nothing is done if
+         *  the number of points changed.
+         * \param[in] OTM the OptimalTransportMap
+         */
+        void begin(OptimalTransportMap& OTM);
+
+        /**
+         * \brief Stores the weights computed by an OptimalTransportMap.
+         * \details Needs to be called after OptimalTransportMap::optimize().
+         *  If the solve ended with empty cells, the weights are forgotten,
+         *  and the next solve starts from the default weights.
+         * \param[in] OTM the OptimalTransportMap
+         */
+        void end(const OptimalTransportMap& OTM);
+
+    private:
+        bool extrapolate_;
+        bool check_;
+        vector<double> w_;
+        vector<double> w_prev_;
+    };
+}
+
+#endif
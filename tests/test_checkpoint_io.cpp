@@ -0,0 +1,236 @@
+/*
+ *  Copyright (c) 2000-2022 Inria
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *  this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *  * Neither the name of the ALICE Project-Team nor the names of its
+ *  contributors may be used to endorse or promote products derived from this
+ *  software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  Contact: Bruno Levy
+ *
+ *     https://www.inria.fr/fr/bruno-levy
+ *
+ *     Inria,
+ *     Domaine de Voluceau,
+ *     78150 Le Chesnay - Rocquencourt
+ *     FRANCE
+ *
+ */
+
+/*
+ * Round-trip test of OTCheckpoint::save() and OTCheckpoint::load(),
+ * and rejection of truncated and corrupted files.
+ *
+ * Usage: test_checkpoint_io [filename]
+ */
+
+#include <exploragram/optimal_transport/checkpoint.h>
+#include <geogram/basic/logger.h>
+
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <cstdio>
+
+namespace {
+    using namespace GEO;
+
+    /**
+     * \brief Logs an error if a condition is not satisfied.
+     * \param[in] condition the condition
+     * \param[in] what a description of the condition
+     * \return \p condition
+     */
+    bool check(bool condition, const std::string& what) {
+        if(!condition) {
+            Logger::err("Test") << "failed: " << what << std::endl;
+        }
+        return condition;
+    }
+
+    /**
+     * \brief Creates an OTCheckpoint with all the fields set.
+     * \param[out] C the OTCheckpoint
+     */
+    void create_checkpoint(OTCheckpoint& C) {
+        C.dimension = 3;
+        C.level = 2;
+        C.iteration = 5;
+        C.current_iter = 17;
+        C.nb_linsolve_iter = 1234;
+        C.first_inner_iter = 1;
+        C.epsilon0 = 0.125;
+        C.forcing_term = 1e-3;
+        C.prev_g_norm = 2.5e-4;
+        C.g_norm = 1.25e-4;
+        C.weights.resize(10);
+        for(index_t i=0; i<C.weights.size(); ++i) {
+            C.weights[i] = 0.1 * double(i) - 0.3;
+        }
+        C.direction.resize(6);
+        for(index_t i=0; i<C.direction.size(); ++i) {
+            C.direction[i] = 1.0 / double(i+1);
+        }
+    }
+
+    /**
+     * \brief Tests whether two OTCheckpoints are the same.
+     * \param[in] A , B the two OTCheckpoints
+     * \retval true if all the fields of \p A and \p B are equal
+     * \retval false otherwise
+     */
+    bool same_checkpoints(const OTCheckpoint& A, const OTCheckpoint& B) {
+        return
+            A.dimension == B.dimension &&
+            A.level == B.level &&
+            A.iteration == B.iteration &&
+            A.current_iter == B.current_iter &&
+            A.nb_linsolve_iter == B.nb_linsolve_iter &&
+            A.first_inner_iter == B.first_inner_iter &&
+            A.epsilon0 == B.epsilon0 &&
+            A.forcing_term == B.forcing_term &&
+            A.prev_g_norm == B.prev_g_norm &&
+            A.g_norm == B.g_norm &&
+            A.weights == B.weights &&
+            A.direction == B.direction;
+    }
+
+    /**
+     * \brief Reads a file.
+     * \param[in] filename the name of the file
+     * \return the contents of the file
+     */
+    std::string read_file(const std::string& filename) {
+        std::ifstream in(filename.c_str(), std::ios::binary);
+        return std::string(
+            std::istreambuf_iterator<char>(in),
+            std::istreambuf_iterator<char>()
+        );
+    }
+
+    /**
+     * \brief Tests a save() / load() round trip, and the same round
+     *  trip with load_from_memory().
+     * \param[in] filename the name of the temporary file
+     * \retval true if the test passed
+     * \retval false otherwise
+     */
+    bool test_round_trip(const std::string& filename) {
+        OTCheckpoint C;
+        create_checkpoint(C);
+        OTCheckpoint loaded;
+        bool ok = check(C.save(filename), "save()");
+        ok = ok && check(loaded.load(filename), "load()");
+        ok = ok && check(same_checkpoints(C, loaded), "round trip");
+
+        std::string data = read_file(filename);
+        OTCheckpoint from_memory;
+        ok = ok && check(
+            from_memory.load_from_memory(data.data(), data.size()),
+            "load_from_memory()"
+        );
+        ok = ok && check(
+            same_checkpoints(C, from_memory), "round trip in memory"
+        );
+
+        // An empty checkpoint has no arrays.
+        OTCheckpoint empty;
+        ok = ok && check(empty.save(filename), "save() empty");
+        ok = ok && check(loaded.load(filename), "load() empty");
+        ok = ok && check(same_checkpoints(empty, loaded), "empty round trip");
+        return ok;
+    }
+
+    /**
+     * \brief Tests that truncated and corrupted files are rejected.
+     * \param[in] filename the name of the temporary file
+     * \retval true if the test passed
+     * \retval false otherwise
+     */
+    bool test_invalid_files(const std::string& filename) {
+        OTCheckpoint C;
+        create_checkpoint(C);
+        if(!check(C.save(filename), "save()")) {
+            return false;
+        }
+        std::string data = read_file(filename);
+        bool ok = true;
+        OTCheckpoint loaded;
+
+        // Truncated arrays, truncated header
+        ok = check(
+            !loaded.load_from_memory(data.data(), data.size() - 8),
+            "truncated arrays"
+        ) && ok;
+        ok = check(loaded.weights.size() == 0, "cleared on error") && ok;
+        ok = check(
+            !loaded.load_from_memory(data.data(), 40), "truncated header"
+        ) && ok;
+
+        // Huge array sizes in the header (8 bytes of magic, then
+        // dimension, nb_weights, nb_direction, ...)
+        index_t huge = index_t(-1);
+        for(index_t i=1; i<3; ++i) {
+            std::string corrupted = data;
+            corrupted.replace(
+                8 + i*sizeof(index_t), sizeof(index_t),
+                reinterpret_cast<const char*>(&huge), sizeof(index_t)
+            );
+            ok = check(
+                !loaded.load_from_memory(
+                    corrupted.data(), corrupted.size()
+                ),
+                "corrupted sizes"
+            ) && ok;
+        }
+
+        // Wrong magic
+        std::string corrupted = data;
+        corrupted[0] = 'X';
+        ok = check(
+            !loaded.load_from_memory(corrupted.data(), corrupted.size()),
+            "wrong magic"
+        ) && ok;
+        return ok;
+    }
+}
+
+int main(int argc, char** argv) {
+    using namespace GEO;
+
+    GEO::initialize();
+
+    std::string filename =
+        (argc > 1) ? argv[1] : "test_checkpoint_io.otckpt";
+
+    bool ok = true;
+    ok = test_round_trip(filename) && ok;
+    ok = test_invalid_files(filename) && ok;
+    std::remove(filename.c_str());
+
+    if(!ok) {
+        return 1;
+    }
+    Logger::out("Test") << "OTCheckpoint I/O: OK" << std::endl;
+    return 0;
+}
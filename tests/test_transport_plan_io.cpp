@@ -0,0 +1,244 @@
+/*
+ *  Copyright (c) 2000-2022 Inria
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *  this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright notice,
+ *  this list of conditions and the following disclaimer in the documentation
+ *  and/or other materials provided with the distribution.
+ *  * Neither the name of the ALICE Project-Team nor the names of its
+ *  contributors may be used to endorse or promote products derived from this
+ *  software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  Contact: Bruno Levy
+ *
+ *     https://www.inria.fr/fr/bruno-levy
+ *
+ *     Inria,
+ *     Domaine de Voluceau,
+ *     78150 Le Chesnay - Rocquencourt
+ *     FRANCE
+ *
+ */
+
+/*
+ * Round-trip test of TransportPlan::save() and TransportPlan::load(),
+ * and rejection of truncated and corrupted files.
+ *
+ * Usage: test_transport_plan_io [filename]
+ */
+
+#include <exploragram/optimal_transport/transport_plan.h>
+#include <geogram/basic/logger.h>
+
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <cstdio>
+
+namespace {
+    using namespace GEO;
+
+    /**
+     * \brief Logs an error if a condition is not satisfied.
+     * \param[in] condition the condition
+     * \param[in] what a description of the condition
+     * \return \p condition
+     */
+    bool check(bool condition, const std::string& what) {
+        if(!condition) {
+            Logger::err("Test") << "failed: " << what << std::endl;
+        }
+        return condition;
+    }
+
+    /**
+     * \brief Creates a TransportPlan.
+     * \details Contributions are added by two threads, with duplicates,
+     *  and some seeds have no coupling.
+     * \param[out] plan the TransportPlan
+     * \param[in] dim the dimension of the first moments, or 0
+     */
+    void create_plan(TransportPlan& plan, index_t dim) {
+        const index_t nb_seeds = 5;
+        const index_t nb_elements = 7;
+        plan.begin_assembly(2, nb_seeds, nb_elements, dim);
+        for(index_t v=0; v<nb_seeds; v+=2) {
+            for(index_t t=v; t<nb_elements; t+=3) {
+                double mg[3] = { double(v), double(t), 0.5 };
+                plan.add(0, v, t, 1.0 + double(v*nb_elements+t), mg);
+                plan.add(1, v, t, 0.25, mg);
+            }
+        }
+        plan.end_assembly();
+    }
+
+    /**
+     * \brief Tests whether two TransportPlans are the same.
+     * \param[in] A , B the two TransportPlans
+     * \retval true if \p A and \p B have the same sizes and coefficients
+     * \retval false otherwise
+     */
+    bool same_plans(const TransportPlan& A, const TransportPlan& B) {
+        if(
+            A.nb_seeds() != B.nb_seeds() ||
+            A.nb_elements() != B.nb_elements() ||
+            A.nb_couplings() != B.nb_couplings() ||
+            A.dimension() != B.dimension()
+        ) {
+            return false;
+        }
+        for(index_t v=0; v<A.nb_seeds(); ++v) {
+            if(
+                A.row_begin(v) != B.row_begin(v) ||
+                A.row_end(v) != B.row_end(v)
+            ) {
+                return false;
+            }
+        }
+        for(index_t k=0; k<A.nb_couplings(); ++k) {
+            if(
+                A.element(k) != B.element(k) ||
+                A.measure(k) != B.measure(k)
+            ) {
+                return false;
+            }
+            for(index_t c=0; c<A.dimension(); ++c) {
+                if(A.moment(k)[c] != B.moment(k)[c]) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    /**
+     * \brief Reads a file.
+     * \param[in] filename the name of the file
+     * \return the contents of the file
+     */
+    std::string read_file(const std::string& filename) {
+        std::ifstream in(filename.c_str(), std::ios::binary);
+        return std::string(
+            std::istreambuf_iterator<char>(in),
+            std::istreambuf_iterator<char>()
+        );
+    }
+
+    /**
+     * \brief Writes a file.
+     * \param[in] filename the name of the file
+     * \param[in] data the contents of the file
+     */
+    void write_file(const std::string& filename, const std::string& data) {
+        std::ofstream out(filename.c_str(), std::ios::binary);
+        out.write(data.data(), std::streamsize(data.size()));
+    }
+
+    /**
+     * \brief Tests a save() / load() round trip.
+     * \param[in] filename the name of the temporary file
+     * \param[in] dim the dimension of the first moments, or 0
+     * \retval true if the test passed
+     * \retval false otherwise
+     */
+    bool test_round_trip(const std::string& filename, index_t dim) {
+        TransportPlan plan;
+        create_plan(plan, dim);
+        TransportPlan loaded;
+        bool ok = check(plan.save(filename), "save()");
+        ok = ok && check(loaded.load(filename), "load()");
+        ok = ok && check(same_plans(plan, loaded), "round trip");
+        return ok;
+    }
+
+    /**
+     * \brief Tests that truncated and corrupted files are rejected.
+     * \param[in] filename the name of the temporary file
+     * \retval true if the test passed
+     * \retval false otherwise
+     */
+    bool test_invalid_files(const std::string& filename) {
+        TransportPlan plan;
+        create_plan(plan, 3);
+        if(!check(plan.save(filename), "save()")) {
+            return false;
+        }
+        std::string data = read_file(filename);
+        bool ok = true;
+        TransportPlan loaded;
+
+        // Truncated arrays
+        write_file(filename, data.substr(0, data.size() - 8));
+        ok = check(!loaded.load(filename), "truncated file") && ok;
+        ok = check(loaded.nb_couplings() == 0, "cleared on error") && ok;
+
+        // Truncated header
+        write_file(filename, data.substr(0, 12));
+        ok = check(!loaded.load(filename), "truncated header") && ok;
+
+        // Huge sizes in the header (8 bytes of magic, then nb_seeds,
+        // nb_elements, nb_couplings, dimension). load() needs to fail
+        // before allocating anything.
+        const index_t sizes[3] = { 0, 2, 3 };
+        index_t huge = index_t(-1);
+        for(index_t i=0; i<3; ++i) {
+            std::string corrupted = data;
+            corrupted.replace(
+                8 + sizes[i]*sizeof(index_t), sizeof(index_t),
+                reinterpret_cast<const char*>(&huge), sizeof(index_t)
+            );
+            write_file(filename, corrupted);
+            ok = check(!loaded.load(filename), "corrupted sizes") && ok;
+        }
+
+        // Column out of range (nb_elements reduced to 1)
+        index_t one = 1;
+        std::string corrupted = data;
+        corrupted.replace(
+            8 + sizeof(index_t), sizeof(index_t),
+            reinterpret_cast<const char*>(&one), sizeof(index_t)
+        );
+        write_file(filename, corrupted);
+        ok = check(!loaded.load(filename), "element out of range") && ok;
+
+        return ok;
+    }
+}
+
+int main(int argc, char** argv) {
+    using namespace GEO;
+
+    GEO::initialize();
+
+    std::string filename =
+        (argc > 1) ? argv[1] : "test_transport_plan_io.otplan";
+
+    bool ok = true;
+    ok = test_round_trip(filename, 0) && ok;
+    ok = test_round_trip(filename, 3) && ok;
+    ok = test_invalid_files(filename) && ok;
+    std::remove(filename.c_str());
+
+    if(!ok) {
+        return 1;
+    }
+    Logger::out("Test") << "TransportPlan I/O: OK" << std::endl;
+    return 0;
+}